@@ -0,0 +1,173 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <err.h>
+#include <inttypes.h>
+#include <lib/console.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unittest.h>
+
+// Large enough for the non-temporal copy paths to kick in.
+static const size_t kBufSize = 1024 * 1024;
+
+// Guard bytes on either side of each copy, to catch over- and underruns.
+static const size_t kGuard = 64;
+
+static const uint8_t kGuardByte = 0xa5;
+
+static void fill_pattern(uint8_t* buf, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = static_cast<uint8_t>(seed >> 16);
+    }
+}
+
+// Every size up to kSmallSizes covers the unrolled size classes and the
+// switch to rep movs; the larger ones straddle the remaining boundaries.
+static const size_t kSmallSizes = 160;
+static const size_t kLargeSizes[] = {
+    255, 256, 257, 4095, 4096, 4097, 65535, 65536,
+    256 * 1024 - 1, 256 * 1024, 256 * 1024 + 1,
+    kBufSize - 2 * kGuard - 16,
+};
+static const size_t kNumTestSizes = kSmallSizes + 1 + countof(kLargeSizes);
+
+static size_t test_size(size_t i) {
+    return i <= kSmallSizes ? i : kLargeSizes[i - kSmallSizes - 1];
+}
+
+static bool check_guards(const uint8_t* buf, size_t offset, size_t len) {
+    for (size_t i = 0; i < offset; i++) {
+        if (buf[i] != kGuardByte)
+            return false;
+    }
+    for (size_t i = offset + len; i < offset + len + kGuard; i++) {
+        if (buf[i] != kGuardByte)
+            return false;
+    }
+    return true;
+}
+
+static bool memcpy_sizes(void* context) {
+    BEGIN_TEST;
+
+    uint8_t* src = static_cast<uint8_t*>(memalign(PAGE_SIZE, kBufSize));
+    uint8_t* dst = static_cast<uint8_t*>(memalign(PAGE_SIZE, kBufSize));
+    REQUIRE_NONNULL(src, "");
+    REQUIRE_NONNULL(dst, "");
+    fill_pattern(src, kBufSize, 1);
+
+    for (size_t i = 0; i < kNumTestSizes; i++) {
+        size_t len = test_size(i);
+        for (size_t align = 0; align < 16; align += 7) {
+            size_t dst_offset = kGuard + align;
+            size_t src_offset = kGuard + (align * 3) % 16;
+            memset(dst, kGuardByte, dst_offset + len + kGuard);
+
+            void* ret = memcpy(dst + dst_offset, src + src_offset, len);
+
+            EXPECT_EQ(dst + dst_offset, ret, "memcpy returns its destination");
+            EXPECT_EQ(0, memcmp(dst + dst_offset, src + src_offset, len), "memcpy data");
+            EXPECT_TRUE(check_guards(dst, dst_offset, len), "memcpy wrote outside the copy");
+        }
+    }
+
+    free(dst);
+    free(src);
+
+    END_TEST;
+}
+
+static bool memset_sizes(void* context) {
+    BEGIN_TEST;
+
+    uint8_t* buf = static_cast<uint8_t*>(memalign(PAGE_SIZE, kBufSize));
+    REQUIRE_NONNULL(buf, "");
+
+    for (size_t i = 0; i < kNumTestSizes; i++) {
+        size_t len = test_size(i);
+        for (size_t align = 0; align < 16; align += 7) {
+            size_t offset = kGuard + align;
+            uint8_t value = static_cast<uint8_t>(i + align);
+            memset(buf, kGuardByte, offset + len + kGuard);
+
+            void* ret = memset(buf + offset, value, len);
+
+            EXPECT_EQ(buf + offset, ret, "memset returns its destination");
+            bool filled = true;
+            for (size_t j = 0; j < len; j++)
+                filled = filled && buf[offset + j] == value;
+            EXPECT_TRUE(filled, "memset data");
+            EXPECT_TRUE(check_guards(buf, offset, len), "memset wrote outside the fill");
+        }
+    }
+
+    free(buf);
+
+    END_TEST;
+}
+
+// Reports memcpy and memset throughput for each size class.  This takes a
+// while and its numbers are for people, so it is a console command rather
+// than part of the unit tests.
+static int memcpy_bench(int argc, const cmd_args* argv, uint32_t flags) {
+    uint8_t* src = static_cast<uint8_t*>(memalign(PAGE_SIZE, kBufSize));
+    uint8_t* dst = static_cast<uint8_t*>(memalign(PAGE_SIZE, kBufSize));
+    if (!src || !dst) {
+        printf("failed to allocate buffers\n");
+        free(dst);
+        free(src);
+        return ERR_NO_MEMORY;
+    }
+    fill_pattern(src, kBufSize, 2);
+
+    static const size_t sizes[] = {
+        8, 16, 32, 64, 128, 256, 1024, 4096, 16384, 65536, 256 * 1024, kBufSize,
+    };
+    // Move about 64MB per measurement.
+    static const size_t kBytesPerRun = 64 * 1024 * 1024;
+
+    printf("\n%10s %14s %14s\n", "size", "memcpy MB/s", "memset MB/s");
+    for (size_t size : sizes) {
+        size_t iterations = kBytesPerRun / size;
+
+        lk_time_t start = current_time();
+        for (size_t i = 0; i < iterations; i++)
+            memcpy(dst, src, size);
+        lk_time_t copy_time = current_time() - start;
+
+        start = current_time();
+        for (size_t i = 0; i < iterations; i++)
+            memset(dst, static_cast<int>(i), size);
+        lk_time_t set_time = current_time() - start;
+
+        // Bytes per nanosecond, times 1000, is MB/s.
+        uint64_t bytes = static_cast<uint64_t>(iterations) * size;
+        uint64_t copy_mbps = copy_time ? bytes * 1000 / copy_time : 0;
+        uint64_t set_mbps = set_time ? bytes * 1000 / set_time : 0;
+        printf("%10zu %14" PRIu64 " %14" PRIu64 "\n", size, copy_mbps, set_mbps);
+    }
+
+    free(dst);
+    free(src);
+
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("memcpy_bench", "memcpy/memset bandwidth by size", &memcpy_bench)
+STATIC_COMMAND_END(memcpy_bench);
+
+UNITTEST_START_TESTCASE(memcpy_tests)
+UNITTEST("memcpy across sizes and alignments", memcpy_sizes)
+UNITTEST("memset across sizes and alignments", memset_sizes)
+UNITTEST_END_TESTCASE(memcpy_tests, "memcpy", "memcpy/memset correctness",
+                      nullptr, nullptr);
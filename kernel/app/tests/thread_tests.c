@@ -371,6 +371,72 @@ static void preempt_test(void)
     printf("done with real-time preempt test, above time stamps should be 1 second apart\n");
 }
 
+static volatile int inherit_count;
+static volatile int inherit_stop;
+
+static int inherit_spinner(void *arg)
+{
+    while (!inherit_stop)
+        ;
+    return 0;
+}
+
+static int inherit_counter(void *arg)
+{
+    while (!inherit_stop)
+        atomic_add(&inherit_count, 1);
+    return 0;
+}
+
+static void priority_inheritance_test(void)
+{
+    /* a low priority thread shares cpu 0 with a higher priority spinner,
+     * which keeps it from running until it inherits a priority above the
+     * spinner's, and again once the inherited priority is taken away */
+    printf("testing priority inheritance\n");
+
+    thread_set_priority(HIGH_PRIORITY);
+    inherit_count = 0;
+    inherit_stop = 0;
+
+    thread_t *spinner = thread_create("inherit spinner", &inherit_spinner, NULL,
+                                      DEFAULT_PRIORITY + 2, DEFAULT_STACK_SIZE);
+    thread_t *counter = thread_create("inherit counter", &inherit_counter, NULL,
+                                      LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_set_pinned_cpu(spinner, 0);
+    thread_set_pinned_cpu(counter, 0);
+    thread_resume(spinner);
+    thread_resume(counter);
+
+    thread_sleep_relative(LK_MSEC(100));
+    int before = inherit_count;
+    thread_sleep_relative(LK_MSEC(200));
+    int starved = inherit_count - before;
+
+    thread_set_inherited_priority(counter, HIGH_PRIORITY - 1);
+    printf("\teffective priority %d (should be %d)\n",
+           thread_effective_priority(counter), HIGH_PRIORITY - 1);
+    before = inherit_count;
+    thread_sleep_relative(LK_MSEC(200));
+    int inherited = inherit_count - before;
+
+    thread_set_inherited_priority(counter, 0);
+    thread_sleep_relative(LK_MSEC(100));
+    before = inherit_count;
+    thread_sleep_relative(LK_MSEC(200));
+    int dropped = inherit_count - before;
+
+    inherit_stop = 1;
+    thread_join(spinner, NULL, INFINITE_TIME);
+    thread_join(counter, NULL, INFINITE_TIME);
+    thread_set_priority(DEFAULT_PRIORITY);
+
+    printf("\tcounter ran %d times starved, %d inheriting, %d after (should be 0, >0, 0)\n",
+           starved, inherited, dropped);
+    if (starved != 0 || inherited == 0 || dropped != 0)
+        printf("\tpriority inheritance test FAILED\n");
+}
+
 static int join_tester(void *arg)
 {
     long val = (long)arg;
@@ -605,6 +671,8 @@ int thread_tests(void)
 
     preempt_test();
 
+    priority_inheritance_test();
+
     join_test();
 
     return 0;
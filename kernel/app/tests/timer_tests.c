@@ -7,6 +7,7 @@
 #include "tests.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/timer.h>
@@ -70,8 +71,112 @@ static void timer_test_all_cpus(void)
     printf("%u threads created, %u threads joined\n", max, joined);
 }
 
+#define TIMER_PERF_COUNT 10000
+
+static enum handler_return timer_perf_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    return INT_NO_RESCHEDULE;
+}
+
+static void timer_test_arm_cancel_perf(void)
+{
+    timer_t* timers = malloc(sizeof(timer_t) * TIMER_PERF_COUNT);
+    if (!timers) {
+        printf("failed to allocate timers\n");
+        return;
+    }
+
+    for (uint i = 0; i < TIMER_PERF_COUNT; i++)
+        timer_initialize(&timers[i]);
+
+    // spread the deadlines from 1s to ~1h out so that none of them fire
+    // while we're measuring and every level of the wheel gets used
+    lk_time_t base = current_time() + LK_SEC(1);
+    lk_time_t t0 = current_time();
+    for (uint i = 0; i < TIMER_PERF_COUNT; i++) {
+        lk_time_t offset = ((lk_time_t)rand() * LK_MSEC(1)) % LK_SEC(3600);
+        timer_set_oneshot(&timers[i], base + offset, timer_perf_cb, NULL);
+    }
+    lk_time_t t1 = current_time();
+
+    // one more arm/cancel pair with all of the others outstanding
+    timer_t extra;
+    timer_initialize(&extra);
+    lk_time_t t2 = current_time();
+    timer_set_oneshot(&extra, base + LK_MSEC(500), timer_perf_cb, NULL);
+    timer_cancel(&extra);
+    lk_time_t t3 = current_time();
+
+    uint canceled = 0;
+    for (uint i = 0; i < TIMER_PERF_COUNT; i++) {
+        if (timer_cancel(&timers[i]))
+            canceled++;
+    }
+    lk_time_t t4 = current_time();
+
+    printf("%u timers: arm %" PRIu64 " ns/timer, cancel %" PRIu64 " ns/timer, "
+           "arm+cancel with all outstanding %" PRIu64 " ns\n",
+           TIMER_PERF_COUNT, (t1 - t0) / TIMER_PERF_COUNT, (t4 - t3) / TIMER_PERF_COUNT, t3 - t2);
+    if (canceled != TIMER_PERF_COUNT)
+        printf("error: only %u of %u timers canceled before firing\n", canceled, TIMER_PERF_COUNT);
+
+    free(timers);
+}
+
+#define TIMER_SLACK_COUNT 64
+
+struct timer_slack_state {
+    lk_time_t deadline;
+    lk_time_t fired;
+};
+
+static enum handler_return timer_slack_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    struct timer_slack_state* state = arg;
+    state->fired = now;
+    return INT_NO_RESCHEDULE;
+}
+
+static void timer_test_slack(void)
+{
+    timer_t timers[TIMER_SLACK_COUNT];
+    struct timer_slack_state state[TIMER_SLACK_COUNT];
+
+    // a bunch of timers 100us apart, each allowed to fire up to 2ms late
+    lk_time_t slack = LK_MSEC(2);
+    lk_time_t base = current_time() + LK_MSEC(10);
+    for (uint i = 0; i < TIMER_SLACK_COUNT; i++) {
+        timer_initialize(&timers[i]);
+        state[i].deadline = base + i * LK_USEC(100);
+        state[i].fired = 0;
+        timer_set_oneshot_etc(&timers[i], state[i].deadline, slack, timer_slack_cb, &state[i]);
+    }
+
+    thread_sleep(base + TIMER_SLACK_COUNT * LK_USEC(100) + slack + LK_MSEC(10));
+
+    uint errors = 0;
+    for (uint i = 0; i < TIMER_SLACK_COUNT; i++) {
+        timer_cancel(&timers[i]);
+        if (state[i].fired == 0) {
+            printf("error: slack timer %u never fired\n", i);
+            errors++;
+        } else if (state[i].fired < state[i].deadline) {
+            printf("error: slack timer %u fired %" PRIu64 " ns early\n", i,
+                   state[i].deadline - state[i].fired);
+            errors++;
+        }
+    }
+    printf("%u slack timers, %u errors\n", TIMER_SLACK_COUNT, errors);
+}
+
 void timer_tests(void)
 {
     // timer fires on all cpus
     timer_test_all_cpus();
+
+    // timers with slack fire in their window
+    timer_test_slack();
+
+    // arm/cancel cost with many timers outstanding
+    timer_test_arm_cancel_perf();
 }
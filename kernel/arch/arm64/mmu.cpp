@@ -342,6 +342,54 @@ static bool page_table_is_clear(volatile pte_t* page_table, uint page_size_shift
     return true;
 }
 
+// Replace the block descriptor at page_table[index] with a table of next level
+// entries mapping the same memory with the same attributes, so part of the
+// block can be unmapped or reprotected.
+static status_t arm64_mmu_split_block(vaddr_t block_vaddr, uint index_shift,
+                                      uint page_size_shift, volatile pte_t* page_table,
+                                      vaddr_t index, uint asid) {
+    const pte_t pte = page_table[index];
+    const uint next_shift = index_shift - (page_size_shift - 3);
+    const size_t count = 1UL << (page_size_shift - 3);
+
+    DEBUG_ASSERT((pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK);
+
+    LTRACEF("splitting block at %#" PRIxPTR ", pte %#" PRIx64 "\n", block_vaddr, pte);
+
+    paddr_t table_paddr;
+    status_t ret = alloc_page_table(&table_paddr, page_size_shift);
+    if (ret)
+        return ret;
+    volatile pte_t* table = static_cast<volatile pte_t*>(paddr_to_kvaddr(table_paddr));
+
+    const paddr_t paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
+    pte_t attrs = pte & ~(MMU_PTE_OUTPUT_ADDR_MASK | MMU_PTE_DESCRIPTOR_MASK);
+    if (next_shift > page_size_shift)
+        attrs |= MMU_PTE_L012_DESCRIPTOR_BLOCK;
+    else
+        attrs |= MMU_PTE_L3_DESCRIPTOR_PAGE;
+    for (size_t i = 0; i < count; i++)
+        table[i] = (paddr + (i << next_shift)) | attrs;
+
+    __asm__ volatile("dmb ishst" ::
+                         : "memory");
+
+    // break-before-make: the block has to be gone from every tlb before the
+    // table replacing it becomes visible
+    page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+    DSB;
+    if (asid == MMU_ARM64_GLOBAL_ASID)
+        ARM64_TLBI(vaae1is, block_vaddr >> 12);
+    else
+        ARM64_TLBI(vae1is, block_vaddr >> 12 | (vaddr_t)asid << 48);
+    DSB;
+
+    page_table[index] = table_paddr | MMU_PTE_L012_DESCRIPTOR_TABLE;
+    LTRACEF("pte %p[%#" PRIxPTR "] = %#" PRIx64 "\n",
+            page_table, index, page_table[index]);
+    return 0;
+}
+
 static ssize_t arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
                                   size_t size,
                                   uint index_shift, uint page_size_shift,
@@ -369,6 +417,15 @@ static ssize_t arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
 
         pte = page_table[index];
 
+        // only part of a block is going away; if it cannot be split, the rest
+        // of it is unmapped too and faults back in later
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK &&
+            arm64_mmu_split_block(vaddr - vaddr_rem, index_shift, page_size_shift,
+                                  page_table, index, asid) == 0) {
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
@@ -527,6 +584,17 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         index = vaddr_rel >> index_shift;
         pte = page_table[index];
 
+        // only part of a block changes protection, so it has to be split first
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            if (arm64_mmu_split_block(vaddr - vaddr_rem, index_shift, page_size_shift,
+                                      page_table, index, asid)) {
+                TRACEF("failed to split block, index %#" PRIxPTR "\n", index);
+                goto err;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
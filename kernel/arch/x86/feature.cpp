@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 
 #include <arch/x86/feature.h>
+#include <arch/x86/memops.h>
 
 #include <assert.h>
 #include <bits.h>
@@ -28,6 +29,9 @@ static struct x86_model_info model_info;
 
 static int initialized = 0;
 
+bool x86_memops_erms = false;
+size_t x86_memops_nt_threshold = SIZE_MAX;
+
 static enum x86_microarch_list get_microarch(struct x86_model_info* info);
 
 void x86_feature_init(void)
@@ -100,6 +104,11 @@ void x86_feature_init(void)
 
         x86_microarch = get_microarch(&model_info);
     }
+
+    /* pick the copy strategies; rep movsb is only the fastest medium sized
+     * copy when the cpu advertises enhanced rep movsb/stosb */
+    x86_memops_erms = x86_feature_test(X86_FEATURE_ERMS);
+    x86_memops_nt_threshold = X86_64_MEMOPS_NT_THRESHOLD;
 }
 
 static enum x86_microarch_list get_microarch(struct x86_model_info* info) {
@@ -201,6 +210,9 @@ void x86_feature_debug(void)
         { X86_FEATURE_TSC_ADJUST, "tsc_adj" },
         { X86_FEATURE_SMEP, "smep" },
         { X86_FEATURE_SMAP, "smap" },
+        { X86_FEATURE_ERMS, "erms" },
+        { X86_FEATURE_PCID, "pcid" },
+        { X86_FEATURE_INVPCID, "invpcid" },
         { X86_FEATURE_RDRAND, "rdrand" },
         { X86_FEATURE_RDSEED, "rdseed" },
         { X86_FEATURE_PKU, "pku" },
@@ -33,6 +33,15 @@ struct arch_aspace {
      * actually an mp_cpu_mask_t, but header dependencies. */
     volatile int active_cpus;
 
+    /* Unique, never reused identifier for this aspace, used to tell whether
+     * a CPU's PCID still holds this aspace's TLB entries. */
+    uint64_t pcid_ctx_id;
+
+    /* Bumped on every TLB shootdown of this aspace.  A CPU which was not
+     * running the aspace at the time, and so was not interrupted, compares
+     * it on its next switch in to learn that its entries are stale. */
+    volatile int64_t tlb_generation;
+
     /* Pointer to a bitmap::RleBitmap representing the range of ports
      * enabled in this aspace. */
     void *io_bitmap;
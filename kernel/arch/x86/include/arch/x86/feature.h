@@ -99,6 +99,7 @@ void x86_feature_debug(void);
 #define X86_FEATURE_SSE3         X86_CPUID_BIT(0x1, 2, 0)
 #define X86_FEATURE_VMX          X86_CPUID_BIT(0x1, 2, 5)
 #define X86_FEATURE_SSSE3        X86_CPUID_BIT(0x1, 2, 9)
+#define X86_FEATURE_PCID         X86_CPUID_BIT(0x1, 2, 17)
 #define X86_FEATURE_SSE4_1       X86_CPUID_BIT(0x1, 2, 19)
 #define X86_FEATURE_SSE4_2       X86_CPUID_BIT(0x1, 2, 20)
 #define X86_FEATURE_X2APIC       X86_CPUID_BIT(0x1, 2, 21)
@@ -117,6 +118,8 @@ void x86_feature_debug(void);
 #define X86_FEATURE_TSC_ADJUST   X86_CPUID_BIT(0x7, 1, 1)
 #define X86_FEATURE_AVX2         X86_CPUID_BIT(0x7, 1, 5)
 #define X86_FEATURE_SMEP         X86_CPUID_BIT(0x7, 1, 7)
+#define X86_FEATURE_ERMS         X86_CPUID_BIT(0x7, 1, 9)
+#define X86_FEATURE_INVPCID      X86_CPUID_BIT(0x7, 1, 10)
 #define X86_FEATURE_RDSEED       X86_CPUID_BIT(0x7, 1, 18)
 #define X86_FEATURE_SMAP         X86_CPUID_BIT(0x7, 1, 20)
 #define X86_FEATURE_PT           X86_CPUID_BIT(0x7, 1, 25)
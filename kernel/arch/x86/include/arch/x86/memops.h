@@ -0,0 +1,37 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/x86_64_memops.h>
+
+#ifndef __ASSEMBLER__
+
+#include <magenta/compiler.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+__BEGIN_CDECLS
+
+/* Tuning for memcpy, memset and the user copy routines, chosen from cpuid by
+ * x86_feature_init().  Until then the copies use only baseline instructions. */
+extern bool x86_memops_erms;
+extern size_t x86_memops_nt_threshold;
+
+__END_CDECLS
+
+#else // __ASSEMBLER__
+
+/* See <magenta/x86_64_memops.h>. */
+.macro memcpy_body
+    x86_64_memcpy_body x86_memops_erms, x86_memops_nt_threshold
+.endm
+
+.macro memset_body
+    x86_64_memset_body x86_memops_erms, x86_memops_nt_threshold
+.endm
+
+#endif // __ASSEMBLER__
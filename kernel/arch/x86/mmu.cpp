@@ -32,6 +32,11 @@ uint8_t g_paddr_width = 32;
 /* True if the system supports 1GB pages */
 static bool supports_huge_pages = false;
 
+/* True if user address spaces are tagged with PCIDs, and if the INVPCID
+ * instruction can be used to flush them */
+static bool use_pcid = false;
+static bool use_invpcid = false;
+
 /* top level kernel page tables, initialized in start.S */
 volatile pt_entry_t pml4[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
 volatile pt_entry_t pdp[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE); /* temporary */
@@ -109,83 +114,263 @@ static bool x86_mmu_check_paddr(paddr_t paddr) {
     return paddr <= max_paddr;
 }
 
+/* INVPCID invalidation types, see Intel 3A section 4.10.4.1 */
+enum {
+    INVPCID_ADDRESS = 0,
+    INVPCID_SINGLE_CONTEXT = 1,
+    INVPCID_ALL_INCLUDING_GLOBAL = 2,
+    INVPCID_ALL_EXCLUDING_GLOBAL = 3,
+};
+
+static void x86_invpcid(uint64_t type, uint64_t pcid, vaddr_t vaddr) {
+    struct {
+        uint64_t pcid;
+        uint64_t vaddr;
+    } desc = {pcid, vaddr};
+    __asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(type) : "memory");
+}
+
 /**
  * @brief  invalidate all TLB entries, including global entries
  */
 static void x86_tlb_global_invalidate() {
-    /* See Intel 3A section 4.10.4.1 */
+    if (use_invpcid) {
+        x86_invpcid(INVPCID_ALL_INCLUDING_GLOBAL, 0, 0);
+        return;
+    }
+
+    /* See Intel 3A section 4.10.4.1.  Any change to PGE flushes every entry
+     * for every PCID; with PCIDs enabled a cr3 reload would only flush the
+     * current one, so toggle it even if it was clear. */
     ulong cr4 = x86_get_cr4();
-    if (likely(cr4 & X86_CR4_PGE)) {
-        x86_set_cr4(cr4 & ~X86_CR4_PGE);
-        x86_set_cr4(cr4);
-    } else {
-        x86_set_cr3(x86_get_cr3());
+    x86_set_cr4(cr4 ^ X86_CR4_PGE);
+    x86_set_cr4(cr4);
+}
+
+/*
+ * PCIDs are handed out to user aspaces per CPU.  Each CPU remembers which
+ * aspace its last few PCIDs were used for, so that switching back to one of
+ * them can keep its TLB entries rather than starting cold.  PCID 0 is left
+ * for the kernel aspace, and for everything when PCIDs are not in use.
+ *
+ * Entries tagged with a PCID survive switching away from an aspace, so a CPU
+ * can hold stale entries for an aspace it was not running (and so was not
+ * sent a shootdown for).  Every shootdown bumps the aspace's tlb_generation;
+ * a CPU switching back in whose slot has an older generation reloads cr3
+ * without the no-flush bit, dropping that PCID's entries.
+ */
+static constexpr uint kNumUserPcids = 8;
+
+struct pcid_slot {
+    /* pcid_ctx_id of the aspace using this PCID, or 0 if none */
+    uint64_t ctx_id;
+    /* The aspace's tlb_generation when this CPU last flushed the PCID */
+    int64_t tlb_generation;
+};
+
+struct pcid_cpu_state {
+    pcid_slot slots[kNumUserPcids];
+    uint next_victim;
+} __CPU_ALIGN;
+
+static pcid_cpu_state pcid_state[SMP_MAX_CPUS];
+
+/* Source of arch_aspace::pcid_ctx_id; 0 is never handed out */
+static volatile int64_t next_pcid_ctx_id = 1;
+
+/**
+ * @brief Choose the cr3 value to switch this CPU to the given user aspace
+ *
+ * Must be called with interrupts disabled, after this CPU has been added to
+ * the aspace's active_cpus.
+ */
+static ulong x86_pcid_cr3(arch_aspace_t* aspace) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    pcid_cpu_state* state = &pcid_state[arch_curr_cpu_num()];
+
+    /* Read the generation only after joining active_cpus: a shootdown which
+     * loaded active_cpus before we joined it bumped the generation first. */
+    int64_t generation = atomic_load_64(&aspace->tlb_generation);
+
+    for (uint i = 0; i < kNumUserPcids; ++i) {
+        pcid_slot* slot = &state->slots[i];
+        if (slot->ctx_id != aspace->pcid_ctx_id) {
+            continue;
+        }
+        ulong cr3 = aspace->pt_phys | (i + 1);
+        if (slot->tlb_generation == generation) {
+            return cr3 | X86_CR3_NOFLUSH;
+        }
+        slot->tlb_generation = generation;
+        return cr3;
+    }
+
+    /* Not cached here; recycle a PCID.  Loading cr3 without the no-flush bit
+     * drops whatever the previous owner left behind. */
+    uint i = state->next_victim;
+    state->next_victim = (i + 1) % kNumUserPcids;
+    state->slots[i].ctx_id = aspace->pcid_ctx_id;
+    state->slots[i].tlb_generation = generation;
+    return aspace->pt_phys | (i + 1);
+}
+
+/**
+ * @brief Note that this CPU has flushed its entries for the aspace it is running
+ */
+static void x86_pcid_note_flushed(int64_t generation) {
+    ulong pcid = x86_get_cr3() & X86_CR3_PCID_MASK;
+    if (pcid == 0) {
+        return;
+    }
+    pcid_slot* slot = &pcid_state[arch_curr_cpu_num()].slots[pcid - 1];
+    if (slot->tlb_generation < generation) {
+        slot->tlb_generation = generation;
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct tlb_invalidate_page_context {
+/**
+ * @brief A set of TLB invalidations accumulated over one page table operation
+ *
+ * Rather than interrupting every CPU in the aspace once per modified entry,
+ * the page table walkers queue up the addresses they touch here, and the
+ * top-level operation sends a single shootdown for all of them once it is
+ * done.  Beyond kMaxPages addresses it is cheaper to flush the whole TLB than
+ * to invlpg each one, so we stop tracking individual pages.
+ */
+struct PendingTlbInvalidation {
+    struct Item {
+        vaddr_t vaddr;
+        enum page_table_levels level;
+        bool global_page;
+    };
+
+    static constexpr uint kMaxPages = 32;
+
+    PendingTlbInvalidation() { list_initialize(&freed_tables); }
+    ~PendingTlbInvalidation() {
+        DEBUG_ASSERT(count == 0 && !full_shootdown);
+        DEBUG_ASSERT(list_is_empty(&freed_tables));
+    }
+
+    void enqueue(vaddr_t vaddr, enum page_table_levels level, bool global_page) {
+        if (global_page) {
+            contains_global = true;
+        }
+        /* A top-level entry covers too much address space to invlpg it */
+        if (level == PML4_L || count == kMaxPages) {
+            full_shootdown = true;
+            return;
+        }
+        items[count++] = {vaddr, level, global_page};
+    }
+
+    /* Page tables unlinked by this operation may still be referenced by
+     * another CPU's paging-structure caches until the shootdown completes,
+     * so they are only returned to the PMM after it. */
+    void free_table(vm_page_t* page) { list_add_tail(&freed_tables, &page->free.node); }
+
+    bool is_empty() const { return count == 0 && !full_shootdown; }
+
+    void clear() {
+        count = 0;
+        full_shootdown = false;
+        contains_global = false;
+    }
+
+    Item items[kMaxPages];
+    uint count = 0;
+    bool full_shootdown = false;
+    bool contains_global = false;
+    struct list_node freed_tables;
+};
+
+/* Task used for invalidating a set of TLB entries on each CPU */
+struct tlb_invalidate_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+    int64_t tlb_generation;
+    const PendingTlbInvalidation* pending;
 };
-static void tlb_invalidate_page_task(void* raw_context) {
+static void tlb_invalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    const tlb_invalidate_context* context = (const tlb_invalidate_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    bool in_target = context->target_cr3 == (cr3 & X86_CR3_BASE_MASK);
+    if (!in_target && !pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else if (use_invpcid) {
+            x86_invpcid(INVPCID_SINGLE_CONTEXT, cr3 & X86_CR3_PCID_MASK, 0);
+        } else {
+            /* Reloading cr3 drops all non-global entries (of the current
+             * PCID, if PCIDs are enabled) */
+            x86_set_cr3(cr3);
+        }
+    } else {
+        /* invlpg only affects the current PCID, plus global entries */
+        for (uint i = 0; i < pending->count; ++i) {
+            const PendingTlbInvalidation::Item& item = pending->items[i];
+            if (!in_target && !item.global_page) {
+                continue;
+            }
+            __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.vaddr));
+        }
+    }
+
+    if (use_pcid && in_target) {
+        x86_pcid_note_flushed(context->tlb_generation);
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a batch of pending TLB invalidations
  *
- * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * Sends one shootdown covering everything queued in |pending|, frees any page
+ * tables it was holding on to, and leaves it empty for reuse.
  *
- * TODO(teisenbe): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
+ * @param pending The invalidations to perform
  */
-void x86_tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, enum page_table_levels level,
-                             bool global_page) {
-    ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
-    };
+static void x86_tlb_invalidate(arch_aspace_t* aspace, PendingTlbInvalidation* pending) {
+    if (!pending->is_empty()) {
+        ulong cr3 = aspace ? aspace->pt_phys : (x86_get_cr3() & X86_CR3_BASE_MASK);
+        int64_t generation = 0;
+        if (aspace != nullptr) {
+            /* Must happen before active_cpus is loaded below, see
+             * x86_pcid_cr3() */
+            generation = atomic_add_64(&aspace->tlb_generation, 1) + 1;
+        }
+        struct tlb_invalidate_context task_context = {
+            .target_cr3 = cr3, .tlb_generation = generation, .pending = pending,
+        };
+
+        /* Target only CPUs this aspace is active on.  It may be the case that
+         * some other CPU will become active in it after this load, or will
+         * have left it just before this load.  In the former case, it is
+         * becoming active after the write to the page table, so it will see
+         * the change.  In the latter case, it will get a spurious request to
+         * flush. */
+        mp_cpu_mask_t targets;
+        if (pending->contains_global || aspace == nullptr) {
+            targets = MP_CPU_ALL;
+        } else {
+            targets = atomic_load(&aspace->active_cpus);
+            static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        }
 
-    /* Target only CPUs this aspace is active on.  It may be the case that some
-     * other CPU will become active in it after this load, or will have left it
-     * just before this load.  In the former case, it is becoming active after
-     * the write to the page table, so it will see the change.  In the latter
-     * case, it will get a spurious request to flush. */
-    mp_cpu_mask_t targets;
-    if (global_page || aspace == nullptr) {
-        targets = MP_CPU_ALL;
-    } else {
-        targets = atomic_load(&aspace->active_cpus);
-        static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        mp_sync_exec(targets, tlb_invalidate_task, &task_context);
+        pending->clear();
     }
 
-    mp_sync_exec(targets, tlb_invalidate_page_task, &task_context);
+    if (!list_is_empty(&pending->freed_tables)) {
+        pmm_free(&pending->freed_tables);
+    }
 }
 
 template <int Level>
@@ -373,10 +558,11 @@ struct PageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue an invalidation of a single page at this page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
-        x86_tlb_invalidate_page(aspace, vaddr, Base::level, global_page);
+    static void tlb_invalidate_page(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                    bool global_page) {
+        pending->enqueue(vaddr, Base::level, global_page);
     }
 };
 
@@ -424,9 +610,10 @@ struct ExtendedPageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue an invalidation of a single page at this page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
+    static void tlb_invalidate_page(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                    bool global_page) {
         // TODO(abdulla): Implement this.
     }
 };
@@ -504,8 +691,8 @@ struct MappingCursor {
 };
 
 template <typename PageTable>
-static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry_t* pte,
-                         paddr_t paddr, arch_flags_t flags) {
+static void update_entry(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                         volatile pt_entry_t* pte, paddr_t paddr, arch_flags_t flags) {
     DEBUG_ASSERT(pte);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(paddr));
 
@@ -516,12 +703,13 @@ static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
 template <typename PageTable>
-static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry_t* pte) {
+static void unmap_entry(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                        volatile pt_entry_t* pte) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
@@ -530,7 +718,7 @@ static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry_
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
@@ -554,7 +742,8 @@ static volatile pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 template <typename PageTable>
-static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry_t* pte) {
+static status_t x86_mmu_split(vaddr_t vaddr, volatile pt_entry_t* pte,
+                              PendingTlbInvalidation* pending) {
     static_assert(PageTable::level != PT_L, "tried splitting PT_L");
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, PageTable::level);
 
@@ -575,14 +764,14 @@ static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_
         volatile pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        update_entry<typename PageTable::LowerTable>(aspace, new_vaddr, e, new_paddr, flags);
+        update_entry<typename PageTable::LowerTable>(pending, new_vaddr, e, new_paddr, flags);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + PageTable::page_size());
 
     flags = PageTable::intermediate_arch_flags();
-    update_entry<PageTable>(aspace, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    update_entry<PageTable>(pending, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
     return NO_ERROR;
 }
 
@@ -682,7 +871,8 @@ status_t x86_mmu_get_mapping<ExtendedPageTable<PT_L>>(volatile pt_entry_t* table
  */
 template <typename PageTable>
 static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* table,
-                                   const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                   const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                   PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -717,7 +907,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
             bool vaddr_level_aligned = PageTable::page_aligned(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -727,17 +917,18 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            status_t status = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            status_t status = x86_mmu_split<PageTable>(page_vaddr, e, pending);
             if (status != NO_ERROR) {
                 // If split fails, just unmap the whole thing, and let a
                 // subsequent page fault clean it up.
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 const size_t size = (new_cursor->size > ps) ? ps : new_cursor->size;
                 new_cursor->vaddr += size;
                 new_cursor->size -= size;
                 DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
+                continue;
             }
             pt_val = *e;
         }
@@ -745,7 +936,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
         bool lower_unmapped = x86_mmu_remove_mapping<typename PageTable::LowerTable>(
-            aspace, next_table, *new_cursor, &cursor);
+            aspace, next_table, *new_cursor, &cursor, pending);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -765,8 +956,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
             }
         }
         if (unmap_page_table) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
-            pmm_free_page(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
+            pending->free_table(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
             unmapped = true;
         }
         *new_cursor = cursor;
@@ -782,7 +973,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
 template <typename PageTable>
 static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                       const MappingCursor& start_cursor,
-                                      MappingCursor* new_cursor) {
+                                      MappingCursor* new_cursor,
+                                      PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -794,7 +986,7 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         volatile pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
             unmapped = true;
         }
 
@@ -808,17 +1000,20 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t
 template <>
 bool x86_mmu_remove_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                              const MappingCursor& start_cursor,
-                                             MappingCursor* new_cursor) {
-    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor);
+                                             MappingCursor* new_cursor,
+                                             PendingTlbInvalidation* pending) {
+    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor,
+                                                      pending);
 }
 
 template <>
 bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
                                                      volatile pt_entry_t* table,
                                                      const MappingCursor& start_cursor,
-                                                     MappingCursor* new_cursor) {
+                                                     MappingCursor* new_cursor,
+                                                     PendingTlbInvalidation* pending) {
     return x86_mmu_remove_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, start_cursor,
-                                                              new_cursor);
+                                                              new_cursor, pending);
 }
 
 /**
@@ -832,6 +1027,7 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
  * act on within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations required by this update are queued here
  *
  * @return NO_ERROR if successful
  * @return ERR_ALREADY_EXISTS if the range overlaps an existing mapping
@@ -840,7 +1036,8 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
 template <typename PageTable>
 static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                     uint mmu_flags,
-                                    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                    PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     DEBUG_ASSERT(x86_mmu_check_vaddr(start_cursor.vaddr));
     DEBUG_ASSERT(x86_mmu_check_paddr(start_cursor.paddr));
@@ -869,7 +1066,7 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, volatile pt_entry_t*
         if (level_supports_large_pages && !IS_PAGE_PRESENT(pt_val) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
+            update_entry<PageTable>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                     arch_flags | X86_MMU_PG_PS);
 
             new_cursor->paddr += ps;
@@ -887,14 +1084,15 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, volatile pt_entry_t*
 
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, PageTable::level);
 
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
+                update_entry<PageTable>(pending, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
                                         interm_arch_flags);
                 pt_val = *e;
             }
 
             MappingCursor cursor;
             ret = x86_mmu_add_mapping<typename PageTable::LowerTable>(
-                aspace, get_next_table_from_entry(pt_val), mmu_flags, *new_cursor, &cursor);
+                aspace, get_next_table_from_entry(pt_val), mmu_flags, *new_cursor, &cursor,
+                pending);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != NO_ERROR) {
@@ -910,7 +1108,8 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result);
+            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result,
+                                                                 pending);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -921,7 +1120,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                        uint mmu_flags, const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -936,7 +1136,7 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_
             return ERR_ALREADY_EXISTS;
         }
 
-        update_entry<PageTable>(aspace, new_cursor->vaddr, e, new_cursor->paddr, arch_flags);
+        update_entry<PageTable>(pending, new_cursor->vaddr, e, new_cursor->paddr, arch_flags);
 
         new_cursor->paddr += PAGE_SIZE;
         new_cursor->vaddr += PAGE_SIZE;
@@ -950,9 +1150,10 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_
 template <>
 status_t x86_mmu_add_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                               uint mmu_flags, const MappingCursor& start_cursor,
-                                              MappingCursor* new_cursor) {
+                                              MappingCursor* new_cursor,
+                                              PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                   new_cursor);
+                                                   new_cursor, pending);
 }
 
 template <>
@@ -960,9 +1161,10 @@ status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
                                                       volatile pt_entry_t* table,
                                                       uint mmu_flags,
                                                       const MappingCursor& start_cursor,
-                                                      MappingCursor* new_cursor) {
+                                                      MappingCursor* new_cursor,
+                                                      PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                           new_cursor);
+                                                           new_cursor, pending);
 }
 
 /**
@@ -976,12 +1178,14 @@ status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
  * act on within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations required by this update are queued here
  */
 template <typename PageTable>
 static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                        uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -1016,7 +1220,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e,
+                update_entry<PageTable>(pending, new_cursor->vaddr, e,
                                         PageTable::paddr_from_pte(pt_val),
                                         arch_flags | X86_MMU_PG_PS);
 
@@ -1027,7 +1231,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            ret = x86_mmu_split<PageTable>(page_vaddr, e, pending);
             if (ret != NO_ERROR) {
                 // If we failed to split the table, just unmap it.  Subsequent
                 // page faults will bring it back in.
@@ -1036,7 +1240,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
                 cursor.size = ps;
 
                 MappingCursor tmp_cursor;
-                x86_mmu_remove_mapping<PageTable>(aspace, table, cursor, &tmp_cursor);
+                x86_mmu_remove_mapping<PageTable>(aspace, table, cursor, &tmp_cursor, pending);
 
                 const size_t size = (new_cursor->size > ps) ? ps : new_cursor->size;
                 new_cursor->vaddr += size;
@@ -1048,7 +1252,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
         ret = x86_mmu_update_mapping<typename PageTable::LowerTable>(aspace, next_table, mmu_flags,
-                                                                     *new_cursor, &cursor);
+                                                                     *new_cursor, &cursor, pending);
         *new_cursor = cursor;
         if (ret != NO_ERROR) {
             // Currently this can't happen
@@ -1069,7 +1273,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                           uint mmu_flags, const MappingCursor& start_cursor,
-                                          MappingCursor* new_cursor) {
+                                          MappingCursor* new_cursor,
+                                          PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_update_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -1084,8 +1289,8 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, volatile pt_ent
         pt_entry_t pt_val = *e;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(pt_val)) {
-            update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(pt_val),
-                                    arch_flags);
+            update_entry<PageTable>(pending, new_cursor->vaddr, e,
+                                    PageTable::paddr_from_pte(pt_val), arch_flags);
         }
 
         new_cursor->vaddr += PAGE_SIZE;
@@ -1098,18 +1303,20 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, volatile pt_ent
 template <>
 status_t x86_mmu_update_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, volatile pt_entry_t* table,
                                                  uint mmu_flags, const MappingCursor& start_cursor,
-                                                 MappingCursor* new_cursor) {
+                                                 MappingCursor* new_cursor,
+                                                 PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                      new_cursor);
+                                                      new_cursor, pending);
 }
 
 template <>
 status_t x86_mmu_update_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
                                                          volatile pt_entry_t* table, uint mmu_flags,
                                                          const MappingCursor& start_cursor,
-                                                         MappingCursor* new_cursor) {
+                                                         MappingCursor* new_cursor,
+                                                         PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags,
-                                                              start_cursor, new_cursor);
+                                                              start_cursor, new_cursor, pending);
 }
 
 template <template <int> class PageTable>
@@ -1134,7 +1341,10 @@ static status_t mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, const size_t cou
     };
 
     MappingCursor result;
-    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result);
+    PendingTlbInvalidation pending;
+    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result,
+                                                        &pending);
+    x86_tlb_invalidate(aspace, &pending);
     DEBUG_ASSERT(result.size == 0);
 
     if (unmapped)
@@ -1180,8 +1390,11 @@ static status_t mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, con
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt,
-                                                                       mmu_flags, start, &result);
+                                                                       mmu_flags, start, &result,
+                                                                       &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -1228,8 +1441,10 @@ static status_t mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count,
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     status_t status = x86_mmu_update_mapping<PageTable<MAX_PAGING_LEVEL>>(
-        aspace, aspace->pt_virt, mmu_flags, start, &result);
+        aspace, aspace->pt_virt, mmu_flags, start, &result, &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         return status;
     }
@@ -1248,11 +1463,16 @@ status_t guest_mmu_protect(guest_paspace_t* paspace, vaddr_t vaddr, size_t count
 }
 
 void x86_mmu_early_init() {
+    use_pcid = x86_feature_test(X86_FEATURE_PCID);
+    use_invpcid = use_pcid && x86_feature_test(X86_FEATURE_INVPCID);
+
     x86_mmu_mem_type_init();
     x86_mmu_percpu_init();
 
     /* unmap the lower identity mapping */
-    unmap_entry<PageTable<PML4_L>>(nullptr, 0, &pml4[0]);
+    PendingTlbInvalidation pending;
+    unmap_entry<PageTable<PML4_L>>(&pending, 0, &pml4[0]);
+    x86_tlb_invalidate(nullptr, &pending);
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
@@ -1317,6 +1537,8 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
     }
     aspace->io_bitmap = nullptr;
     aspace->active_cpus = 0;
+    aspace->pcid_ctx_id = atomic_add_64(&next_pcid_ctx_id, 1);
+    aspace->tlb_generation = 0;
     spin_lock_init(&aspace->io_bitmap_lock);
 
     return NO_ERROR;
@@ -1396,15 +1618,21 @@ void arch_mmu_context_switch(arch_aspace_t* old_aspace, arch_aspace_t* aspace) {
     if (aspace != nullptr) {
         DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
         LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, aspace->pt_phys);
-        x86_set_cr3(aspace->pt_phys);
+        /* Join active_cpus before picking a PCID, see x86_pcid_cr3() */
+        atomic_or(&aspace->active_cpus, cpu_bit);
+        if (use_pcid) {
+            x86_set_cr3(x86_pcid_cr3(aspace));
+        } else {
+            x86_set_cr3(aspace->pt_phys);
+        }
 
-        if (old_aspace != nullptr) {
+        if (old_aspace != nullptr && old_aspace != aspace) {
             atomic_and(&old_aspace->active_cpus, ~cpu_bit);
         }
-        atomic_or(&aspace->active_cpus, cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
-        x86_set_cr3(kernel_pt_phys);
+        /* PCID 0 only ever holds kernel (global) mappings, nothing to flush */
+        x86_set_cr3(use_pcid ? (kernel_pt_phys | X86_CR3_NOFLUSH) : kernel_pt_phys);
         if (old_aspace != nullptr) {
             atomic_and(&old_aspace->active_cpus, ~cpu_bit);
         }
@@ -1502,6 +1730,10 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP))
         cr4 |= X86_CR4_SMAP;
+    /* Requires the PCID bits of cr3 to be clear, which holds for the kernel
+     * page tables we are running on */
+    if (use_pcid)
+        cr4 |= X86_CR4_PCIDE;
     x86_set_cr4(cr4);
 
     /* Set NXE bit in X86_MSR_IA32_EFER*/
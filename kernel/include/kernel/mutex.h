@@ -64,6 +64,10 @@ void mutex_release(mutex_t *m) TA_REL(m);
 /* special version of the above with the thread lock held */
 void mutex_release_thread_locked(mutex_t *m, bool resched) TA_REL(m);
 
+/* contention statistics, for the kernel console */
+void dump_mutex_stats(uint count);
+void reset_mutex_stats(void);
+
 /* does the current thread hold the mutex? */
 static inline bool is_mutex_held(const mutex_t *m)
 {
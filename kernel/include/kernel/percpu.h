@@ -16,19 +16,30 @@
 __BEGIN_CDECLS
 
 struct percpu {
-    /* per cpu timer queue */
-    struct list_node timer_queue;
+    /* per cpu timer wheel */
+    struct timer_wheel timer_wheel;
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     /* per cpu preemption timer */
     timer_t preempt_timer;
 #endif
 
+    /* per cpu run queue and bitmap to indicate which queues are non empty */
+    struct list_node run_queue[NUM_PRIORITIES];
+    uint32_t run_queue_bitmap;
+
+    /* number of threads sitting in this cpu's run queue */
+    uint32_t run_queue_len;
+
     /* thread/cpu level statistics */
     struct cpu_stats stats;
 
     /* per cpu idle thread */
     thread_t idle_thread;
+
+    /* thread currently running on this cpu, only compared against by
+     * other cpus and never dereferenced by them */
+    thread_t *running_thread;
 } __CPU_MAX_ALIGN;
 
 /* the kernel per-cpu structure */
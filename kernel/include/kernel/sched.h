@@ -25,3 +25,15 @@ void sched_reschedule(void);
 void _thread_resched_internal(void);
 
 thread_t *sched_get_top_thread(uint cpu);
+
+/* from the timer tick: wake an idle cpu to steal work queued on this one */
+void sched_balance(uint cpu);
+
+/* effective priority, including any inherited one */
+int sched_effective_priority(const thread_t *t);
+
+/* set the inherited priority floor of a thread, moving it if it is queued */
+void sched_inherit_priority(thread_t *t, int priority);
+
+/* migrate the run queue of a cpu that is being unplugged */
+void sched_transition_off_cpu(uint old_cpu);
@@ -18,6 +18,8 @@ struct cpu_stats {
     ulong irq_preempts;
     ulong preempts;
     ulong yields;
+    ulong steals; /* threads pulled from another cpu's run queue */
+    ulong handoffs; /* threads woken to run next on the waking thread's cpu */
 
     /* cpu level interrupts and exceptions */
     ulong interrupts; /* hardware interrupts, minus timer interrupts or inter-processor interrupts */
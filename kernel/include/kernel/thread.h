@@ -82,8 +82,10 @@ typedef struct thread {
 
     int base_priority;
     int priority_boost;
+    int inherited_priority; /* floor on the effective priority, 0 if none */
 
     uint last_cpu; /* last/current cpu the thread is running on */
+    uint queue_cpu; /* cpu whose run queue holds the thread while it is ready */
     int pinned_cpu; /* only run on pinned_cpu if >= 0 */
 
     /* pointer to the kernel address space this thread is associated with */
@@ -111,6 +113,9 @@ typedef struct thread {
     /* are we allowed to be interrupted on the current thing we're blocked/sleeping on */
     bool interruptable;
 
+    /* see thread_handoff_begin() */
+    int handoff;
+
     /* non-NULL if stopped in an exception */
     const struct arch_exception_context *exception_context;
 
@@ -193,6 +198,27 @@ void thread_preempt(void);    /* get preempted at irq time */
 void thread_reschedule(void); /* revaluate the run queue on the current cpu,
                                  can be used after waking up threads */
 
+/* Hand the cpu straight to a thread the current one is about to wake and then
+ * wait for (or, when replying, a thread it has been serving).  Between begin and
+ * end, the first thread woken from thread context goes at the head of this cpu's
+ * run queue with the rest of our time slice, instead of wherever the scheduler
+ * would place it, and runs as soon as we block.  thread_reschedule() after such
+ * a wake switches to it right away.
+ */
+#define THREAD_HANDOFF_NONE  0
+#define THREAD_HANDOFF_ARMED 1
+#define THREAD_HANDOFF_DONE  2
+
+void thread_handoff_begin(void);
+void thread_handoff_end(void);
+
+/* Priority inheritance, for locks that know their owner: the owner runs at no
+ * less than the priority of the threads it is blocking.  The caller tracks who
+ * lends what and sets the resulting floor, or 0 for none.
+ */
+int thread_effective_priority(const thread_t *t);
+void thread_set_inherited_priority(thread_t *t, int priority);
+
 void thread_owner_name(thread_t *t, char out_name[THREAD_NAME_LENGTH]);
 
 #define THREAD_BACKTRACE_DEPTH 10
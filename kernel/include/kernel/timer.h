@@ -28,6 +28,7 @@ typedef struct timer {
 
     lk_time_t scheduled_time;
     lk_time_t period;
+    lk_time_t slack;         // how late past scheduled_time the timer may fire
 
     timer_callback callback;
     void *arg;
@@ -42,21 +43,45 @@ typedef struct timer {
     .node = LIST_INITIAL_CLEARED_VALUE, \
     .scheduled_time = 0, \
     .period = 0, \
+    .slack = 0, \
     .callback = NULL, \
     .arg = NULL, \
     .active_cpu = -1, \
     .cancel = false, \
 }
 
+/* per cpu hierarchical timer wheel, see timer.c */
+#define TIMER_WHEEL_LEVELS 5
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+
+struct timer_wheel {
+    /* current position of the wheel, in level 0 slot units */
+    uint64_t base;
+
+    /* the deadline the hardware timer is programmed for, or INFINITE_TIME */
+    lk_time_t programmed;
+
+    /* bit per slot, set if the slot may have timers in it */
+    uint64_t bitmap[TIMER_WHEEL_LEVELS];
+    struct list_node slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    /* timers beyond the range of the highest level */
+    struct list_node overflow;
+};
+
 /* Rules for Timers:
  * - Timer callbacks occur from interrupt context
  * - Timers may be programmed or canceled from interrupt or thread context
  * - Timers may be canceled or reprogrammed from within their callback
  * - Setting and canceling timers is not thread safe and cannot be done concurrently
  * - timer_cancel() may spin waiting for a pending timer to complete on another cpu
+ * - A timer with slack may fire anywhere between its deadline and deadline + slack,
+ *   which lets nearby timers share a single hardware interrupt
 */
 void timer_initialize(timer_t *);
 void timer_set_oneshot(timer_t *, lk_time_t deadline, timer_callback, void *arg);
+void timer_set_oneshot_etc(timer_t *, lk_time_t deadline, lk_time_t slack, timer_callback, void *arg);
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 bool timer_cancel(timer_t *);
 
@@ -38,6 +38,10 @@ __BEGIN_CDECLS
 #define ROUNDUP_PAGE_SIZE(x) ROUNDUP((x), PAGE_SIZE)
 #define IS_PAGE_ALIGNED(x) IS_ALIGNED((x), PAGE_SIZE)
 
+/* The smallest large page the mmu code maps with: a last level page table's worth of pages */
+#define LARGE_PAGE_SIZE_SHIFT (PAGE_SIZE_SHIFT + PAGE_SIZE_SHIFT - 3)
+#define LARGE_PAGE_SIZE (1UL << LARGE_PAGE_SIZE_SHIFT)
+
 struct mmu_initial_mapping {
     paddr_t phys;
     vaddr_t virt;
@@ -112,6 +116,8 @@ status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 /* flags for allocation routines below */
 #define PMM_ALLOC_FLAG_ANY (0x0)  /* no restrictions on which arena to allocate from */
 #define PMM_ALLOC_FLAG_KMAP (0x1) /* allocate only from arenas marked KMAP */
+#define PMM_ALLOC_FLAG_ZEROED (0x2) /* return zero filled pages, preferring the pre-zeroed pool */
+#define PMM_ALLOC_FLAG_NO_SCAN (0x4) /* contiguous runs: fail rather than scan arenas or drain caches */
 
 /* Allocate count pages of physical memory, adding to the tail of the passed list.
  * The list must be initialized.
@@ -22,6 +22,8 @@ typedef struct vm_page {
     struct {
         uint32_t flags : 8;
         uint32_t state : 3;
+        // log2 of the number of pages in the free block this page heads
+        uint32_t order : 5;
     };
     uint32_t map_count;
 
@@ -57,6 +59,10 @@ enum vm_page_state {
     _VM_PAGE_STATE_COUNT
 };
 
+// vm_page_t::flags
+#define VM_PAGE_FLAG_ZEROED (1u << 0) // free page known to be zero filled
+#define VM_PAGE_FLAG_FREE_BLOCK (1u << 1) // first page of a free block in the pmm
+
 // helpers
 static inline bool page_is_free(const vm_page_t* page) {
     return page->state == VM_PAGE_STATE_FREE;
@@ -89,6 +89,9 @@ protected:
 // DEAD, then the VmAddressRegion is invalid and has no meaning.
 //
 // All VmAddressRegion and VmMapping state is protected by the aspace lock.
+// In addition, a VmMapping's range, flags and life cycle state are only changed
+// while also holding its VmObject's lock, which lets page faults resolve under
+// the object lock alone once they have found their mapping.
 class VmAddressRegionOrMapping : public mxtl::RefCounted<VmAddressRegionOrMapping> {
 public:
     // If a VMO-mapping, unmap all pages and remove dependency on vm object it has a ref to.
@@ -113,7 +116,8 @@ public:
     mxtl::RefPtr<VmMapping> as_vm_mapping();
 
     // Page fault in an address within the region.  Recursively traverses
-    // the regions to find the target mapping, if it exists.
+    // the regions to find the target mapping, if it exists.  Must be called
+    // without the aspace lock held.
     virtual status_t PageFault(vaddr_t va, uint pf_flags) = 0;
 
     // WAVL tree key function
@@ -459,6 +463,12 @@ private:
     // Version of Destroy() that does not acquire the aspace lock
     status_t DestroyLocked() override;
 
+    // Implementation for PageFault(), given the object_ that was read while
+    // finding this mapping under the aspace lock.  Does not acquire the aspace
+    // lock; returns ERR_INTERRUPTED_RETRY if the mapping no longer covers |va|,
+    // in which case the caller should look |va| up again.
+    status_t PageFault(vaddr_t va, uint pf_flags, const mxtl::RefPtr<VmObject>& object);
+
     // Implementation for Unmap().  This does not acquire the aspace lock, and
     // supports partial unmapping.
     status_t UnmapLocked(vaddr_t base, size_t size);
@@ -476,6 +486,29 @@ private:
     // in Clang around capability aliasing, we need to relax the analysis.
     void ActivateLocked();
 
+    // Change the permissions of, or unmap, part of our range in the arch
+    // aspace.  These acquire the aspace's arch lock.
+    void ArchProtect(vaddr_t base, size_t size, uint mmu_flags);
+    status_t ArchUnmap(vaddr_t base, size_t size) const;
+
+    // Map |count| physically contiguous pages starting at |va|, falling back to
+    // mapping them one at a time if the run cannot be mapped as a whole.
+    // Requires the aspace's arch lock.
+    void MapPagesLocked(vaddr_t va, paddr_t pa, size_t count, uint mmu_flags);
+
+    // If the object holds the whole large page around a just-faulted |va| as one
+    // aligned physical run starting from |pa|'s large page, map all of it with
+    // a single large page.  Returns false, having mapped nothing, otherwise.
+    // Requires the aspace's arch lock, and should be annotated
+    // TA_REQ(object_->lock()), see ActivateLocked().
+    bool MapLargePageLocked(vaddr_t va, paddr_t pa);
+
+    // Map the pages around a just-faulted |va| that the object already has
+    // committed, so that touching them does not take another fault.
+    // Requires the aspace's arch lock, and should be annotated
+    // TA_REQ(object_->lock()), see ActivateLocked().
+    void FaultAroundLocked(vaddr_t va, uint mmu_flags);
+
     // pointer and region of the object we are mapping
     mxtl::RefPtr<VmObject> object_;
     uint64_t object_offset_ = 0;
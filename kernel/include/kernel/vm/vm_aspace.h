@@ -142,6 +142,12 @@ protected:
     friend class VmMapping;
     mutex_t* lock() { return &lock_; }
 
+    // Page faults hold lock_ only long enough to find their mapping, so the
+    // arch page tables are serialized separately.  Anything that walks or
+    // changes arch_aspace_ on behalf of a mapping takes this, after lock_ and
+    // the VmObject lock.
+    mutex_t* arch_lock() { return &arch_lock_; }
+
     // Expose the PRNG for ASLR to VmAddressRegion
     crypto::PRNG& AslrPrng() {
         DEBUG_ASSERT(aslr_enabled_);
@@ -177,6 +183,9 @@ private:
 
     mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
 
+    // see arch_lock()
+    mutex_t arch_lock_ = MUTEX_INITIAL_VALUE(arch_lock_);
+
     // root of virtual address space
     // Access to this reference is guarded by lock_.
     mxtl::RefPtr<VmAddressRegion> root_vmar_;
@@ -157,6 +157,12 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // get the physical address of the page at the specified offset, but only if this object
+    // already holds it. never faults in, copies or borrows a page from a parent.
+    virtual status_t GetCommittedPageLocked(uint64_t offset, paddr_t* pa) TA_REQ(lock_) {
+        return ERR_NOT_SUPPORTED;
+    }
+
     Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
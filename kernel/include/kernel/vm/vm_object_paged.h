@@ -67,6 +67,8 @@ public:
         // Calls a Locked method of the parent, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    status_t GetCommittedPageLocked(uint64_t offset, paddr_t* pa) override TA_REQ(lock_);
+
     status_t CloneCOW(uint64_t offset, uint64_t size, bool copy_name,
                       mxtl::RefPtr<VmObject>* clone_vmo) override
         // Calls a Locked method of the child, which confuses analysis.
@@ -108,9 +110,15 @@ private:
     // set our offset within our parent
     status_t SetParentOffsetLocked(uint64_t o) TA_REQ(lock_);
 
+    // returns true if none of the pages in the page aligned range are committed
+    bool IsRangeUncommittedLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
+
     // maximum size of a VMO is one page less than the full 64bit range
     static const uint64_t MAX_SIZE = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
 
+    // number of pages in a large page, which CommitRange tries to allocate together
+    static const size_t kLargePageCount = LARGE_PAGE_SIZE / PAGE_SIZE;
+
     // members
     uint64_t size_ TA_GUARDED(lock_) = 0;
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
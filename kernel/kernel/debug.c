@@ -20,6 +20,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <kernel/mutex.h>
 #include <kernel/percpu.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
@@ -34,6 +35,7 @@ static int cmd_thread(int argc, const cmd_args *argv, uint32_t flags);
 static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags);
 static int cmd_threadload(int argc, const cmd_args *argv, uint32_t flags);
 static int cmd_kill(int argc, const cmd_args *argv, uint32_t flags);
+static int cmd_mutexstats(int argc, const cmd_args *argv, uint32_t flags);
 
 STATIC_COMMAND_START
 #if LK_DEBUGLEVEL > 1
@@ -42,6 +44,7 @@ STATIC_COMMAND_MASKED("thread", "list kernel threads with options", &cmd_thread,
 STATIC_COMMAND("threadstats", "thread level statistics", &cmd_threadstats)
 STATIC_COMMAND("threadload", "toggle thread load display", &cmd_threadload)
 STATIC_COMMAND("kill", "kill a thread", &cmd_kill)
+STATIC_COMMAND("mutexstats", "most contended mutexes", &cmd_mutexstats)
 STATIC_COMMAND_END(kernel);
 
 #if LK_DEBUGLEVEL > 1
@@ -93,6 +96,9 @@ static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
         printf("\tcontext_switches: %lu\n", percpu[i].stats.context_switches);
         printf("\tpreempts: %lu\n", percpu[i].stats.preempts);
         printf("\tyields: %lu\n", percpu[i].stats.yields);
+        printf("\tsteals: %lu\n", percpu[i].stats.steals);
+        printf("\thandoffs: %lu\n", percpu[i].stats.handoffs);
+        printf("\trun queue length: %u\n", percpu[i].run_queue_len);
         printf("\tinterrupts: %lu\n", percpu[i].stats.interrupts);
         printf("\ttimer interrupts: %lu\n", percpu[i].stats.timer_ints);
         printf("\ttimers: %lu\n", percpu[i].stats.timers);
@@ -197,4 +203,26 @@ static int cmd_kill(int argc, const cmd_args *argv, uint32_t flags)
     return 0;
 }
 
+static int cmd_mutexstats(int argc, const cmd_args *argv, uint32_t flags)
+{
+    if (argc >= 2 && !strcmp(argv[1].str, "reset")) {
+        reset_mutex_stats();
+        return 0;
+    }
+
+    uint count = 16;
+    if (argc >= 2) {
+        if (argv[1].u == 0) {
+            printf("usage:\n");
+            printf("%s [count]\n", argv[0].str);
+            printf("%s reset\n", argv[0].str);
+            return -1;
+        }
+        count = (uint)argv[1].u;
+    }
+
+    dump_mutex_stats(count);
+    return 0;
+}
+
 #endif // WITH_LIB_CONSOLE
@@ -18,6 +18,7 @@
 #include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/sched.h>
 #include <kernel/spinlock.h>
 #include <kernel/stats.h>
 #include <kernel/timer.h>
@@ -312,6 +313,9 @@ status_t mp_unplug_cpu(uint cpu_id) {
     /* Now that the CPU is no longer processing tasks, move all of its timers */
     timer_transition_off_cpu(cpu_id);
 
+    /* ...and any threads still waiting in its run queue */
+    sched_transition_off_cpu(cpu_id);
+
     status = platform_mp_cpu_unplug(cpu_id);
     if (status != NO_ERROR) {
         /* Do not cleanup the unplug thread in this case.  We have successfully
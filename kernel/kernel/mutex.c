@@ -21,12 +21,124 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <platform.h>
+#include <stdio.h>
+#include <string.h>
+#include <arch/ops.h>
+#include <kernel/percpu.h>
 #include <kernel/thread.h>
 #include <kernel/sched.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
 
+/* how long a contended acquire spins on a running owner before blocking */
+#define MUTEX_SPIN_MAX_DURATION LK_USEC(10)
+
+/* Contention counters live in a small table hashed by mutex address rather
+ * than in mutex_t, so they cost nothing until a mutex is actually contended.
+ * A mutex that finds no free slot within MUTEX_STATS_PROBE tries is only
+ * counted in mutex_stats_dropped.
+ */
+#define MUTEX_STATS_SHIFT 8
+#define MUTEX_STATS_SLOTS (1u << MUTEX_STATS_SHIFT)
+#define MUTEX_STATS_PROBE 8u
+
+struct mutex_stats {
+    uint64_t mutex;     /* address of the mutex, 0 if the slot is free */
+    uint64_t caller;    /* caller of the contended acquire that took the slot */
+    uint64_t contended; /* acquires that found the mutex held */
+    uint64_t spun;      /* contended acquires that got it by spinning */
+    uint64_t blocked;   /* contended acquires that had to block */
+};
+
+static struct mutex_stats mutex_stats[MUTEX_STATS_SLOTS];
+static uint64_t mutex_stats_dropped;
+
+static struct mutex_stats *mutex_stats_find(const mutex_t *m, bool claim)
+{
+    uint64_t key = (uintptr_t)m;
+    uint slot = (uint)((key * 0x9E3779B97F4A7C15ull) >> (64 - MUTEX_STATS_SHIFT));
+
+    for (uint i = 0; i < MUTEX_STATS_PROBE; i++) {
+        struct mutex_stats *s = &mutex_stats[(slot + i) % MUTEX_STATS_SLOTS];
+        uint64_t cur = atomic_load_u64_relaxed(&s->mutex);
+        if (cur == key)
+            return s;
+        if (cur == 0 && claim) {
+            if (atomic_cmpxchg_u64(&s->mutex, &cur, key))
+                return s;
+            if (cur == key)
+                return s;
+        }
+    }
+    return NULL;
+}
+
+static struct mutex_stats *mutex_stats_contended(const mutex_t *m, void *caller)
+{
+    struct mutex_stats *s = mutex_stats_find(m, true);
+    if (unlikely(!s)) {
+        atomic_add_u64(&mutex_stats_dropped, 1);
+        return NULL;
+    }
+    if (atomic_add_u64(&s->contended, 1) == 0)
+        s->caller = (uintptr_t)caller;
+    return s;
+}
+
+static inline void mutex_stats_inc(uint64_t *counter)
+{
+    atomic_add_u64(counter, 1);
+}
+
+/* Is |t| running on some cpu right now? Only compares pointers, since |t|
+ * may exit and be freed at any time. |cpu_hint| caches where it was last
+ * seen so that the common case reads a single percpu slot.
+ */
+static bool mutex_owner_running(const thread_t *t, uint *cpu_hint)
+{
+    if (__atomic_load_n(&percpu[*cpu_hint].running_thread, __ATOMIC_RELAXED) == t)
+        return true;
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (__atomic_load_n(&percpu[i].running_thread, __ATOMIC_RELAXED) == t) {
+            *cpu_hint = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Spin on a held mutex while its owner runs on another cpu, on the theory
+ * that it will release soon and that's cheaper than blocking and waking up.
+ * Gives up once the owner stops running, waiters are queued (release hands
+ * a queued mutex straight to the first waiter) or the spin budget is spent.
+ */
+static bool mutex_spin(mutex_t *m, thread_t *ct)
+{
+    uint cpu_hint = 0;
+    lk_time_t deadline = current_time() + MUTEX_SPIN_MAX_DURATION;
+
+    for (;;) {
+        uintptr_t val = mutex_val(m);
+        if (val == 0) {
+            if (atomic_cmpxchg_u64(&m->val, &val, (uintptr_t)ct))
+                return true;
+            continue;
+        }
+
+        if (val & MUTEX_FLAG_QUEUED)
+            return false;
+        if (!mutex_owner_running((const thread_t *)val, &cpu_hint))
+            return false;
+        if (current_time() >= deadline)
+            return false;
+
+        arch_spinloop_pause();
+    }
+}
+
 /**
  * @brief  Initialize a mutex_t
  */
@@ -60,6 +172,16 @@ void mutex_destroy(mutex_t *m)
     m->val = 0;
     wait_queue_destroy(&m->wait);
     THREAD_UNLOCK(state);
+
+    // release the contention slot so the address can be reused
+    struct mutex_stats *s = mutex_stats_find(m, false);
+    if (s) {
+        s->caller = 0;
+        s->contended = 0;
+        s->spun = 0;
+        s->blocked = 0;
+        atomic_store_u64(&s->mutex, 0);
+    }
 }
 
 /**
@@ -71,6 +193,7 @@ void mutex_acquire(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
     DEBUG_ASSERT(!arch_in_int_handler());
 
     thread_t *ct = get_current_thread();
+    struct mutex_stats *stats = NULL;
     uintptr_t oldval;
 
 retry:
@@ -87,6 +210,16 @@ retry:
               ct, ct->name, m);
 #endif
 
+    if (!stats)
+        stats = mutex_stats_contended(m, __GET_CALLER());
+
+    // the owner may be about to release it, try spinning before blocking
+    if (mutex_spin(m, ct)) {
+        if (stats)
+            mutex_stats_inc(&stats->spun);
+        return;
+    }
+
     // we contended with someone else, will probably need to block
     THREAD_LOCK(state);
 
@@ -105,6 +238,8 @@ retry:
     }
 
     // we have signalled that we're blocking, so drop into the wait queue
+    if (stats)
+        mutex_stats_inc(&stats->blocked);
     status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
     if (unlikely(ret < NO_ERROR)) {
         // mutexes are not interruptable and cannot time out, so it
@@ -192,3 +327,51 @@ void mutex_release_thread_locked(mutex_t *m, bool reschedule) TA_NO_THREAD_SAFET
     // the thread_lock
     mutex_release_internal(m, reschedule, true);
 }
+
+/**
+ * @brief  Print the most contended mutexes
+ *
+ * Lists up to |count| mutexes by number of contended acquires, along with
+ * the caller of the first contended acquire to help identify them.
+ */
+void dump_mutex_stats(uint count)
+{
+    uint64_t printed[MUTEX_STATS_SLOTS / 64] = { 0 };
+
+    printf("%18s %18s %10s %10s %10s\n", "mutex", "caller", "contended", "spun", "blocked");
+    for (uint n = 0; n < count; n++) {
+        uint best = MUTEX_STATS_SLOTS;
+        uint64_t best_contended = 0;
+        for (uint i = 0; i < MUTEX_STATS_SLOTS; i++) {
+            uint64_t contended = atomic_load_u64_relaxed(&mutex_stats[i].contended);
+            if ((printed[i / 64] & (1ull << (i % 64))) || contended <= best_contended)
+                continue;
+            best = i;
+            best_contended = contended;
+        }
+        if (best == MUTEX_STATS_SLOTS)
+            break;
+
+        printed[best / 64] |= 1ull << (best % 64);
+        const struct mutex_stats *s = &mutex_stats[best];
+        printf("%#18" PRIx64 " %#18" PRIx64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+               s->mutex, s->caller, best_contended, s->spun, s->blocked);
+    }
+
+    uint64_t dropped = atomic_load_u64_relaxed(&mutex_stats_dropped);
+    if (dropped)
+        printf("%" PRIu64 " contended acquires not tracked (table full)\n", dropped);
+}
+
+/**
+ * @brief  Zero the contention counters of all mutexes
+ */
+void reset_mutex_stats(void)
+{
+    for (uint i = 0; i < MUTEX_STATS_SLOTS; i++) {
+        atomic_store_u64(&mutex_stats[i].contended, 0);
+        atomic_store_u64(&mutex_stats[i].spun, 0);
+        atomic_store_u64(&mutex_stats[i].blocked, 0);
+    }
+    atomic_store_u64(&mutex_stats_dropped, 0);
+}
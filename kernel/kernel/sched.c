@@ -16,11 +16,9 @@
 #include <lib/ktrace.h>
 #include <kernel/mp.h>
 #include <kernel/percpu.h>
+#include <kernel/stats.h>
 #include <kernel/thread.h>
 
-/* legacy implementation that just broadcast ipis for every reschedule */
-#define BROADCAST_RESCHEDULE 0
-
 /* disable priority boosting */
 #define NO_BOOST 0
 
@@ -37,17 +35,15 @@
 #define LOCAL_KTRACE2(probe, x, y)
 #endif
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
-
-/* make sure the bitmap is large enough to cover our number of priorities */
-static_assert(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * CHAR_BIT, "");
+/* make sure the per cpu bitmap is large enough to cover our number of priorities */
+static_assert(NUM_PRIORITIES <= sizeof(percpu[0].run_queue_bitmap) * CHAR_BIT, "");
 
 /* compute the effective priority of a thread */
 static int effec_priority(const thread_t *t)
 {
     int ep = t->base_priority + t->priority_boost;
+    if (unlikely(t->inherited_priority > ep))
+        ep = t->inherited_priority;
     DEBUG_ASSERT(ep >= LOWEST_PRIORITY && ep <= HIGHEST_PRIORITY);
     return ep;
 }
@@ -101,123 +97,303 @@ static void deboost_thread(thread_t *t, bool quantum_expiration)
     t->priority_boost--;
 }
 
-/* pick a 'random' cpu */
-static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
+/* compute the highest priority run queue with a thread in it from a bitmap */
+static uint highest_run_queue(uint32_t bitmap)
 {
-    if (unlikely(mask == 0))
-        return 0;
-
-    /* check that the mask passed in has at least one bit set in the online mask */
-    mp_cpu_mask_t online = mp_get_online_mask();
-    if (unlikely((mask & online) == 0))
-        return 0;
+    DEBUG_ASSERT(bitmap != 0);
 
-    /* compute the highest online cpu */
-    uint highest_cpu = (sizeof(mp_cpu_mask_t) * CHAR_BIT - 1) - __builtin_clz(online);
-
-    /* not very random, round robins a bit through the mask until it gets a hit */
-    for (;;) {
-        /* protected by THREAD_LOCK, safe to use non atomically */
-        static uint rot = 0;
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap)
+           - (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+}
 
-        if (++rot > highest_cpu)
-            rot = 0;
+/* is the thread allowed to run on the cpu */
+static bool thread_can_run_on(const thread_t *t, uint cpu)
+{
+    return likely(t->pinned_cpu < 0) || (uint)t->pinned_cpu == cpu;
+}
 
-        if ((1u << rot) & mask)
-            return (1u << rot);
+/* pick the least loaded cpu out of a mask, starting the search at the
+ * cpu the thread last ran on so that ties are broken in favor of cpus
+ * closest to it.
+ */
+static uint least_loaded_cpu(mp_cpu_mask_t mask, uint last_cpu)
+{
+    DEBUG_ASSERT(mask != 0);
+
+    uint best_cpu = 0;
+    uint32_t best_len = UINT32_MAX;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        uint cpu = (last_cpu + i) % SMP_MAX_CPUS;
+        if ((mask & (1u << cpu)) == 0)
+            continue;
+
+        if (percpu[cpu].run_queue_len < best_len) {
+            best_cpu = cpu;
+            best_len = percpu[cpu].run_queue_len;
+        }
     }
+
+    return best_cpu;
 }
 
-/* find a cpu to wake up */
-static mp_cpu_mask_t find_cpu(thread_t *t)
+/* find a cpu to run a newly ready thread on */
+static uint find_cpu(thread_t *t)
 {
-    if (BROADCAST_RESCHEDULE)
-        return MP_CPU_ALL_BUT_LOCAL;
+    /* pinned threads only ever go in their pinned cpu's queue */
+    if (unlikely(t->pinned_cpu >= 0))
+        return (uint)t->pinned_cpu;
 
     /* get the last cpu the thread ran on */
-    mp_cpu_mask_t last_ran_cpu_mask = (1u << thread_last_cpu(t));
+    uint last_cpu = thread_last_cpu(t);
+    mp_cpu_mask_t last_ran_cpu_mask = (1u << last_cpu);
 
     /* the current cpu */
-    mp_cpu_mask_t curr_cpu_mask = (1u << arch_curr_cpu_num());
+    uint curr_cpu = arch_curr_cpu_num();
+    mp_cpu_mask_t curr_cpu_mask = (1u << curr_cpu);
+
+    /* cpus we can place the thread on. avoid cpus running real time threads,
+     * since they will not be interrupted to pick up the new thread.
+     */
+    mp_cpu_mask_t candidates = mp_get_active_mask() & ~mp_get_realtime_mask();
+    if (unlikely(candidates == 0))
+        return curr_cpu;
 
     /* get a list of idle cpus */
-    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask();
+    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask() & candidates;
     if (idle_cpu_mask != 0) {
         if (idle_cpu_mask & curr_cpu_mask) {
             /* the current cpu is idle, so run it here */
-            return 0;
+            return curr_cpu;
         }
 
         if (last_ran_cpu_mask & idle_cpu_mask) {
             /* the last core it ran on is idle and isn't the current cpu */
-            return last_ran_cpu_mask;
+            return last_cpu;
         }
 
-        /* pick an idle_cpu */
-        return rand_cpu(idle_cpu_mask);
+        /* pick the idle cpu closest to the one it last ran on */
+        return least_loaded_cpu(idle_cpu_mask, last_cpu);
     }
 
-    /* no idle cpus */
-    if (last_ran_cpu_mask == curr_cpu_mask) {
-        /* the last cpu it ran on is us */
-        /* pick a random cpu that isn't the current one */
-        return rand_cpu(mp_get_online_mask() & ~(curr_cpu_mask));
-    } else {
-        /* pick the last cpu it ran on */
-        return last_ran_cpu_mask;
+    /* no idle cpus. stay on the last cpu it ran on, since it's likely to still have
+     * some of the thread's working set in cache, unless that cpu's queue is noticeably
+     * longer than the least loaded one.
+     */
+    uint best_cpu = least_loaded_cpu(candidates, last_cpu);
+    if ((last_ran_cpu_mask & candidates) &&
+        percpu[last_cpu].run_queue_len <= percpu[best_cpu].run_queue_len + 1) {
+        return last_cpu;
     }
+
+    return best_cpu;
 }
 
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+static void insert_in_run_queue_head(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
     int ep = effec_priority(t);
 
-    list_add_head(&run_queue[ep], &t->queue_node);
-    run_queue_bitmap |= (1u << ep);
+    list_add_head(&percpu[cpu].run_queue[ep], &t->queue_node);
+    percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
+    t->queue_cpu = cpu;
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static void insert_in_run_queue_tail(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
     int ep = effec_priority(t);
 
-    list_add_tail(&run_queue[ep], &t->queue_node);
-    run_queue_bitmap |= (1u << ep);
+    list_add_tail(&percpu[cpu].run_queue[ep], &t->queue_node);
+    percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
+    t->queue_cpu = cpu;
 }
 
-thread_t *sched_get_top_thread(uint cpu)
+static void remove_from_run_queue(uint cpu, uint queue, thread_t *t)
+{
+    list_delete(&t->queue_node);
+
+    if (list_is_empty(&percpu[cpu].run_queue[queue]))
+        percpu[cpu].run_queue_bitmap &= ~(1u << queue);
+
+    DEBUG_ASSERT(percpu[cpu].run_queue_len > 0);
+    percpu[cpu].run_queue_len--;
+}
+
+/* the cpu that the current thread goes back in the queue of when it stops running */
+static uint requeue_cpu(const thread_t *t)
+{
+    uint cpu = arch_curr_cpu_num();
+    if (unlikely(!thread_can_run_on(t, cpu)))
+        cpu = (uint)t->pinned_cpu;
+    return cpu;
+}
+
+/* put a thread that has just become ready in the best cpu's queue and poke that cpu */
+static void place_ready_thread(thread_t *t)
+{
+    thread_t *current_thread = get_current_thread();
+    uint curr_cpu = arch_curr_cpu_num();
+
+    /* the current thread is handing off to this one: queue it to run here next,
+     * donating what is left of our time slice */
+    if (unlikely(current_thread->handoff == THREAD_HANDOFF_ARMED) &&
+        !arch_in_int_handler() && thread_can_run_on(t, curr_cpu)) {
+        current_thread->handoff = THREAD_HANDOFF_DONE;
+        if (t->remaining_time_slice < current_thread->remaining_time_slice)
+            t->remaining_time_slice = current_thread->remaining_time_slice;
+
+        insert_in_run_queue_head(curr_cpu, t);
+        CPU_STATS_INC(handoffs);
+        LOCAL_KTRACE0("sched_handoff");
+        return;
+    }
+
+    uint cpu = find_cpu(t);
+
+    insert_in_run_queue_head(cpu, t);
+
+    if (cpu != arch_curr_cpu_num())
+        mp_reschedule(1u << cpu, 0);
+}
+
+/* pull the highest priority runnable thread out of a cpu's queue */
+static thread_t *dequeue_top_thread(uint queue_cpu, uint cpu)
 {
     thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+    uint32_t local_run_queue_bitmap = percpu[queue_cpu].run_queue_bitmap;
 
     while (local_run_queue_bitmap) {
         /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
+        uint next_queue = highest_run_queue(local_run_queue_bitmap);
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
-            if (likely(newthread->pinned_cpu < 0) || (uint)newthread->pinned_cpu == cpu) {
-                list_delete(&newthread->queue_node);
+        list_for_every_entry(&percpu[queue_cpu].run_queue[next_queue], newthread, thread_t, queue_node) {
+            if (thread_can_run_on(newthread, cpu)) {
+                remove_from_run_queue(queue_cpu, next_queue, newthread);
+                return newthread;
+            }
+        }
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+        local_run_queue_bitmap &= ~(1u << next_queue);
+    }
 
-                LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
+    return NULL;
+}
 
-                return newthread;
-            }
+/* the local queue is empty, try to take work from the busiest other cpu */
+static thread_t *steal_thread(uint cpu)
+{
+    /* find the cpu with the highest priority work queued, preferring longer queues */
+    uint victim = cpu;
+    uint victim_queue = 0;
+    uint32_t victim_len = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i == cpu || percpu[i].run_queue_bitmap == 0)
+            continue;
+
+        uint top = highest_run_queue(percpu[i].run_queue_bitmap);
+
+        /* a queued thread waits behind the one running on its cpu, so it is
+         * worth taking, unless that cpu is idle and about to run it itself.
+         * cpus that are not active any more will never drain their queue.
+         */
+        if (mp_is_cpu_active(i) && (mp_get_idle_mask() & (1u << i)))
+            continue;
+
+        if (victim == cpu || top > victim_queue ||
+            (top == victim_queue && percpu[i].run_queue_len > victim_len)) {
+            victim = i;
+            victim_queue = top;
+            victim_len = percpu[i].run_queue_len;
         }
+    }
+
+    if (victim == cpu)
+        return NULL;
+
+    thread_t *t = dequeue_top_thread(victim, cpu);
+    if (t) {
+        CPU_STATS_INC(steals);
+        LOCAL_KTRACE2("sched_steal", victim, cpu);
+    }
+    return t;
+}
+
+thread_t *sched_get_top_thread(uint cpu)
+{
+    thread_t *newthread = dequeue_top_thread(cpu, cpu);
+
+    /* nothing local to run, go look for work elsewhere before idling */
+    if (!newthread)
+        newthread = steal_thread(cpu);
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+    if (newthread) {
+        LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
+        return newthread;
     }
+
     /* no threads to run, select the idle thread for this cpu */
     return &percpu[cpu].idle_thread;
 }
 
+void sched_balance(uint cpu)
+{
+    /* cpus only steal on their way to idle, so one that went idle before
+     * this cpu's queue built up has to be woken up to notice it.  this runs
+     * without the thread lock; a stale length only costs a spurious ipi. */
+    if (percpu[cpu].run_queue_len == 0)
+        return;
+
+    mp_cpu_mask_t idle = mp_get_idle_mask() & mp_get_active_mask() & ~(1u << cpu);
+    if (idle == 0)
+        return;
+
+    LOCAL_KTRACE2("sched_balance", cpu, idle);
+    mp_reschedule(1u << __builtin_ctz(idle), 0);
+}
+
+int sched_effective_priority(const thread_t *t)
+{
+    return effec_priority(t);
+}
+
+/* take a ready thread out of the run queue it sits in */
+static uint unqueue_ready_thread(thread_t *t)
+{
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+
+    uint cpu = t->queue_cpu;
+    remove_from_run_queue(cpu, effec_priority(t), t);
+    return cpu;
+}
+
+void sched_inherit_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(priority >= LOWEST_PRIORITY && priority <= HIGHEST_PRIORITY);
+
+    LOCAL_KTRACE2("sched_inherit", t->inherited_priority, priority);
+
+    /* a running or blocked thread picks up the new priority the next time it
+     * is queued; a ready one has to move to the queue of its new priority */
+    if (t->state != THREAD_READY || thread_is_idle(t)) {
+        t->inherited_priority = priority;
+        return;
+    }
+
+    uint cpu = unqueue_ready_thread(t);
+    t->inherited_priority = priority;
+    insert_in_run_queue_head(cpu, t);
+
+    if (cpu != arch_curr_cpu_num())
+        mp_reschedule(1u << cpu, 0);
+}
+
 void sched_block(void)
 {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
@@ -246,9 +422,7 @@ void sched_unblock(thread_t *t)
 
     /* stuff the new thread in the run queue */
     t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-
-    mp_reschedule(find_cpu(t), 0);
+    place_ready_thread(t);
 }
 
 void sched_unblock_list(struct list_node *list)
@@ -269,9 +443,7 @@ void sched_unblock_list(struct list_node *list)
 
         /* stuff the new thread in the run queue */
         t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
-
-        mp_reschedule(find_cpu(t), 0);
+        place_ready_thread(t);
     }
 }
 
@@ -289,7 +461,7 @@ void sched_yield(void)
     /* consume the rest of the time slice, deboost ourself, and go to the end of the queue */
     current_thread->remaining_time_slice = 0;
     deboost_thread(current_thread, false);
-    insert_in_run_queue_tail(current_thread);
+    insert_in_run_queue_tail(requeue_cpu(current_thread), current_thread);
 
     _thread_resched_internal();
 }
@@ -307,12 +479,13 @@ void sched_preempt(void)
 
     /* idle thread doesn't go in the run queue */
     if (likely(!thread_is_idle(current_thread))) {
+        uint cpu = requeue_cpu(current_thread);
         if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(current_thread);
+            insert_in_run_queue_head(cpu, current_thread);
         } else {
             /* if we're out of quantum, deboost the thread and put it at the tail of the queue */
             deboost_thread(current_thread, true);
-            insert_in_run_queue_tail(current_thread);
+            insert_in_run_queue_tail(cpu, current_thread);
         }
     }
 
@@ -336,20 +509,52 @@ void sched_reschedule(void)
         /* deboost the current thread */
         deboost_thread(current_thread, false);
 
-        if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(current_thread);
+        /* after a handoff, go behind the thread we handed off to */
+        uint cpu = requeue_cpu(current_thread);
+        if (current_thread->handoff == THREAD_HANDOFF_DONE) {
+            insert_in_run_queue_tail(cpu, current_thread);
+        } else if (current_thread->remaining_time_slice > 0) {
+            insert_in_run_queue_head(cpu, current_thread);
         } else {
-            insert_in_run_queue_tail(current_thread);
+            insert_in_run_queue_tail(cpu, current_thread);
         }
     }
 
     _thread_resched_internal();
 }
 
+/* move all of the threads queued on a cpu that is going offline to the current cpu */
+void sched_transition_off_cpu(uint old_cpu)
+{
+    DEBUG_ASSERT(old_cpu != arch_curr_cpu_num());
+
+    THREAD_LOCK(state);
+
+    uint cpu = arch_curr_cpu_num();
+    for (uint queue = 0; queue < NUM_PRIORITIES; queue++) {
+        thread_t *t;
+        thread_t *temp;
+        list_for_every_entry_safe(&percpu[old_cpu].run_queue[queue], t, temp, thread_t, queue_node) {
+            /* threads pinned to the old cpu have nowhere else to go */
+            if (!thread_can_run_on(t, cpu))
+                continue;
+
+            remove_from_run_queue(old_cpu, queue, t);
+            insert_in_run_queue_tail(cpu, t);
+        }
+    }
+
+    THREAD_UNLOCK(state);
+}
+
 void sched_init_early(void)
 {
     /* initialize the run queues */
-    for (unsigned int i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (uint i = 0; i < NUM_PRIORITIES; i++)
+            list_initialize(&percpu[cpu].run_queue[i]);
+        percpu[cpu].run_queue_bitmap = 0;
+        percpu[cpu].run_queue_len = 0;
+    }
 }
 
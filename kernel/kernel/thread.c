@@ -717,6 +717,9 @@ void _thread_resched_internal(void)
 
     CPU_STATS_INC(reschedules);
 
+    /* whatever happens next, any handoff has run its course */
+    current_thread->handoff = THREAD_HANDOFF_NONE;
+
     /* pick a new thread to run */
     thread_t *newthread = sched_get_top_thread(cpu);
 
@@ -741,6 +744,7 @@ void _thread_resched_internal(void)
 
     /* mark the cpu ownership of the threads */
     thread_set_last_cpu(newthread, cpu);
+    __atomic_store_n(&percpu[cpu].running_thread, newthread, __ATOMIC_RELAXED);
 
     /* set the cpu state based on the new thread we've picked */
     if (thread_is_idle(newthread)) {
@@ -899,6 +903,33 @@ void thread_reschedule(void)
     THREAD_UNLOCK(state);
 }
 
+int thread_effective_priority(const thread_t *t)
+{
+    return sched_effective_priority(t);
+}
+
+void thread_set_inherited_priority(thread_t *t, int priority)
+{
+    THREAD_LOCK(state);
+    if (priority != t->inherited_priority)
+        sched_inherit_priority(t, priority);
+    THREAD_UNLOCK(state);
+}
+
+void thread_handoff_begin(void)
+{
+    get_current_thread()->handoff = THREAD_HANDOFF_ARMED;
+}
+
+void thread_handoff_end(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    /* a completed handoff stays pending until we next leave the cpu */
+    if (current_thread->handoff == THREAD_HANDOFF_ARMED)
+        current_thread->handoff = THREAD_HANDOFF_NONE;
+}
+
 enum handler_return thread_timer_tick(void)
 {
     thread_t *current_thread = get_current_thread();
@@ -906,6 +937,8 @@ enum handler_return thread_timer_tick(void)
     if (thread_is_real_time_or_idle(current_thread))
         return INT_NO_RESCHEDULE;
 
+    sched_balance(arch_curr_cpu_num());
+
     current_thread->remaining_time_slice -= MIN(THREAD_TICK_RATE, current_thread->remaining_time_slice);
 
     ktrace_probe2("timer_tick", (uint32_t)current_thread->user_tid, current_thread->remaining_time_slice);
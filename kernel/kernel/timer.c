@@ -35,40 +35,261 @@
 
 #define LOCAL_TRACE 0
 
+/* Timers are kept in a per cpu hierarchical timing wheel. Level 0 has
+ * TIMER_WHEEL_SLOTS slots of 2^TIMER_WHEEL_TICK_SHIFT ns each and every level
+ * above it has slots TIMER_WHEEL_SLOTS times as wide as the one below. A timer
+ * is hashed into the lowest level whose range covers its deadline, so arming
+ * and canceling are O(1). As the wheel advances, the slot of a higher level
+ * that comes due is cascaded down into the levels beneath it. Timers beyond
+ * the range of the top level sit on an overflow list that is redistributed
+ * every time the top level wraps.
+ *
+ * With 1ms slots and 5 levels of 64 the wheel spans about 13 days.
+ */
+#define TIMER_WHEEL_TICK_SHIFT 20
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
 static spin_lock_t timer_lock;
 
 static enum handler_return timer_tick(void *arg, lk_time_t now);
 
-/**
- * @brief  Initialize a timer object
- */
-void timer_initialize(timer_t *timer)
+static inline uint wheel_level_shift(uint level)
 {
-    *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
+    return level * TIMER_WHEEL_SLOT_BITS;
+}
+
+static inline uint64_t wheel_time_to_tick(lk_time_t t)
+{
+    return t >> TIMER_WHEEL_TICK_SHIFT;
+}
+
+static inline lk_time_t wheel_tick_to_time(uint64_t tick)
+{
+    if (tick > (INFINITE_TIME >> TIMER_WHEEL_TICK_SHIFT))
+        return INFINITE_TIME;
+    return tick << TIMER_WHEEL_TICK_SHIFT;
+}
+
+/* rotate a slot bitmap so that bit 0 corresponds to slot |first| */
+static inline uint64_t wheel_rotate_bitmap(uint64_t bitmap, uint first)
+{
+    first &= TIMER_WHEEL_SLOT_MASK;
+    if (first == 0)
+        return bitmap;
+    return (bitmap >> first) | (bitmap << (TIMER_WHEEL_SLOTS - first));
+}
+
+/* the latest time the timer is allowed to fire at */
+static inline lk_time_t timer_fire_time(const timer_t *timer)
+{
+    lk_time_t t = timer->scheduled_time + timer->slack;
+    return (t < timer->scheduled_time) ? INFINITE_TIME : t;
 }
 
-static void insert_timer_in_queue(uint cpu, timer_t *timer)
+static bool wheel_is_empty(struct timer_wheel *w)
 {
-    timer_t *entry;
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (w->bitmap[level])
+            return false;
+    }
+    return list_is_empty(&w->overflow);
+}
 
+static void wheel_insert(struct timer_wheel *w, timer_t *timer)
+{
     DEBUG_ASSERT(arch_ints_disabled());
 
-    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 ", periodic %" PRIu64 "\n", timer, cpu, timer->scheduled_time, timer->period);
+    LTRACEF("timer %p, wheel %p, scheduled %" PRIu64 ", periodic %" PRIu64 "\n", timer, w, timer->scheduled_time, timer->period);
+
+    uint64_t tick = wheel_time_to_tick(timer->scheduled_time);
+    if (tick < w->base)
+        tick = w->base;
 
-    list_for_every_entry(&percpu[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
+    /* find the lowest level that reaches far enough out */
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint shift = wheel_level_shift(level);
+        if ((tick >> shift) - (w->base >> shift) < TIMER_WHEEL_SLOTS) {
+            uint slot = (tick >> shift) & TIMER_WHEEL_SLOT_MASK;
+            list_add_tail(&w->slots[level][slot], &timer->node);
+            w->bitmap[level] |= (1ull << slot);
             return;
         }
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+    list_add_tail(&w->overflow, &timer->node);
+}
+
+/* move the contents of a list back into the wheel relative to the current base */
+static void wheel_reinsert_list(struct timer_wheel *w, struct list_node *list)
+{
+    timer_t *timer;
+    struct list_node tmp = LIST_INITIAL_VALUE(tmp);
+
+    /* the timers may land back on the same list, so detach them first */
+    list_move(list, &tmp);
+    while ((timer = list_remove_head_type(&tmp, timer_t, node)) != NULL) {
+        wheel_insert(w, timer);
+    }
+}
+
+/* called every time the base moves, cascades the higher level slots that just came due */
+static void wheel_cascade(struct timer_wheel *w)
+{
+    if (likely(w->base & TIMER_WHEEL_SLOT_MASK))
+        return;
+
+    if ((w->base & ((1ull << wheel_level_shift(TIMER_WHEEL_LEVELS)) - 1)) == 0)
+        wheel_reinsert_list(w, &w->overflow);
+
+    for (uint level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        uint shift = wheel_level_shift(level);
+        if (w->base & ((1ull << shift) - 1))
+            continue;
+
+        uint slot = (w->base >> shift) & TIMER_WHEEL_SLOT_MASK;
+        if (w->bitmap[level] & (1ull << slot)) {
+            w->bitmap[level] &= ~(1ull << slot);
+            wheel_reinsert_list(w, &w->slots[level][slot]);
+        }
+    }
+}
+
+/* pull everything in the current level 0 slot that is due by now onto the expired list */
+static void wheel_expire_slot(struct timer_wheel *w, lk_time_t now, struct list_node *expired)
+{
+    uint slot = w->base & TIMER_WHEEL_SLOT_MASK;
+    if (!(w->bitmap[0] & (1ull << slot)))
+        return;
+
+    struct list_node *list = &w->slots[0][slot];
+    timer_t *timer, *temp;
+    list_for_every_entry_safe(list, timer, temp, timer_t, node) {
+        if (timer->scheduled_time <= now) {
+            list_delete(&timer->node);
+            list_add_tail(expired, &timer->node);
+        }
+    }
+
+    if (list_is_empty(list))
+        w->bitmap[0] &= ~(1ull << slot);
+}
+
+/* advance the wheel up to now, collecting every timer that is due */
+static void wheel_advance(struct timer_wheel *w, lk_time_t now, struct list_node *expired)
+{
+    uint64_t now_tick = wheel_time_to_tick(now);
+
+    for (;;) {
+        wheel_expire_slot(w, now, expired);
+        if (w->base >= now_tick)
+            break;
+
+        uint64_t next = w->base + 1;
+        if (w->bitmap[0] == 0) {
+            /* level 0 is empty, skip straight to the next boundary at which
+             * the lowest occupied level has something to cascade.
+             */
+            uint level = 1;
+            while (level < TIMER_WHEEL_LEVELS && w->bitmap[level] == 0)
+                level++;
+
+            if (level == TIMER_WHEEL_LEVELS && list_is_empty(&w->overflow)) {
+                next = now_tick;
+            } else {
+                uint shift = wheel_level_shift(level);
+                next = MIN(((w->base >> shift) + 1) << shift, now_tick);
+            }
+        }
+
+        w->base = next;
+        wheel_cascade(w);
+    }
 }
 
-static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, timer_callback callback, void *arg)
+/* compute when the hardware timer next needs to go off for this wheel */
+static lk_time_t wheel_next_deadline(struct timer_wheel *w)
 {
-    LTRACEF("timer %p, deadline %" PRIu64 ", period %" PRIu64 ", callback %p, arg %p\n", timer, deadline, period, callback, arg);
+    lk_time_t deadline = INFINITE_TIME;
+
+    /* the next time a higher level needs to be cascaded down */
+    for (uint level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (w->bitmap[level] == 0)
+            continue;
+
+        uint shift = wheel_level_shift(level);
+        uint64_t pos = w->base >> shift;
+        uint64_t bitmap = wheel_rotate_bitmap(w->bitmap[level], (uint)(pos + 1));
+        uint64_t tick = (pos + 1 + __builtin_ctzll(bitmap)) << shift;
+        deadline = MIN(deadline, wheel_tick_to_time(tick));
+    }
+    if (!list_is_empty(&w->overflow)) {
+        uint shift = wheel_level_shift(TIMER_WHEEL_LEVELS);
+        deadline = MIN(deadline, wheel_tick_to_time(((w->base >> shift) + 1) << shift));
+    }
+
+    /* walk the occupied level 0 slots in order. Each timer may fire as late as
+     * its deadline plus slack, so keep going while a slot could still hold a
+     * timer that has to fire sooner than what we have.
+     */
+    uint64_t bitmap = wheel_rotate_bitmap(w->bitmap[0], (uint)w->base);
+    while (bitmap) {
+        uint offset = __builtin_ctzll(bitmap);
+        bitmap &= bitmap - 1;
+
+        uint64_t tick = w->base + offset;
+        if (wheel_tick_to_time(tick) >= deadline)
+            break;
+
+        uint slot = tick & TIMER_WHEEL_SLOT_MASK;
+        if (list_is_empty(&w->slots[0][slot])) {
+            /* everything in it got canceled */
+            w->bitmap[0] &= ~(1ull << slot);
+            continue;
+        }
+
+        timer_t *timer;
+        list_for_every_entry(&w->slots[0][slot], timer, timer_t, node) {
+            deadline = MIN(deadline, timer_fire_time(timer));
+        }
+    }
+
+    return deadline;
+}
+
+/* reprogram the local hardware timer for the next event in the wheel */
+static void wheel_program(struct timer_wheel *w)
+{
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    DEBUG_ASSERT(w == &percpu[arch_curr_cpu_num()].timer_wheel);
+
+    lk_time_t deadline = wheel_next_deadline(w);
+    if (deadline == w->programmed)
+        return;
+
+    w->programmed = deadline;
+    if (deadline == INFINITE_TIME) {
+        LTRACEF("clearing old hw timer, nothing in the wheel\n");
+        platform_stop_timer();
+    } else {
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
+        platform_set_oneshot_timer(timer_tick, NULL, deadline);
+    }
+#endif
+}
+
+/**
+ * @brief  Initialize a timer object
+ */
+void timer_initialize(timer_t *timer)
+{
+    *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
+}
+
+static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, lk_time_t slack,
+                      timer_callback callback, void *arg)
+{
+    LTRACEF("timer %p, deadline %" PRIu64 ", period %" PRIu64 ", slack %" PRIu64 ", callback %p, arg %p\n",
+            timer, deadline, period, slack, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
@@ -80,6 +301,7 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
     spin_lock_irqsave(&timer_lock, state);
 
     uint cpu = arch_curr_cpu_num();
+    struct timer_wheel *w = &percpu[cpu].timer_wheel;
 
     if (unlikely(timer->active_cpu == (int)cpu)) {
         /* the timer is active on our own cpu, we must be inside the callback */
@@ -92,6 +314,7 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
     /* set up the structure */
     timer->scheduled_time = deadline;
     timer->period = period;
+    timer->slack = slack;
     timer->callback = callback;
     timer->arg = arg;
     timer->active_cpu = -1;
@@ -99,13 +322,23 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
 
     LTRACEF("scheduled time %" PRIu64 "\n", timer->scheduled_time);
 
-    insert_timer_in_queue(cpu, timer);
+    /* an empty wheel may not have moved in a long time, bring it up to date
+     * so the new timer lands as low in the hierarchy as possible.
+     */
+    if (wheel_is_empty(w))
+        w->base = MAX(w->base, wheel_time_to_tick(current_time()));
+
+    wheel_insert(w, timer);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
-        platform_set_oneshot_timer(timer_tick, NULL, deadline);
+    /* if the hardware timer is already set to go off somewhere between the
+     * deadline and deadline + slack, this timer rides along on that interrupt.
+     */
+    lk_time_t fire_time = timer_fire_time(timer);
+    if (fire_time < w->programmed) {
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", fire_time);
+        w->programmed = fire_time;
+        platform_set_oneshot_timer(timer_tick, NULL, fire_time);
     }
 #endif
 
@@ -129,7 +362,26 @@ out:
  */
 void timer_set_oneshot(timer_t *timer, lk_time_t deadline, timer_callback callback, void *arg)
 {
-    timer_set(timer, deadline, 0, callback, arg);
+    timer_set(timer, deadline, 0, 0, callback, arg);
+}
+
+/**
+ * @brief  Set up a timer that executes once, with some leeway
+ *
+ * Like timer_set_oneshot(), but the callback may be delayed by up to |slack|
+ * ns past the deadline so that it can be batched with other timers into a
+ * single hardware interrupt.
+ *
+ * @param  timer The timer to use
+ * @param  deadline The deadline, in ns, after which the timer is executed
+ * @param  slack  How late, in ns, the timer may fire past the deadline
+ * @param  callback  The function to call when the timer expires
+ * @param  arg  The argument to pass to the callback
+ */
+void timer_set_oneshot_etc(timer_t *timer, lk_time_t deadline, lk_time_t slack,
+                           timer_callback callback, void *arg)
+{
+    timer_set(timer, deadline, 0, slack, callback, arg);
 }
 
 /**
@@ -150,7 +402,7 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 {
     if (period == 0)
         period = 1;
-    timer_set(timer, current_time() + period, period, callback, arg);
+    timer_set(timer, current_time() + period, period, 0, callback, arg);
 }
 
 /**
@@ -191,28 +443,19 @@ bool timer_cancel(timer_t *timer)
 
     bool callback_not_running;
 
-    /* if the timer is in a queue, remove it and adjust hardware timers if needed */
+    /* if the timer is in a wheel, remove it and adjust hardware timers if needed */
     if (list_in_list(&timer->node)) {
         callback_not_running = true;
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-        timer_t *oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-#endif
-
-        /* remove it from the queue */
+        /* remove it from its slot, the slot bitmap is cleaned up lazily */
         list_delete(&timer->node);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-        /* see if we've just modified the head of this cpu's timer queue */
-        /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        timer_t *newhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-        if (newhead == NULL) {
-            LTRACEF("clearing old hw timer, nothing in the queue\n");
-            platform_stop_timer();
-        } else if (newhead != oldhead) {
-            LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
-            platform_set_oneshot_timer(timer_tick, NULL, newhead->scheduled_time);
-        }
+        /* if the local hardware timer was armed for this timer, rearm it for the next one */
+        /* if it was on another cpu's wheel, we'll just let it fire and sort itself out */
+        struct timer_wheel *w = &percpu[cpu].timer_wheel;
+        if (timer_fire_time(timer) == w->programmed)
+            wheel_program(w);
 #endif
     } else {
         callback_not_running = false;
@@ -244,26 +487,34 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
     CPU_STATS_INC(timer_ints);
 
     uint cpu = arch_curr_cpu_num();
+    struct timer_wheel *w = &percpu[cpu].timer_wheel;
 
     LTRACEF("cpu %u now %" PRIu64 ", sp %p\n", cpu, now, __GET_FRAME());
 
     spin_lock(&timer_lock);
 
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* the hardware timer just went off, it is no longer armed */
+    w->programmed = INFINITE_TIME;
+#endif
+
+    struct list_node expired = LIST_INITIAL_VALUE(expired);
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-        if (likely(timer == 0))
-            break;
-        LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
-        if (likely(TIME_LT(now, timer->scheduled_time)))
-            break;
+        timer = list_remove_head_type(&expired, timer_t, node);
+        if (!timer) {
+            /* pick up anything that came due, including timers requeued by callbacks */
+            wheel_advance(w, now, &expired);
+            timer = list_remove_head_type(&expired, timer_t, node);
+            if (likely(timer == NULL))
+                break;
+        }
 
         /* process it */
         LTRACEF("timer %p\n", timer);
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                 "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                 timer, (uint)timer->magic);
-        list_delete(&timer->node);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
@@ -297,29 +548,21 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         /* if we've been cancelled, it's not okay to touch the timer structure from now on out */
         if (!cancelled) {
             /* if it is a periodic timer and it hasn't been requeued
-             * by the callback put it back in the list
+             * by the callback put it back in the wheel
              */
             if (timer->period > 0 && !list_in_list(&timer->node)) {
                 LTRACEF("periodic timer, period %" PRIu64 "\n", timer->period);
                 timer->scheduled_time = now + timer->period;
-                insert_timer_in_queue(cpu, timer);
+                wheel_insert(w, timer);
             }
         }
     }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-    if (timer) {
-        /* has to be the case or it would have fired already */
-        DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
-
-        LTRACEF("setting new timer for %" PRIu64 " nsecs for event %p\n", timer->scheduled_time,
-                timer);
-        platform_set_oneshot_timer(timer_tick, NULL, timer->scheduled_time);
-    }
+    wheel_program(w);
 
-    /* we're done manipulating the timer queue */
+    /* we're done manipulating the timer wheel */
     spin_unlock(&timer_lock);
 #else
     /* release the timer lock before calling the tick handler */
@@ -358,23 +601,23 @@ void timer_transition_off_cpu(uint old_cpu)
     spin_lock_irqsave(&timer_lock, state);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&percpu[old_cpu].timer_queue, timer_t, node);
+    struct timer_wheel *old_wheel = &percpu[old_cpu].timer_wheel;
+    struct timer_wheel *w = &percpu[cpu].timer_wheel;
+
+    if (wheel_is_empty(w))
+        w->base = MAX(w->base, wheel_time_to_tick(current_time()));
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe(&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
-        insert_timer_in_queue(cpu, entry);
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            wheel_reinsert_list(w, &old_wheel->slots[level][slot]);
+        }
+        old_wheel->bitmap[level] = 0;
     }
+    wheel_reinsert_list(w, &old_wheel->overflow);
+    old_wheel->programmed = INFINITE_TIME;
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    timer_t *new_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-    if (new_head != NULL && new_head != old_head) {
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
-        platform_set_oneshot_timer(timer_tick, NULL, new_head->scheduled_time);
-    }
-#endif
+    wheel_program(w);
 
     spin_unlock_irqrestore(&timer_lock, state);
 }
@@ -387,13 +630,11 @@ void timer_thaw_percpu(void)
     DEBUG_ASSERT(arch_ints_disabled());
     spin_lock(&timer_lock);
 
-    uint cpu = arch_curr_cpu_num();
+    struct timer_wheel *w = &percpu[arch_curr_cpu_num()].timer_wheel;
 
-    timer_t *t = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-    if (t) {
-        LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
-        platform_set_oneshot_timer(timer_tick, NULL, t->scheduled_time);
-    }
+    /* whatever the hardware was programmed for before suspend is gone */
+    w->programmed = INFINITE_TIME;
+    wheel_program(w);
 
     spin_unlock(&timer_lock);
 #endif
@@ -403,7 +644,17 @@ void timer_init(void)
 {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&percpu[i].timer_queue);
+        struct timer_wheel *w = &percpu[i].timer_wheel;
+
+        w->base = 0;
+        w->programmed = INFINITE_TIME;
+        for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            w->bitmap[level] = 0;
+            for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+                list_initialize(&w->slots[level][slot]);
+            }
+        }
+        list_initialize(&w->overflow);
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
     #warning "Platform does not have dynamic timer. Timer has 10ms resolution"
@@ -10,8 +10,11 @@
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/auto_lock.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/vm.h>
 #include <lib/console.h>
@@ -35,6 +38,32 @@ static Mutex arena_lock;
 static mxtl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// The background zeroing thread keeps up to this many free pages zero filled,
+// and is woken whenever allocations drain the pool below half of that.
+static const size_t kZeroedPoolTarget = 4096;
+static event_t zero_pool_event = EVENT_INITIAL_VALUE(zero_pool_event, true, EVENT_FLAG_AUTOUNSIGNAL);
+
+// Per-cpu caches of free pages, so that single page allocations and frees do
+// not have to take arena_lock. As far as the arenas are concerned, pages in a
+// cache are allocated. Caches are refilled and trimmed kCpuCacheBatch pages at
+// a time, and hold up to kCpuCacheMax pages.
+static const size_t kCpuCacheBatch = 16;
+static const size_t kCpuCacheMax = 64;
+
+struct PmmCpuCache {
+    SpinLock lock;
+    // pages known to be zero filled are kept apart from the rest
+    list_node dirty = LIST_INITIAL_VALUE(dirty);
+    list_node zeroed = LIST_INITIAL_VALUE(zeroed);
+    size_t dirty_count = 0;
+    size_t zeroed_count = 0;
+} __CPU_MAX_ALIGN;
+
+static PmmCpuCache cpu_cache[SMP_MAX_CPUS];
+
+// set once threads exist; until then everything goes straight to the arenas
+static bool cpu_caches_enabled;
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -105,25 +134,209 @@ done_add:
     return NO_ERROR;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+static size_t pmm_count_zeroed_pages_locked() TA_REQ(arena_lock) {
+    size_t zeroed = 0u;
+    for (const auto& a : arena_list) {
+        zeroed += a.zeroed_count();
+    }
+    return zeroed;
+}
+
+// Wake up the zeroing thread if the pre-zeroed pool is running low.
+static void pmm_check_zeroed_pool_locked() TA_REQ(arena_lock) {
+    if (pmm_count_zeroed_pages_locked() < kZeroedPoolTarget / 2)
+        event_signal(&zero_pool_event, false);
+}
+
+// Finish off a freshly allocated page outside of the arena lock: zero it if the
+// caller asked for that and it did not come out of the pre-zeroed pool.
+static void pmm_prepare_page(vm_page_t* page, uint alloc_flags) {
+    if ((alloc_flags & PMM_ALLOC_FLAG_ZEROED) && !(page->flags & VM_PAGE_FLAG_ZEROED))
+        arch_zero_page(paddr_to_kvaddr(vm_page_to_paddr(page)));
+    page->flags &= ~VM_PAGE_FLAG_ZEROED;
+}
+
+// Return a list of pages to the arenas they came from.
+static size_t pmm_free_locked(list_node* list) TA_REQ(arena_lock) {
+    size_t count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+
+        DEBUG_ASSERT(!page_is_free(page));
+
+        /* see which arena this page belongs to and add it */
+        for (auto& a : arena_list) {
+            if (a.FreePage(page) >= 0) {
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+static void pmm_cache_put_locked(PmmCpuCache* c, vm_page_t* page) {
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        list_add_head(&c->zeroed, &page->free.node);
+        c->zeroed_count++;
+    } else {
+        list_add_head(&c->dirty, &page->free.node);
+        c->dirty_count++;
+    }
+}
+
+static vm_page_t* pmm_cache_take_locked(PmmCpuCache* c, bool zeroed) {
+    vm_page_t* page = nullptr;
+    if (zeroed)
+        page = list_remove_head_type(&c->zeroed, vm_page_t, free.node);
+    if (!page)
+        page = list_remove_head_type(&c->dirty, vm_page_t, free.node);
+    if (!page)
+        page = list_remove_head_type(&c->zeroed, vm_page_t, free.node);
+    if (!page)
+        return nullptr;
+
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        c->zeroed_count--;
+    } else {
+        c->dirty_count--;
+    }
+    return page;
+}
+
+// Allocate a page out of the current cpu's cache, refilling it from the
+// arenas if it is empty.
+static vm_page_t* pmm_cache_alloc(uint alloc_flags) {
+    const bool zeroed = alloc_flags & PMM_ALLOC_FLAG_ZEROED;
+    PmmCpuCache* c = &cpu_cache[arch_curr_cpu_num()];
+    spin_lock_saved_state_t state;
+
+    c->lock.AcquireIrqSave(state);
+    vm_page_t* page = pmm_cache_take_locked(c, zeroed);
+    c->lock.ReleaseIrqRestore(state);
+    if (page)
+        return page;
+
+    list_node batch = LIST_INITIAL_VALUE(batch);
+    {
+        AutoLock al(&arena_lock);
+
+        size_t allocated = 0;
+        for (auto& a : arena_list) {
+            allocated += a.AllocPages(kCpuCacheBatch - allocated, alloc_flags, &batch);
+            if (allocated == kCpuCacheBatch)
+                break;
+        }
+
+        pmm_check_zeroed_pool_locked();
+    }
+
+    page = list_remove_head_type(&batch, vm_page_t, free.node);
+    if (!page)
+        return nullptr;
+
+    c->lock.AcquireIrqSave(state);
+    vm_page_t* p;
+    while ((p = list_remove_head_type(&batch, vm_page_t, free.node))) {
+        pmm_cache_put_locked(c, p);
+    }
+    c->lock.ReleaseIrqRestore(state);
+
+    return page;
+}
+
+// Move the pages on |list| into the current cpu's cache. Pages the cache has
+// to shed to make room are moved to |overflow| for the caller to free.
+static size_t pmm_cache_free(list_node* list, list_node* overflow) {
+    PmmCpuCache* c = &cpu_cache[arch_curr_cpu_num()];
+    spin_lock_saved_state_t state;
+    size_t count = 0;
+
+    c->lock.AcquireIrqSave(state);
+    vm_page_t* page;
+    while ((page = list_remove_head_type(list, vm_page_t, free.node))) {
+        DEBUG_ASSERT(!page_is_free(page));
+
+        if (c->dirty_count >= kCpuCacheMax) {
+            for (size_t i = 0; i < kCpuCacheBatch; i++) {
+                list_add_tail(overflow, list_remove_tail(&c->dirty));
+            }
+            c->dirty_count -= kCpuCacheBatch;
+        }
+
+        page->state = VM_PAGE_STATE_ALLOC;
+        page->flags &= ~VM_PAGE_FLAG_ZEROED;
+        pmm_cache_put_locked(c, page);
+        count++;
+    }
+    c->lock.ReleaseIrqRestore(state);
+
+    return count;
+}
+
+// Give every cpu's cached pages back to the arenas, so that they can be found
+// by allocations that need particular pages. Returns false if there were none.
+static bool pmm_drain_cpu_caches() {
+    if (!cpu_caches_enabled)
+        return false;
+
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    for (auto& c : cpu_cache) {
+        spin_lock_saved_state_t state;
+        c.lock.AcquireIrqSave(state);
+        vm_page_t* page;
+        while ((page = pmm_cache_take_locked(&c, false))) {
+            list_add_tail(&pages, &page->free.node);
+        }
+        c.lock.ReleaseIrqRestore(state);
+    }
+
+    if (list_is_empty(&pages))
+        return false;
+
     AutoLock al(&arena_lock);
+    pmm_free_locked(&pages);
+    return true;
+}
 
-    /* walk the arenas in order until we find one with a free page */
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    vm_page_t* page = nullptr;
+    if (cpu_caches_enabled && !(alloc_flags & PMM_ALLOC_FLAG_KMAP)) {
+        page = pmm_cache_alloc(alloc_flags);
+        if (page && pa)
+            *pa = vm_page_to_paddr(page);
+    }
+
+    for (int pass = 0; !page && pass < 2; pass++) {
+        if (pass > 0 && !pmm_drain_cpu_caches())
+            break;
+
+        AutoLock al(&arena_lock);
+
+        /* walk the arenas in order until we find one with a free page */
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            // try to allocate the page out of the arena
+            page = a.AllocPage(alloc_flags, pa);
+            if (page)
+                break;
         }
 
-        // try to allocate the page out of the arena
-        vm_page_t* page = a.AllocPage(pa);
-        if (page)
-            return page;
+        pmm_check_zeroed_pool_locked();
     }
 
-    LTRACEF("failed to allocate page\n");
-    return nullptr;
+    if (!page) {
+        LTRACEF("failed to allocate page\n");
+        return nullptr;
+    }
+
+    pmm_prepare_page(page, alloc_flags);
+    return page;
 }
 
 size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
@@ -135,24 +348,39 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     if (count == 0)
         return 0;
 
-    AutoLock al(&arena_lock);
-
-    /* walk the arenas in order, allocating as many pages as we can from each */
+    // collect the pages on a private list first, so only they get prepared below
+    list_node new_pages = LIST_INITIAL_VALUE(new_pages);
     size_t allocated = 0;
-    for (auto& a : arena_list) {
-        DEBUG_ASSERT(count > allocated);
+    for (int pass = 0; allocated < count && pass < 2; pass++) {
+        if (pass > 0 && !pmm_drain_cpu_caches())
+            break;
 
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+        AutoLock al(&arena_lock);
+
+        /* walk the arenas in order, allocating as many pages as we can from each */
+        for (auto& a : arena_list) {
+            DEBUG_ASSERT(count > allocated);
+
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            // ask the arena to allocate some pages
+            allocated += a.AllocPages(count - allocated, alloc_flags, &new_pages);
+            DEBUG_ASSERT(allocated <= count);
+            if (allocated == count)
+                break;
         }
 
-        // ask the arena to allocate some pages
-        allocated += a.AllocPages(count - allocated, list);
-        DEBUG_ASSERT(allocated <= count);
-        if (allocated == count)
-            break;
+        pmm_check_zeroed_pool_locked();
+    }
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&new_pages, vm_page_t, free.node))) {
+        pmm_prepare_page(page, alloc_flags);
+        list_add_tail(list, &page->free.node);
     }
 
     return allocated;
@@ -167,24 +395,32 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     address = ROUNDDOWN(address, PAGE_SIZE);
 
-    AutoLock al(&arena_lock);
+    for (int pass = 0; allocated < count && pass < 2; pass++) {
+        // the pages may be sitting in a cpu cache
+        if (pass > 0 && !pmm_drain_cpu_caches())
+            break;
 
-    /* walk through the arenas, looking to see if the physical page belongs to it */
-    for (auto& a : arena_list) {
-        while (allocated < count && a.address_in_arena(address)) {
-            vm_page_t* page = a.AllocSpecific(address);
-            if (!page)
-                break;
+        AutoLock al(&arena_lock);
 
-            if (list)
-                list_add_tail(list, &page->free.node);
+        /* walk through the arenas, looking to see if the physical page belongs to it */
+        for (auto& a : arena_list) {
+            while (allocated < count && a.address_in_arena(address)) {
+                vm_page_t* page = a.AllocSpecific(address);
+                if (!page)
+                    break;
 
-            allocated++;
-            address += PAGE_SIZE;
-        }
+                page->flags &= ~VM_PAGE_FLAG_ZEROED;
 
-        if (allocated == count)
-            break;
+                if (list)
+                    list_add_tail(list, &page->free.node);
+
+                allocated++;
+                address += PAGE_SIZE;
+            }
+
+            if (allocated == count)
+                break;
+        }
     }
 
     return allocated;
@@ -199,24 +435,45 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
     if (alignment_log2 < PAGE_SIZE_SHIFT)
         alignment_log2 = PAGE_SIZE_SHIFT;
 
-    AutoLock al(&arena_lock);
+    paddr_t run_pa;
+    size_t allocated = 0;
+    for (int pass = 0; allocated == 0 && pass < 2; pass++) {
+        // cached pages can break up an otherwise free run
+        if (pass > 0 && ((alloc_flags & PMM_ALLOC_FLAG_NO_SCAN) || !pmm_drain_cpu_caches()))
+            break;
 
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
+        AutoLock al(&arena_lock);
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            allocated = a.AllocContiguous(count, alignment_log2,
+                                          !(alloc_flags & PMM_ALLOC_FLAG_NO_SCAN), &run_pa, list);
+            if (allocated > 0) {
+                DEBUG_ASSERT(allocated == count);
+                break;
+            }
         }
+
+        pmm_check_zeroed_pool_locked();
     }
 
-    LTRACEF("couldn't find run\n");
-    return 0;
+    if (allocated == 0) {
+        LTRACEF("couldn't find run\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pmm_prepare_page(paddr_to_vm_page(run_pa + i * PAGE_SIZE), alloc_flags);
+    }
+
+    if (pa)
+        *pa = run_pa;
+    return allocated;
 }
 
 /* physically allocate a run from arenas marked as KMAP */
@@ -293,24 +550,20 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(&arena_lock);
-
-    uint count = 0;
-    while (!list_is_empty(list)) {
-        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
-
-        DEBUG_ASSERT(!page_is_free(page));
-
-        /* see which arena this page belongs to and add it */
-        for (auto& a : arena_list) {
-            if (a.FreePage(page) >= 0) {
-                count++;
-                break;
-            }
+    size_t count;
+    if (cpu_caches_enabled) {
+        list_node overflow = LIST_INITIAL_VALUE(overflow);
+        count = pmm_cache_free(list, &overflow);
+        if (!list_is_empty(&overflow)) {
+            AutoLock al(&arena_lock);
+            pmm_free_locked(&overflow);
         }
+    } else {
+        AutoLock al(&arena_lock);
+        count = pmm_free_locked(list);
     }
 
-    LTRACEF("returning count %u\n", count);
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -333,10 +586,62 @@ static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
 }
 
 size_t pmm_count_free_pages() {
+    size_t cached = 0u;
+    for (auto& c : cpu_cache) {
+        spin_lock_saved_state_t state;
+        c.lock.AcquireIrqSave(state);
+        cached += c.dirty_count + c.zeroed_count;
+        c.lock.ReleaseIrqRestore(state);
+    }
+
     AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
+    return pmm_count_free_pages_locked() + cached;
+}
+
+// Refills the pre-zeroed pool in the background. It runs just above the idle
+// threads, so zeroing only uses time the cpus would otherwise spend idle.
+static int pmm_zero_thread(void* arg) {
+    for (;;) {
+        event_wait(&zero_pool_event);
+
+        for (;;) {
+            PmmArena* arena = nullptr;
+            vm_page_t* page = nullptr;
+            {
+                AutoLock al(&arena_lock);
+                if (pmm_count_zeroed_pages_locked() >= kZeroedPoolTarget)
+                    break;
+
+                for (auto& a : arena_list) {
+                    page = a.TakeDirtyPage();
+                    if (page) {
+                        arena = &a;
+                        break;
+                    }
+                }
+            }
+            if (!page)
+                break;
+
+            arch_zero_page(paddr_to_kvaddr(arena->page_address_from_arena(page)));
+
+            AutoLock al(&arena_lock);
+            arena->ReturnZeroedPage(page);
+        }
+    }
+    return 0;
 }
 
+static void pmm_threading_init(uint level) {
+    cpu_caches_enabled = true;
+
+    thread_t* t = thread_create("pmm-zero", &pmm_zero_thread, nullptr, LOWEST_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(pmm_threading, &pmm_threading_init, LK_INIT_LEVEL_THREADING);
+
 static void pmm_dump_free() TA_REQ(arena_lock) {
     auto megabytes_free = pmm_count_free_pages_locked() / 256u;
     printf(" %zu free MBs\n", megabytes_free);
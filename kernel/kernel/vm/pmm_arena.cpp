@@ -9,6 +9,7 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <pow2.h>
 #include <pretty/sizes.h>
 #include <string.h>
 #include <trace.h>
@@ -16,7 +17,11 @@
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
 PmmArena::PmmArena(const pmm_arena_info_t* info)
-    : info_(*info) {}
+    : info_(*info) {
+    for (auto& area : free_area_) {
+        list_initialize(&area);
+    }
+}
 
 PmmArena::~PmmArena() {}
 
@@ -24,9 +29,9 @@ PmmArena::~PmmArena() {}
 void PmmArena::EnforceFill() {
     DEBUG_ASSERT(!enforce_fill_);
 
-    vm_page_t* page;
-    list_for_every_entry (&free_list_, page, vm_page_t, free.node) {
-        FreeFill(page);
+    for (size_t i = 0; i < page_count(); i++) {
+        if (page_is_free(&page_array_[i]))
+            FreeFill(&page_array_[i]);
     }
 
     enforce_fill_ = true;
@@ -41,8 +46,9 @@ void PmmArena::FreeFill(vm_page_t* page) {
 void PmmArena::CheckFreeFill(vm_page_t* page) {
     paddr_t paddr = page_address_from_arena(page);
     uint8_t* kvaddr = static_cast<uint8_t*>(paddr_to_kvaddr(paddr));
+    uint8_t fill = (page->flags & VM_PAGE_FLAG_ZEROED) ? 0 : PMM_FREE_FILL_BYTE;
     for (size_t j = 0; j < PAGE_SIZE; ++j) {
-        ASSERT(!enforce_fill_ || *(kvaddr + j) == PMM_FREE_FILL_BYTE);
+        ASSERT(!enforce_fill_ || *(kvaddr + j) == fill);
     }
 }
 #endif // PMM_ENABLE_FREE_FILL
@@ -60,27 +66,170 @@ void PmmArena::BootAllocArray() {
 
     page_array_ = (vm_page_t*)raw_page_array;
 
-    /* add them to the free list */
-    for (size_t i = 0; i < page_count; i++) {
-        auto& p = page_array_[i];
+    /* hand all of the pages to the buddy allocator */
+    FreeRange(0, page_count);
+
+    free_count_ += page_count;
+}
+
+void PmmArena::AddFreeBlock(size_t index, uint order) {
+    vm_page_t* page = &page_array_[index];
+
+    DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(((base_pfn() + index) & ((1ul << order) - 1)) == 0);
+    DEBUG_ASSERT(index + (1ul << order) <= page_count());
+
+    page->flags |= VM_PAGE_FLAG_FREE_BLOCK;
+    page->order = order & 0x1f;
+    list_add_head(&free_area_[order], &page->free.node);
+    free_block_count_[order]++;
+}
+
+void PmmArena::RemoveFreeBlock(size_t index) {
+    vm_page_t* page = &page_array_[index];
 
-        list_add_tail(&free_list_, &p.free.node);
+    DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_FREE_BLOCK);
+    DEBUG_ASSERT(free_block_count_[page->order] > 0);
+
+    list_delete(&page->free.node);
+    page->flags &= ~VM_PAGE_FLAG_FREE_BLOCK;
+    free_block_count_[page->order]--;
+}
+
+bool PmmArena::AllocBlock(uint order, size_t* index) {
+    for (uint o = order; o <= kMaxOrder; o++) {
+        vm_page_t* page = list_peek_head_type(&free_area_[o], vm_page_t, free.node);
+        if (!page)
+            continue;
+
+        size_t i = page - page_array_;
+        RemoveFreeBlock(i);
+
+        /* split the block, giving back the upper halves until it is the right size */
+        while (o > order) {
+            o--;
+            AddFreeBlock(i + (1ul << o), o);
+        }
+
+        *index = i;
+        return true;
     }
+    return false;
+}
 
-    free_count_ += page_count;
+void PmmArena::FreeBlock(size_t index, uint order) {
+    /* merge with the buddy for as long as it is free and whole */
+    while (order < kMaxOrder) {
+        size_t buddy_pfn = (base_pfn() + index) ^ (1ul << order);
+        if (buddy_pfn < base_pfn())
+            break;
+        size_t buddy = buddy_pfn - base_pfn();
+        if (buddy + (1ul << order) > page_count())
+            break;
+
+        const vm_page_t* p = &page_array_[buddy];
+        if (!(p->flags & VM_PAGE_FLAG_FREE_BLOCK) || p->order != order)
+            break;
+
+        RemoveFreeBlock(buddy);
+        index = MIN(index, buddy);
+        order++;
+    }
+
+    AddFreeBlock(index, order);
+}
+
+void PmmArena::FreeRange(size_t index, size_t count) {
+    /* break the range up into the largest naturally aligned blocks that fit */
+    const size_t end = index + count;
+    while (index < end) {
+        size_t pfn = base_pfn() + index;
+        uint order = 0;
+        while (order < kMaxOrder && (pfn & ((2ul << order) - 1)) == 0 &&
+               index + (2ul << order) <= end) {
+            order++;
+        }
+
+        FreeBlock(index, order);
+        index += 1ul << order;
+    }
+}
+
+bool PmmArena::RemoveFreePageAt(size_t index) {
+    vm_page_t* page = &page_array_[index];
+    if (!page_is_free(page))
+        return false;
+
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        DEBUG_ASSERT(zeroed_count_ > 0);
+        list_delete(&page->free.node);
+        zeroed_count_--;
+        return true;
+    }
+
+    /* find the block holding this page, and split it down around the page */
+    const size_t pfn = base_pfn() + index;
+    for (uint order = 0; order <= kMaxOrder; order++) {
+        size_t head_pfn = pfn & ~((1ul << order) - 1);
+        if (head_pfn < base_pfn())
+            break;
+
+        size_t head = head_pfn - base_pfn();
+        const vm_page_t* p = &page_array_[head];
+        if (!(p->flags & VM_PAGE_FLAG_FREE_BLOCK) || head + (1ul << p->order) <= index)
+            continue;
+
+        uint o = p->order;
+        RemoveFreeBlock(head);
+        while (o > 0) {
+            o--;
+            size_t half = head + (1ul << o);
+            if (index >= half) {
+                AddFreeBlock(head, o);
+                head = half;
+            } else {
+                AddFreeBlock(half, o);
+            }
+        }
+        DEBUG_ASSERT(head == index);
+        return true;
+    }
+
+    panic("free page %p not in any free block\n", page);
 }
 
-vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
-    vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
+vm_page_t* PmmArena::RemoveFreePage(bool prefer_zeroed) {
+    vm_page_t* page = nullptr;
+    if (prefer_zeroed)
+        page = list_remove_head_type(&zeroed_list_, vm_page_t, free.node);
+
+    size_t index;
+    if (!page && AllocBlock(0, &index))
+        page = &page_array_[index];
+
+    if (!page)
+        page = list_remove_head_type(&zeroed_list_, vm_page_t, free.node);
     if (!page)
         return nullptr;
 
     DEBUG_ASSERT(free_count_ > 0);
 
     free_count_--;
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        DEBUG_ASSERT(zeroed_count_ > 0);
+        zeroed_count_--;
+    }
 
     DEBUG_ASSERT(page_is_free(page));
 
+    return page;
+}
+
+vm_page_t* PmmArena::AllocPage(uint alloc_flags, paddr_t* pa) {
+    vm_page_t* page = RemoveFreePage(alloc_flags & PMM_ALLOC_FLAG_ZEROED);
+    if (!page)
+        return nullptr;
+
     page->state = VM_PAGE_STATE_ALLOC;
 #if PMM_ENABLE_FREE_FILL
     CheckFreeFill(page);
@@ -106,13 +255,11 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
     DEBUG_ASSERT(index < size() / PAGE_SIZE);
 
     vm_page_t* page = get_page(index);
-    if (!page_is_free(page)) {
+    if (!RemoveFreePageAt(index)) {
         /* we hit an allocated page */
         return nullptr;
     }
 
-    list_delete(&page->free.node);
-
     page->state = VM_PAGE_STATE_ALLOC;
 
     DEBUG_ASSERT(free_count_ > 0);
@@ -122,21 +269,16 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
     return page;
 }
 
-size_t PmmArena::AllocPages(size_t count, list_node* list) {
+size_t PmmArena::AllocPages(size_t count, uint alloc_flags, list_node* list) {
     size_t allocated = 0;
 
     while (allocated < count) {
-        vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
+        vm_page_t* page = RemoveFreePage(alloc_flags & PMM_ALLOC_FLAG_ZEROED);
         if (!page)
             return allocated;
 
         LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
 
-        DEBUG_ASSERT(free_count_ > 0);
-
-        free_count_--;
-
-        DEBUG_ASSERT(page_is_free(page));
 #if PMM_ENABLE_FREE_FILL
         CheckFreeFill(page);
 #endif
@@ -150,15 +292,15 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
     return allocated;
 }
 
-size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
-    /* walk the list starting at alignment boundaries.
+size_t PmmArena::ScanContiguous(size_t count, uint8_t alignment_log2) {
+    /* walk the page array starting at alignment boundaries.
      * calculate the starting offset into this arena, based on the
      * base address of the arena to handle the case where the arena
      * is not aligned on the same boundary requested.
      */
     paddr_t rounded_base = ROUNDUP(base(), 1UL << alignment_log2);
     if (rounded_base < base() || rounded_base > base() + size() - 1)
-        return 0;
+        return SIZE_MAX;
 
     paddr_t aligned_offset = (rounded_base - base()) / PAGE_SIZE;
     paddr_t start = aligned_offset;
@@ -184,35 +326,57 @@ retry:
 
         /* we found a run */
         LTRACEF("found run from pn %" PRIuPTR " to %" PRIuPTR "\n", start, start + count);
+        return start;
+    }
 
-        /* remove the pages from the run out of the free list */
-        for (paddr_t i = start; i < start + count; i++) {
-            p = &page_array_[i];
-            DEBUG_ASSERT(page_is_free(p));
-            DEBUG_ASSERT(list_in_list(&p->free.node));
-
-            list_delete(&p->free.node);
-            p->state = VM_PAGE_STATE_ALLOC;
+    return SIZE_MAX;
+}
 
-            DEBUG_ASSERT(free_count_ > 0);
+size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, bool scan, paddr_t* pa,
+                                 struct list_node* list) {
+    DEBUG_ASSERT(alignment_log2 >= PAGE_SIZE_SHIFT);
+
+    /* a block of high enough order is both big and aligned enough; trim the
+     * unused tail back into the allocator. */
+    uint order = MAX(log2_ulong_ceil(count), (uint)(alignment_log2 - PAGE_SIZE_SHIFT));
+    size_t start;
+    if (order <= kMaxOrder && AllocBlock(order, &start)) {
+        for (size_t i = start; i < start + count; i++) {
+            page_array_[i].state = VM_PAGE_STATE_ALLOC;
+        }
+        FreeRange(start + count, (1ul << order) - count);
+    } else {
+        /* runs larger than the biggest block, or that need pages off the zeroed
+         * list, fall back to searching the page array */
+        if (!scan)
+            return 0;
+        start = ScanContiguous(count, alignment_log2);
+        if (start == SIZE_MAX)
+            return 0;
+
+        for (size_t i = start; i < start + count; i++) {
+            __UNUSED bool removed = RemoveFreePageAt(i);
+            DEBUG_ASSERT(removed);
+            page_array_[i].state = VM_PAGE_STATE_ALLOC;
+        }
+    }
 
-            free_count_--;
+    DEBUG_ASSERT(free_count_ >= count);
+    free_count_ -= count;
 
+    for (size_t i = start; i < start + count; i++) {
+        vm_page_t* p = &page_array_[i];
 #if PMM_ENABLE_FREE_FILL
-            CheckFreeFill(p);
+        CheckFreeFill(p);
 #endif
-
-            if (list)
-                list_add_tail(list, &p->free.node);
-        }
-
-        if (pa)
-            *pa = base() + start * PAGE_SIZE;
-
-        return count;
+        if (list)
+            list_add_tail(list, &p->free.node);
     }
 
-    return 0;
+    if (pa)
+        *pa = base() + start * PAGE_SIZE;
+
+    return count;
 }
 
 status_t PmmArena::FreePage(vm_page_t* page) {
@@ -225,17 +389,52 @@ status_t PmmArena::FreePage(vm_page_t* page) {
 #endif
 
     page->state = VM_PAGE_STATE_FREE;
+    page->flags &= ~VM_PAGE_FLAG_ZEROED;
 
-    list_add_head(&free_list_, &page->free.node);
+    FreeBlock(page - page_array_, 0);
     free_count_++;
     return NO_ERROR;
 }
 
+vm_page_t* PmmArena::TakeDirtyPage() {
+    size_t index;
+    if (!AllocBlock(0, &index))
+        return nullptr;
+
+    vm_page_t* page = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(free_count_ > 0);
+
+    // mark it allocated while it is out of the arena, so contiguous allocations skip it
+    page->state = VM_PAGE_STATE_ALLOC;
+    free_count_--;
+
+    return page;
+}
+
+void PmmArena::ReturnZeroedPage(vm_page_t* page) {
+    DEBUG_ASSERT(page_belongs_to_arena(page));
+    DEBUG_ASSERT(page->state == VM_PAGE_STATE_ALLOC);
+
+    page->state = VM_PAGE_STATE_FREE;
+    page->flags |= VM_PAGE_FLAG_ZEROED;
+
+    list_add_tail(&zeroed_list_, &page->free.node);
+    free_count_++;
+    zeroed_count_++;
+}
+
 void PmmArena::Dump(bool dump_pages, bool dump_free_ranges) {
     char pbuf[16];
     printf("arena %p: name '%s' base %#" PRIxPTR " size %s (0x%zx) priority %u flags 0x%x\n", this, name(), base(),
            format_size(pbuf, sizeof(pbuf), size()), size(), priority(), flags());
-    printf("\tpage_array %p, free_count %zu\n", page_array_, free_count_);
+    printf("\tpage_array %p, free_count %zu, zeroed_count %zu\n", page_array_, free_count_,
+           zeroed_count_);
+    printf("\tfree blocks by order:");
+    for (uint i = 0; i <= kMaxOrder; i++) {
+        printf(" %zu", free_block_count_[i]);
+    }
+    printf("\n");
 
     /* dump all of the pages */
     if (dump_pages) {
@@ -38,16 +38,26 @@ public:
     unsigned int flags() const { return info_.flags; }
     unsigned int priority() const { return info_.priority; }
     size_t free_count() const { return free_count_; };
+    size_t zeroed_count() const { return zeroed_count_; };
 
     vm_page_t* get_page(size_t index) { return &page_array_[index]; }
 
     // main allocation routines
-    vm_page_t* AllocPage(paddr_t* pa);
+    vm_page_t* AllocPage(uint alloc_flags, paddr_t* pa);
     vm_page_t* AllocSpecific(paddr_t pa);
-    size_t AllocPages(size_t count, list_node* list);
-    size_t AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list);
+    size_t AllocPages(size_t count, uint alloc_flags, list_node* list);
+    size_t AllocContiguous(size_t count, uint8_t alignment_log2, bool scan, paddr_t* pa,
+                           struct list_node* list);
     status_t FreePage(vm_page_t* page);
 
+    // number of free blocks of the given order
+    size_t free_block_count(uint order) const { return free_block_count_[order]; }
+
+    // background zeroing: pull a free page that still needs zeroing out of the
+    // arena, and put it back on the zeroed list once it has been cleared
+    vm_page_t* TakeDirtyPage();
+    void ReturnZeroedPage(vm_page_t* page);
+
     // helpers
     bool page_belongs_to_arena(const vm_page* page) const {
         uintptr_t page_addr = reinterpret_cast<uintptr_t>(page);
@@ -68,7 +78,26 @@ public:
         return (address >= info_.base && address <= info_.base + info_.size - 1);
     }
 
+    // free pages that are not on the zeroed list are kept in naturally aligned
+    // power of two blocks, up to this order
+    static constexpr uint kMaxOrder = 10;
+
 private:
+    // remove a page from one of the free lists, preferring the zeroed list if asked to
+    vm_page_t* RemoveFreePage(bool prefer_zeroed);
+
+    // buddy allocator primitives; blocks are identified by the index of their first page
+    void AddFreeBlock(size_t index, uint order);
+    void RemoveFreeBlock(size_t index);
+    bool AllocBlock(uint order, size_t* index);
+    void FreeBlock(size_t index, uint order);
+    void FreeRange(size_t index, size_t count);
+    bool RemoveFreePageAt(size_t index);
+    size_t ScanContiguous(size_t count, uint8_t alignment_log2);
+
+    size_t page_count() const { return info_.size / PAGE_SIZE; }
+    size_t base_pfn() const { return info_.base / PAGE_SIZE; }
+
 #if PMM_ENABLE_FREE_FILL
     void FreeFill(vm_page_t* page);
     void CheckFreeFill(vm_page_t* page);
@@ -77,8 +106,13 @@ private:
     const pmm_arena_info_t info_;
     vm_page_t* page_array_ = nullptr;
 
+    // free pages are either in a buddy block or, once known to be zero
+    // filled, on the zeroed list; free_count_ covers both
     size_t free_count_ = 0;
-    list_node free_list_ = LIST_INITIAL_VALUE(free_list_);
+    list_node free_area_[kMaxOrder + 1];
+    size_t free_block_count_[kMaxOrder + 1] = {};
+    size_t zeroed_count_ = 0;
+    list_node zeroed_list_ = LIST_INITIAL_VALUE(zeroed_list_);
 
 #if PMM_ENABLE_FREE_FILL
     bool enforce_fill_ = false;
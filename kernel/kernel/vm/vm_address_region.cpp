@@ -377,16 +377,34 @@ size_t VmAddressRegion::AllocatedPagesLocked() const {
 
 status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
 
-    for (auto vmar = WrapRefPtr(this);
-         auto next = vmar->FindRegionLocked(va);
-         vmar = next->as_vm_address_region()) {
-        if (next->is_mapping())
-            return next->PageFault(va, pf_flags);
-    }
+    // only the walk down to the mapping needs the aspace lock; the mapping
+    // resolves the fault under its object's lock
+    for (;;) {
+        mxtl::RefPtr<VmMapping> mapping;
+        mxtl::RefPtr<VmObject> object;
+        {
+            AutoLock guard(aspace_->lock());
+            for (auto vmar = WrapRefPtr(this);
+                 auto next = vmar->FindRegionLocked(va);
+                 vmar = next->as_vm_address_region()) {
+                if (next->is_mapping()) {
+                    mapping = next->as_vm_mapping();
+                    object = mapping->object_;
+                    break;
+                }
+            }
+        }
 
-    return ERR_NOT_FOUND;
+        if (!mapping)
+            return ERR_NOT_FOUND;
+
+        // a Protect or Unmap that split the mapping after we dropped the lock
+        // may have moved |va| to another mapping; walk down again to find it
+        status_t status = mapping->PageFault(va, pf_flags, object);
+        if (status != ERR_INTERRUPTED_RETRY)
+            return status;
+    }
 }
 
 bool VmAddressRegion::IsRangeAvailableLocked(vaddr_t base, size_t size) {
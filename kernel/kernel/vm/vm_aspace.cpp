@@ -523,12 +523,10 @@ status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(!aspace_destroyed_);
     LTRACEF("va %#" PRIxPTR ", flags %#x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(&lock_);
-
-    return root_vmar_->PageFault(va, flags);
+    // the aspace lock is only held while looking up the mapping, so faults on
+    // different objects, and the slow parts of faults on the same one, can
+    // proceed in parallel
+    return RootVmar()->PageFault(va, flags);
 }
 
 void VmAspace::Dump(bool verbose) const {
@@ -21,6 +21,10 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// Number of pages, aligned within the mapping, that a page fault looks at for
+// already committed neighbours to map along with the faulting page.
+static const size_t kFaultAroundPages = 16;
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      mxtl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags)
     : VmAddressRegionOrMapping(base, size, vmar_flags,
@@ -119,9 +123,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
 
     // If we're changing the whole mapping, just make the change.
     if (base_ == base && size_ == size) {
-        status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                           new_arch_mmu_flags);
-        LTRACEF("arch_mmu_protect returns %d\n", status);
+        ArchProtect(base, size, new_arch_mmu_flags);
         arch_mmu_flags_ = new_arch_mmu_flags;
         return NO_ERROR;
     }
@@ -137,9 +139,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
             return ERR_NO_MEMORY;
         }
 
-        status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                           new_arch_mmu_flags);
-        LTRACEF("arch_mmu_protect returns %d\n", status);
+        ArchProtect(base, size, new_arch_mmu_flags);
         arch_mmu_flags_ = new_arch_mmu_flags;
 
         size_ = size;
@@ -160,9 +160,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
             return ERR_NO_MEMORY;
         }
 
-        status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                           new_arch_mmu_flags);
-        LTRACEF("arch_mmu_protect returns %d\n", status);
+        ArchProtect(base, size, new_arch_mmu_flags);
 
         size_ -= size;
         mapping->ActivateLocked();
@@ -189,9 +187,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
         return ERR_NO_MEMORY;
     }
 
-    status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                       new_arch_mmu_flags);
-    LTRACEF("arch_mmu_protect returns %d\n", status);
+    ArchProtect(base, size, new_arch_mmu_flags);
 
     // Turn us into the left half
     size_ = left_size;
@@ -256,7 +252,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     // Check if unmapping from one of the ends
     if (base_ == base || base + size == base_ + size_) {
         LTRACEF("unmapping base %#lx size %#zx\n", base, size);
-        status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), base, size / PAGE_SIZE, nullptr);
+        status_t status = ArchUnmap(base, size);
         if (status < 0) {
             return status;
         }
@@ -291,7 +287,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
 
     // Unmap the middle segment
     LTRACEF("unmapping base %#lx size %#zx\n", base, size);
-    status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), base, size / PAGE_SIZE, nullptr);
+    status_t status = ArchUnmap(base, size);
     if (status < 0) {
         return status;
     }
@@ -361,8 +357,7 @@ status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
     LTRACEF("going to unmap %#" PRIxPTR ", len %#" PRIx64 " aspace %p\n",
             unmap_base.ValueOrDie(), len_new, aspace_.get());
 
-    status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), unmap_base.ValueOrDie(),
-                                     static_cast<size_t>(len_new) / PAGE_SIZE, nullptr);
+    status_t status = ArchUnmap(unmap_base.ValueOrDie(), static_cast<size_t>(len_new));
     if (status < 0)
         return status;
 
@@ -398,9 +393,16 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     auto ac = mxtl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
     // iterate through the range, grabbing a page from the underlying object and
-    // mapping it in
-    size_t o;
-    for (o = offset; o < offset + len; o += PAGE_SIZE) {
+    // mapping it in. physically contiguous runs are mapped with a single call, which
+    // lets the arch layer use large pages where the alignment allows.
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_count = 0;
+    auto map_run = [&]() {
+        AutoLock pt(aspace_->arch_lock());
+        MapPagesLocked(run_va, run_pa, run_count, arch_mmu_flags_);
+    };
+    for (size_t o = offset; o < offset + len; o += PAGE_SIZE) {
         uint64_t vmo_offset = object_offset_ + o;
 
         status_t status;
@@ -410,6 +412,7 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
             // no page to map
             if (commit) {
                 // fail when we can't commit every requested page
+                map_run();
                 return status;
             } else {
                 // skip ahead
@@ -418,20 +421,155 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         }
 
         vaddr_t va = base_ + o;
-        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
-
-        size_t mapped;
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, arch_mmu_flags_, &mapped);
-        if (ret < 0) {
-            TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
+        if (run_count > 0 && va == run_va + run_count * PAGE_SIZE &&
+            pa == run_pa + run_count * PAGE_SIZE) {
+            run_count++;
+            continue;
         }
 
-        DEBUG_ASSERT(mapped == 1);
+        map_run();
+        run_va = va;
+        run_pa = pa;
+        run_count = 1;
     }
+    map_run();
 
     return NO_ERROR;
 }
 
+void VmMapping::MapPagesLocked(vaddr_t va, paddr_t pa, size_t count, uint mmu_flags) {
+    DEBUG_ASSERT(is_mutex_held(aspace_->arch_lock()));
+
+    if (count == 0)
+        return;
+
+    LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR " count %zu\n", pa, va, count);
+
+    size_t mapped;
+    auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, count, mmu_flags, &mapped);
+    if (ret >= 0) {
+        DEBUG_ASSERT(mapped == count);
+        return;
+    }
+
+    // the arch layer backs out a failed run entirely, so retry page by page in
+    // case only some of the run was in the way
+    for (size_t i = 0; i < count; i++) {
+        ret = arch_mmu_map(&aspace_->arch_aspace(), va + i * PAGE_SIZE, pa + i * PAGE_SIZE, 1,
+                           mmu_flags, &mapped);
+        if (ret < 0) {
+            TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret,
+                   va + i * PAGE_SIZE, pa + i * PAGE_SIZE);
+        }
+    }
+}
+
+void VmMapping::ArchProtect(vaddr_t base, size_t size, uint mmu_flags) {
+    AutoLock pt(aspace_->arch_lock());
+    __UNUSED status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
+                                                mmu_flags);
+    LTRACEF("arch_mmu_protect returns %d\n", status);
+}
+
+status_t VmMapping::ArchUnmap(vaddr_t base, size_t size) const {
+    AutoLock pt(aspace_->arch_lock());
+    return arch_mmu_unmap(&aspace_->arch_aspace(), base, size / PAGE_SIZE, nullptr);
+}
+
+bool VmMapping::MapLargePageLocked(vaddr_t va, paddr_t pa) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(is_mutex_held(aspace_->arch_lock()));
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    // the large page has to lie within the mapping, and line up virtually and physically
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    if (size_ < LARGE_PAGE_SIZE || large_va < base_ || large_va - base_ > size_ - LARGE_PAGE_SIZE)
+        return false;
+    if ((pa & (LARGE_PAGE_SIZE - 1)) != va - large_va)
+        return false;
+
+    // every page of it has to be held by the object itself, in order.  a write fault
+    // would resolve to these same pages, so they can be mapped writable right away.
+    const uint64_t large_offset = object_offset_ + (large_va - base_);
+    const paddr_t large_pa = pa - (va - large_va);
+    for (size_t o = 0; o < LARGE_PAGE_SIZE; o += PAGE_SIZE) {
+        paddr_t page_pa;
+        if (object_->GetCommittedPageLocked(large_offset + o, &page_pa) != NO_ERROR ||
+            page_pa != large_pa + o)
+            return false;
+    }
+
+    LTRACEF("mapping large page pa %#" PRIxPTR " to va %#" PRIxPTR "\n", large_pa, large_va);
+
+    // this fails if smaller pages already map part of the range, in which case the
+    // caller maps just the faulting page as usual
+    size_t mapped;
+    status_t status = arch_mmu_map(&aspace_->arch_aspace(), large_va, large_pa,
+                                   LARGE_PAGE_SIZE / PAGE_SIZE, arch_mmu_flags_, &mapped);
+    if (status < 0)
+        return false;
+    DEBUG_ASSERT(mapped == LARGE_PAGE_SIZE / PAGE_SIZE);
+
+#if ARCH_ARM64
+    if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+        arch_sync_cache_range((addr_t)paddr_to_kvaddr(large_pa), LARGE_PAGE_SIZE);
+#endif
+    return true;
+}
+
+void VmMapping::FaultAroundLocked(vaddr_t va, uint mmu_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(is_mutex_held(aspace_->arch_lock()));
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    const size_t window = kFaultAroundPages * PAGE_SIZE;
+    const size_t fault_offset = va - base_;
+    const size_t start = ROUNDDOWN(fault_offset, window);
+    const size_t end = MIN(start + window, size_);
+
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_count = 0;
+    auto flush_run = [&]() {
+        MapPagesLocked(run_va, run_pa, run_count, mmu_flags);
+#if ARCH_ARM64
+        // sync through the physmap, which stays mapped even if part of the run did not
+        if (run_count > 0 && (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE))
+            arch_sync_cache_range((addr_t)paddr_to_kvaddr(run_pa), run_count * PAGE_SIZE);
+#endif
+        run_count = 0;
+    };
+    for (size_t o = start; o < end; o += PAGE_SIZE) {
+        if (o == fault_offset) {
+            flush_run();
+            continue;
+        }
+
+        // only pages the object already holds itself are mapped; anything that would
+        // need a fault, a copy or a parent's page is left for a real fault to resolve
+        paddr_t pa;
+        status_t status = object_->GetCommittedPageLocked(object_offset_ + o, &pa);
+        if (status == ERR_NOT_SUPPORTED)
+            return;
+
+        vaddr_t page_va = base_ + o;
+        if (status < 0 || arch_mmu_query(&aspace_->arch_aspace(), page_va, nullptr, nullptr) >= 0) {
+            flush_run();
+            continue;
+        }
+
+        if (run_count > 0 && pa == run_pa + run_count * PAGE_SIZE) {
+            DEBUG_ASSERT(page_va == run_va + run_count * PAGE_SIZE);
+            run_count++;
+            continue;
+        }
+
+        flush_run();
+        run_va = page_va;
+        run_pa = pa;
+        run_count = 1;
+    }
+    flush_run();
+}
+
 status_t VmMapping::DecommitRange(size_t offset, size_t len,
                                   size_t* decommitted) {
     canary_.Assert();
@@ -502,9 +640,46 @@ status_t VmMapping::DestroyLocked() {
 
 status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
 
-    DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
+    mxtl::RefPtr<VmObject> object;
+    {
+        AutoLock guard(aspace_->lock());
+        if (state_ != LifeCycleState::ALIVE) {
+            return ERR_NOT_FOUND;
+        }
+        object = object_;
+    }
+
+    status_t status = PageFault(va, pf_flags, object);
+    if (status == ERR_INTERRUPTED_RETRY) {
+        // we were split or shrunk while unlocked; |va| may now belong to a
+        // sibling mapping, so look it up again from the top
+        mxtl::RefPtr<VmAddressRegion> root = aspace_->RootVmar();
+        if (!root)
+            return ERR_NOT_FOUND;
+        status = root->PageFault(va, pf_flags);
+    }
+    return status;
+}
+
+status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags,
+                              const mxtl::RefPtr<VmObject>& object) {
+    canary_.Assert();
+    DEBUG_ASSERT(object);
+
+    // grab the lock for the vmo
+    AutoLock al(object->lock());
+
+    // Unmap, Protect and Destroy change our range and flags with the object lock held,
+    // so now that we hold it, check that the fault still lands in this mapping.  Once
+    // destroyed our size is zero, and it stays non-zero only while object_ is |object|.
+    // If not, a split may have handed |va| to another mapping, so the caller must
+    // find it again.
+    if (size_ == 0 || va < base_ || va - base_ >= size_) {
+        LTRACEF("%p va %#" PRIxPTR " no longer mapped here\n", this, va);
+        return ERR_INTERRUPTED_RETRY;
+    }
+    DEBUG_ASSERT(state_ == LifeCycleState::ALIVE && object_.get() == object.get());
 
     va = ROUNDDOWN(va, PAGE_SIZE);
     uint64_t vmo_offset = va - base_ + object_offset_;
@@ -531,9 +706,6 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         return ERR_ACCESS_DENIED;
     }
 
-    // grab the lock for the vmo
-    AutoLock al(object_->lock());
-
     // set the currently faulting flag for any recursive calls the vmo may make back into us
     // The specific path we're avoiding is if the VMO calls back into us during vmo->GetPageLocked()
     // via UnmapVmoRangeLocked(). Since we're responsible for that page, signal to ourself to skip
@@ -545,7 +717,7 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     // fault in or grab an existing page
     paddr_t new_pa;
     vm_page_t* page;
-    status_t status = object_->GetPageLocked(vmo_offset, pf_flags, &page, &new_pa);
+    status_t status = object->GetPageLocked(vmo_offset, pf_flags, &page, &new_pa);
     if (status < 0) {
         TRACEF("ERROR: failed to fault in or grab existing page\n");
         TRACEF("%p vmo_offset %#" PRIx64 ", pf_flags %#x\n", this, vmo_offset, pf_flags);
@@ -561,6 +733,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
     }
 
+    // the page itself is resolved; only updating the page tables needs to exclude
+    // other faults in this aspace
+    AutoLock pt(aspace_->arch_lock());
+
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single address
     uint page_flags;
@@ -619,6 +795,9 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         // assert that we're not accidentally mapping the zero page writable
         DEBUG_ASSERT((new_pa != vm_get_zero_page_paddr()) || !(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE));
 
+        if (MapLargePageLocked(va, new_pa))
+            return NO_ERROR;
+
         size_t mapped;
         status = arch_mmu_map(&aspace_->arch_aspace(), va, new_pa, 1, mmu_flags, &mapped);
         if (status < 0) {
@@ -626,6 +805,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        // a fresh fault is often followed by touches to its neighbours; map the ones
+        // that are already committed now rather than taking a fault for each
+        FaultAroundLocked(va, mmu_flags);
     }
 
 // TODO: figure out what to do with this
@@ -25,22 +25,6 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
-namespace {
-
-void ZeroPage(paddr_t pa) {
-    void* ptr = paddr_to_kvaddr(pa);
-    DEBUG_ASSERT(ptr);
-
-    arch_zero_page(ptr);
-}
-
-void ZeroPage(vm_page_t* p) {
-    paddr_t pa = vm_page_to_paddr(p);
-    ZeroPage(pa);
-}
-
-} // namespace
-
 VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObject> parent)
     : VmObject(mxtl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags) {
     LTRACEF("%p\n", this);
@@ -228,6 +212,21 @@ mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromROData(const void* data, size_t
     return vmo;
 }
 
+status_t VmObjectPaged::GetCommittedPageLocked(uint64_t offset, paddr_t* pa_out) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (offset >= size_)
+        return ERR_OUT_OF_RANGE;
+
+    vm_page_t* p = page_list_.GetPage(offset);
+    if (!p)
+        return ERR_NOT_FOUND;
+
+    *pa_out = vm_page_to_paddr(p);
+    return NO_ERROR;
+}
+
 status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** const page_out, paddr_t* const pa_out) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -324,15 +323,12 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
     }
 
     // allocate a page
-    p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+    p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &pa);
     if (!p)
         return ERR_NO_MEMORY;
 
     p->state = VM_PAGE_STATE_OBJECT;
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     status_t status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == NO_ERROR);
 
@@ -380,11 +376,37 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     if (count == 0)
         return NO_ERROR;
 
-    // allocate count number of pages
+    // allocate count number of pages, queued in the order the loop below adds them
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    const uint alloc_flags = pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED;
+    size_t allocated = 0;
+    if (count < kLargePageCount) {
+        allocated = pmm_alloc_pages(count, alloc_flags, &page_list);
+    } else {
+        // back large page aligned stretches that are wholly uncommitted with an aligned
+        // contiguous run, if the pmm has one to hand, so they can be mapped with a
+        // large page; everything else gets single pages
+        size_t singles = 0;
+        for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+            if (IS_ALIGNED(o, LARGE_PAGE_SIZE) && end - o >= LARGE_PAGE_SIZE &&
+                IsRangeUncommittedLocked(o, LARGE_PAGE_SIZE)) {
+                allocated += pmm_alloc_pages(singles, alloc_flags, &page_list);
+                singles = 0;
+                if (pmm_alloc_contiguous(kLargePageCount, alloc_flags | PMM_ALLOC_FLAG_NO_SCAN,
+                                         LARGE_PAGE_SIZE_SHIFT, nullptr,
+                                         &page_list) == kLargePageCount) {
+                    allocated += kLargePageCount;
+                    o += LARGE_PAGE_SIZE - PAGE_SIZE;
+                    continue;
+                }
+            }
+            if (!page_list_.GetPage(o))
+                singles++;
+        }
+        allocated += pmm_alloc_pages(singles, alloc_flags, &page_list);
+    }
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -405,9 +427,6 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         status_t status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
 
@@ -423,6 +442,16 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     return NO_ERROR;
 }
 
+bool VmObjectPaged::IsRangeUncommittedLocked(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        if (page_list_.GetPage(o))
+            return false;
+    }
+    return true;
+}
+
 status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uint64_t* committed,
                                               uint8_t alignment_log2) {
     canary_.Assert();
@@ -453,13 +482,16 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
             count++;
     }
 
-    DEBUG_ASSERT(count == new_len / PAGE_SIZE);
+    // the whole range has to be empty, since it is backed by one run
+    if (count != new_len / PAGE_SIZE)
+        return ERR_BAD_STATE;
 
     // allocate count number of pages
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, alignment_log2, nullptr, &page_list);
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED,
+                                            alignment_log2, nullptr, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -478,9 +510,6 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         auto status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
 
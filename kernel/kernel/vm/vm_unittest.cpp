@@ -6,6 +6,9 @@
 
 #include <assert.h>
 #include <err.h>
+#include <inttypes.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
 #include <kernel/vm/vm_aspace.h>
@@ -14,6 +17,7 @@
 #include <kernel/vm/vm_object_physical.h>
 #include <mxalloc/new.h>
 #include <mxtl/array.h>
+#include <platform.h>
 #include <unittest.h>
 
 static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
@@ -71,6 +75,92 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+static const size_t kPmmStressIterations = 10000;
+
+// Allocates and frees single pages, and small batches, in a tight loop.
+static int pmm_stress_thread(void* arg) {
+    for (size_t i = 0; i < kPmmStressIterations; i++) {
+        vm_page_t* page = pmm_alloc_page(0, nullptr);
+        if (!page)
+            return ERR_NO_MEMORY;
+        pmm_free_page(page);
+
+        list_node list = LIST_INITIAL_VALUE(list);
+        size_t count = pmm_alloc_pages(4, 0, &list);
+        pmm_free(&list);
+        if (count != 4)
+            return ERR_NO_MEMORY;
+    }
+    return NO_ERROR;
+}
+
+// Measures page allocation throughput with one thread per cpu, then fragments
+// memory and reports how many aligned contiguous runs can still be found.
+static bool pmm_stress_test(void* context) {
+    BEGIN_TEST;
+
+    uint num_cpus = 0;
+    thread_t* threads[SMP_MAX_CPUS];
+    lk_time_t t = current_time();
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        if (!mp_is_cpu_online(i))
+            continue;
+        threads[num_cpus] = thread_create("pmm stress", &pmm_stress_thread, nullptr,
+                                          DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        REQUIRE_NONNULL(threads[num_cpus], "thread create");
+        thread_set_pinned_cpu(threads[num_cpus], i);
+        thread_resume(threads[num_cpus]);
+        num_cpus++;
+    }
+    for (uint i = 0; i < num_cpus; i++) {
+        int ret;
+        thread_join(threads[i], &ret, INFINITE_TIME);
+        EXPECT_EQ(NO_ERROR, ret, "stress thread");
+    }
+    t = current_time() - t;
+    if (t == 0)
+        t = 1;
+
+    // each iteration allocates and frees five pages
+    uint64_t ops = (uint64_t)num_cpus * kPmmStressIterations * 5 * 2;
+    unittest_printf("%u cpus: %" PRIu64 " page allocs+frees in %" PRIu64 " us, %" PRIu64 " ops/sec\n",
+                    num_cpus, ops, t / 1000, ops * LK_SEC(1) / t);
+
+    // fragment some memory by freeing every other page of a large allocation
+    static const size_t frag_count = 8192;
+    list_node held = LIST_INITIAL_VALUE(held);
+    list_node to_free = LIST_INITIAL_VALUE(to_free);
+    size_t count = pmm_alloc_pages(frag_count, 0, &held);
+    REQUIRE_EQ(frag_count, count, "fragmenting allocation");
+    for (size_t i = 0; i < frag_count / 2; i++) {
+        list_add_tail(&to_free, list_remove_head(&held));
+        list_add_tail(&held, list_remove_head(&held));
+    }
+    pmm_free(&to_free);
+
+    list_node runs = LIST_INITIAL_VALUE(runs);
+    for (uint order = 0; order <= 9; order++) {
+        static const uint attempts = 16;
+        uint succeeded = 0;
+        for (uint i = 0; i < attempts; i++) {
+            paddr_t pa;
+            size_t got = pmm_alloc_contiguous(1u << order, 0, (uint8_t)(PAGE_SIZE_SHIFT + order),
+                                              &pa, &runs);
+            if (got == 0)
+                continue;
+            EXPECT_EQ(0u, pa & ((PAGE_SIZE << order) - 1), "contiguous run alignment");
+            succeeded++;
+        }
+        unittest_printf("order %u: %u/%u contiguous runs allocated\n", order, succeeded, attempts);
+        if (order == 0)
+            EXPECT_EQ(attempts, succeeded, "single page runs");
+    }
+
+    pmm_free(&runs);
+    pmm_free(&held);
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -685,6 +775,183 @@ bool vmo_cache_test(void* context) {
     END_TEST;
 }
 
+// Touches one byte in every page of the range, returning how long it took.
+static lk_time_t touch_pages(void* ptr, size_t len) {
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+    lk_time_t t = current_time();
+    for (size_t o = 0; o < len; o += PAGE_SIZE) {
+        p[o] = 0x99;
+    }
+    return current_time() - t;
+}
+
+// Measures page fault throughput over committed and uncommitted objects, and
+// checks that faulting on a committed page maps its committed neighbours too.
+static bool vmo_fault_throughput_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 1024;
+    auto ka = VmAspace::kernel_aspace();
+
+    for (int committed = 0; committed < 2; committed++) {
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+        REQUIRE_NONNULL(vmo, "vmobject creation\n");
+        if (committed) {
+            auto ret = vmo->CommitRange(0, alloc_size, nullptr);
+            REQUIRE_EQ(NO_ERROR, ret, "committing object");
+        }
+
+        void* ptr;
+        auto ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                         0, 0, kArchRwFlags);
+        REQUIRE_EQ(NO_ERROR, ret, "mapping object");
+
+        lk_time_t t = touch_pages(ptr, alloc_size);
+        if (t == 0)
+            t = 1;
+        unittest_printf("%s: %zu pages in %" PRIu64 " us, %" PRIu64 " pages/sec\n",
+                        committed ? "committed" : "demand zero", alloc_size / PAGE_SIZE,
+                        t / 1000, (uint64_t)(alloc_size / PAGE_SIZE) * LK_SEC(1) / t);
+
+        auto err = ka->FreeRegion((vaddr_t)ptr);
+        EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    }
+
+    // a single fault on a committed object maps the rest of its window
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+    auto ret = vmo->CommitRange(0, alloc_size, nullptr);
+    REQUIRE_EQ(NO_ERROR, ret, "committing object");
+    void* ptr;
+    ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr, 0, 0, kArchRwFlags);
+    REQUIRE_EQ(NO_ERROR, ret, "mapping object");
+
+    static_cast<volatile uint8_t*>(ptr)[0] = 0x99;
+    paddr_t pa;
+    ret = arch_mmu_query(&ka->arch_aspace(), (vaddr_t)ptr + PAGE_SIZE, &pa, nullptr);
+    EXPECT_EQ(NO_ERROR, ret, "neighbouring page mapped");
+
+    auto err = ka->FreeRegion((vaddr_t)ptr);
+    EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    END_TEST;
+}
+
+static const size_t kFaultScalingPages = 4096;
+
+static int fault_scaling_thread(void* arg) {
+    touch_pages(arg, kFaultScalingPages * PAGE_SIZE);
+    return 0;
+}
+
+// Measures demand fault throughput in one aspace with 1, 2, 4... threads, each
+// pinned to its own cpu and faulting in its own mapping.
+static bool vmo_fault_scaling_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = kFaultScalingPages * PAGE_SIZE;
+    auto ka = VmAspace::kernel_aspace();
+
+    uint cpus[SMP_MAX_CPUS];
+    uint num_cpus = 0;
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        if (mp_is_cpu_online(i))
+            cpus[num_cpus++] = i;
+    }
+
+    for (uint num_threads = 1; num_threads <= num_cpus; num_threads *= 2) {
+        void* ptrs[SMP_MAX_CPUS];
+        thread_t* threads[SMP_MAX_CPUS];
+        for (uint i = 0; i < num_threads; i++) {
+            auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+            REQUIRE_NONNULL(vmo, "vmobject creation\n");
+            auto ret = ka->MapObjectInternal(mxtl::move(vmo), "test", 0, alloc_size, &ptrs[i],
+                                             0, 0, kArchRwFlags);
+            REQUIRE_EQ(NO_ERROR, ret, "mapping object");
+
+            threads[i] = thread_create("fault scaling", &fault_scaling_thread, ptrs[i],
+                                       DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+            REQUIRE_NONNULL(threads[i], "thread create");
+            thread_set_pinned_cpu(threads[i], cpus[i]);
+        }
+
+        lk_time_t t = current_time();
+        for (uint i = 0; i < num_threads; i++) {
+            thread_resume(threads[i]);
+        }
+        for (uint i = 0; i < num_threads; i++) {
+            thread_join(threads[i], nullptr, INFINITE_TIME);
+        }
+        t = current_time() - t;
+        if (t == 0)
+            t = 1;
+
+        uint64_t pages = (uint64_t)num_threads * kFaultScalingPages;
+        unittest_printf("%u threads: %" PRIu64 " faults in %" PRIu64 " us, %" PRIu64
+                        " faults/sec\n",
+                        num_threads, pages, t / 1000, pages * LK_SEC(1) / t);
+
+        for (uint i = 0; i < num_threads; i++) {
+            auto err = ka->FreeRegion((vaddr_t)ptrs[i]);
+            EXPECT_EQ(NO_ERROR, err, "unmapping object");
+        }
+    }
+    END_TEST;
+}
+
+struct SplitFaultArgs {
+    vaddr_t va;
+    volatile bool done;
+    uint failures;
+};
+
+static int split_fault_thread(void* arg) {
+    auto args = static_cast<SplitFaultArgs*>(arg);
+    auto root = VmAspace::kernel_aspace()->RootVmar();
+    while (!args->done) {
+        if (root->PageFault(args->va, VMM_PF_FLAG_SW_FAULT) != NO_ERROR)
+            args->failures++;
+    }
+    return 0;
+}
+
+// Faults on the last page of a mapping while it is repeatedly split by
+// protecting it one page at a time from the left.  Each split hands the
+// faulting address to a new mapping, which the fault must find again.
+static bool vmo_fault_during_split_test(void* context) {
+    BEGIN_TEST;
+    static const size_t kPages = 256;
+    static const size_t alloc_size = kPages * PAGE_SIZE;
+    auto ka = VmAspace::kernel_aspace();
+
+    for (int round = 0; round < 16; round++) {
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+        REQUIRE_NONNULL(vmo, "vmobject creation\n");
+        void* ptr;
+        auto ret = ka->MapObjectInternal(mxtl::move(vmo), "test", 0, alloc_size, &ptr,
+                                         0, 0, kArchRwFlags);
+        REQUIRE_EQ(NO_ERROR, ret, "mapping object");
+
+        SplitFaultArgs args = {(vaddr_t)ptr + alloc_size - PAGE_SIZE, false, 0};
+        thread_t* t = thread_create("split fault", &split_fault_thread, &args,
+                                    DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        REQUIRE_NONNULL(t, "thread create");
+        thread_resume(t);
+
+        auto root = ka->RootVmar();
+        for (size_t i = 0; i < kPages - 1; i++) {
+            ret = root->Protect((vaddr_t)ptr + i * PAGE_SIZE, PAGE_SIZE,
+                                ARCH_MMU_FLAG_PERM_READ);
+            EXPECT_EQ(NO_ERROR, ret, "protecting page");
+        }
+
+        args.done = true;
+        thread_join(t, nullptr, INFINITE_TIME);
+        EXPECT_EQ(0u, args.failures, "faults on a mapped page failed");
+
+        auto err = ka->FreeRegion((vaddr_t)ptr);
+        EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    }
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
@@ -692,6 +959,7 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_stress_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -712,6 +980,9 @@ VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
 VM_UNITTEST(vmo_cache_test)
+VM_UNITTEST(vmo_fault_throughput_test)
+VM_UNITTEST(vmo_fault_scaling_test)
+VM_UNITTEST(vmo_fault_during_split_test)
 // Uncomment for debugging
 // VM_UNITTEST(dump_all_aspaces)  // Run last
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", nullptr, nullptr);
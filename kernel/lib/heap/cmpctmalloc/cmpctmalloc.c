@@ -861,6 +861,24 @@ void cmpct_free(void *payload)
     unlock();
 }
 
+size_t cmpct_usable_size(const void *payload)
+{
+    if (payload == NULL) return 0;
+    const header_t *header = (const header_t *)payload - 1;
+    DEBUG_ASSERT(!is_tagged_as_free((header_t *)header));
+    return header->size - sizeof(header_t);
+}
+
+void cmpct_get_info(size_t *size_bytes, size_t *free_bytes)
+{
+    lock();
+    if (size_bytes != NULL)
+        *size_bytes = theheap.size;
+    if (free_bytes != NULL)
+        *free_bytes = theheap.remaining;
+    unlock();
+}
+
 void *cmpct_realloc(void *payload, size_t size)
 {
     if (payload == NULL) return cmpct_alloc(size);
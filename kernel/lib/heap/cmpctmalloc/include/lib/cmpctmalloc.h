@@ -16,6 +16,13 @@ void *cmpct_realloc(void *, size_t);
 void cmpct_free(void *);
 void *cmpct_memalign(size_t size, size_t alignment);
 
+// Returns the number of bytes that can be used in the allocation at |payload|,
+// which is at least the size that was requested for it.
+size_t cmpct_usable_size(const void *payload);
+
+// Returns the total size of the heap and how much of it is free.
+void cmpct_get_info(size_t *size_bytes, size_t *free_bytes);
+
 void cmpct_init(void);
 void cmpct_dump(bool panic_time);
 void cmpct_test(void);
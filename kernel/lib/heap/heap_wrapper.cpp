@@ -37,13 +37,291 @@ static bool heap_trace = false;
 #define heap_trace (false)
 #endif
 
+/*
+ * Per cpu small object caches.
+ *
+ * Small allocations are served out of per cpu magazines (fixed size stacks of
+ * free objects) of a handful of size classes, so the common malloc/free path
+ * only takes an uncontended per cpu spinlock instead of the cmpctmalloc mutex.
+ * Each cpu keeps a loaded and a previous magazine per class. Full and empty
+ * magazines are exchanged with a per class depot when both run out, and only
+ * when the depot can't help do we fall back to cmpctmalloc.
+ */
+#define HEAP_CACHE_MAGAZINE_SIZE 16
+#define HEAP_CACHE_DEPOT_MAGAZINES 8
+#define HEAP_CACHE_MAX_SIZE 512
+
+static const size_t heap_cache_class_size[] = {
+    16, 32, 48, 64, 96, 128, 160, 192, 256, 320, 384, HEAP_CACHE_MAX_SIZE,
+};
+#define HEAP_CACHE_NUM_CLASSES countof(heap_cache_class_size)
+
+struct heap_magazine {
+    struct list_node node;
+    uint rounds;
+    void *objs[HEAP_CACHE_MAGAZINE_SIZE];
+};
+
+struct heap_cache_stats {
+    ulong alloc_hits;
+    ulong alloc_misses;
+    ulong free_hits;
+    ulong free_misses;
+};
+
+struct heap_cpu_cache {
+    spin_lock_t lock;
+    struct heap_magazine *loaded[HEAP_CACHE_NUM_CLASSES];
+    struct heap_magazine *previous[HEAP_CACHE_NUM_CLASSES];
+    struct heap_cache_stats stats[HEAP_CACHE_NUM_CLASSES];
+} __CPU_ALIGN;
+
+struct heap_depot {
+    spin_lock_t lock;
+    struct list_node full;
+    struct list_node empty;
+    uint full_count;
+};
+
+static struct heap_cpu_cache heap_cpu_cache[SMP_MAX_CPUS];
+static struct heap_depot heap_depot[HEAP_CACHE_NUM_CLASSES];
+static struct heap_magazine heap_magazines[HEAP_CACHE_NUM_CLASSES]
+                                          [SMP_MAX_CPUS * 2 + HEAP_CACHE_DEPOT_MAGAZINES];
+static bool heap_cache_enabled;
+
+/* size class lookup tables, indexed by size / 16. -1 means uncached */
+static int8_t heap_cache_alloc_class[HEAP_CACHE_MAX_SIZE / 16 + 1];
+static int8_t heap_cache_free_class[HEAP_CACHE_MAX_SIZE / 16 + 1];
+
+/* the smallest class that can hold an allocation of |size| bytes */
+static inline int heap_cache_class_for_alloc(size_t size)
+{
+    if (size == 0 || size > HEAP_CACHE_MAX_SIZE)
+        return -1;
+    return heap_cache_alloc_class[(size + 15) / 16];
+}
+
+/* the largest class that an allocation with |usable| bytes can satisfy.
+ * blocks bigger than the largest class go back to the heap rather than
+ * being parked whole in it. -1 means uncached */
+static inline int heap_cache_class_for_free(size_t usable)
+{
+    if (usable > HEAP_CACHE_MAX_SIZE)
+        return -1;
+    return heap_cache_free_class[usable / 16];
+}
+
+static void heap_cache_init(void)
+{
+    for (size_t i = 0; i <= HEAP_CACHE_MAX_SIZE / 16; i++) {
+        heap_cache_alloc_class[i] = -1;
+        heap_cache_free_class[i] = -1;
+        for (size_t c = 0; c < HEAP_CACHE_NUM_CLASSES; c++) {
+            if (heap_cache_alloc_class[i] < 0 && heap_cache_class_size[c] >= i * 16)
+                heap_cache_alloc_class[i] = (int8_t)c;
+            if (heap_cache_class_size[c] <= i * 16)
+                heap_cache_free_class[i] = (int8_t)c;
+        }
+    }
+
+    for (size_t c = 0; c < HEAP_CACHE_NUM_CLASSES; c++) {
+        struct heap_depot *depot = &heap_depot[c];
+        spin_lock_init(&depot->lock);
+        list_initialize(&depot->full);
+        list_initialize(&depot->empty);
+        depot->full_count = 0;
+
+        size_t m = 0;
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            heap_cpu_cache[cpu].loaded[c] = &heap_magazines[c][m++];
+            heap_cpu_cache[cpu].previous[c] = &heap_magazines[c][m++];
+        }
+        for (; m < countof(heap_magazines[c]); m++)
+            list_add_tail(&depot->empty, &heap_magazines[c][m].node);
+    }
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        spin_lock_init(&heap_cpu_cache[cpu].lock);
+
+    heap_cache_enabled = true;
+}
+
+static inline void heap_magazine_swap(struct heap_magazine **a, struct heap_magazine **b)
+{
+    struct heap_magazine *temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+/* try to pop an object of size class |c| off of the current cpu's cache */
+static void *heap_cache_alloc(int c)
+{
+    spin_lock_saved_state_t state;
+    struct heap_cpu_cache *cache = &heap_cpu_cache[arch_curr_cpu_num()];
+    spin_lock_irqsave(&cache->lock, state);
+
+    struct heap_magazine **loaded = &cache->loaded[c];
+    struct heap_magazine **previous = &cache->previous[c];
+    void *ptr = NULL;
+
+    if ((*loaded)->rounds == 0) {
+        if ((*previous)->rounds > 0) {
+            heap_magazine_swap(loaded, previous);
+        } else {
+            /* trade our empty previous magazine for a full one from the depot */
+            struct heap_depot *depot = &heap_depot[c];
+            spin_lock(&depot->lock);
+            struct heap_magazine *full =
+                list_remove_head_type(&depot->full, struct heap_magazine, node);
+            if (full) {
+                depot->full_count--;
+                list_add_head(&depot->empty, &(*previous)->node);
+                *previous = *loaded;
+                *loaded = full;
+            }
+            spin_unlock(&depot->lock);
+        }
+    }
+
+    if ((*loaded)->rounds > 0) {
+        ptr = (*loaded)->objs[--(*loaded)->rounds];
+        cache->stats[c].alloc_hits++;
+    } else {
+        cache->stats[c].alloc_misses++;
+    }
+
+    spin_unlock_irqrestore(&cache->lock, state);
+    return ptr;
+}
+
+/* try to push an object of size class |c| onto the current cpu's cache */
+static bool heap_cache_free(int c, void *ptr)
+{
+    spin_lock_saved_state_t state;
+    struct heap_cpu_cache *cache = &heap_cpu_cache[arch_curr_cpu_num()];
+    spin_lock_irqsave(&cache->lock, state);
+
+    struct heap_magazine **loaded = &cache->loaded[c];
+    struct heap_magazine **previous = &cache->previous[c];
+    bool cached = false;
+
+    if ((*loaded)->rounds == HEAP_CACHE_MAGAZINE_SIZE) {
+        if ((*previous)->rounds < HEAP_CACHE_MAGAZINE_SIZE) {
+            heap_magazine_swap(loaded, previous);
+        } else {
+            /* hand our full previous magazine to the depot for an empty one */
+            struct heap_depot *depot = &heap_depot[c];
+            spin_lock(&depot->lock);
+            struct heap_magazine *empty =
+                list_remove_head_type(&depot->empty, struct heap_magazine, node);
+            if (empty) {
+                DEBUG_ASSERT(empty->rounds == 0);
+                list_add_head(&depot->full, &(*previous)->node);
+                depot->full_count++;
+                *previous = *loaded;
+                *loaded = empty;
+            }
+            spin_unlock(&depot->lock);
+        }
+    }
+
+    if ((*loaded)->rounds < HEAP_CACHE_MAGAZINE_SIZE) {
+        (*loaded)->objs[(*loaded)->rounds++] = ptr;
+        cache->stats[c].free_hits++;
+        cached = true;
+    } else {
+        cache->stats[c].free_misses++;
+    }
+
+    spin_unlock_irqrestore(&cache->lock, state);
+    return cached;
+}
+
+/* return every object sitting in the caches to cmpctmalloc */
+static void heap_cache_drain(void)
+{
+    if (!heap_cache_enabled)
+        return;
+
+    void *objs[HEAP_CACHE_MAGAZINE_SIZE * 2];
+
+    for (size_t c = 0; c < HEAP_CACHE_NUM_CLASSES; c++) {
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            struct heap_cpu_cache *cache = &heap_cpu_cache[cpu];
+            size_t count = 0;
+
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&cache->lock, state);
+            struct heap_magazine *mags[] = { cache->loaded[c], cache->previous[c] };
+            for (size_t i = 0; i < countof(mags); i++) {
+                while (mags[i]->rounds > 0)
+                    objs[count++] = mags[i]->objs[--mags[i]->rounds];
+            }
+            spin_unlock_irqrestore(&cache->lock, state);
+
+            for (size_t i = 0; i < count; i++)
+                cmpct_free(objs[i]);
+        }
+
+        struct heap_depot *depot = &heap_depot[c];
+        for (;;) {
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&depot->lock, state);
+            struct heap_magazine *full =
+                list_remove_head_type(&depot->full, struct heap_magazine, node);
+            if (full)
+                depot->full_count--;
+            spin_unlock_irqrestore(&depot->lock, state);
+
+            if (!full)
+                break;
+
+            while (full->rounds > 0)
+                cmpct_free(full->objs[--full->rounds]);
+
+            spin_lock_irqsave(&depot->lock, state);
+            list_add_head(&depot->empty, &full->node);
+            spin_unlock_irqrestore(&depot->lock, state);
+        }
+    }
+}
+
+/* allocate |size| bytes, going through the per cpu caches if it is small enough */
+static void *heap_alloc(size_t size)
+{
+    int c = heap_cache_class_for_alloc(size);
+    if (likely(heap_cache_enabled && c >= 0)) {
+        void *ptr = heap_cache_alloc(c);
+        if (likely(ptr))
+            return ptr;
+
+        /* round up so the object can be recycled through this class later */
+        return cmpct_alloc(heap_cache_class_size[c]);
+    }
+
+    return cmpct_alloc(size);
+}
+
+static void heap_free(void *ptr)
+{
+    if (likely(heap_cache_enabled && ptr)) {
+        int c = heap_cache_class_for_free(cmpct_usable_size(ptr));
+        if (c >= 0 && heap_cache_free(c, ptr))
+            return;
+    }
+
+    cmpct_free(ptr);
+}
+
 void heap_init(void)
 {
     cmpct_init();
+    heap_cache_init();
 }
 
 void heap_trim(void)
 {
+    heap_cache_drain();
     cmpct_trim();
 }
 
@@ -53,7 +331,7 @@ void *malloc(size_t size)
 
     LTRACEF("size %zu\n", size);
 
-    void *ptr = cmpct_alloc(size);
+    void *ptr = heap_alloc(size);
     if (unlikely(heap_trace))
         printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
 
@@ -89,7 +367,7 @@ void *calloc(size_t count, size_t size)
 
     size_t realsize = count * size;
 
-    void *ptr = cmpct_alloc(realsize);
+    void *ptr = heap_alloc(realsize);
     if (likely(ptr))
         memset(ptr, 0, realsize);
     if (unlikely(heap_trace))
@@ -122,7 +400,7 @@ void free(void *ptr)
     if (unlikely(heap_trace))
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
 
-    cmpct_free(ptr);
+    heap_free(ptr);
 }
 
 static void heap_dump(bool panic_time)
@@ -130,6 +408,36 @@ static void heap_dump(bool panic_time)
     cmpct_dump(panic_time);
 }
 
+static void heap_dump_stats(void)
+{
+    size_t size_bytes, free_bytes;
+    cmpct_get_info(&size_bytes, &free_bytes);
+    printf("heap size %zu, free %zu\n", size_bytes, free_bytes);
+
+    if (!heap_cache_enabled)
+        return;
+
+    printf("cache class  cached    depot alloc hit   alloc miss     free hit    free miss\n");
+    for (size_t c = 0; c < HEAP_CACHE_NUM_CLASSES; c++) {
+        struct heap_cache_stats total = {};
+        size_t cached = 0;
+
+        /* not taking the locks, the numbers are only approximate */
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            const struct heap_cpu_cache *cache = &heap_cpu_cache[cpu];
+            total.alloc_hits += cache->stats[c].alloc_hits;
+            total.alloc_misses += cache->stats[c].alloc_misses;
+            total.free_hits += cache->stats[c].free_hits;
+            total.free_misses += cache->stats[c].free_misses;
+            cached += cache->loaded[c]->rounds + cache->previous[c]->rounds;
+        }
+
+        printf("%11zu %7zu %8u %12lu %12lu %12lu %12lu\n",
+               heap_cache_class_size[c], cached, heap_depot[c].full_count,
+               total.alloc_hits, total.alloc_misses, total.free_hits, total.free_misses);
+    }
+}
+
 static void heap_test(void)
 {
     cmpct_test();
@@ -182,6 +490,7 @@ usage:
         printf("usage:\n");
         printf("\t%s info\n", argv[0].str);
         if (!(flags & CMD_FLAG_PANIC)) {
+            printf("\t%s stats\n", argv[0].str);
             printf("\t%s trace\n", argv[0].str);
             printf("\t%s trim\n", argv[0].str);
             printf("\t%s alloc <size> [alignment]\n", argv[0].str);
@@ -193,6 +502,8 @@ usage:
 
     if (strcmp(argv[1].str, "info") == 0) {
         heap_dump(flags & CMD_FLAG_PANIC);
+    } else if (!(flags & CMD_FLAG_PANIC) && strcmp(argv[1].str, "stats") == 0) {
+        heap_dump_stats();
     } else if (!(flags & CMD_FLAG_PANIC) && strcmp(argv[1].str, "test") == 0) {
         heap_test();
     } else if (!(flags & CMD_FLAG_PANIC) && strcmp(argv[1].str, "trace") == 0) {
@@ -13,6 +13,7 @@
 #include <trace.h>
 
 #include <kernel/event.h>
+#include <kernel/thread.h>
 #include <platform.h>
 
 #include <magenta/handle.h>
@@ -83,12 +84,40 @@ mx_status_t ChannelDispatcher::add_observer(StateObserver* observer) {
     return NO_ERROR;
 }
 
+void ChannelDispatcher::AddWaiterLocked(MessageWaiter* waiter) {
+    // The sequence number only collides after it wraps while an older call
+    // with the same txid is still waiting; skip over it then.
+    do {
+        waiter->set_key(waiter_seq_++);
+    } while (!waiters_.insert_or_find(waiter));
+}
+
+// Returns the call for |txid| that started waiting first, if any.  Calls
+// that share a txid lose that order only once the sequence number wraps.
+ChannelDispatcher::MessageWaiter* ChannelDispatcher::FindWaiterLocked(mx_txid_t txid) {
+    auto iter = waiters_.lower_bound(static_cast<uint64_t>(txid) << 32);
+    if (!iter.IsValid() || iter->get_txid() != txid)
+        return nullptr;
+    return &*iter;
+}
+
+void ChannelDispatcher::EraseWaiterLocked(MessageWaiter* waiter) {
+    waiters_.erase(*waiter);
+}
+
+void ChannelDispatcher::CancelWaitersLocked(status_t status) {
+    while (!waiters_.is_empty()) {
+        auto waiter = waiters_.pop_front();
+        waiter->Cancel(status);
+    }
+}
+
 void ChannelDispatcher::RemoveWaiter(MessageWaiter* waiter) {
     AutoLock lock(&lock_);
     if (!waiter->InContainer()) {
         return;
     }
-    waiters_.erase(*waiter);
+    EraseWaiterLocked(waiter);
 }
 
 // Thread safety analysis disabled as this accesses guarded member variables without holding
@@ -107,10 +136,7 @@ void ChannelDispatcher::on_zero_handles() TA_NO_THREAD_SAFETY_ANALYSIS {
         // because we've been canceled by reason
         // of our local handle going away.
         // Remove waiter from list.
-        while (!waiters_.is_empty()) {
-            auto waiter = waiters_.pop_front();
-            waiter->Cancel(ERR_CANCELED);
-        }
+        CancelWaitersLocked(ERR_CANCELED);
     }
 
     // Ensure other endpoint detaches us
@@ -131,10 +157,7 @@ void ChannelDispatcher::OnPeerZeroHandles() {
     // because we've been canceled by reason
     // of the opposing endpoint going away.
     // Remove waiter from list.
-    while (!waiters_.is_empty()) {
-        auto waiter = waiters_.pop_front();
-        waiter->Cancel(ERR_PEER_CLOSED);
-    }
+    CancelWaitersLocked(ERR_PEER_CLOSED);
 }
 
 status_t ChannelDispatcher::Read(uint32_t* msg_size,
@@ -217,11 +240,14 @@ status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
 
         // (0) Before writing outbound message and waiting.
         // Add our stack-allocated waiter to the list.
-        waiters_.push_back(waiter);
+        AddWaiterLocked(waiter);
     }
 
-    // (1) Write outbound message to opposing endpoint.
+    // (1) Write outbound message to opposing endpoint.  A server thread
+    // it wakes runs next on this cpu, as soon as we block in (2).
+    thread_handoff_begin();
     other->WriteSelf(mxtl::move(msg));
+    thread_handoff_end();
 
     // Reuse the code from the half-call used for retrying a Call after thread
     // suspend.
@@ -258,7 +284,7 @@ status_t ChannelDispatcher::ResumeInterruptedCall(mx_time_t deadline,
         // Otherwise, the status is ERR_TIMED_OUT and it
         // is our job to remove the waiter from the list.
         if ((status = waiter->EndWait(reply)) == ERR_TIMED_OUT)
-            waiters_.erase(*waiter);
+            EraseWaiterLocked(waiter);
     }
 
     return status;
@@ -274,15 +300,13 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
         // If the far side is waiting for replies to messages
         // send via "call", see if this message has a matching
         // txid to one of the waiters, and if so, deliver it.
-        mx_txid_t txid = msg->get_txid();
-        for (auto& waiter: waiters_) {
+        MessageWaiter* waiter = FindWaiterLocked(msg->get_txid());
+        if (waiter) {
             // (3C) Deliver message to waiter.
             // Remove waiter from list.
-            if (waiter.get_txid() == txid) {
-                waiters_.erase(waiter);
-                // we return how many threads have been woken up, or zero.
-                return waiter.Deliver(mxtl::move(msg));
-            }
+            EraseWaiterLocked(waiter);
+            // we return how many threads have been woken up, or zero.
+            return waiter->Deliver(mxtl::move(msg));
         }
     }
     messages_.push_back(mxtl::move(msg));
@@ -359,5 +383,10 @@ int ChannelDispatcher::MessageWaiter::Deliver(mxtl::unique_ptr<MessagePacket> ms
     txid_ = msg->get_txid();
     msg_ = mxtl::move(msg);
     status_ = NO_ERROR;
-    return event_.Signal(NO_ERROR);
+
+    // The caller runs next on this cpu; Write()'s reschedule switches to it.
+    thread_handoff_begin();
+    int woken = event_.Signal(NO_ERROR);
+    thread_handoff_end();
+    return woken;
 }
@@ -11,6 +11,7 @@
 #include <magenta/futex_context.h>
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
+#include <mxtl/algorithm.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
@@ -24,16 +25,40 @@ FutexContext::~FutexContext() {
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+    for (auto& bucket : buckets_) {
+        AutoLock lock(&bucket.lock);
+        DEBUG_ASSERT(bucket.table.is_empty());
+    }
+}
+
+// The bucket index is taken from the top bits of a multiplicative hash, so
+// that it is independent of the low bits BucketTable uses for its chains.
+FutexContext::Bucket* FutexContext::GetBucket(uintptr_t futex_key) {
+    uint64_t hash = static_cast<uint64_t>(futex_key >> 2) * 0x9e3779b97f4a7c15ull;
+    return &buckets_[hash >> (64 - kBucketShift)];
 }
 
 status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline) {
     LTRACE_ENTRY;
 
+    return Wait(value_ptr, current_value, nullptr, deadline);
+}
+
+status_t FutexContext::FutexWaitPI(user_ptr<int> value_ptr, int current_value, UserThread* owner,
+                                   mx_time_t deadline) {
+    LTRACE_ENTRY;
+
+    DEBUG_ASSERT(owner);
+    return Wait(value_ptr, current_value, owner, deadline);
+}
+
+status_t FutexContext::Wait(user_ptr<int> value_ptr, int current_value, UserThread* owner,
+                            mx_time_t deadline) {
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
     if (futex_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
+    Bucket* bucket = GetBucket(futex_key);
     FutexNode* node;
 
     // FutexWait() checks that the address value_ptr still contains
@@ -42,16 +67,16 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    lock_.Acquire();
+    bucket->lock.Acquire();
 
     int value;
     status_t result = value_ptr.copy_from_user(&value);
     if (result != NO_ERROR) {
-        lock_.Release();
+        bucket->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        bucket->lock.Release();
         return ERR_BAD_STATE;
     }
 
@@ -60,18 +85,31 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    if (owner) {
+        node->set_pi_waiter(thread, thread_effective_priority(get_current_thread()));
+    } else {
+        node->set_pi_waiter(nullptr, 0);
+    }
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
+    FutexNode* head = QueueNodesLocked(bucket, node);
+
+    // We checked the futex value names |owner| as the holder of the lock, so
+    // everyone waiting on it lends to |owner| now, whoever they named before.
+    if (owner)
+        SetPiOwner(head, owner);
+
+    // Block current thread.  This releases the bucket lock and does not reacquire it.
+    result = node->BlockThread(&bucket->lock, deadline);
     if (result == NO_ERROR) {
         // Fix/workaround for MG-624:
         // We must re-acquire the lock here to force this thread to wait until
         // the WakeThreads() marks this thread as not in the queue anymore.
         // Otherwise, this thread can exit before it does that, causing
-        // WakeThreads() to scribble on memory.
-        AutoLock lock(&lock_);
+        // WakeThreads() to scribble on memory.  Wakes leave the key of the
+        // woken nodes alone, so it still names the bucket to lock.
+        bucket = LockNodeBucket(node);
         DEBUG_ASSERT(!node->IsInQueue());
+        bucket->lock.Release();
         // All the work necessary for removing us from the hash table was done by FutexWake()
         return NO_ERROR;
     }
@@ -81,9 +119,12 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     // (ERR_INTERRUPTED_RETRY).
     //
     // We need to ensure that the thread's node is removed from the wait
-    // queue, because FutexWake() probably didn't do that.
-    AutoLock lock(&lock_);
-    if (UnqueueNodeLocked(node)) {
+    // queue, because FutexWake() probably didn't do that.  We may have been
+    // requeued onto a futex in another bucket in the meantime.
+    bucket = LockNodeBucket(node);
+    bool unqueued = UnqueueNodeLocked(bucket, node);
+    bucket->lock.Release();
+    if (unqueued) {
         return result;
     }
     // The current thread was not found on the wait queue.  This means
@@ -112,15 +153,27 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
                                  uint32_t count) {
     LTRACE_ENTRY;
 
+    return Wake(value_ptr, count, false);
+}
+
+status_t FutexContext::FutexWakePI(user_ptr<const int> value_ptr,
+                                   uint32_t count) {
+    LTRACE_ENTRY;
+
+    return Wake(value_ptr, count, true);
+}
+
+status_t FutexContext::Wake(user_ptr<const int> value_ptr, uint32_t count, bool inherit) {
     if (count == 0) return NO_ERROR;
 
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
     if (futex_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
+    Bucket* bucket = GetBucket(futex_key);
+    AutoLock lock(&bucket->lock);
 
-    FutexNode* node = futex_table_.erase(futex_key);
+    FutexNode* node = bucket->table.erase(futex_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return NO_ERROR;
@@ -128,12 +181,21 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
     DEBUG_ASSERT(node->GetKey() == futex_key);
 
     FutexNode* wake_head = node;
-    node = FutexNode::RemoveFromHead(node, count, futex_key, 0u);
+    node = FutexNode::RemoveFromHead(node, count, futex_key, futex_key);
     // node is now the new blocked thread list head
 
+    // Woken threads stop lending.  Their owner, normally the caller, drops
+    // back to what waiters on other futexes lend it, so that a woken thread
+    // that now outranks it preempts it.
+    SetPiOwner(wake_head, nullptr);
+
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == futex_key);
-        futex_table_.insert(node);
+        bucket->table.insert(node);
+
+        // The first woken thread is the likely next owner.
+        if (inherit)
+            SetPiOwner(node, wake_head->pi_thread());
     }
 
     // Traversing this list of threads must be done while holding the
@@ -146,29 +208,57 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
 }
 
 status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
-                                    user_ptr<int> requeue_ptr, uint32_t requeue_count) {
+                                    user_ptr<int> requeue_ptr, uint32_t requeue_count)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
-
-    int value;
-    status_t result = wake_ptr.copy_from_user(&value);
-    if (result != NO_ERROR) return result;
-    if (value != current_value) return ERR_BAD_STATE;
-
     uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
     uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
     if (wake_key == requeue_key) return ERR_INVALID_ARGS;
     if (wake_key % sizeof(int) || requeue_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
+    // Requeueing moves nodes between the two futexes' buckets, so hold
+    // both locks, taken in address order when they differ.
+    Bucket* wake_bucket = GetBucket(wake_key);
+    Bucket* requeue_bucket = GetBucket(requeue_key);
+    Bucket* first = wake_bucket < requeue_bucket ? wake_bucket : requeue_bucket;
+    Bucket* second = wake_bucket < requeue_bucket ? requeue_bucket : wake_bucket;
+
+    first->lock.Acquire();
+    if (second != first)
+        second->lock.Acquire();
+
+    status_t result = RequeueLocked(wake_bucket, wake_ptr, wake_count, current_value,
+                                    requeue_bucket, requeue_key, requeue_count);
+
+    if (second != first)
+        second->lock.Release();
+    first->lock.Release();
+    return result;
+}
+
+status_t FutexContext::RequeueLocked(Bucket* wake_bucket, user_ptr<int> wake_ptr,
+                                     uint32_t wake_count, int current_value,
+                                     Bucket* requeue_bucket, uintptr_t requeue_key,
+                                     uint32_t requeue_count) {
+    DEBUG_ASSERT(wake_bucket->lock.IsHeld());
+    DEBUG_ASSERT(requeue_bucket->lock.IsHeld());
+
+    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
+
+    int value;
+    status_t result = wake_ptr.copy_from_user(&value);
+    if (result != NO_ERROR) return result;
+    if (value != current_value) return ERR_BAD_STATE;
+
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
+    // nodes below, because operations on the bucket tables look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = wake_bucket->table.erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return NO_ERROR;
@@ -179,7 +269,8 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
         wake_head = nullptr;
     } else {
         wake_head = node;
-        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, 0u);
+        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, wake_key);
+        SetPiOwner(wake_head, nullptr);
     }
 
     // node is now the head of wake_ptr futex after possibly removing some threads to wake
@@ -190,40 +281,116 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
             node = FutexNode::RemoveFromHead(node, requeue_count,
                                              wake_key, requeue_key);
 
-            // now requeue our nodes to requeue_ptr mutex
+            // now requeue our nodes to requeue_ptr mutex; their owner
+            // has nothing to do with that one
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            SetPiOwner(requeue_head, nullptr);
+            QueueNodesLocked(requeue_bucket, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_bucket->table.insert(node);
     }
 
     FutexNode::WakeThreads(wake_head);
     return NO_ERROR;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+FutexNode* FutexContext::QueueNodesLocked(Bucket* bucket, FutexNode* head) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
 
-    FutexNode::HashTable::iterator iter;
+    BucketTable::iterator iter;
 
     // Attempt to insert this FutexNode into the hash table.  If the insert
     // succeeds, then the current thread is first to block on this futex and we
     // are finished.  If the insert fails, then there is already a thread
     // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+    if (!bucket->table.insert_or_find(head, &iter))
         iter->AppendList(head);
+    return &*iter;
+}
+
+void FutexContext::SetPiOwner(FutexNode* head, UserThread* owner) {
+    if (!head)
+        return;
+
+    AutoLock lock(&pi_lock_);
+
+    // An owner on its way out cannot take on lenders; it would leave
+    // them pointing at it.
+    if (owner && !owner->CanInheritPriority())
+        owner = nullptr;
+
+    // The waiters on one futex normally all lend to the same thread.
+    UserThread* previous = nullptr;
+    FutexNode* node = head;
+    do {
+        UserThread* old_owner = MovePiLenderLocked(node, owner);
+        if (old_owner && old_owner != previous) {
+            if (previous)
+                UpdateInheritedPriorityLocked(previous);
+            previous = old_owner;
+        }
+        node = node->queue_next();
+    } while (node != head);
+
+    if (previous)
+        UpdateInheritedPriorityLocked(previous);
+    if (owner)
+        UpdateInheritedPriorityLocked(owner);
+}
+
+// Returns the thread |node| lent to before, if it changed.
+UserThread* FutexContext::MovePiLenderLocked(FutexNode* node, UserThread* owner) {
+    UserThread* old_owner = node->pi_owner();
+    if (!node->pi_thread() || old_owner == owner)
+        return nullptr;
+
+    if (old_owner)
+        old_owner->pi_lenders().erase(*node);
+    node->set_pi_owner(owner);
+    if (owner)
+        owner->pi_lenders().push_back(node);
+    return old_owner;
+}
+
+void FutexContext::UpdateInheritedPriorityLocked(UserThread* owner) {
+    int priority = 0;
+    for (const auto& node : owner->pi_lenders())
+        priority = mxtl::max(priority, node.pi_priority());
+    owner->SetInheritedPriority(priority);
+}
+
+void FutexContext::ReleasePiLenders(UserThread* thread) {
+    AutoLock lock(&pi_lock_);
+
+    while (!thread->pi_lenders().is_empty())
+        thread->pi_lenders().pop_front()->set_pi_owner(nullptr);
+}
+
+// A node's key only changes when FutexRequeue() moves it to another futex,
+// and FutexRequeue() holds the locks of both buckets while it does so.  So
+// once we hold the lock of the bucket for the key we read, and the key is
+// still the same, the node cannot move away from under us.
+FutexContext::Bucket* FutexContext::LockNodeBucket(FutexNode* node) {
+    for (;;) {
+        uintptr_t futex_key = node->GetKey();
+        Bucket* bucket = GetBucket(futex_key);
+        bucket->lock.Acquire();
+        if (node->GetKey() == futex_key)
+            return bucket;
+        bucket->lock.Release();
+    }
 }
 
 // This attempts to unqueue a thread (which may or may not be waiting on a
 // futex), given its FutexNode.  This returns whether the FutexNode was
 // found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
+bool FutexContext::UnqueueNodeLocked(Bucket* bucket, FutexNode* node) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
 
     if (!node->IsInQueue())
         return false;
@@ -233,11 +400,21 @@ bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
     // However, that could be out of date if the thread was requeued by
     // FutexRequeue(), so we need to re-get the hash table key here.
     uintptr_t futex_key = node->GetKey();
+    DEBUG_ASSERT(GetBucket(futex_key) == bucket);
+
+    // A PI waiter that gives up, by timing out or being killed, stops
+    // lending to the owner.
+    if (node->pi_owner()) {
+        AutoLock lock(&pi_lock_);
+        UserThread* owner = MovePiLenderLocked(node, nullptr);
+        if (owner)
+            UpdateInheritedPriorityLocked(owner);
+    }
 
-    FutexNode* old_head = futex_table_.erase(futex_key);
+    FutexNode* old_head = bucket->table.erase(futex_key);
     DEBUG_ASSERT(old_head);
     FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
     if (new_head)
-        futex_table_.insert(new_head);
+        bucket->table.insert(new_head);
     return true;
 }
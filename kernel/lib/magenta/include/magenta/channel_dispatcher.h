@@ -16,6 +16,7 @@
 
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
+#include <mxtl/intrusive_wavl_tree.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/unique_ptr.h>
 
@@ -66,7 +67,7 @@ public:
     // only transitions to nullptr while holding the ChannelDispatcher's lock.
     //
     // See also: comments in ChannelDispatcher::Call()
-    class MessageWaiter : public mxtl::DoublyLinkedListable<MessageWaiter*> {
+    class MessageWaiter : public mxtl::WAVLTreeContainable<MessageWaiter*> {
     public:
         MessageWaiter() : txid_(0), status_(ERR_BAD_STATE) {
         }
@@ -102,6 +103,11 @@ public:
 
         mx_txid_t get_txid() const { return txid_; }
 
+        // Waiters are keyed by txid, then by the order they started waiting
+        // on the channel in, as several calls may use the same txid.
+        uint64_t GetKey() const { return key_; }
+        void set_key(uint32_t seq) { key_ = (static_cast<uint64_t>(txid_) << 32) | seq; }
+
         mx_status_t Wait(lk_time_t deadline) {
             DEBUG_ASSERT(armed());
             return event_.Wait(deadline);
@@ -125,11 +131,19 @@ public:
         WaitEvent event_;
         mx_txid_t txid_;
         mx_status_t status_;
+        uint64_t key_ = 0;
     };
 
 private:
     using MessageList = mxtl::DoublyLinkedList<mxtl::unique_ptr<MessagePacket>>;
-    using WaiterList = mxtl::DoublyLinkedList<MessageWaiter*>;
+    // Call waiters are kept in a tree keyed by txid, so that a reply finds
+    // its waiter without walking every outstanding call.
+    using WaiterTree = mxtl::WAVLTree<uint64_t, MessageWaiter*>;
+
+    void AddWaiterLocked(MessageWaiter* waiter) TA_REQ(lock_);
+    MessageWaiter* FindWaiterLocked(mx_txid_t txid) TA_REQ(lock_);
+    void EraseWaiterLocked(MessageWaiter* waiter) TA_REQ(lock_);
+    void CancelWaitersLocked(status_t status) TA_REQ(lock_);
 
     void RemoveWaiter(MessageWaiter* waiter);
 
@@ -143,7 +157,8 @@ private:
 
     Mutex lock_;
     MessageList messages_ TA_GUARDED(lock_);
-    WaiterList waiters_ TA_GUARDED(lock_);
+    WaiterTree waiters_ TA_GUARDED(lock_);
+    uint32_t waiter_seq_ TA_GUARDED(lock_) = 0;
     mxtl::unique_ptr<PortClient> iopc_ TA_GUARDED(lock_);
     StateTracker state_tracker_;
     mxtl::RefPtr<ChannelDispatcher> other_ TA_GUARDED(lock_);
@@ -10,10 +10,15 @@
 #include <lib/user_copy/user_ptr.h>
 #include <magenta/futex_node.h>
 #include <magenta/types.h>
+#include <mxtl/intrusive_hash_table.h>
+
+class UserThread;
 
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
 // to contain all active futexes.
+// The table is split into kNumBuckets buckets, each with its own lock, so that operations
+// on unrelated futexes do not serialize on a single lock.
 // A futex is considered active if there is one or more threads blocked on the futex.
 // After no threads are left blocked on a futex it is removed from the hash table.
 // The value in the futex hash table is the FutexNode object associated with the head
@@ -47,18 +52,69 @@ public:
     status_t FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
                           user_ptr<int> requeue_ptr, uint32_t requeue_count);
 
+    // FutexWaitPI is FutexWait for a futex whose lock is held by |owner|.
+    // While the current thread is blocked, it and the other PI waiters on
+    // the futex lend their effective priority to |owner|.
+    status_t FutexWaitPI(user_ptr<int> value_ptr, int current_value, UserThread* owner,
+                         mx_time_t deadline);
+
+    // FutexWakePI wakes up to |count| threads blocked on the |value_ptr|
+    // futex, and hands the priority its remaining waiters lent the current
+    // thread on to the first woken thread, as it is expected to become the
+    // new owner.  If it does not, it names the actual owner in its next
+    // FutexWaitPI, which moves the futex's waiters over to that owner.
+    status_t FutexWakePI(user_ptr<const int> value_ptr, uint32_t count);
+
+    // Detaches the PI waiters lending their priority to |thread|, which is
+    // exiting.
+    void ReleasePiLenders(UserThread* thread);
+
 private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr uint32_t kBucketShift = 4;
+    static constexpr uint32_t kNumBuckets = 1u << kBucketShift;
+
+    // Hash table for the futexes of one bucket.  Key is futex address, value is the
+    // FutexNode for the head of futex's blocked thread list.
+    using BucketTable = mxtl::HashTable<uintptr_t, FutexNode*,
+                                        mxtl::SinglyLinkedList<FutexNode*>, size_t, 7>;
+
+    struct Bucket {
+        // protects table
+        Mutex lock;
+        BucketTable table TA_GUARDED(lock);
+    };
+
+    Bucket* GetBucket(uintptr_t futex_key);
+
+    status_t Wait(user_ptr<int> value_ptr, int current_value, UserThread* owner,
+                  mx_time_t deadline) TA_NO_THREAD_SAFETY_ANALYSIS;
+    status_t Wake(user_ptr<const int> value_ptr, uint32_t count, bool inherit);
+    status_t RequeueLocked(Bucket* wake_bucket, user_ptr<int> wake_ptr, uint32_t wake_count,
+                           int current_value, Bucket* requeue_bucket, uintptr_t requeue_key,
+                           uint32_t requeue_count) TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // Returns the head of the wait queue the nodes were added to.
+    static FutexNode* QueueNodesLocked(Bucket* bucket, FutexNode* head) TA_REQ(bucket->lock);
+
+    // Makes the PI waiters on the list starting with |head| lend their
+    // priority to |owner|, or to nobody if it is null, and updates the
+    // priority of each thread that gains or loses lenders.  The list must
+    // be held still by its bucket's lock.
+    void SetPiOwner(FutexNode* head, UserThread* owner);
+    UserThread* MovePiLenderLocked(FutexNode* node, UserThread* owner) TA_REQ(pi_lock_);
+    void UpdateInheritedPriorityLocked(UserThread* owner) TA_REQ(pi_lock_);
+
+    // Locks the bucket of the futex |node| is (or was last) queued on.
+    Bucket* LockNodeBucket(FutexNode* node) TA_NO_THREAD_SAFETY_ANALYSIS;
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    bool UnqueueNodeLocked(Bucket* bucket, FutexNode* node) TA_REQ(bucket->lock);
 
-    // protects futex_table_
-    Mutex lock_;
+    Bucket buckets_[kNumBuckets];
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+    // Protects which owner each PI waiter lends to, and the owners' lists
+    // of lenders.  Taken after a bucket lock.
+    Mutex pi_lock_;
 };
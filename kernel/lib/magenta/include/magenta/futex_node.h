@@ -11,8 +11,11 @@
 #include <kernel/wait.h>
 #include <list.h>
 #include <magenta/types.h>
+#include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_hash_table.h>
 
+class UserThread;
+
 // Node for linked list of threads blocked on a futex
 // Intended to be embedded within a UserThread Instance
 class FutexNode : public mxtl::SinglyLinkedListable<FutexNode*> {
@@ -48,6 +51,33 @@ public:
         hash_key_ = key;
     }
 
+    // The node after this one on the futex wait queue it is in.
+    FutexNode* queue_next() const { return queue_next_; }
+
+    // Records the priority a PI waiter lends to the futex owner, or clears
+    // it for an ordinary waiter (|thread| null).
+    void set_pi_waiter(UserThread* thread, int priority) {
+        DEBUG_ASSERT(pi_owner_ == nullptr);
+        pi_thread_ = thread;
+        pi_priority_ = priority;
+    }
+    UserThread* pi_thread() const { return pi_thread_; }
+    int pi_priority() const { return pi_priority_; }
+
+    // The thread this PI waiter currently lends its priority to, if any.
+    // Guarded by the FutexContext's pi lock, like the list of lenders the
+    // node is on while it is set.
+    UserThread* pi_owner() const { return pi_owner_; }
+    void set_pi_owner(UserThread* owner) { pi_owner_ = owner; }
+
+    // The PI waiters lending their priority to one owner.
+    struct PiLenderTraits {
+        static mxtl::DoublyLinkedListNodeState<FutexNode*>& node_state(FutexNode& node) {
+            return node.pi_lender_node_state_;
+        }
+    };
+    using PiLenderList = mxtl::DoublyLinkedList<FutexNode*, PiLenderTraits>;
+
     // Trait implementation for mxtl::HashTable
     uintptr_t GetKey() const { return hash_key_; }
     static size_t GetHash(uintptr_t key) { return (key >> 3); }
@@ -66,6 +96,15 @@ private:
     //    intrusive SinglyLinkedLists).
     uintptr_t hash_key_;
 
+    // The blocked thread and its effective priority when it waits with
+    // FutexWaitPI(); pi_thread_ is null for an ordinary FutexWait().
+    UserThread* pi_thread_ = nullptr;
+    int pi_priority_ = 0;
+
+    // The owner this waiter lends to, and its place on the owner's list.
+    UserThread* pi_owner_ = nullptr;
+    mxtl::DoublyLinkedListNodeState<FutexNode*> pi_lender_node_state_;
+
     // Used for waking the thread corresponding to the FutexNode.
     wait_queue_t wait_queue_;
 
@@ -17,6 +17,8 @@
 
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
+#include <mxtl/intrusive_hash_table.h>
+#include <mxtl/intrusive_single_list.h>
 #include <mxtl/unique_ptr.h>
 
 #include <sys/types.h>
@@ -83,11 +85,25 @@ struct PortPacket final : public mxtl::DoublyLinkedListable<PortPacket*> {
     mx_port_packet_t packet;
     PortObserver* observer;
 
+    // Links a queued signal packet into the per-key index of a port created
+    // with MX_PORT_OPT_COALESCE.
+    mxtl::SinglyLinkedListNodeState<PortPacket*> key_node;
+
     PortPacket();
     PortPacket(const PortPacket&) = delete;
     void operator=(PortPacket) = delete;
 
     uint32_t type() const { return packet.type; }
+
+    // mxtl::HashTable support for the per-key index.
+    uint64_t GetKey() const { return packet.key; }
+    static size_t GetHash(uint64_t key) { return static_cast<size_t>(key ^ (key >> 32)); }
+
+    struct KeyNodeTraits {
+        static mxtl::SinglyLinkedListNodeState<PortPacket*>& node_state(PortPacket& obj) {
+            return obj.key_node;
+        }
+    };
 };
 
 // Observers are weakly contained in state trackers until |remove_| member
@@ -143,6 +159,11 @@ public:
     mx_status_t QueueUser(const mx_port_packet_t& packet);
     mx_status_t DeQueue(mx_time_t deadline, mx_port_packet_t* packet);
 
+    // Waits like DeQueue() but then removes up to |count| packets with a
+    // single lock acquisition. |actual| is the number copied to |packets|.
+    mx_status_t DeQueueMany(mx_time_t deadline, mx_port_packet_t* packets,
+                            size_t count, size_t* actual);
+
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
     bool CanReap(PortObserver* observer, PortPacket* port_packet);
@@ -156,12 +177,19 @@ public:
     bool CancelQueued(const void* handle, uint64_t key);
 
 private:
+    using KeyIndex = mxtl::HashTable<uint64_t, PortPacket*,
+                                     mxtl::SinglyLinkedList<PortPacket*,
+                                                            PortPacket::KeyNodeTraits>>;
+
     PortDispatcherV2(uint32_t options);
-    PortObserver* CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) TA_REQ(lock_);
+    PortPacket* PopLocked() TA_REQ(lock_);
 
     mxtl::Canary<mxtl::magic("POR2")> canary_;
+    const bool coalesce_;
     Mutex lock_;
     Semaphore sema_;
     bool zero_handles_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
+    // Queued signal packets by key; only used when |coalesce_| is set.
+    KeyIndex keyed_ TA_GUARDED(lock_);
 };
@@ -20,6 +20,10 @@ public:
     int Post();
     status_t Wait(lk_time_t deadline);
 
+    // Takes up to |count| resources without blocking and returns how many
+    // were taken.
+    uint64_t TryWait(uint64_t count);
+
 private:
     int64_t count_;
     wait_queue_t waitq_;
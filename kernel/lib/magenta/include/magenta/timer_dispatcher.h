@@ -28,7 +28,7 @@ public:
     StateTracker* get_state_tracker() final { return &state_tracker_; }
 
     // Timer specific ops.
-    mx_status_t SetOneShot(lk_time_t deadline);
+    mx_status_t SetOneShot(lk_time_t deadline, lk_time_t slack);
     mx_status_t CancelOneShot();
     void OnTimerFired();
 
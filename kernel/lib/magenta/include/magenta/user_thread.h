@@ -90,6 +90,19 @@ public:
     status_t Suspend();
     status_t Resume();
 
+    // Whether PI futex waiters may lend this thread their priority: it has
+    // started and not begun to exit.
+    bool CanInheritPriority();
+
+    // Keeps the thread's priority at no less than |priority|, or lifts that
+    // floor if it is 0, while the thread is still running.  Used for
+    // priority inheritance.
+    void SetInheritedPriority(int priority);
+
+    // The PI futex waiters lending this thread their priority.  Guarded by
+    // the pi lock of the process's FutexContext.
+    FutexNode::PiLenderList& pi_lenders() { return pi_lenders_; }
+
     // accessors
     ProcessDispatcher* process() { return process_.get(); }
     // N.B. The dispatcher() accessor is potentially racy.
@@ -207,6 +220,9 @@ private:
     // Node for linked list of threads blocked on a futex
     FutexNode futex_node_;
 
+    // PI futex waiters lending us their priority
+    FutexNode::PiLenderList pi_lenders_;
+
     StateTracker state_tracker_;
 
     // A thread-level exception port for this thread.
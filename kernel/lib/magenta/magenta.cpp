@@ -9,6 +9,8 @@
 #include <pow2.h>
 #include <trace.h>
 
+#include <arch/ops.h>
+
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/mutex.h>
@@ -30,6 +32,7 @@
 #include <magenta/io_mapping_dispatcher.h>
 
 #include <mxtl/arena.h>
+#include <mxtl/atomic.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/type_support.h>
 
@@ -40,18 +43,42 @@
 // The number of possible handles in the arena.
 constexpr size_t kMaxHandleCount = 256 * 1024u;
 
+// The handle arena is split into shards, each with its own lock, so that
+// handle creation and destruction on different cpus do not contend on a
+// single mutex. Each cpu allocates from its own shard until it fills up.
+constexpr size_t kHandleArenaShardCount = 16u;
+constexpr size_t kHandlesPerShard = kMaxHandleCount / kHandleArenaShardCount;
+static_assert((kHandleArenaShardCount & (kHandleArenaShardCount - 1)) == 0,
+              "kHandleArenaShardCount must be a power of 2");
+
 // Warning level: high_handle_count() is called when
 // there are this many outstanding handles.
 constexpr size_t kHighHandleCount = (kMaxHandleCount * 7) / 8;
 
-// The handle arena and its mutex. It also guards Dispatcher::handle_count_.
-static Mutex handle_mutex;
-static mxtl::Arena TA_GUARDED(handle_mutex) handle_arena;
-static size_t outstanding_handles TA_GUARDED(handle_mutex) = 0u;
+// The minimum time between two high handle count warnings.
+constexpr lk_time_t kHighHandleCountWarningInterval = LK_SEC(1);
+
+namespace {
+
+struct HandleArenaShard {
+    Mutex lock;
+    mxtl::Arena arena TA_GUARDED(lock);
+
+    // The highest address ever returned by |arena|. Slots below it always
+    // hold committed memory, which lets MapU32ToHandle() validate a handle
+    // value without taking |lock|.
+    mxtl::atomic<uintptr_t> top;
+} __CPU_ALIGN;
+
+} // namespace
+
+static HandleArenaShard handle_arena_shards[kHandleArenaShardCount];
+
+// The number of handles allocated from all the shards.
+static mxtl::atomic<size_t> outstanding_handles;
 
 size_t internal::OutstandingHandles() {
-    AutoLock lock(&handle_mutex);
-    return outstanding_handles;
+    return outstanding_handles.load(mxtl::memory_order_relaxed);
 }
 
 // The system exception port.
@@ -66,7 +93,13 @@ static mxtl::RefPtr<JobDispatcher> root_job;
 static PolicyManager* policy_manager;
 
 void magenta_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
-    handle_arena.Init("handles", sizeof(Handle), kMaxHandleCount);
+    for (size_t i = 0; i < kHandleArenaShardCount; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "handles-%zu", i);
+        auto& shard = handle_arena_shards[i];
+        shard.arena.Init(name, sizeof(Handle), kHandlesPerShard);
+        shard.top.store(reinterpret_cast<uintptr_t>(shard.arena.start()));
+    }
     root_job = JobDispatcher::CreateRootJob();
     policy_manager = PolicyManager::Create();
 }
@@ -78,8 +111,10 @@ void magenta_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
 //   [31..30]: Must be zero
 //   [29..kHandleGenerationShift]: Generation number
 //                                 Masked by kHandleGenerationMask
-//   [kHandleGenerationShift-1..0]: Index into handle_arena
+//   [kHandleGenerationShift-1..0]: Index into the handle arena
 //                                  Masked by kHandleIndexMask
+//                                  The top bits select the shard,
+//                                  the rest are the slot in the shard.
 static constexpr uint32_t kHandleIndexMask = kMaxHandleCount - 1;
 static_assert((kHandleIndexMask & kMaxHandleCount) == 0,
               "kMaxHandleCount must be a power of 2");
@@ -95,16 +130,22 @@ static_assert((kHandleGenerationMask >> kHandleGenerationShift) >= 255,
 static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
                   0xffffffffu,
               "Masks do not agree");
-
-// Returns a new |base_value| based on the value stored in the free
-// |handle_arena| slot pointed to by |addr|. The new value will be different
+static constexpr uint32_t kHandleSlotMask = kHandlesPerShard - 1;
+static constexpr uint32_t kHandleShardShift = log2_uint_floor(kHandlesPerShard);
+static_assert((kHandleSlotMask >> kHandleShardShift) == 0 &&
+                  (kHandleIndexMask >> kHandleShardShift) == kHandleArenaShardCount - 1,
+              "Shard and slot masks do not agree");
+
+// Returns a new |base_value| based on the value stored in the free slot of
+// |shard_index|'s arena pointed to by |addr|. The new value will be different
 // from the last |base_value| used by this slot.
-static uint32_t GetNewHandleBaseValue(void* addr) TA_REQ(handle_mutex) {
-    // Get the index of this slot within handle_arena.
+static uint32_t GetNewHandleBaseValue(uint32_t shard_index, void* addr) {
+    // Get the index of this slot within the shard.
     auto va = reinterpret_cast<Handle*>(addr) -
-              reinterpret_cast<Handle*>(handle_arena.start());
-    uint32_t handle_index = static_cast<uint32_t>(va);
-    DEBUG_ASSERT((handle_index & ~kHandleIndexMask) == 0);
+              reinterpret_cast<Handle*>(handle_arena_shards[shard_index].arena.start());
+    uint32_t slot = static_cast<uint32_t>(va);
+    DEBUG_ASSERT((slot & ~kHandleSlotMask) == 0);
+    uint32_t handle_index = (shard_index << kHandleShardShift) | slot;
 
     // Check the free memory for a stashed base_value.
     uint32_t v = *reinterpret_cast<uint32_t*>(addr);
@@ -123,7 +164,7 @@ static uint32_t GetNewHandleBaseValue(void* addr) TA_REQ(handle_mutex) {
 // Destroys, but does not free, the Handle, and fixes up its memory to protect
 // against stale pointers to it. Also stashes the Handle's base_value for reuse
 // the next time this slot is allocated.
-void internal::TearDownHandle(Handle *handle) TA_EXCL(handle_mutex) {
+void internal::TearDownHandle(Handle *handle) {
     uint32_t base_value = handle->base_value();
 
     // Calling the handle dtor can cause many things to happen, so it is
@@ -147,74 +188,92 @@ void internal::TearDownHandle(Handle *handle) TA_EXCL(handle_mutex) {
 }
 
 static void high_handle_count(size_t count) {
-    // TODO: Avoid calling this for every handle after kHighHandleCount;
-    // printfs are slow and |handle_mutex| is held by our caller.
+    // Warn at most once per interval; printfs are slow, and every handle
+    // allocated while the count stays high ends up here.
+    static mxtl::atomic<lk_time_t> last_warning;
+
+    lk_time_t now = current_time();
+    lk_time_t last = last_warning.load(mxtl::memory_order_relaxed);
+    if (last != 0 && now - last < kHighHandleCountWarningInterval)
+        return;
+    if (!last_warning.compare_exchange_strong(&last, now, mxtl::memory_order_relaxed,
+                                              mxtl::memory_order_relaxed))
+        return;
+
     printf("WARNING: High handle count: %zu handles\n", count);
 }
 
-Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
-    uint32_t* handle_count = nullptr;
-    void* addr;
-    uint32_t base_value;
-
-    {
-        AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        if (addr == nullptr) {
-            const auto oh = outstanding_handles;
-            lock.release();
-            printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
-                   oh);
-            return nullptr;
+// Allocates the memory for a new Handle, preferring the current cpu's shard and
+// falling back to the others when it is full. Returns the new handle's
+// |base_value| through |base_value|, or nullptr if every shard is full.
+static void* AllocHandleSlot(uint32_t* base_value) {
+    const uint32_t first = arch_curr_cpu_num() % kHandleArenaShardCount;
+    for (uint32_t i = 0; i < kHandleArenaShardCount; i++) {
+        const uint32_t shard_index = (first + i) % kHandleArenaShardCount;
+        auto& shard = handle_arena_shards[shard_index];
+
+        void* addr;
+        {
+            AutoLock lock(&shard.lock);
+            addr = shard.arena.Alloc();
+            if (addr == nullptr)
+                continue;
+
+            auto end = reinterpret_cast<uintptr_t>(addr) + sizeof(Handle);
+            if (end > shard.top.load(mxtl::memory_order_relaxed))
+                shard.top.store(end, mxtl::memory_order_release);
+
+            *base_value = GetNewHandleBaseValue(shard_index, addr);
         }
-        if (++outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
-
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)++;
-        if (*handle_count != 2u)
-            handle_count = nullptr;
 
-        base_value = GetNewHandleBaseValue(addr);
+        size_t count = outstanding_handles.fetch_add(1u, mxtl::memory_order_relaxed) + 1u;
+        if (count > kHighHandleCount)
+            high_handle_count(count);
+        return addr;
     }
 
+    printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
+           internal::OutstandingHandles());
+    return nullptr;
+}
+
+// Returns true if the handle count of |dispatcher| moved onto or off of 1 by
+// the update that produced |count|.
+static bool IsLastHandleTransition(uint32_t count, bool incremented) {
+    return incremented ? (count == 2u) : (count == 1u);
+}
+
+Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
+    uint32_t base_value;
+    void* addr = AllocHandleSlot(&base_value);
+    if (addr == nullptr)
+        return nullptr;
+
+    auto handle_count = dispatcher->get_handle_count_ptr();
+    uint32_t count = handle_count->fetch_add(1u) + 1u;
+
     auto state_tracker = dispatcher->get_state_tracker();
     if (state_tracker != nullptr)
-        state_tracker->UpdateLastHandleSignal(handle_count);
+        state_tracker->UpdateLastHandleSignal(
+            IsLastHandleTransition(count, true) ? handle_count : nullptr);
 
     return new (addr) Handle(mxtl::move(dispatcher), rights, base_value);
 }
 
 Handle* DupHandle(Handle* source, mx_rights_t rights, bool is_replace) {
     mxtl::RefPtr<Dispatcher> dispatcher(source->dispatcher());
-    uint32_t* handle_count;
-    void* addr;
     uint32_t base_value;
+    void* addr = AllocHandleSlot(&base_value);
+    if (addr == nullptr)
+        return nullptr;
 
-    {
-        AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        if (addr == nullptr) {
-            const auto oh = outstanding_handles;
-            lock.release();
-            printf(
-                "WARNING: Could not allocate duplicate handle (%zu outstanding)\n", oh);
-            return nullptr;
-        }
-        if (++outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
-
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)++;
-        if (*handle_count != 2u)
-            handle_count = nullptr;
-
-        base_value = GetNewHandleBaseValue(addr);
-    }
+    auto handle_count = dispatcher->get_handle_count_ptr();
+    uint32_t count = handle_count->fetch_add(1u) + 1u;
 
     auto state_tracker = dispatcher->get_state_tracker();
     if (!is_replace && (state_tracker != nullptr))
-        state_tracker->UpdateLastHandleSignal(handle_count);
+        state_tracker->UpdateLastHandleSignal(
+            IsLastHandleTransition(count, true) ? handle_count : nullptr);
 
     return new (addr) Handle(source, rights, base_value);
 }
@@ -244,56 +303,55 @@ void DeleteHandle(Handle* handle) {
         };
     }
 
+    const uint32_t shard_index =
+        (handle->base_value() & kHandleIndexMask) >> kHandleShardShift;
+
     // Destroys, but does not free, the Handle, and fixes up its memory
     // to protect against stale pointers to it. Also stashes the Handle's
     // base_value for reuse the next time this slot is allocated.
     internal::TearDownHandle(handle);
 
-    bool zero_handles = false;
-    uint32_t* handle_count;
     {
-        AutoLock lock(&handle_mutex);
-        --outstanding_handles;
-
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)--;
-        if (*handle_count == 0u)
-            zero_handles = true;
-        else if (*handle_count != 1u)
-            handle_count = nullptr;
-
-        handle_arena.Free(handle);
+        auto& shard = handle_arena_shards[shard_index];
+        AutoLock lock(&shard.lock);
+        shard.arena.Free(handle);
     }
+    outstanding_handles.fetch_sub(1u, mxtl::memory_order_relaxed);
 
-    if (zero_handles) {
+    auto handle_count = dispatcher->get_handle_count_ptr();
+    uint32_t count = handle_count->fetch_sub(1u) - 1u;
+    if (count == 0u) {
         dispatcher->on_zero_handles();
         return;
     }
 
     if (state_tracker)
-        state_tracker->UpdateLastHandleSignal(handle_count);
+        state_tracker->UpdateLastHandleSignal(
+            IsLastHandleTransition(count, false) ? handle_count : nullptr);
 
     // If |dispatcher| is the last reference then the dispatcher object
     // gets destroyed here.
 }
 
-bool HandleInRange(void* addr) {
-    AutoLock lock(&handle_mutex);
-    return handle_arena.in_range(addr);
-}
-
 Handle* MapU32ToHandle(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
     auto index = value & kHandleIndexMask;
-    auto va = &reinterpret_cast<Handle*>(handle_arena.start())[index];
-    if (!HandleInRange(va))
+    auto& shard = handle_arena_shards[index >> kHandleShardShift];
+
+    // The arena's start never changes after init and |top| only grows, so
+    // the slot can be checked without taking the shard lock.
+    auto va = &reinterpret_cast<Handle*>(shard.arena.start())[index & kHandleSlotMask];
+    if (reinterpret_cast<uintptr_t>(va) + sizeof(Handle) >
+        shard.top.load(mxtl::memory_order_acquire))
         return nullptr;
     Handle *handle = reinterpret_cast<Handle*>(va);
     return handle->base_value() == value ? handle : nullptr;
 }
 
 void internal::DumpHandleTableInfo() {
-    AutoLock lock(&handle_mutex);
-    handle_arena.Dump();
+    for (auto& shard : handle_arena_shards) {
+        AutoLock lock(&shard.lock);
+        shard.arena.Dump();
+    }
 }
 
 mx_status_t SetSystemExceptionPort(mxtl::RefPtr<ExceptionPort> eport) {
@@ -99,7 +99,7 @@ void PortObserver::MaybeQueue(mx_signals_t new_state, uint64_t count) {
 mx_status_t PortDispatcherV2::Create(uint32_t options,
                                      mxtl::RefPtr<Dispatcher>* dispatcher,
                                      mx_rights_t* rights) {
-    DEBUG_ASSERT(options == MX_PORT_OPT_V2);
+    DEBUG_ASSERT((options & ~MX_PORT_OPT_COALESCE) == MX_PORT_OPT_V2);
     AllocChecker ac;
     auto disp = new (&ac) PortDispatcherV2(options);
     if (!ac.check())
@@ -110,8 +110,9 @@ mx_status_t PortDispatcherV2::Create(uint32_t options,
     return NO_ERROR;
 }
 
-PortDispatcherV2::PortDispatcherV2(uint32_t /*options*/)
-    : zero_handles_(false) {
+PortDispatcherV2::PortDispatcherV2(uint32_t options)
+    : coalesce_((options & MX_PORT_OPT_COALESCE) != 0u),
+      zero_handles_(false) {
 }
 
 PortDispatcherV2::~PortDispatcherV2() {
@@ -157,13 +158,25 @@ mx_status_t PortDispatcherV2::Queue(PortPacket* port_packet,
             return ERR_BAD_STATE;
 
         if (observed) {
-            if (port_packet->InContainer())
+            if (coalesce_) {
+                // Fold the new state into the signal packet still queued for
+                // this key, which can be |port_packet| itself.
+                auto it = keyed_.find(port_packet->packet.key);
+                if (it.IsValid()) {
+                    it->packet.signal.observed |= observed;
+                    it->packet.signal.count += count;
+                    return NO_ERROR;
+                }
+            } else if (port_packet->InContainer()) {
                 return NO_ERROR;
+            }
             port_packet->packet.signal.observed = observed;
             port_packet->packet.signal.count = count;
         }
 
         packets_.push_back(port_packet);
+        if (coalesce_ && observed)
+            keyed_.insert(port_packet);
         wake_count = sema_.Post();
     }
 
@@ -174,39 +187,64 @@ mx_status_t PortDispatcherV2::Queue(PortPacket* port_packet,
 }
 
 mx_status_t PortDispatcherV2::DeQueue(mx_time_t deadline, mx_port_packet_t* packet) {
+    size_t actual;
+    return DeQueueMany(deadline, packet, 1u, &actual);
+}
+
+mx_status_t PortDispatcherV2::DeQueueMany(mx_time_t deadline, mx_port_packet_t* packets,
+                                          size_t count, size_t* actual) {
     canary_.Assert();
+    DEBUG_ASSERT(count > 0u);
 
-    PortPacket* port_packet = nullptr;
-    PortObserver* observer = nullptr;
+    // User packets and the observers of signal packets whose wait is over
+    // are destroyed after the lock is dropped.
+    mxtl::DoublyLinkedList<PortPacket*> reap;
+    size_t taken = 0u;
+    bool waited = false;
 
     while (true) {
         {
             AutoLock al(&lock_);
-            if (packets_.is_empty())
-                goto wait;
-
-            port_packet = packets_.pop_front();
-            observer = CopyLocked(port_packet, packet);
+            while ((taken < count) && !packets_.is_empty()) {
+                auto port_packet = PopLocked();
+                if (packets)
+                    packets[taken] = port_packet->packet;
+                ++taken;
+                if ((port_packet->type() == MX_PKT_TYPE_USER) || port_packet->observer)
+                    reap.push_back(port_packet);
+            }
         }
 
-        if (observer)
-            delete observer;
-        else if (packet && packet->type == MX_PKT_TYPE_USER)
-            delete port_packet;
-        return NO_ERROR;
+        if (taken)
+            break;
 
-wait:
         status_t st = sema_.Wait(deadline);
         if (st != NO_ERROR)
             return st;
+        waited = true;
     }
-}
 
-PortObserver* PortDispatcherV2::CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) {
-    if (packet)
-        *packet = port_packet->packet;
+    // Every queued packet posted the semaphore once; retire the posts of the
+    // packets taken here in one go so later waiters don't wake up for them.
+    sema_.TryWait(waited ? taken - 1u : taken);
+
+    while (!reap.is_empty()) {
+        auto port_packet = reap.pop_front();
+        if (port_packet->type() == MX_PKT_TYPE_USER)
+            delete port_packet;
+        else
+            delete port_packet->observer;
+    }
+
+    *actual = taken;
+    return NO_ERROR;
+}
 
-    return (port_packet->type() == MX_PKT_TYPE_USER) ? nullptr : port_packet->observer;
+PortPacket* PortDispatcherV2::PopLocked() {
+    auto port_packet = packets_.pop_front();
+    if (coalesce_ && (port_packet->type() != MX_PKT_TYPE_USER))
+        keyed_.erase(*port_packet);
+    return port_packet;
 }
 
 bool PortDispatcherV2::CanReap(PortObserver* observer, PortPacket* port_packet) {
@@ -283,7 +321,10 @@ bool PortDispatcherV2::CancelQueued(const void* handle, uint64_t key) {
         if ((ob_handle == handle) && (ob_key == key)) {
             auto to_remove = it;
             ++it;
-            delete packets_.erase(to_remove)->observer;
+            auto port_packet = packets_.erase(to_remove);
+            if (coalesce_)
+                keyed_.erase(*port_packet);
+            delete port_packet->observer;
             packet_removed = true;
         } else {
             ++it;
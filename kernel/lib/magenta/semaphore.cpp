@@ -30,6 +30,17 @@ int Semaphore::Post() {
     return ret;
 }
 
+uint64_t Semaphore::TryWait(uint64_t count) {
+    uint64_t taken = 0u;
+    THREAD_LOCK(state);
+    if (count_ > 0) {
+        taken = ((uint64_t)count_ < count) ? (uint64_t)count_ : count;
+        count_ -= (int64_t)taken;
+    }
+    THREAD_UNLOCK(state);
+    return taken;
+}
+
 status_t Semaphore::Wait(lk_time_t deadline) {
     thread_t *current_thread = get_current_thread();
 
@@ -54,7 +54,7 @@ TimerDispatcher::~TimerDispatcher() {
     DEBUG_ASSERT(!active_);
 }
 
-mx_status_t TimerDispatcher::SetOneShot(lk_time_t deadline) {
+mx_status_t TimerDispatcher::SetOneShot(lk_time_t deadline, lk_time_t slack) {
     canary_.Assert();
     AutoLock al(&lock_);
 
@@ -86,12 +86,12 @@ mx_status_t TimerDispatcher::SetOneShot(lk_time_t deadline) {
     // or in the complicated cancelation path above.
     AddRef();
     active_ = true;
-    timer_set_oneshot(&timer_, deadline, &timer_irq_callback, &timer_dpc_);
+    timer_set_oneshot_etc(&timer_, deadline, slack, &timer_irq_callback, &timer_dpc_);
     return NO_ERROR;
 }
 
 mx_status_t TimerDispatcher::CancelOneShot() {
-    return SetOneShot(0u);
+    return SetOneShot(0u, 0u);
 }
 
 void TimerDispatcher::OnTimerFired() {
@@ -346,6 +346,27 @@ status_t UserThread::Resume() {
     return thread_resume(&thread_);
 }
 
+bool UserThread::CanInheritPriority() {
+    canary_.Assert();
+
+    AutoLock lock(&state_lock_);
+
+    return state_ == State::RUNNING || state_ == State::SUSPENDED;
+}
+
+void UserThread::SetInheritedPriority(int priority) {
+    canary_.Assert();
+
+    LTRACE_ENTRY_OBJ;
+
+    AutoLock lock(&state_lock_);
+
+    if (state_ != State::RUNNING && state_ != State::SUSPENDED)
+        return;
+
+    thread_set_inherited_priority(&thread_, priority);
+}
+
 void UserThread::DispatcherClosed() {
     canary_.Assert();
 
@@ -395,6 +416,10 @@ void UserThread::Exiting() {
         }
     }
 
+    // Waiters can no longer lend us their priority, as we are DYING; let
+    // go of the ones that still do before we go away.
+    process_->futex_context()->ReleasePiLenders(this);
+
     // Mark the thread as dead. Do this before removing the thread from the
     // process because if this is the last thread then the process will be
     // marked dead, and we don't want to have a state where the process is
@@ -82,6 +82,18 @@ status_t split_syscall_flags(uint32_t flags, uint32_t* vmar_flags, uint* arch_mm
     return NO_ERROR;
 }
 
+// The alignment at which to place a mapping of |len| bytes of a vmo starting
+// at |vmo_offset| so that the largest possible pages can map it, or 0 if it is
+// too small or too misaligned for any large page.
+uint8_t large_page_align_pow2(uint64_t vmo_offset, size_t len) {
+    const uint8_t huge_page_shift = LARGE_PAGE_SIZE_SHIFT + (PAGE_SIZE_SHIFT - 3);
+    if (len >= (1ul << huge_page_shift) && IS_ALIGNED(vmo_offset, 1ul << huge_page_shift))
+        return huge_page_shift;
+    if (len >= LARGE_PAGE_SIZE && IS_ALIGNED(vmo_offset, LARGE_PAGE_SIZE))
+        return LARGE_PAGE_SIZE_SHIFT;
+    return 0;
+}
+
 } // namespace
 
 constexpr mx_rights_t kDefaultVmarRights =
@@ -169,6 +181,9 @@ mx_status_t VmAddressRegionDispatcher::Map(size_t vmar_offset, mxtl::RefPtr<VmOb
     if (!is_valid_mapping_protection(flags))
         return ERR_INVALID_ARGS;
 
+    // Committing is up to the caller, once the mapping exists.
+    flags &= ~MX_VM_FLAG_COMMIT;
+
     // Split flags into vmar_flags and arch_mmu_flags
     uint32_t vmar_flags;
     uint arch_mmu_flags;
@@ -176,11 +191,23 @@ mx_status_t VmAddressRegionDispatcher::Map(size_t vmar_offset, mxtl::RefPtr<VmOb
     if (status != NO_ERROR)
         return status;
 
+    // Place large mappings such that they can be mapped with large pages, unless
+    // the caller picked the address or the vmar is too fragmented to allow it.
+    uint8_t align_pow2 = 0;
+    if (!(vmar_flags & (VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE)))
+        align_pow2 = large_page_align_pow2(vmo_offset, len);
+
     mxtl::RefPtr<VmMapping> result(nullptr);
-    status = vmar_->CreateVmMapping(vmar_offset, len, /* align_pow2 */ 0,
-                                    vmar_flags, mxtl::move(vmo), vmo_offset,
+    status = vmar_->CreateVmMapping(vmar_offset, len, align_pow2,
+                                    vmar_flags, vmo, vmo_offset,
                                     arch_mmu_flags, "useralloc",
                                     &result);
+    if (status == ERR_NO_MEMORY && align_pow2 != 0) {
+        status = vmar_->CreateVmMapping(vmar_offset, len, 0,
+                                        vmar_flags, mxtl::move(vmo), vmo_offset,
+                                        arch_mmu_flags, "useralloc",
+                                        &result);
+    }
     if (status != NO_ERROR) {
         return status;
     }
@@ -7,6 +7,8 @@
 #include <trace.h>
 
 #include <magenta/process_dispatcher.h>
+#include <magenta/thread_dispatcher.h>
+#include <magenta/user_thread.h>
 
 #include "syscalls_priv.h"
 
@@ -36,3 +38,30 @@ mx_status_t sys_futex_requeue(user_ptr<mx_futex_t> wake_ptr, uint32_t wake_count
         wake_ptr, wake_count, current_value,
         requeue_ptr, requeue_count);
 }
+
+mx_status_t sys_futex_wait_pi(user_ptr<mx_futex_t> value_ptr, int current_value,
+                              mx_handle_t owner_handle, mx_time_t deadline) {
+    LTRACEF("futex %p current %d owner %d\n", value_ptr.get(), current_value, owner_handle);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // Lending our priority changes how the owner is scheduled.
+    mxtl::RefPtr<ThreadDispatcher> owner;
+    mx_status_t status = up->GetDispatcherWithRights(owner_handle, MX_RIGHT_WRITE, &owner);
+    if (status != NO_ERROR)
+        return status;
+
+    // The owner must be another thread of the process the futex lives in.
+    UserThread* owner_thread = owner->thread();
+    if (owner_thread == UserThread::GetCurrent() || owner_thread->process() != up)
+        return ERR_INVALID_ARGS;
+
+    return up->futex_context()->FutexWaitPI(value_ptr, current_value, owner_thread, deadline);
+}
+
+mx_status_t sys_futex_wake_pi(user_ptr<const mx_futex_t> value_ptr, uint32_t count) {
+    LTRACEF("futex %p count %" PRIu32 "\n", value_ptr.get(), count);
+
+    return ProcessDispatcher::GetCurrent()->futex_context()->FutexWakePI(
+        value_ptr, count);
+}
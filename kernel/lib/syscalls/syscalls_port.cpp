@@ -25,11 +25,17 @@
 
 #define LOCAL_TRACE 0
 
+// Upper bound on the packets returned by a single port_wait_many call.
+constexpr uint32_t kMaxPortWaitPackets = 16u;
+
 mx_status_t sys_port_create(uint32_t options, user_ptr<mx_handle_t> _out) {
     LTRACEF("options %u\n", options);
 
-    // Currently, the only allowed option is to switch on PortsV2.
-    if (options & ~MX_PORT_OPT_V2)
+    // Currently, the only allowed options are to switch on PortsV2 and to
+    // coalesce the signal packets of a V2 port.
+    if (options & ~(MX_PORT_OPT_V2 | MX_PORT_OPT_COALESCE))
+        return ERR_INVALID_ARGS;
+    if ((options & MX_PORT_OPT_COALESCE) && !(options & MX_PORT_OPT_V2))
         return ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -40,7 +46,7 @@ mx_status_t sys_port_create(uint32_t options, user_ptr<mx_handle_t> _out) {
     mxtl::RefPtr<Dispatcher> dispatcher;
     mx_rights_t rights;
 
-    mx_status_t result = (options == MX_PORT_OPT_V2) ?
+    mx_status_t result = (options & MX_PORT_OPT_V2) ?
         PortDispatcherV2::Create(options, &dispatcher, &rights):
         PortDispatcher::Create(options, &dispatcher, &rights);
 
@@ -155,6 +161,36 @@ mx_status_t sys_port_wait(mx_handle_t handle, mx_time_t deadline,
     return NO_ERROR;
 }
 
+mx_status_t sys_port_wait_many(mx_handle_t handle, mx_time_t deadline,
+                               user_ptr<mx_port_packet_t> _packets, uint32_t count,
+                               user_ptr<uint32_t> _actual) {
+    LTRACEF("handle %d count %u\n", handle, count);
+
+    if (!_packets || (count == 0u))
+        return ERR_INVALID_ARGS;
+    if (count > kMaxPortWaitPackets)
+        count = kMaxPortWaitPackets;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PortDispatcherV2> port;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &port);
+    if (status != NO_ERROR)
+        return status;
+
+    mx_port_packet_t pp[kMaxPortWaitPackets];
+    size_t actual;
+    status = port->DeQueueMany(deadline, pp, count, &actual);
+    if (status != NO_ERROR)
+        return status;
+
+    if (_packets.copy_array_to_user(pp, actual) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    if (_actual.copy_to_user(static_cast<uint32_t>(actual)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    return NO_ERROR;
+}
+
 mx_status_t sys_port_bind(mx_handle_t handle, uint64_t key,
                           mx_handle_t source, mx_signals_t signals) {
     LTRACEF("handle %d source %d\n", handle, source);
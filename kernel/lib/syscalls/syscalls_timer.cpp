@@ -56,7 +56,6 @@ mx_status_t sys_timer_start(
     if (deadline == 0u)
         return ERR_INVALID_ARGS;
 
-    // TODO(cpu): support timer coalescing (aka slack).
     // TODO(cpu): support periodic timers.
     if (period)
         return ERR_INVALID_ARGS;
@@ -68,7 +67,7 @@ mx_status_t sys_timer_start(
     if (status != NO_ERROR)
         return status;
 
-    return timer->SetOneShot(deadline);
+    return timer->SetOneShot(deadline, slack);
 }
 
 mx_status_t sys_timer_cancel(mx_handle_t handle) {
@@ -122,6 +122,8 @@ mx_status_t sys_vmar_map(mx_handle_t vmar_handle, size_t vmar_offset,
         do_map_range = true;
         map_flags &= ~MX_VM_FLAG_MAP_RANGE;
     }
+    // MX_VM_FLAG_COMMIT is stripped by the dispatcher
+    const bool do_commit = (map_flags & MX_VM_FLAG_COMMIT) != 0;
 
     // Usermode is not allowed to specify these flags on mappings, though we may
     // set them below.
@@ -162,8 +164,18 @@ mx_status_t sys_vmar_map(mx_handle_t vmar_handle, size_t vmar_offset,
         vm_mapping->Destroy();
     });
 
+    if (do_commit) {
+        // CommitRange() backs large-page-aligned parts of the range with large
+        // pages where it can, which the dispatcher placed the mapping to allow.
+        status = vmo->vmo()->CommitRange(vmo_offset, len, nullptr);
+        // VMOs that cannot be committed (such as physical ones) are always backed.
+        if (status != NO_ERROR && status != ERR_NOT_SUPPORTED)
+            return status;
+        do_map_range = true;
+    }
+
     if (do_map_range) {
-        status = vm_mapping->MapRange(vmo_offset, len, false);
+        status = vm_mapping->MapRange(0, len, false);
         if (status != NO_ERROR) {
             return status;
         }
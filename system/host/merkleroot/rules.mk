@@ -32,4 +32,6 @@ MODULE_COMPILEFLAGS += -Ithird_party/ulib/cryptolib/include
 MODULE_SRCS += third_party/ulib/cryptolib/cryptolib.c
 endif
 
+MODULE_HOST_LIBS += -lpthread
+
 include make/module.mk
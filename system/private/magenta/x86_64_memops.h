@@ -0,0 +1,295 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// The x86-64 memcpy and memset bodies shared by the kernel and libc.  Each
+// side keeps its own tuning variables, chosen from cpuid at startup, and
+// passes their names to the macros: |erms| is a bool that is nonzero when
+// rep movsb/stosb is the fastest medium sized copy, and |nt_threshold| a
+// size_t from which copies use non-temporal stores.
+
+// Copies and fills of at least this many bytes bypass the cache with
+// non-temporal stores: they would evict more than they leave behind to be
+// reused.
+#define X86_64_MEMOPS_NT_THRESHOLD (256 * 1024)
+
+#ifdef __ASSEMBLER__
+
+// Copies %rdx bytes from %rsi to %rdi, which must not overlap.
+//
+// Sizes up to 64 bytes are done with overlapping loads and stores and no
+// loop, the middle sizes with rep movs, and copies of at least
+// |nt_threshold| bytes with non-temporal stores.
+//
+// Clobbers %rcx, %rdx, %rsi, %rdi and %r8-%r11, and leaves %rax alone.  It
+// does not touch the stack, so the kernel's user copy routines can use it
+// between setting up and clearing their fault return.
+.macro x86_64_memcpy_body erms:req, nt_threshold:req
+    cmp $16, %rdx
+    jbe .Lsmall\@
+    cmp $64, %rdx
+    jbe .Lupto64\@
+    cmp \nt_threshold(%rip), %rdx
+    jae .Lnt\@
+
+    cmpb $0, \erms(%rip)
+    jz .Lmovsq\@
+    mov %rdx, %rcx
+    rep movsb
+    jmp .Ldone\@
+
+.Lmovsq\@:
+    // Copy whole quads, then the last 8 bytes, which may overlap the last quad.
+    mov -8(%rsi,%rdx), %r8
+    mov %rdx, %rcx
+    shr $3, %rcx
+    rep movsq
+    and $7, %rdx
+    mov %r8, -8(%rdi,%rdx)
+    jmp .Ldone\@
+
+.Lupto64\@:
+    // 17 to 64 bytes: the first and last 32 (or 16) bytes, overlapping.
+    cmp $32, %rdx
+    jbe .Lupto32\@
+    mov (%rsi), %r8
+    mov 8(%rsi), %r9
+    mov 16(%rsi), %r10
+    mov 24(%rsi), %r11
+    mov %r8, (%rdi)
+    mov %r9, 8(%rdi)
+    mov %r10, 16(%rdi)
+    mov %r11, 24(%rdi)
+    mov -32(%rsi,%rdx), %r8
+    mov -24(%rsi,%rdx), %r9
+    mov -16(%rsi,%rdx), %r10
+    mov -8(%rsi,%rdx), %r11
+    mov %r8, -32(%rdi,%rdx)
+    mov %r9, -24(%rdi,%rdx)
+    mov %r10, -16(%rdi,%rdx)
+    mov %r11, -8(%rdi,%rdx)
+    jmp .Ldone\@
+
+.Lupto32\@:
+    mov (%rsi), %r8
+    mov 8(%rsi), %r9
+    mov -16(%rsi,%rdx), %r10
+    mov -8(%rsi,%rdx), %r11
+    mov %r8, (%rdi)
+    mov %r9, 8(%rdi)
+    mov %r10, -16(%rdi,%rdx)
+    mov %r11, -8(%rdi,%rdx)
+    jmp .Ldone\@
+
+.Lsmall\@:
+    // 0 to 16 bytes: a pair of overlapping moves of the largest fitting width.
+    cmp $8, %rdx
+    jb .Lupto7\@
+    mov (%rsi), %r8
+    mov -8(%rsi,%rdx), %r9
+    mov %r8, (%rdi)
+    mov %r9, -8(%rdi,%rdx)
+    jmp .Ldone\@
+.Lupto7\@:
+    cmp $4, %rdx
+    jb .Lupto3\@
+    mov (%rsi), %r8d
+    mov -4(%rsi,%rdx), %r9d
+    mov %r8d, (%rdi)
+    mov %r9d, -4(%rdi,%rdx)
+    jmp .Ldone\@
+.Lupto3\@:
+    cmp $2, %rdx
+    jb .Lupto1\@
+    movzwl (%rsi), %r8d
+    movzwl -2(%rsi,%rdx), %r9d
+    mov %r8w, (%rdi)
+    mov %r9w, -2(%rdi,%rdx)
+    jmp .Ldone\@
+.Lupto1\@:
+    test %rdx, %rdx
+    jz .Ldone\@
+    movzbl (%rsi), %r8d
+    mov %r8b, (%rdi)
+    jmp .Ldone\@
+
+.Lnt\@:
+    // Copy the first 64 bytes normally, then stream whole 64 byte lines
+    // from the first cache line aligned destination, then copy the last
+    // 64 bytes normally.  The three parts may overlap.
+    mov (%rsi), %r8
+    mov 8(%rsi), %r9
+    mov 16(%rsi), %r10
+    mov 24(%rsi), %r11
+    mov %r8, (%rdi)
+    mov %r9, 8(%rdi)
+    mov %r10, 16(%rdi)
+    mov %r11, 24(%rdi)
+    mov 32(%rsi), %r8
+    mov 40(%rsi), %r9
+    mov 48(%rsi), %r10
+    mov 56(%rsi), %r11
+    mov %r8, 32(%rdi)
+    mov %r9, 40(%rdi)
+    mov %r10, 48(%rdi)
+    mov %r11, 56(%rdi)
+
+    mov %rdi, %rcx
+    neg %rcx
+    and $63, %rcx
+    add %rcx, %rdi
+    add %rcx, %rsi
+    sub %rcx, %rdx
+
+.Lntloop\@:
+    mov (%rsi), %r8
+    mov 8(%rsi), %r9
+    mov 16(%rsi), %r10
+    mov 24(%rsi), %r11
+    movnti %r8, (%rdi)
+    movnti %r9, 8(%rdi)
+    movnti %r10, 16(%rdi)
+    movnti %r11, 24(%rdi)
+    mov 32(%rsi), %r8
+    mov 40(%rsi), %r9
+    mov 48(%rsi), %r10
+    mov 56(%rsi), %r11
+    movnti %r8, 32(%rdi)
+    movnti %r9, 40(%rdi)
+    movnti %r10, 48(%rdi)
+    movnti %r11, 56(%rdi)
+    add $64, %rsi
+    add $64, %rdi
+    sub $64, %rdx
+    cmp $64, %rdx
+    jae .Lntloop\@
+    // Order the streamed stores before anything that follows the copy.
+    sfence
+
+    mov -64(%rsi,%rdx), %r8
+    mov -56(%rsi,%rdx), %r9
+    mov -48(%rsi,%rdx), %r10
+    mov -40(%rsi,%rdx), %r11
+    mov %r8, -64(%rdi,%rdx)
+    mov %r9, -56(%rdi,%rdx)
+    mov %r10, -48(%rdi,%rdx)
+    mov %r11, -40(%rdi,%rdx)
+    mov -32(%rsi,%rdx), %r8
+    mov -24(%rsi,%rdx), %r9
+    mov -16(%rsi,%rdx), %r10
+    mov -8(%rsi,%rdx), %r11
+    mov %r8, -32(%rdi,%rdx)
+    mov %r9, -24(%rdi,%rdx)
+    mov %r10, -16(%rdi,%rdx)
+    mov %r11, -8(%rdi,%rdx)
+
+.Ldone\@:
+.endm
+
+// Fills %rdx bytes at %rdi with %rax, which must hold the fill byte in every
+// byte.  Size classes as in x86_64_memcpy_body.
+//
+// Clobbers %rcx and %rdi, and leaves %rax, %rdx and %rsi alone.
+.macro x86_64_memset_body erms:req, nt_threshold:req
+    cmp $16, %rdx
+    jbe .Lsmall\@
+    cmp $64, %rdx
+    jbe .Lupto64\@
+    cmp \nt_threshold(%rip), %rdx
+    jae .Lnt\@
+
+    cmpb $0, \erms(%rip)
+    jz .Lstosq\@
+    mov %rdx, %rcx
+    rep stosb // while (rcx-- > 0) *rdi++ = al;
+    jmp .Ldone\@
+
+.Lstosq\@:
+    // Fill the last 8 bytes, then whole quads from the start.
+    mov %rax, -8(%rdi,%rdx)
+    mov %rdx, %rcx
+    shr $3, %rcx
+    rep stosq
+    jmp .Ldone\@
+
+.Lupto64\@:
+    mov %rax, (%rdi)
+    mov %rax, 8(%rdi)
+    mov %rax, -16(%rdi,%rdx)
+    mov %rax, -8(%rdi,%rdx)
+    cmp $32, %rdx
+    jbe .Ldone\@
+    mov %rax, 16(%rdi)
+    mov %rax, 24(%rdi)
+    mov %rax, -32(%rdi,%rdx)
+    mov %rax, -24(%rdi,%rdx)
+    jmp .Ldone\@
+
+.Lsmall\@:
+    cmp $8, %rdx
+    jb .Lupto7\@
+    mov %rax, (%rdi)
+    mov %rax, -8(%rdi,%rdx)
+    jmp .Ldone\@
+.Lupto7\@:
+    cmp $4, %rdx
+    jb .Lupto3\@
+    mov %eax, (%rdi)
+    mov %eax, -4(%rdi,%rdx)
+    jmp .Ldone\@
+.Lupto3\@:
+    cmp $2, %rdx
+    jb .Lupto1\@
+    mov %ax, (%rdi)
+    mov %ax, -2(%rdi,%rdx)
+    jmp .Ldone\@
+.Lupto1\@:
+    test %rdx, %rdx
+    jz .Ldone\@
+    mov %al, (%rdi)
+    jmp .Ldone\@
+
+.Lnt\@:
+    // Fill the first and last 64 bytes normally and stream the whole
+    // cache lines in between.
+    mov %rax, (%rdi)
+    mov %rax, 8(%rdi)
+    mov %rax, 16(%rdi)
+    mov %rax, 24(%rdi)
+    mov %rax, 32(%rdi)
+    mov %rax, 40(%rdi)
+    mov %rax, 48(%rdi)
+    mov %rax, 56(%rdi)
+    mov %rax, -64(%rdi,%rdx)
+    mov %rax, -56(%rdi,%rdx)
+    mov %rax, -48(%rdi,%rdx)
+    mov %rax, -40(%rdi,%rdx)
+    mov %rax, -32(%rdi,%rdx)
+    mov %rax, -24(%rdi,%rdx)
+    mov %rax, -16(%rdi,%rdx)
+    mov %rax, -8(%rdi,%rdx)
+
+    lea (%rdi,%rdx), %rcx
+    and $~63, %rcx
+    add $63, %rdi
+    and $~63, %rdi
+.Lntloop\@:
+    movnti %rax, (%rdi)
+    movnti %rax, 8(%rdi)
+    movnti %rax, 16(%rdi)
+    movnti %rax, 24(%rdi)
+    movnti %rax, 32(%rdi)
+    movnti %rax, 40(%rdi)
+    movnti %rax, 48(%rdi)
+    movnti %rax, 56(%rdi)
+    add $64, %rdi
+    cmp %rcx, %rdi
+    jb .Lntloop\@
+    sfence
+
+.Ldone\@:
+.endm
+
+#endif // __ASSEMBLER__
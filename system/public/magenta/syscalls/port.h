@@ -12,6 +12,9 @@ __BEGIN_CDECLS
 // mx_port_create() options.
 #define MX_PORT_OPT_V1 0u
 #define MX_PORT_OPT_V2 1u
+// Merges signal packets with the same key while one is still queued.
+// Only valid together with MX_PORT_OPT_V2.
+#define MX_PORT_OPT_COALESCE 2u
 
 // mx_port V1 packet structures.
 
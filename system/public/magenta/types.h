@@ -234,6 +234,7 @@ typedef uint32_t mx_rights_t;
 #define MX_VM_FLAG_CAN_MAP_WRITE      (1u << 8)
 #define MX_VM_FLAG_CAN_MAP_EXECUTE    (1u << 9)
 #define MX_VM_FLAG_MAP_RANGE          (1u << 10)
+#define MX_VM_FLAG_COMMIT             (1u << 11)
 
 // clock ids
 #define MX_CLOCK_MONOTONIC        (0u)
@@ -11,7 +11,9 @@
 #include <mx/event.h>
 #include <mx/vmo.h>
 #include <mxtl/algorithm.h>
+#include <mxtl/auto_lock.h>
 #include <mxtl/macros.h>
+#include <mxtl/mutex.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
@@ -138,14 +140,19 @@ private:
     mx_status_t Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) final;
     mx_status_t Sync() final;
 
-    // Read both VMOs into memory, if we haven't already.
+    // Create both VMOs, if we haven't already, and read the Merkle tree
+    // into memory. Data blocks are read on demand by VerifyRange.
     //
     // TODO(smklein): When we have can register the Blob Store as a pager
     // service, and it can properly handle pages faults on a vnode's contents,
-    // then we can avoid reading the entire blob up-front. Until then, read
-    // the contents of a VMO into memory when it is opened.
+    // then we can let the VMO fault in data instead.
     mx_status_t InitVmos();
 
+    // Ensures the data blocks covering [off, off + len) have been read
+    // from disk and checked against the Merkle tree.
+    // Requires: InitVmos
+    mx_status_t VerifyRange(uint64_t off, uint64_t len);
+
     mx_status_t WriteShared(size_t start, size_t len, uint64_t maxlen,
                             mx_handle_t vmo, uint64_t start_block);
     // Called by Blob once the last write has completed, updating the
@@ -158,6 +165,10 @@ private:
     mxtl::unique_ptr<MappedVmo> merkle_tree_;
     mxtl::unique_ptr<MappedVmo> blob_;
 
+    // One bit per data block, set once the block is in blob_ and has been
+    // verified. Blocks are never verified twice.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> verified_;
+
     mx::event readable_event_;
     uint64_t bytes_written_;
 
@@ -226,6 +237,17 @@ private:
     mx_status_t AllocateNode(size_t* node_index_out);
     void FreeNode(size_t node_index);
 
+    // Builds the digest index and the free node list from the node map.
+    mx_status_t BuildNodeIndex();
+
+    // Adds or removes an allocated node from the digest index.
+    // The node's merkle root must be set while it is in the index.
+    void IndexNode(size_t node_index);
+    void UnindexNode(size_t node_index);
+
+    // Finds the node holding a blob with the given merkle root.
+    mx_status_t FindNode(const uint8_t* digest, size_t* node_index_out) const;
+
     // Access the nth block of the block bitmap.
     void* GetBlockmapData(uint64_t n) const;
     // Access the nth block of the node map.
@@ -238,6 +260,10 @@ private:
     // Given a node within the node map at an index, write it to disk.
     mx_status_t WriteNode(size_t map_index);
 
+    // Blobs are written and released concurrently from the dispatcher's
+    // threads; this guards the allocation maps, the node index and |hash_|.
+    mxtl::Mutex lock_;
+
     // VnodeBlobs exist in the WAVLTree as long as one or more reference exists;
     // when the Vnode is deleted, it is immediately removed from the WAVL tree.
     using WAVLTreeByMerkle = mxtl::WAVLTree<const uint8_t*,
@@ -248,6 +274,17 @@ private:
 
     RawBitmap block_map_;
     mxtl::unique_ptr<blobstore_inode_t[]> node_map_;
+
+    // Map of merkle root to node for every blob on disk, open or not.
+    // Open addressed with linear probing; each slot holds a node index + 1,
+    // or zero if the slot is empty.
+    mxtl::unique_ptr<uint32_t[]> digest_index_;
+    size_t digest_index_mask_;
+
+    // Stack of node indices which are free to be allocated. Nodes are
+    // reused last-freed first; no index order is maintained.
+    mxtl::unique_ptr<uint32_t[]> free_nodes_;
+    size_t free_node_count_;
 };
 
 int blobstore_mkfs(int fd);
@@ -10,7 +10,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
-#include <fs/mxio-dispatcher.h>
+#include <fs/vfs-dispatcher.h>
 #include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <mxalloc/new.h>
@@ -18,6 +18,7 @@
 #include <merkle/tree.h>
 #include <mxtl/ref_ptr.h>
 #include <mxio/debug.h>
+#include <mxio/remoteio.h>
 
 #define MXDEBUG 0
 
@@ -53,6 +54,16 @@ uint64_t MerkleTreeBlocks(const blobstore_inode_t& blobNode) {
     return mxtl::roundup(size_merkle, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+static_assert(kBlobstoreBlockSize == merkle::Tree::kNodeSize,
+              "Blobstore verifies data one Merkle tree leaf per block");
+
+// Digests are cryptographic hashes, so any of their bytes make a good hash key.
+inline size_t DigestHash(const uint8_t* digest) {
+    size_t hash;
+    memcpy(&hash, digest, sizeof(hash));
+    return hash;
+}
+
 // Get a pointer to the nth block of the bitmap.
 inline void* get_raw_bitmap_data(const RawBitmap& bm, uint64_t n) {
     assert(n * kBlobstoreBlockSize < bm.size()); // Accessing beyond end of bitmap
@@ -102,6 +113,35 @@ mx_status_t vn_dump_block(int fd, mx_handle_t vmo, uint64_t n, uint64_t bno, boo
     return NO_ERROR;
 }
 
+// Write 'count' whole blocks to disk starting at block 'bno', from the vmo
+// starting at its 'nth' logical block, as few device writes as possible.
+mx_status_t vn_dump_blocks(int fd, mx_handle_t vmo, uint64_t n, uint64_t bno, uint64_t count) {
+    constexpr uint64_t kMaxBlocks = MXIO_BULK_SIZE / kBlobstoreBlockSize;
+    AllocChecker ac;
+    mxtl::unique_ptr<char[]> bdata(new (&ac) char[mxtl::min(count, kMaxBlocks) *
+                                                  kBlobstoreBlockSize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    while (count > 0) {
+        uint64_t xfer = mxtl::min(count, kMaxBlocks);
+        mx_status_t status = vmo_read_exact(vmo, bdata.get(), n * kBlobstoreBlockSize,
+                                            xfer * kBlobstoreBlockSize);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        ssize_t len = xfer * kBlobstoreBlockSize;
+        if (pwrite(fd, bdata.get(), len, bno * kBlobstoreBlockSize) != len) {
+            fprintf(stderr, "blobstore: cannot write blocks %lu-%lu\n", bno, bno + xfer - 1);
+            return ERR_IO;
+        }
+        n += xfer;
+        bno += xfer;
+        count -= xfer;
+    }
+    return NO_ERROR;
+}
+
 // Sanity check the metadata for the blobstore, given a maximum number of
 // available blocks.
 mx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max) {
@@ -151,13 +191,11 @@ void* Blobstore::GetNodemapData(uint64_t n) const {
     return (void*)((uintptr_t)(node_map_.get()) + (uintptr_t)(kBlobstoreBlockSize * n));
 }
 
+// Positioned I/O, so that blocks of different blobs may be read and written
+// from several dispatcher threads at once.
 mx_status_t readblk(int fd, uint64_t bno, void* data) {
     off_t off = bno * kBlobstoreBlockSize;
-    if (lseek(fd, off, SEEK_SET) < 0) {
-        fprintf(stderr, "blobstore: cannot seek to block %lu\n", bno);
-        return ERR_IO;
-    }
-    if (read(fd, data, kBlobstoreBlockSize) != kBlobstoreBlockSize) {
+    if (pread(fd, data, kBlobstoreBlockSize, off) != kBlobstoreBlockSize) {
         fprintf(stderr, "blobstore: cannot read block %lu\n", bno);
         return ERR_IO;
     }
@@ -166,11 +204,7 @@ mx_status_t readblk(int fd, uint64_t bno, void* data) {
 
 mx_status_t writeblk(int fd, uint64_t bno, const void* data) {
     off_t off = bno * kBlobstoreBlockSize;
-    if (lseek(fd, off, SEEK_SET) < 0) {
-        fprintf(stderr, "blobstore: cannot seek to block %lu\n", bno);
-        return ERR_IO;
-    }
-    if (write(fd, data, kBlobstoreBlockSize) != kBlobstoreBlockSize) {
+    if (pwrite(fd, data, kBlobstoreBlockSize, off) != kBlobstoreBlockSize) {
         fprintf(stderr, "blobstore: cannot write block %lu\n", bno);
         return ERR_IO;
     }
@@ -188,6 +222,8 @@ mx_status_t VnodeBlob::InitVmos() {
     uint64_t merkle_vmo_size = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     uint64_t data_vmo_size = BlobDataBlocks(*inode) * kBlobstoreBlockSize;
 
+    // The Merkle tree is small relative to the data and every read walks it,
+    // so read all of it now.
     if (merkle_vmo_size != 0) {
         if ((status = MappedVmo::Create(merkle_vmo_size, &merkle_tree_)) != NO_ERROR) {
             error("Failed to initialize vmo; error: %d\n", status);
@@ -203,17 +239,13 @@ mx_status_t VnodeBlob::InitVmos() {
         }
     }
 
+    // Data blocks are read lazily by VerifyRange as they are touched.
     if ((status = MappedVmo::Create(data_vmo_size, &blob_)) != NO_ERROR) {
         error("Failed to initialize vmo; error: %d\n", status);
         goto fail;
     }
-
-    for (uint64_t n = 0; n < BlobDataBlocks(*inode); n++) {
-        uint64_t bno = inode->start_block + n + MerkleTreeBlocks(*inode);
-        if ((status = vn_fill_block(fd, blob_->GetVmo(), n, bno)) != NO_ERROR) {
-            error("Failed to fill bno\n");
-            goto fail;
-        }
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != NO_ERROR) {
+        goto fail;
     }
 
     return NO_ERROR;
@@ -222,6 +254,45 @@ fail:
     return status;
 }
 
+mx_status_t VnodeBlob::VerifyRange(uint64_t off, uint64_t len) {
+    auto inode = &blobstore_->node_map_[map_index_];
+    uint64_t block = off / kBlobstoreBlockSize;
+    uint64_t end = mxtl::roundup(off + len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+
+    size_t first_unverified;
+    while (!verified_.Get(block, end, &first_unverified)) {
+        // Read in and verify the next run of unverified blocks.
+        uint64_t run_start = first_unverified;
+        uint64_t run_end = verified_.Scan(run_start, end, false);
+
+        mx_status_t status;
+        for (uint64_t n = run_start; n < run_end; n++) {
+            uint64_t bno = inode->start_block + MerkleTreeBlocks(*inode) + n;
+            if ((status = vn_fill_block(blobstore_->blockfd_, blob_->GetVmo(), n, bno)) != NO_ERROR) {
+                return status;
+            }
+        }
+
+        merkle::Tree mt;
+        merkle::Digest d;
+        d = ((const uint8_t*) &digest_[0]);
+        uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
+        const void* merkle_data = (merkle_tree_ != nullptr) ? merkle_tree_->GetData() : nullptr;
+        uint64_t verify_off = run_start * kBlobstoreBlockSize;
+        uint64_t verify_len = mxtl::min(run_end * kBlobstoreBlockSize,
+                                        inode->blob_size) - verify_off;
+        status = mt.Verify(blob_->GetData(), inode->blob_size, merkle_data, size_merkle,
+                           verify_off, verify_len, d);
+        if (status != NO_ERROR) {
+            return status;
+        }
+
+        verified_.Set(run_start, run_end);
+        block = run_end;
+    }
+    return NO_ERROR;
+}
+
 uint64_t VnodeBlob::SizeData() const {
     if (GetState() == kBlobStateReadable) {
         auto inode = &blobstore_->node_map_[map_index_];
@@ -259,8 +330,11 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
 
     // Find a free node, mark it as reserved.
     mx_status_t status;
-    if ((status = blobstore_->AllocateNode(&map_index_)) != NO_ERROR) {
-        return status;
+    {
+        mxtl::AutoLock lock(&blobstore_->lock_);
+        if ((status = blobstore_->AllocateNode(&map_index_)) != NO_ERROR) {
+            return status;
+        }
     }
 
     // Initialize the inode with known fields
@@ -279,9 +353,16 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
     if ((status = MappedVmo::Create(size_data, &blob_)) != NO_ERROR) {
         goto fail;
     }
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != NO_ERROR) {
+        goto fail;
+    }
 
     // Allocate space for the blob
-    if ((status = blobstore_->AllocateBlocks(inode->num_blocks, &inode->start_block)) != NO_ERROR) {
+    {
+        mxtl::AutoLock lock(&blobstore_->lock_);
+        status = blobstore_->AllocateBlocks(inode->num_blocks, &inode->start_block);
+    }
+    if (status != NO_ERROR) {
         goto fail;
     }
 
@@ -290,7 +371,10 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
 
 fail:
     BlobCloseHandles();
-    blobstore_->FreeNode(map_index_);
+    {
+        mxtl::AutoLock lock(&blobstore_->lock_);
+        blobstore_->FreeNode(map_index_);
+    }
     return status;
 }
 
@@ -302,12 +386,12 @@ mx_status_t VnodeBlob::WriteShared(size_t start, size_t len, uint64_t maxlen,
     uint64_t n = start / kBlobstoreBlockSize;
     uint64_t n_end = (start + len) / kBlobstoreBlockSize;
     mx_status_t status;
-    while (n < n_end) {
-        status = vn_dump_block(blobstore_->blockfd_, vmo, n, n + start_block, false);
+    if (n < n_end) {
+        status = vn_dump_blocks(blobstore_->blockfd_, vmo, n, n + start_block, n_end - n);
         if (status != NO_ERROR) {
             return status;
         }
-        n++;
+        n = n_end;
     }
 
     // Special case: We've written all the 'whole blocks', but we're missing
@@ -345,6 +429,7 @@ mx_status_t VnodeBlob::WriteMetadata() {
     // complete.
     flags_ |= kBlobFlagSync;
     auto inode = &blobstore_->node_map_[map_index_];
+    mxtl::AutoLock lock(&blobstore_->lock_);
 
     // Write block allocation bitmap
     if (blobstore_->WriteBitmap(inode->num_blocks, inode->start_block) != NO_ERROR) {
@@ -356,6 +441,7 @@ mx_status_t VnodeBlob::WriteMetadata() {
 
     // Update the on-disk hash
     memcpy(inode->merkle_root_hash, &digest_[0], merkle::Digest::kLength);
+    blobstore_->IndexNode(map_index_);
 
     // Write back the blob node
     if (blobstore_->WriteNode(map_index_)) {
@@ -382,7 +468,7 @@ mx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             return status;
         }
 
-        status = WriteShared(bytes_written_, len, inode->blob_size,
+        status = WriteShared(bytes_written_, to_write, inode->blob_size,
                              blob_->GetVmo(),
                              inode->start_block + MerkleTreeBlocks(*inode));
         if (status != NO_ERROR) {
@@ -402,19 +488,20 @@ mx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
         // methods to create the merkle tree as we write data, rather than
         // waiting until the data is fully downloaded to create the tree.
         merkle::Tree tree;
+        merkle::Digest digest;
         size_t merkle_size = tree.GetTreeLength(inode->blob_size);
-        if (merkle_size > 0) {
-            merkle::Digest digest;
-            if (tree.Create(blob_->GetData(), inode->blob_size, merkle_tree_->GetData(),
-                            merkle_size, &digest) != NO_ERROR) {
-                SetState(kBlobStateError);
-                return status;
-            } else if (digest != digest_) {
-                // Downloaded blob did not match provided digest
-                SetState(kBlobStateError);
-                return status;
-            }
+        void* merkle_data = (merkle_size > 0) ? merkle_tree_->GetData() : nullptr;
+        if ((status = tree.Create(blob_->GetData(), inode->blob_size, merkle_data,
+                                  merkle_size, &digest)) != NO_ERROR) {
+            SetState(kBlobStateError);
+            return status;
+        } else if (digest != digest_) {
+            // Downloaded blob did not match provided digest
+            SetState(kBlobStateError);
+            return ERR_IO_DATA_INTEGRITY;
+        }
 
+        if (merkle_size > 0) {
             status = WriteShared(0, merkle_size, merkle_size, merkle_tree_->GetVmo(),
                                  inode->start_block);
             if (status != NO_ERROR) {
@@ -423,6 +510,10 @@ mx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             }
         }
 
+        // The whole blob was just checked against its digest, so reads
+        // never need to hash it again.
+        verified_.Set(0, BlobDataBlocks(*inode));
+
         // No more data to write. Flush to disk.
         if ((status = WriteMetadata()) != NO_ERROR) {
             SetState(kBlobStateError);
@@ -466,17 +557,9 @@ mx_status_t VnodeBlob::CopyVmo(mx_rights_t rights, mx_handle_t* out) {
     // 1) We could fault in pages on-demand, or
     // 2) We could create a COW subsection of the original VMO.
     //
-    // For now, we aggressively verify the entire VMO up front.
-    merkle::Tree mt;
-    merkle::Digest d;
-    d = ((const uint8_t*) &digest_[0]);
+    // For now, we read in and verify whatever is left of the VMO up front.
     auto inode = &blobstore_->node_map_[map_index_];
-    uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
-    const void* merkle_data = (merkle_tree_ != nullptr) ? merkle_tree_->GetData() : nullptr;
-    status = mt.Verify(blob_->GetData(), inode->blob_size,
-                       merkle_data, size_merkle,
-                       0, inode->blob_size, d);
-    if (status != NO_ERROR) {
+    if ((status = VerifyRange(0, inode->blob_size)) != NO_ERROR) {
         return status;
     }
 
@@ -493,9 +576,6 @@ mx_status_t VnodeBlob::ReadInternal(void* data, size_t len, size_t off, size_t*
         return status;
     }
 
-    merkle::Tree mt;
-    merkle::Digest d;
-    d = ((const uint8_t*) &digest_[0]);
     auto inode = &blobstore_->node_map_[map_index_];
     if (off >= inode->blob_size) {
         *actual = 0;
@@ -505,12 +585,7 @@ mx_status_t VnodeBlob::ReadInternal(void* data, size_t len, size_t off, size_t*
         len = inode->blob_size - off;
     }
 
-    uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
-    const void* merkle_data = (merkle_tree_ != nullptr) ? merkle_tree_->GetData() : nullptr;
-    status = mt.Verify(blob_->GetData(), inode->blob_size,
-                       merkle_data, size_merkle,
-                       off, len, d);
-    if (status != NO_ERROR) {
+    if ((status = VerifyRange(off, len)) != NO_ERROR) {
         return status;
     }
 
@@ -542,20 +617,103 @@ void Blobstore::FreeBlocks(size_t nblocks, size_t blkno) {
 
 // Allocates a node IN MEMORY
 mx_status_t Blobstore::AllocateNode(size_t* node_index_out) {
-    for (size_t i = 0; i < info_.inode_count; ++i) {
-        if (node_map_[i].start_block == kStartBlockFree) {
-            // Found a free node. Mark it as reserved so no one else can allocate it.
-            node_map_[i].start_block = kStartBlockReserved;
-            *node_index_out = i;
-            return NO_ERROR;
-        }
-    }
-    return ERR_NO_RESOURCES;
+    if (free_node_count_ == 0) {
+        return ERR_NO_RESOURCES;
+    }
+    size_t i = free_nodes_[--free_node_count_];
+    assert(node_map_[i].start_block == kStartBlockFree);
+    // Mark it as reserved so no one else can allocate it.
+    node_map_[i].start_block = kStartBlockReserved;
+    *node_index_out = i;
+    return NO_ERROR;
 }
 
 // Frees a node IN MEMORY
 void Blobstore::FreeNode(size_t node_index) {
+    UnindexNode(node_index);
     memset(&node_map_[node_index], 0, sizeof(blobstore_inode_t));
+    assert(free_node_count_ < info_.inode_count);
+    free_nodes_[free_node_count_++] = static_cast<uint32_t>(node_index);
+}
+
+void Blobstore::IndexNode(size_t node_index) {
+    size_t i = DigestHash(node_map_[node_index].merkle_root_hash) & digest_index_mask_;
+    while (digest_index_[i] != 0) {
+        i = (i + 1) & digest_index_mask_;
+    }
+    digest_index_[i] = static_cast<uint32_t>(node_index + 1);
+}
+
+void Blobstore::UnindexNode(size_t node_index) {
+    size_t i = DigestHash(node_map_[node_index].merkle_root_hash) & digest_index_mask_;
+    for (;; i = (i + 1) & digest_index_mask_) {
+        if (digest_index_[i] == 0) {
+            // Never made it into the index.
+            return;
+        } else if (digest_index_[i] == node_index + 1) {
+            break;
+        }
+    }
+
+    // Empty the slot, then shift back any later entries in the same probe run
+    // which would no longer be reachable from their home slot.
+    digest_index_[i] = 0;
+    for (size_t j = (i + 1) & digest_index_mask_; digest_index_[j] != 0;
+         j = (j + 1) & digest_index_mask_) {
+        const uint8_t* digest = node_map_[digest_index_[j] - 1].merkle_root_hash;
+        size_t home = DigestHash(digest) & digest_index_mask_;
+        if (((j - home) & digest_index_mask_) >= ((j - i) & digest_index_mask_)) {
+            digest_index_[i] = digest_index_[j];
+            digest_index_[j] = 0;
+            i = j;
+        }
+    }
+}
+
+mx_status_t Blobstore::FindNode(const uint8_t* digest, size_t* node_index_out) const {
+    size_t i = DigestHash(digest) & digest_index_mask_;
+    for (; digest_index_[i] != 0; i = (i + 1) & digest_index_mask_) {
+        size_t node_index = digest_index_[i] - 1;
+        if (memcmp(node_map_[node_index].merkle_root_hash, digest,
+                   merkle::Digest::kLength) == 0) {
+            *node_index_out = node_index;
+            return NO_ERROR;
+        }
+    }
+    return ERR_NOT_FOUND;
+}
+
+mx_status_t Blobstore::BuildNodeIndex() {
+    // Keep the index at most half full so probe runs stay short.
+    size_t slots = 1;
+    while (slots < info_.inode_count * 2) {
+        slots <<= 1;
+    }
+
+    AllocChecker ac;
+    digest_index_.reset(new (&ac) uint32_t[slots]());
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    digest_index_mask_ = slots - 1;
+
+    free_nodes_.reset(new (&ac) uint32_t[info_.inode_count]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    free_node_count_ = 0;
+
+    // Push free nodes in reverse so that, until nodes are freed, the lowest
+    // indices are allocated first. Freed nodes are pushed on top and are
+    // reused first, so node order is not preserved after that.
+    for (size_t i = info_.inode_count; i-- > 0;) {
+        if (node_map_[i].start_block >= kStartBlockMinimum) {
+            IndexNode(i);
+        } else {
+            free_nodes_[free_node_count_++] = static_cast<uint32_t>(i);
+        }
+    }
+    return NO_ERROR;
 }
 
 mx_status_t Blobstore::Unmount() {
@@ -601,6 +759,7 @@ mx_status_t Blobstore::NewBlob(const merkle::Digest& digest, mxtl::RefPtr<VnodeB
         return ERR_NO_MEMORY;
     }
 
+    mxtl::AutoLock lock(&lock_);
     hash_.insert(out->get());
     return NO_ERROR;
 }
@@ -611,6 +770,7 @@ mx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
     // Ex: open, alloc, disk write async start, unlink, release, disk write async end.
     // FWIW, this isn't a problem right now with synchronous writes, but it
     // would become a problem with asynchronous writes.
+    mxtl::AutoLock lock(&lock_);
     switch (vn->GetState()) {
         case kBlobStateEmpty: {
             // There are no in-memory or on-disk structures allocated.
@@ -656,6 +816,7 @@ static_assert(sizeof(dircookie_t) <= sizeof(vdircookie_t),
 mx_status_t Blobstore::Readdir(void* cookie, void* dirents, size_t len) {
     fs::DirentFiller df(dirents, len);
     dircookie_t* c = static_cast<dircookie_t*>(cookie);
+    mxtl::AutoLock lock(&lock_);
 
     for (size_t i = c->index; i < info_.inode_count; ++i) {
         if (node_map_[i].start_block >= kStartBlockMinimum) {
@@ -676,8 +837,13 @@ mx_status_t Blobstore::Readdir(void* cookie, void* dirents, size_t len) {
 }
 
 mx_status_t Blobstore::LookupBlob(const merkle::Digest& digest, mxtl::RefPtr<VnodeBlob>* out) {
+    // Declared ahead of the lock, so that if this turns out to be the last
+    // reference the blob is released (which takes the lock) after unlocking.
+    mxtl::RefPtr<VnodeBlob> vn;
+    mxtl::AutoLock lock(&lock_);
+
     // Look up blob in the fast map (is the blob open elsewhere?)
-    mxtl::RefPtr<VnodeBlob> vn = mxtl::RefPtr<VnodeBlob>(hash_.find(digest.AcquireBytes()).CopyPointer());
+    vn = mxtl::RefPtr<VnodeBlob>(hash_.find(digest.AcquireBytes()).CopyPointer());
     digest.ReleaseBytes();
     if (vn != nullptr) {
         if (out != nullptr) {
@@ -687,36 +853,38 @@ mx_status_t Blobstore::LookupBlob(const merkle::Digest& digest, mxtl::RefPtr<Vno
     }
 
     // Look up blob in the slow map
-    for (size_t i = 0; i < info_.inode_count; ++i) {
-        if (node_map_[i].start_block >= kStartBlockMinimum) {
-            if (digest == node_map_[i].merkle_root_hash) {
-                if (out != nullptr) {
-                    // Found it. Attempt to wrap the blob in a vnode.
-                    AllocChecker ac;
-                    mxtl::RefPtr<VnodeBlob> vn =
-                            mxtl::AdoptRef(new (&ac) VnodeBlob(mxtl::RefPtr<Blobstore>(this), digest));
-                    if (!ac.check()) {
-                        return ERR_NO_MEMORY;
-                    }
-                    vn->SetState(kBlobStateReadable);
-                    vn->SetMapIndex(i);
-                    // Delay reading any data from disk until read.
-                    hash_.insert(vn.get());
-                    *out = mxtl::move(vn);
-                }
-                return NO_ERROR;
-            }
+    size_t i;
+    mx_status_t status = FindNode(digest.AcquireBytes(), &i);
+    digest.ReleaseBytes();
+    if (status != NO_ERROR) {
+        return status;
+    }
+
+    if (out != nullptr) {
+        // Found it. Attempt to wrap the blob in a vnode.
+        AllocChecker ac;
+        vn = mxtl::AdoptRef(new (&ac) VnodeBlob(mxtl::RefPtr<Blobstore>(this), digest));
+        if (!ac.check()) {
+            return ERR_NO_MEMORY;
         }
+        vn->SetState(kBlobStateReadable);
+        vn->SetMapIndex(i);
+        // Delay reading any data from disk until read.
+        hash_.insert(vn.get());
+        *out = mxtl::move(vn);
     }
-    return ERR_NOT_FOUND;
+    return NO_ERROR;
 }
 
-Blobstore::Blobstore(int fd, const blobstore_info_t* info) : blockfd_(fd) {
+Blobstore::Blobstore(int fd, const blobstore_info_t* info)
+    : blockfd_(fd), digest_index_mask_(0), free_node_count_(0) {
     memcpy(&info_, info, sizeof(blobstore_info_t));
 }
 
 Blobstore::~Blobstore() {}
 
+static const unsigned kPoolSize = 4;
+
 mx_status_t Blobstore::Create(int fd, const blobstore_info_t* info, mxtl::RefPtr<VnodeBlob>* out) {
     uint64_t blocks = info->block_count;
 
@@ -726,7 +894,8 @@ mx_status_t Blobstore::Create(int fd, const blobstore_info_t* info, mxtl::RefPtr
         return status;
     }
 
-    if ((status = fs::MxioDispatcher::Create(&blobstore_global_dispatcher)) != NO_ERROR) {
+    if ((status = fs::VfsDispatcher::Create(mxrio_handler, kPoolSize,
+                                            &blobstore_global_dispatcher)) != NO_ERROR) {
         return status;
     }
     AllocChecker ac;
@@ -755,6 +924,11 @@ mx_status_t Blobstore::Create(int fd, const blobstore_info_t* info, mxtl::RefPtr
         return status;
     }
 
+    if ((status = fs->BuildNodeIndex()) < 0) {
+        fprintf(stderr, "blobstore: Failed to index nodes\n");
+        return status;
+    }
+
     *out = mxtl::AdoptRef(new (&ac) VnodeBlob(mxtl::move(fs)));
     if (!ac.check()) {
         return ERR_NO_MEMORY;
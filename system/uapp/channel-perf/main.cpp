@@ -9,13 +9,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <threads.h>
 
+#include <launchpad/launchpad.h>
 #include <magenta/compiler.h>
+#include <magenta/process.h>
+#include <magenta/processargs.h>
 #include <magenta/syscalls.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/unique_ptr.h>
 
 namespace {
 
+// Used to run a copy of ourselves as the other end of the call test.
+constexpr char kBinName[] = "/boot/bin/channel-perf";
+constexpr char kEchoServerArg[] = "echo-server";
+
 void argument_error(const char* argv0, const char* message) {
     fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
     exit(EXIT_FAILURE);
@@ -111,9 +121,160 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
            test_args.size, test_args.handles, test_args.queue, its_per_second);
 }
 
+// Replies to every message on |h| with the same bytes (so the transaction id is
+// preserved), until the peer goes away.
+int echo_loop(void* arg) {
+    mx_handle_t h = static_cast<mx_handle_t>(reinterpret_cast<uintptr_t>(arg));
+
+    static uint8_t buffer[MX_CHANNEL_MAX_MSG_BYTES];
+    for (;;) {
+        mx_signals_t pending;
+        mx_status_t status = mx_object_wait_one(h, MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                                MX_TIME_INFINITE, &pending);
+        if (status != NO_ERROR || !(pending & MX_CHANNEL_READABLE))
+            break;
+
+        uint32_t size;
+        status = mx_channel_read(h, 0u, buffer, nullptr, sizeof(buffer), 0u, &size, nullptr);
+        if (status != NO_ERROR)
+            break;
+        status = mx_channel_write(h, 0u, buffer, size, nullptr, 0u);
+        if (status != NO_ERROR)
+            break;
+    }
+
+    mx_handle_close(h);
+    return EXIT_SUCCESS;
+}
+
+int echo_server() {
+    mx_handle_t h = mx_get_startup_handle(PA_HND(PA_USER0, 0));
+    if (h == MX_HANDLE_INVALID)
+        return EXIT_FAILURE;
+    return echo_loop(reinterpret_cast<void*>(static_cast<uintptr_t>(h)));
+}
+
+// Starts a copy of ourselves serving |h| in another process.
+mx_handle_t launch_echo_server(mx_handle_t h) {
+    mx_status_t status;
+    mx_handle_t job;
+    status = mx_handle_duplicate(mx_job_default(), MX_RIGHT_SAME_RIGHTS, &job);
+    assert(status == NO_ERROR);
+
+    launchpad_t* lp;
+    const char* args[] = {kBinName, kEchoServerArg};
+    uint32_t id = PA_HND(PA_USER0, 0);
+    launchpad_create(job, "channel-perf-echo", &lp);
+    launchpad_load_from_file(lp, kBinName);
+    launchpad_set_args(lp, countof(args), args);
+    launchpad_add_handles(lp, 1, &h, &id);
+
+    mx_handle_t proc;
+    const char* errmsg;
+    if ((status = launchpad_go(lp, &proc, &errmsg)) != NO_ERROR) {
+        fprintf(stderr, "error: could not launch echo server (%d): %s\n", status, errmsg);
+        exit(EXIT_FAILURE);
+    }
+    return proc;
+}
+
+int compare_u64(const void* a, const void* b) {
+    uint64_t x = *static_cast<const uint64_t*>(a);
+    uint64_t y = *static_cast<const uint64_t*>(b);
+    return (x > y) - (x < y);
+}
+
+// Measures mx_channel_call() round trips to an echo server, either in another
+// process (so every iteration switches address spaces twice) or on another
+// thread of this one.  Besides the rate, reports the spread of single round
+// trip times over the first kSamples calls.
+void do_call_test(uint32_t duration, uint32_t size, bool in_process) {
+    __UNUSED mx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+    size = mxtl::max(size, static_cast<uint32_t>(sizeof(mx_txid_t)));
+
+    mx_handle_t mp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
+    status = mx_channel_create(0u, &mp[0], &mp[1]);
+    assert(status == NO_ERROR);
+
+    mx_handle_t proc = MX_HANDLE_INVALID;
+    thrd_t thread;
+    if (in_process) {
+        int r = thrd_create(&thread, echo_loop,
+                            reinterpret_cast<void*>(static_cast<uintptr_t>(mp[1])));
+        assert(r == thrd_success);
+    } else {
+        proc = launch_echo_server(mp[1]);
+    }
+
+    static constexpr uint32_t kSamples = 100000;
+    mxtl::unique_ptr<uint64_t[]> samples(new uint64_t[kSamples]);
+    uint32_t num_samples = 0;
+
+    mxtl::unique_ptr<uint8_t[]> wr_data(new uint8_t[size]);
+    mxtl::unique_ptr<uint8_t[]> rd_data(new uint8_t[size]);
+    memset(wr_data.get(), 0, size);
+
+    mx_channel_call_args_t call_args = {
+        wr_data.get(), nullptr, rd_data.get(), nullptr, size, 0u, size, 0u,
+    };
+
+    static constexpr uint32_t big_it_size = 1000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            uint32_t r_size;
+            uint32_t r_handles;
+            mx_status_t read_status;
+            uint64_t call_start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+            status = mx_channel_call(mp[0], 0u, MX_TIME_INFINITE, &call_args,
+                                     &r_size, &r_handles, &read_status);
+            assert(status == NO_ERROR);
+            assert(r_size == size);
+            if (num_samples < kSamples)
+                samples[num_samples++] = mx_time_get(MX_CLOCK_MONOTONIC) - call_start_ns;
+        }
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    status = mx_handle_close(mp[0]);
+    assert(status == NO_ERROR);
+    if (in_process) {
+        thrd_join(thread, nullptr);
+    } else {
+        status = mx_object_wait_one(proc, MX_PROCESS_TERMINATED, MX_TIME_INFINITE, nullptr);
+        assert(status == NO_ERROR);
+        status = mx_handle_close(proc);
+        assert(status == NO_ERROR);
+    }
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double calls = static_cast<double>(big_its) * big_it_size;
+    printf("call %" PRIu32 " bytes to another %s: %.0f round trips/second "
+               "(%.2f us/round trip)\n",
+           size, in_process ? "thread" : "process",
+           calls / real_duration, real_duration * 1000000.0 / calls);
+
+    qsort(samples.get(), num_samples, sizeof(samples[0]), compare_u64);
+    printf("  single round trip: min %.2f us, median %.2f us, 99th percentile %.2f us\n",
+           static_cast<double>(samples[0]) / 1000.0,
+           static_cast<double>(samples[num_samples / 2]) / 1000.0,
+           static_cast<double>(samples[num_samples * 99 / 100]) / 1000.0);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
+    if (argc == 2 && !strcmp(argv[1], kEchoServerArg))
+        return echo_server();
+
     static constexpr char help[] =
         "Usage: %s [options ...]\n"
         "\n"
@@ -121,6 +282,8 @@ int main(int argc, char** argv) {
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
         "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -c    run cross-process mx_channel_call test (uses -S only)\n"
+        "  -t    run cross-thread mx_channel_call test (uses -S only)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
@@ -128,6 +291,8 @@ int main(int argc, char** argv) {
         "  -Q N  set message pre-queue count to N messages (default: 0)\n";
 
     bool run_suite = false;  // -o/-s
+    bool run_call = false;   // -c/-t
+    bool call_in_process = false;
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
     // Ignored when running a suite:
@@ -138,7 +303,7 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hosctn:d:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -156,9 +321,17 @@ int main(int argc, char** argv) {
                 return EXIT_SUCCESS;
             case 'o':
                 run_suite = false;
+                run_call = false;
                 break;
             case 's':
                 run_suite = true;
+                run_call = false;
+                break;
+            case 'c':
+            case 't':
+                run_call = true;
+                call_in_process = (opt == 't');
+                run_suite = false;
                 break;
             case 'n':
                 assert(optarg);
@@ -196,7 +369,9 @@ int main(int argc, char** argv) {
                    repeats);
         }
 
-        if (run_suite) {
+        if (run_call) {
+            do_call_test(duration, test_args.size, call_in_process);
+        } else if (run_suite) {
             static constexpr TestArgs suite[] = {
                 {10, 0, 0},
                 {100, 0, 0},
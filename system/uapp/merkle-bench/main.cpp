@@ -0,0 +1,82 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <magenta/syscalls.h>
+#include <merkle/digest.h>
+#include <merkle/tree.h>
+#include <mxalloc/new.h>
+#include <mxtl/unique_ptr.h>
+
+namespace {
+
+using merkle::Digest;
+using merkle::Tree;
+
+double MiBPerSecond(size_t len, mx_time_t elapsed) {
+    return (static_cast<double>(len) / (1024.0 * 1024.0)) /
+           (static_cast<double>(elapsed) / 1000000000.0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [data MiB (default: 64)] [max threads]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t data_len = (argc > 1 ? strtoul(argv[1], nullptr, 10) : 64) << 20;
+    size_t max_threads = argc > 2 ? strtoul(argv[2], nullptr, 10)
+                                  : mx_system_get_num_cpus();
+    if (data_len == 0 || max_threads == 0 || max_threads > Tree::kMaxThreads) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Tree tree;
+    size_t tree_len = tree.GetTreeLength(data_len);
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[data_len]);
+    if (!ac.check()) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    // Leave room for the root digest that Create stores when there's no tree.
+    mxtl::unique_ptr<uint8_t[]> tree_buf(new (&ac) uint8_t[tree_len + Tree::kNodeSize]);
+    if (!ac.check()) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < data_len; ++i) {
+        data[i] = static_cast<uint8_t>(rand());
+    }
+
+    printf("%zu MiB of data, %zu byte tree\n", data_len >> 20, tree_len);
+    for (size_t n = 1; n <= max_threads; n <<= 1) {
+        Digest digest;
+        mx_time_t t0 = mx_time_get(MX_CLOCK_MONOTONIC);
+        mx_status_t rc = tree.CreateParallel(data.get(), data_len, tree_buf.get(),
+                                             tree_len, &digest, n);
+        mx_time_t t1 = mx_time_get(MX_CLOCK_MONOTONIC);
+        if (rc != NO_ERROR) {
+            fprintf(stderr, "%s: create failed: %d\n", argv[0], rc);
+            return EXIT_FAILURE;
+        }
+        rc = tree.VerifyParallel(data.get(), data_len, tree_buf.get(), tree_len,
+                                 0, data_len, digest, n);
+        mx_time_t t2 = mx_time_get(MX_CLOCK_MONOTONIC);
+        if (rc != NO_ERROR) {
+            fprintf(stderr, "%s: verify failed: %d\n", argv[0], rc);
+            return EXIT_FAILURE;
+        }
+        printf("%2zu threads: create %8.1f MiB/s, verify %8.1f MiB/s\n", n,
+               MiBPerSecond(data_len, t1 - t0), MiBPerSecond(data_len, t2 - t1));
+    }
+    return EXIT_SUCCESS;
+}
@@ -5,11 +5,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <fs/trace.h>
 
 #include <mxalloc/new.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
 
@@ -18,35 +20,358 @@
 
 namespace minfs {
 
-mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
-    off_t off = bno * kMinfsBlockSize;
-    trace(IO, "readblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
-        return ERR_IO;
+void* Bcache::SlotData(uint32_t slot) const {
+#ifdef __Fuchsia__
+    uintptr_t base = reinterpret_cast<uintptr_t>(cache_vmo_->GetData());
+#else
+    uintptr_t base = reinterpret_cast<uintptr_t>(cache_data_.get());
+#endif
+    return reinterpret_cast<void*>(base + slot * kMinfsBlockSize);
+}
+
+Bcache::BlockEntry* Bcache::Lookup(uint32_t bno) {
+    auto iter = hash_.find(bno);
+    if (!iter.IsValid()) {
+        return nullptr;
+    }
+    BlockEntry* entry = &*iter;
+    lru_.erase(*entry);
+    lru_.push_front(entry);
+    return entry;
+}
+
+bool Bcache::HasDirty(uint32_t bno, uint32_t count) {
+    if (dirty_count_ == pending_count_) {
+        return false;
+    }
+    for (auto& entry : lru_) {
+        if (entry.dirty && !entry.pending && entry.bno >= bno && entry.bno - bno < count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Bcache::MarkDirty(BlockEntry* entry, bool journaled) {
+    if (!entry->dirty) {
+        entry->dirty = true;
+        dirty_count_++;
+    }
+    if (journaled && !entry->pending) {
+#ifdef __Fuchsia__
+        if (pending_count_ == 0) {
+            commit_deadline_ = mx_deadline_after(kMinfsCommitInterval);
+        }
+#endif
+        entry->pending = true;
+        pending_count_++;
+    }
+}
+
+mx_status_t Bcache::Allocate(uint32_t bno, BlockEntry** out) {
+    // Pending blocks must not reach the disk before they are committed, and
+    // commits wait for the end of an operation, so they are never evicted.
+    BlockEntry* entry = nullptr;
+    for (auto iter = lru_.end(); iter != lru_.begin();) {
+        --iter;
+        if (!iter->pending) {
+            entry = &*iter;
+            break;
+        }
+    }
+    if (entry == nullptr) {
+        return ERR_NO_RESOURCES;
+    }
+    if (entry->cached) {
+        if (entry->dirty) {
+            mx_status_t status;
+            if ((status = Checkpoint()) != NO_ERROR) {
+                return status;
+            }
+        }
+        hash_.erase(*entry);
+    }
+    entry->bno = bno;
+    entry->cached = true;
+    entry->dirty = false;
+    entry->pending = false;
+    hash_.insert(entry);
+    lru_.erase(*entry);
+    lru_.push_front(entry);
+    *out = entry;
+    return NO_ERROR;
+}
+
+void Bcache::Invalidate(uint32_t bno, uint32_t count) {
+    for (uint32_t i = 0; i < kMinfsBlockCacheSize; i++) {
+        BlockEntry* entry = &entries_[i];
+        if (!entry->cached || entry->bno < bno || entry->bno - bno >= count) {
+            continue;
+        }
+        if (entry->dirty) {
+            dirty_count_--;
+        }
+        if (entry->pending) {
+            pending_count_--;
+        }
+        hash_.erase(*entry);
+        entry->cached = false;
+        entry->dirty = false;
+        entry->pending = false;
+        lru_.erase(*entry);
+        lru_.push_back(entry);
+    }
+}
+
+mx_status_t Bcache::DeviceIo(bool write, const uint32_t* slots, const uint32_t* bnos,
+                             uint32_t count) {
+    mx_status_t status;
+#ifdef __Fuchsia__
+    block_fifo_request_t requests[MAX_TXN_MESSAGES];
+    size_t n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t vmo_offset = static_cast<uint64_t>(slots[i]) * kMinfsBlockSize;
+        uint64_t dev_offset = static_cast<uint64_t>(bnos[i]) * kMinfsBlockSize;
+        if (n > 0) {
+            block_fifo_request_t* prev = &requests[n - 1];
+            if ((prev->vmo_offset + prev->length == vmo_offset) &&
+                (prev->dev_offset + prev->length == dev_offset)) {
+                prev->length += kMinfsBlockSize;
+                continue;
+            }
+            if (n == MAX_TXN_MESSAGES) {
+                if ((status = DeviceTxn(requests, n)) != NO_ERROR) {
+                    return status;
+                }
+                n = 0;
+            }
+        }
+        requests[n].txnid = txnid_;
+        requests[n].vmoid = cache_vmoid_;
+        requests[n].opcode = write ? BLOCKIO_WRITE : BLOCKIO_READ;
+        requests[n].length = kMinfsBlockSize;
+        requests[n].vmo_offset = vmo_offset;
+        requests[n].dev_offset = dev_offset;
+        n++;
     }
-    if (read(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
+    status = (n > 0) ? DeviceTxn(requests, n) : NO_ERROR;
+#else
+    constexpr uint32_t kMaxIov = 64;
+    struct iovec iov[kMaxIov];
+    status = NO_ERROR;
+    for (uint32_t i = 0; i < count;) {
+        uint32_t run = 0;
+        do {
+            iov[run].iov_base = SlotData(slots[i + run]);
+            iov[run].iov_len = kMinfsBlockSize;
+            run++;
+        } while ((run < kMaxIov) && (i + run < count) && (bnos[i + run] == bnos[i] + run));
+
+        off_t off = static_cast<off_t>(bnos[i]) * kMinfsBlockSize;
+        ssize_t len = static_cast<ssize_t>(run) * kMinfsBlockSize;
+        if (lseek(fd_, off, SEEK_SET) < 0) {
+            return ERR_IO;
+        }
+        if ((write ? writev(fd_, iov, run) : readv(fd_, iov, run)) != len) {
+            return ERR_IO;
+        }
+        i += run;
+    }
+#endif
+    return status;
+}
+
+mx_status_t Bcache::Fill(uint32_t bno, uint32_t count) {
+    if (bno < blockmax_) {
+        count = mxtl::min(count, blockmax_ - bno);
+    } else {
+        count = 1;
+    }
+    count = mxtl::min(count, kMinfsReadaheadMax);
+
+    mx_status_t status;
+    uint32_t slots[kMinfsReadaheadMax];
+    uint32_t bnos[kMinfsReadaheadMax];
+    uint32_t n = 0;
+    for (; n < count; n++) {
+        if ((n > 0) && hash_.find(bno + n).IsValid()) {
+            // Stop the readahead at the first block we already have.
+            break;
+        }
+        BlockEntry* entry;
+        if ((status = Allocate(bno + n, &entry)) != NO_ERROR) {
+            Invalidate(bno, n);
+            return status;
+        }
+        slots[n] = entry->slot;
+        bnos[n] = bno + n;
+    }
+
+    trace(IO, "fill() bno=%u count=%u\n", bno, n);
+    if ((status = DeviceIo(false, slots, bnos, n)) != NO_ERROR) {
+        Invalidate(bno, n);
+        if (n > 1) {
+            // The device may end before the readahead window does.
+            return Fill(bno, 1);
+        }
         error("minfs: cannot read block %u\n", bno);
         return ERR_IO;
     }
     return NO_ERROR;
 }
 
-mx_status_t Bcache::Writeblk(uint32_t bno, const void* data) {
-    off_t off = bno * kMinfsBlockSize;
-    trace(IO, "writeblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
-        return ERR_IO;
+mx_status_t Bcache::WriteBack() {
+    mx_status_t status;
+    if ((status = Commit()) != NO_ERROR) {
+        return status;
     }
-    if (write(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
-        error("minfs: cannot write block %u\n", bno);
-        return ERR_IO;
+    return Checkpoint();
+}
+
+mx_status_t Bcache::ReadblkLocked(uint32_t bno, void* data) {
+    trace(IO, "readblk() bno=%u\n", bno);
+    BlockEntry* entry = Lookup(bno);
+    if (entry == nullptr) {
+        // A miss on the block right after the last one read means a
+        // sequential reader has caught up with the readahead; grow the window.
+        uint32_t count = 1;
+        if (bno == ra_next_) {
+            ra_window_ = mxtl::min(ra_window_ * 2, kMinfsReadaheadMax);
+            count = ra_window_;
+        } else {
+            ra_window_ = 1;
+        }
+        mx_status_t status;
+        if ((status = Fill(bno, count)) != NO_ERROR) {
+            return status;
+        }
+        entry = Lookup(bno);
+        MX_DEBUG_ASSERT(entry != nullptr);
     }
+    memcpy(data, SlotData(entry->slot), kMinfsBlockSize);
+    ra_next_ = bno + 1;
     return NO_ERROR;
 }
 
+mx_status_t Bcache::WriteblkLocked(uint32_t bno, const void* data) {
+    trace(IO, "writeblk() bno=%u\n", bno);
+    mx_status_t status;
+    BlockEntry* entry = Lookup(bno);
+    if ((entry == nullptr) && ((status = Allocate(bno, &entry)) != NO_ERROR)) {
+        return status;
+    }
+    memcpy(SlotData(entry->slot), data, kMinfsBlockSize);
+    // Only metadata is journaled; blocks written here are file data, or
+    // are written before the journal is enabled.
+    MarkDirty(entry, false);
+    if (dirty_count_ - pending_count_ >= kMinfsDirtyMax) {
+        return Checkpoint();
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
+#ifdef __Fuchsia__
+    mxtl::AutoLock lock(&lock_);
+#endif
+    return ReadblkLocked(bno, data);
+}
+
+mx_status_t Bcache::Writeblk(uint32_t bno, const void* data) {
+#ifdef __Fuchsia__
+    mxtl::AutoLock lock(&lock_);
+#endif
+    return WriteblkLocked(bno, data);
+}
+
+#ifdef __Fuchsia__
+mx_status_t Bcache::Txn(block_fifo_request_t* requests, size_t count) {
+    mxtl::AutoLock lock(&lock_);
+    mx_status_t status;
+    mx_status_t capture_status = NO_ERROR;
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t bno = static_cast<uint32_t>(requests[i].dev_offset / kMinfsBlockSize);
+        uint32_t nblocks = static_cast<uint32_t>(requests[i].length / kMinfsBlockSize);
+        switch (requests[i].opcode & BLOCKIO_OP_MASK) {
+        case BLOCKIO_WRITE: {
+            if (journal_) {
+                auto iter = metadata_vmos_.find(requests[i].vmoid);
+                if (iter.IsValid()) {
+                    // A failed capture leaves the journal broken, not the
+                    // rest of the batch unsent.
+                    if (((status = Capture(iter->vmo, requests[i].vmo_offset, bno,
+                                           nblocks)) != NO_ERROR) &&
+                        (capture_status == NO_ERROR)) {
+                        capture_status = status;
+                    }
+                    continue;
+                }
+            }
+            // The request carries newer data than anything we hold, including
+            // pending copies of blocks which were metadata until they were
+            // freed. Committed transactions are always written back before
+            // the commit finishes, so a replay cannot overwrite this write.
+            if (HasDirty(bno, nblocks) && ((status = Checkpoint()) != NO_ERROR)) {
+                return status;
+            }
+            Invalidate(bno, nblocks);
+            break;
+        }
+        case BLOCKIO_READ:
+            // Pending blocks cannot be written back before they are
+            // committed; reads into metadata VMOs pick them up from the
+            // cache below instead.
+            if (HasDirty(bno, nblocks) && ((status = Checkpoint()) != NO_ERROR)) {
+                return status;
+            }
+            break;
+        case BLOCKIO_CLOSE_VMO:
+            metadata_vmos_.erase(requests[i].vmoid);
+            break;
+        }
+        requests[n++] = requests[i];
+    }
+
+    if (n > 0 && (status = DeviceTxn(requests, n)) != NO_ERROR) {
+        return status;
+    }
+    if (pending_count_ == 0) {
+        return capture_status;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if ((requests[i].opcode & BLOCKIO_OP_MASK) != BLOCKIO_READ) {
+            continue;
+        }
+        auto iter = metadata_vmos_.find(requests[i].vmoid);
+        if (!iter.IsValid()) {
+            continue;
+        }
+        uint32_t bno = static_cast<uint32_t>(requests[i].dev_offset / kMinfsBlockSize);
+        uint32_t nblocks = static_cast<uint32_t>(requests[i].length / kMinfsBlockSize);
+        if ((status = Overlay(iter->vmo, requests[i].vmo_offset, bno, nblocks)) != NO_ERROR) {
+            return status;
+        }
+    }
+    return capture_status;
+}
+#endif
+
 int Bcache::Sync() {
+    mx_status_t status;
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&lock_);
+        if ((status = CommitBetweenOps()) == NO_ERROR) {
+            status = Checkpoint();
+        }
+#else
+        status = WriteBack();
+#endif
+    }
+    if (status != NO_ERROR) {
+        return status;
+    }
     return fsync(fd_);
 }
 
@@ -56,8 +381,13 @@ mx_status_t Bcache::Create(mxtl::unique_ptr<Bcache>* out, int fd, uint32_t block
     if (!ac.check()) {
         return ERR_NO_MEMORY;
     }
-#ifdef __Fuchsia__
+    bc->entries_.reset(new (&ac) BlockEntry[kMinfsBlockCacheSize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
     mx_status_t status;
+    const size_t cache_size = (kMinfsBlockCacheSize + 1) * kMinfsBlockSize;
+#ifdef __Fuchsia__
     mx_handle_t fifo;
     ssize_t r;
 
@@ -71,10 +401,32 @@ mx_status_t Bcache::Create(mxtl::unique_ptr<Bcache>* out, int fd, uint32_t block
         mx_handle_close(fifo);
         return status;
     }
+
+    if ((status = MappedVmo::Create(cache_size, &bc->cache_vmo_)) != NO_ERROR) {
+        return status;
+    } else if ((status = bc->AttachVmo(bc->cache_vmo_->GetVmo(),
+                                       &bc->cache_vmoid_)) != NO_ERROR) {
+        return status;
+    }
+#else
+    bc->cache_data_.reset(new (&ac) uint8_t[cache_size]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    status = NO_ERROR;
 #endif
 
+    for (uint32_t i = 0; i < kMinfsBlockCacheSize; i++) {
+        BlockEntry* entry = &bc->entries_[i];
+        entry->slot = i;
+        entry->cached = false;
+        entry->dirty = false;
+        entry->pending = false;
+        bc->lru_.push_back(entry);
+    }
+
     *out = mxtl::move(bc);
-    return NO_ERROR;
+    return status;
 }
 
 #ifdef __Fuchsia__
@@ -91,18 +443,65 @@ mx_status_t Bcache::AttachVmo(mx_handle_t vmo, vmoid_t* out) {
     }
     return NO_ERROR;
 }
+
+mx_status_t Bcache::AttachMetadataVmo(mx_handle_t vmo, vmoid_t* out) {
+    mx_handle_t read_vmo;
+    mx_status_t status = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &read_vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    AllocChecker ac;
+    mxtl::unique_ptr<MetadataVmo> mvmo(new (&ac) MetadataVmo(0, read_vmo));
+    if (!ac.check()) {
+        mx_handle_close(read_vmo);
+        return ERR_NO_MEMORY;
+    }
+    if ((status = AttachVmo(vmo, &mvmo->vmoid)) != NO_ERROR) {
+        return status;
+    }
+    *out = mvmo->vmoid;
+
+    mxtl::AutoLock lock(&lock_);
+    metadata_vmos_.insert(mxtl::move(mvmo));
+    return NO_ERROR;
+}
 #endif
 
 Bcache::Bcache(int fd, uint32_t blockmax) :
-    fd_(fd), blockmax_(blockmax) {}
+#ifdef __Fuchsia__
+    fifo_client_(nullptr), commit_thread_running_(false), commit_stop_(MX_HANDLE_INVALID),
+    commit_deadline_(0), active_ops_(0), commit_due_(false),
+#endif
+    fd_(fd), blockmax_(blockmax), dirty_count_(0), pending_count_(0),
+    ra_next_(blockmax), ra_window_(1), journal_(false), jnl_start_(0),
+    jnl_count_(0), jnl_head_(1), jnl_seq_(0), jnl_broken_(false) {
+#ifdef __Fuchsia__
+    cnd_init(&op_cond_);
+#endif
+}
 
 Bcache::~Bcache() {
 #ifdef __Fuchsia__
+    if (commit_thread_running_) {
+        mx_object_signal(commit_stop_, 0, MX_EVENT_SIGNALED);
+        thrd_join(commit_thread_, nullptr);
+    }
+    if (commit_stop_ != MX_HANDLE_INVALID) {
+        mx_handle_close(commit_stop_);
+    }
+    MX_DEBUG_ASSERT(active_ops_ == 0);
+#endif
+    WriteBack();
+    hash_.clear();
+    lru_.clear();
+#ifdef __Fuchsia__
+    metadata_vmos_.clear();
     if (fifo_client_ != nullptr) {
         ioctl_block_free_txn(fd_, &txnid_);
         ioctl_block_fifo_close(fd_);
         block_fifo_release_client(fifo_client_);
     }
+    cnd_destroy(&op_cond_);
 #endif
     close(fd_);
 }
@@ -8,6 +8,7 @@
 #include <mxtl/algorithm.h>
 #include <mxtl/macros.h>
 
+#include <fs/trace.h>
 #include <fs/vfs.h>
 
 #include "minfs.h"
@@ -29,13 +30,32 @@ class BlockTxn;
 
 #ifdef __Fuchsia__
 
+//
+// Callers Flush() and check the result before reporting success. Whatever
+// is still enqueued at destruction (on an error path, where the caller is
+// already failing) is flushed there, and a failure is logged since it can
+// no longer be returned.
 template <bool Write>
 class BlockTxn <vmoid_t, Write> {
 public:
-    DISALLOW_COPY_AND_ASSIGN_ALLOW_MOVE(BlockTxn);
-    BlockTxn(Bcache* bc) : bc_(bc), count_(0) {}
+    // Not movable: a moved-from write transaction would end its
+    // operation a second time.
+    DISALLOW_COPY_ASSIGN_AND_MOVE(BlockTxn);
+    // A write transaction spans one filesystem operation, and the journal
+    // only commits between operations.
+    BlockTxn(Bcache* bc) : bc_(bc), count_(0), status_(NO_ERROR) {
+        if (Write) {
+            bc_->BeginOp();
+        }
+    }
     ~BlockTxn() {
-        Flush();
+        mx_status_t status = Flush();
+        if (status != NO_ERROR) {
+            error("minfs: unreported txn error: %d\n", status);
+        }
+        if (Write) {
+            bc_->EndOp();
+        }
     }
 
     // Identify that a block should be written to disk
@@ -73,16 +93,19 @@ public:
             // TODO(smklein): Maybe panic (on write) instead, for metadata?
             // TODO(smklein): We could buffer more messages than this -- just
             // send then in MAX_TXN_MESSAGES increments.
-            Flush();
+            // Any error is held until the caller's next Flush().
+            status_ = Flush();
         }
     }
 
-    // Activate the transaction
+    // Activate the transaction. Returns the first error from any
+    // request enqueued since the last call.
     mx_status_t Flush();
 
 private:
     Bcache* bc_;
     size_t count_;
+    mx_status_t status_;
     block_fifo_request_t requests_[MAX_TXN_MESSAGES];
 };
 
@@ -94,11 +117,15 @@ inline mx_status_t BlockTxn<vmoid_t, Write>::Flush() {
         requests_[i].dev_offset *= kMinfsBlockSize;
         requests_[i].length *= kMinfsBlockSize;
     }
-    mx_status_t status = NO_ERROR;
+    mx_status_t status = status_;
     if (count_ != 0) {
-        status = bc_->Txn(requests_, count_);
+        mx_status_t txn_status = bc_->Txn(requests_, count_);
+        if (status == NO_ERROR) {
+            status = txn_status;
+        }
     }
     count_ = 0;
+    status_ = NO_ERROR;
     return status;
 }
 
@@ -112,28 +139,43 @@ using ReadTxn = BlockTxn<vmoid_t, false>;
 template <bool Write>
 class BlockTxn<const void*, Write> {
 public:
-    DISALLOW_COPY_AND_ASSIGN_ALLOW_MOVE(BlockTxn);
-    BlockTxn(Bcache* bc) : bc_(bc) {}
-    ~BlockTxn() { Flush(); }
+    DISALLOW_COPY_ASSIGN_AND_MOVE(BlockTxn);
+    BlockTxn(Bcache* bc) : bc_(bc), status_(NO_ERROR) {}
+    ~BlockTxn() {
+        mx_status_t status = Flush();
+        if (status != NO_ERROR) {
+            error("minfs: unreported txn error: %d\n", status);
+        }
+    }
 
     // Identify that a block should be written to disk
     // as a later point in time.
     void Enqueue(const void* id, uint32_t relative_block,
                  uint32_t absolute_block, uint32_t nblocks) {
         for (size_t b = 0; b < nblocks; b++) {
+            mx_status_t status;
             if (Write) {
-                bc_->Writeblk(absolute_block + b, GetBlock(id, relative_block + b));
+                status = bc_->Writeblk(absolute_block + b, GetBlock(id, relative_block + b));
             } else {
-                bc_->Readblk(absolute_block + b, GetBlock(id, relative_block + b));
+                status = bc_->Readblk(absolute_block + b, GetBlock(id, relative_block + b));
+            }
+            if (status_ == NO_ERROR) {
+                status_ = status;
             }
         }
     }
 
-    // Activate the transaction (do nothing)
-    mx_status_t Flush() { return NO_ERROR; }
+    // Activate the transaction. Nothing is buffered; returns the
+    // first error from any request enqueued since the last call.
+    mx_status_t Flush() {
+        mx_status_t status = status_;
+        status_ = NO_ERROR;
+        return status;
+    }
 
 private:
     Bcache* bc_;
+    mx_status_t status_;
 };
 
 using WriteTxn = BlockTxn<const void*, true>;
@@ -0,0 +1,409 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs/trace.h>
+
+#include <mxalloc/new.h>
+#include <mxtl/unique_ptr.h>
+
+#include "minfs.h"
+#include "minfs-private.h"
+#include "misc.h"
+
+namespace minfs {
+
+namespace {
+
+// Orders cache entries by block number, so runs of adjacent blocks can
+// share a device request.
+template <typename Entry>
+void SortByBno(Entry** entries, uint32_t count) {
+    qsort(entries, count, sizeof(entries[0]), [](const void* a, const void* b) {
+        uint32_t abno = (*static_cast<Entry* const*>(a))->bno;
+        uint32_t bbno = (*static_cast<Entry* const*>(b))->bno;
+        return (abno > bbno) - (abno < bbno);
+    });
+}
+
+uint32_t ChecksumAdd(uint32_t checksum, const void* data) {
+    return (checksum ^ fnv1a32(data, kMinfsBlockSize)) * FNV32_PRIME;
+}
+
+#ifdef __Fuchsia__
+// How deeply the calling thread is nested in Bcache operations.
+thread_local uint32_t op_depth = 0;
+#endif
+
+} // namespace
+
+mx_status_t Bcache::WriteJournalInfo(uint64_t seq) {
+    minfs_journal_info_t* info = static_cast<minfs_journal_info_t*>(SlotData(kScratchSlot));
+    memset(info, 0, kMinfsBlockSize);
+    info->magic = kMinfsJournalMagic;
+    info->seq = seq;
+
+    uint32_t slot = kScratchSlot;
+    return DeviceIo(true, &slot, &jnl_start_, 1);
+}
+
+mx_status_t Bcache::Commit() {
+    if (!journal_ || pending_count_ == 0) {
+        return NO_ERROR;
+    }
+    if (jnl_broken_) {
+        return ERR_IO;
+    }
+    MX_DEBUG_ASSERT(pending_count_ <= kMinfsJournalTxnMax);
+
+    // Every commit is written back before it returns, so the journal only
+    // holds earlier transactions if writing them back failed.
+    mx_status_t status;
+    if (jnl_count_ - jnl_head_ < pending_count_ + 1) {
+        error("minfs: no room in the journal for %u blocks\n", pending_count_);
+        return ERR_IO;
+    }
+
+    BlockEntry* pending[kMinfsJournalTxnMax];
+    uint32_t n = 0;
+    for (auto& entry : lru_) {
+        if (entry.pending) {
+            pending[n++] = &entry;
+        }
+    }
+    MX_DEBUG_ASSERT(n == pending_count_);
+    SortByBno(pending, n);
+
+    // The header goes first, followed by the blocks it describes.
+    minfs_journal_header_t* hdr = static_cast<minfs_journal_header_t*>(SlotData(kScratchSlot));
+    memset(hdr, 0, kMinfsBlockSize);
+    hdr->magic = kMinfsJournalMagic;
+    hdr->seq = jnl_seq_;
+    hdr->count = n;
+    hdr->checksum = FNV32_OFFSET_BASIS;
+
+    uint32_t slots[kMinfsJournalTxnMax + 1];
+    uint32_t bnos[kMinfsJournalTxnMax + 1];
+    slots[0] = kScratchSlot;
+    bnos[0] = jnl_start_ + jnl_head_;
+    for (uint32_t i = 0; i < n; i++) {
+        hdr->bno[i] = pending[i]->bno;
+        hdr->checksum = ChecksumAdd(hdr->checksum, SlotData(pending[i]->slot));
+        slots[i + 1] = pending[i]->slot;
+        bnos[i + 1] = jnl_start_ + jnl_head_ + i + 1;
+    }
+
+    trace(IO, "commit() seq=%llu count=%u\n", (unsigned long long) jnl_seq_, n);
+    if ((status = DeviceIo(true, slots, bnos, n + 1)) != NO_ERROR) {
+        error("minfs: cannot commit %u blocks to journal\n", n);
+        return status;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        pending[i]->pending = false;
+    }
+    pending_count_ = 0;
+    jnl_head_ += n + 1;
+    jnl_seq_++;
+
+    // Write the transaction back and retire it right away. Operations write
+    // blocks in place between commits, which a later replay of a
+    // transaction still in the journal could overwrite.
+    return Checkpoint();
+}
+
+mx_status_t Bcache::Checkpoint() {
+    // Only committed blocks may reach their home location; blocks still
+    // pending belong to a transaction which has not been written yet.
+    BlockEntry* dirty[kMinfsBlockCacheSize];
+    uint32_t slots[kMinfsBlockCacheSize];
+    uint32_t bnos[kMinfsBlockCacheSize];
+    uint32_t n = 0;
+    for (auto& entry : lru_) {
+        if (entry.dirty && !entry.pending) {
+            dirty[n++] = &entry;
+        }
+    }
+    SortByBno(dirty, n);
+    for (uint32_t i = 0; i < n; i++) {
+        slots[i] = dirty[i]->slot;
+        bnos[i] = dirty[i]->bno;
+    }
+
+    trace(IO, "checkpoint() count=%u\n", n);
+    mx_status_t status;
+    if ((status = DeviceIo(true, slots, bnos, n)) != NO_ERROR) {
+        error("minfs: cannot write back %u blocks\n", n);
+        return status;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        dirty[i]->dirty = false;
+    }
+    dirty_count_ -= n;
+
+    // Every committed transaction is now home; retire them all. Blocks
+    // which are pending again may still need their committed copies.
+    if (journal_ && jnl_head_ > 1 && pending_count_ == 0) {
+        if ((status = WriteJournalInfo(jnl_seq_)) != NO_ERROR) {
+            return status;
+        }
+        jnl_head_ = 1;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::ReplayJournal(uint32_t start, uint32_t count) {
+#ifdef __Fuchsia__
+    mxtl::AutoLock lock(&lock_);
+#endif
+    MX_DEBUG_ASSERT(!journal_);
+    if ((count < 2) || (start >= blockmax_) || (blockmax_ - start < count)) {
+        return ERR_INVALID_ARGS;
+    }
+    jnl_start_ = start;
+    jnl_count_ = count;
+
+    mx_status_t status;
+    uint32_t slot = kScratchSlot;
+    if ((status = DeviceIo(false, &slot, &start, 1)) != NO_ERROR) {
+        return status;
+    }
+    const minfs_journal_info_t* info =
+        static_cast<const minfs_journal_info_t*>(SlotData(kScratchSlot));
+    if (info->magic != kMinfsJournalMagic) {
+        error("minfs: bad journal magic\n");
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    uint64_t seq = info->seq;
+    uint64_t first_seq = seq;
+
+    uint8_t hdr_data[kMinfsBlockSize];
+    const minfs_journal_header_t* hdr =
+        reinterpret_cast<const minfs_journal_header_t*>(hdr_data);
+    uint32_t pos = 1;
+    while (count - pos >= 2) {
+        if ((status = ReadblkLocked(start + pos, hdr_data)) != NO_ERROR) {
+            return status;
+        }
+        if ((hdr->magic != kMinfsJournalMagic) || (hdr->seq != seq) || (hdr->count == 0) ||
+            (hdr->count > kMinfsJournalMaxBlocks) || (hdr->count > count - pos - 1)) {
+            break;
+        }
+        bool valid = true;
+        for (uint32_t i = 0; i < hdr->count; i++) {
+            uint32_t bno = hdr->bno[i];
+            if ((bno >= blockmax_) || ((bno >= start) && (bno - start < count))) {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid) {
+            break;
+        }
+
+        AllocChecker ac;
+        mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[hdr->count * kMinfsBlockSize]);
+        if (!ac.check()) {
+            return ERR_NO_MEMORY;
+        }
+        uint32_t checksum = FNV32_OFFSET_BASIS;
+        for (uint32_t i = 0; i < hdr->count; i++) {
+            uint8_t* block = data.get() + i * kMinfsBlockSize;
+            if ((status = ReadblkLocked(start + pos + 1 + i, block)) != NO_ERROR) {
+                return status;
+            }
+            checksum = ChecksumAdd(checksum, block);
+        }
+        if (checksum != hdr->checksum) {
+            // A torn commit; nothing after it was ever acknowledged.
+            break;
+        }
+
+        trace(IO, "replay() seq=%llu count=%u\n", (unsigned long long) seq, hdr->count);
+        for (uint32_t i = 0; i < hdr->count; i++) {
+            if ((status = WriteblkLocked(hdr->bno[i], data.get() + i * kMinfsBlockSize)) !=
+                NO_ERROR) {
+                return status;
+            }
+        }
+        pos += hdr->count + 1;
+        seq++;
+    }
+
+    if ((status = WriteBack()) != NO_ERROR) {
+        return status;
+    }
+    Invalidate(start, count);
+    if (seq != first_seq) {
+        info("minfs: replayed %llu journal transactions\n",
+             (unsigned long long) (seq - first_seq));
+        if ((status = WriteJournalInfo(seq)) != NO_ERROR) {
+            return status;
+        }
+    }
+    jnl_seq_ = seq;
+    return NO_ERROR;
+}
+
+#ifdef __Fuchsia__
+mx_status_t Bcache::EnableJournal(uint32_t start, uint32_t count) {
+    mxtl::AutoLock lock(&lock_);
+    if ((count < 2 * (kMinfsJournalTxnMax + 1) + 1) || (start >= blockmax_) ||
+        (blockmax_ - start < count)) {
+        return ERR_INVALID_ARGS;
+    }
+    mx_status_t status;
+    if ((status = mx_event_create(0, &commit_stop_)) != NO_ERROR) {
+        return status;
+    }
+    jnl_start_ = start;
+    jnl_count_ = count;
+    jnl_head_ = 1;
+    journal_ = true;
+
+    if (thrd_create(&commit_thread_, CommitThread, this) != thrd_success) {
+        journal_ = false;
+        return ERR_NO_RESOURCES;
+    }
+    commit_thread_running_ = true;
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Capture(mx_handle_t vmo, uint64_t vmo_offset, uint32_t bno,
+                            uint32_t count) {
+    mx_status_t status;
+    if (jnl_broken_) {
+        return ERR_IO;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        BlockEntry* entry = Lookup(bno + i);
+        if (((entry == nullptr) || !entry->pending) && (pending_count_ >= kMinfsJournalTxnMax)) {
+            // Some operation went past its reservation. Part of it is
+            // already pending, and can never be committed on its own.
+            error("minfs: too many metadata blocks for one transaction\n");
+            jnl_broken_ = true;
+            return ERR_IO;
+        }
+        if ((entry == nullptr) && ((status = Allocate(bno + i, &entry)) != NO_ERROR)) {
+            return status;
+        }
+        size_t actual;
+        status = mx_vmo_read(vmo, SlotData(entry->slot), vmo_offset + i * kMinfsBlockSize,
+                             kMinfsBlockSize, &actual);
+        if (status != NO_ERROR) {
+            return status;
+        } else if (actual != kMinfsBlockSize) {
+            return ERR_IO;
+        }
+        MarkDirty(entry, true);
+    }
+    // The batch is full; let the operations under way finish, then commit.
+    if ((pending_count_ >= kMinfsJournalBatch) && (active_ops_ > 0)) {
+        commit_due_ = true;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Overlay(mx_handle_t vmo, uint64_t vmo_offset, uint32_t bno,
+                            uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        auto iter = hash_.find(bno + i);
+        if (!iter.IsValid() || !iter->pending) {
+            continue;
+        }
+        size_t actual;
+        mx_status_t status = mx_vmo_write(vmo, SlotData(iter->slot),
+                                          vmo_offset + i * kMinfsBlockSize,
+                                          kMinfsBlockSize, &actual);
+        if (status != NO_ERROR) {
+            return status;
+        } else if (actual != kMinfsBlockSize) {
+            return ERR_IO;
+        }
+    }
+    return NO_ERROR;
+}
+
+void Bcache::BeginOp() {
+    if (op_depth++ > 0) {
+        return;
+    }
+    mxtl::AutoLock lock(&lock_);
+    for (;;) {
+        if (!commit_due_ && (jnl_broken_ || (pending_count_ + (active_ops_ + 1) *
+                                             kMinfsJournalOpMax <= kMinfsJournalTxnMax))) {
+            break;
+        }
+        // Close the transaction before this operation could overflow it.
+        commit_due_ = true;
+        if (active_ops_ > 0) {
+            cnd_wait(&op_cond_, lock_.GetInternal());
+            continue;
+        }
+        // Nothing is under way to commit it for us. A failed commit keeps
+        // its blocks pending for the next attempt; let the operation run.
+        mx_status_t status = Commit();
+        commit_due_ = false;
+        cnd_broadcast(&op_cond_);
+        if (status != NO_ERROR) {
+            error("minfs: commit before operation failed: %d\n", status);
+            break;
+        }
+    }
+    active_ops_++;
+}
+
+mx_status_t Bcache::EndOp() {
+    MX_DEBUG_ASSERT(op_depth > 0);
+    if (--op_depth > 0) {
+        return NO_ERROR;
+    }
+    mxtl::AutoLock lock(&lock_);
+    MX_DEBUG_ASSERT(active_ops_ > 0);
+    active_ops_--;
+    if ((pending_count_ >= kMinfsJournalBatch) ||
+        ((pending_count_ > 0) && (mx_time_get(MX_CLOCK_MONOTONIC) >= commit_deadline_))) {
+        commit_due_ = true;
+    }
+    if ((active_ops_ > 0) || !commit_due_) {
+        return NO_ERROR;
+    }
+    // No operation is under way and none can start, so the pending blocks
+    // hold only whole operations.
+    mx_status_t status = Commit();
+    commit_due_ = false;
+    cnd_broadcast(&op_cond_);
+    return status;
+}
+
+mx_status_t Bcache::CommitBetweenOps() {
+    MX_DEBUG_ASSERT(op_depth == 0);
+    while (active_ops_ > 0) {
+        commit_due_ = true;
+        cnd_wait(&op_cond_, lock_.GetInternal());
+    }
+    mx_status_t status = Commit();
+    if (commit_due_) {
+        commit_due_ = false;
+        cnd_broadcast(&op_cond_);
+    }
+    return status;
+}
+
+int Bcache::CommitThread(void* arg) {
+    Bcache* bc = static_cast<Bcache*>(arg);
+    while (mx_object_wait_one(bc->commit_stop_, MX_EVENT_SIGNALED,
+                              mx_deadline_after(kMinfsCommitInterval), nullptr) == ERR_TIMED_OUT) {
+        mxtl::AutoLock lock(&bc->lock_);
+        if ((bc->pending_count_ > 0) &&
+            (mx_time_get(MX_CLOCK_MONOTONIC) >= bc->commit_deadline_)) {
+            bc->CommitBetweenOps();
+        }
+    }
+    return 0;
+}
+#endif
+
+} // namespace minfs
@@ -385,7 +385,17 @@ found:
 
     for (unsigned i = 0; i < countof(CMDS); i++) {
         if (!strcmp(cmd, CMDS[i].name)) {
-            return CMDS[i].func(mxtl::move(bc), argc - 3, argv + 3);
+            int r = CMDS[i].func(mxtl::move(bc), argc - 3, argv + 3);
+#ifndef __Fuchsia__
+            // The emulated mount is never torn down; write back any blocks
+            // still held by the block cache before exiting.
+            if ((fake_root != nullptr) &&
+                (static_cast<fs::Vnode*>(fake_root.get())->Sync() != NO_ERROR)) {
+                fprintf(stderr, "minfs: failed to sync image\n");
+                return -1;
+            }
+#endif
+            return r;
         }
     }
     return -1;
@@ -107,8 +107,11 @@ mx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, uint32_t ino,
                     minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(data);
                     de->reclen |= kMinfsReclenLast;
                     WriteTxn txn(fs_->bc_.get());
-                    vn->WriteInternal(&txn, data, MINFS_DIRENT_SIZE, prev_off, &actual);
-                    return NO_ERROR;
+                    status = vn->WriteInternal(&txn, data, MINFS_DIRENT_SIZE, prev_off, &actual);
+                    if (status != NO_ERROR) {
+                        return status;
+                    }
+                    return txn.Flush();
                 } else {
                     return ERR_IO;
                 }
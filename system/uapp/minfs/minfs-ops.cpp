@@ -80,12 +80,6 @@ void VnodeMinfs::InodeSync(WriteTxn* txn, uint32_t flags) {
 // Delete all blocks (relative to a file) from "start" (inclusive) to the end of
 // the file. Does not update mtime/atime.
 mx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, uint32_t start) {
-#ifdef __Fuchsia__
-    auto bbm_id = fs_->block_map_vmoid_;
-#else
-    auto bbm_id = fs_->block_map_.StorageUnsafe()->GetData();
-#endif
-
     bool doSync = false;
 
     // release direct blocks
@@ -95,9 +89,7 @@ mx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, uint32_t start) {
         }
         fs_->ValidateBno(inode_.dnum[bno]);
 
-        fs_->block_map_.Clear(inode_.dnum[bno], inode_.dnum[bno] + 1);
-        uint32_t bitblock = inode_.dnum[bno] / kMinfsBlockBits;
-        txn->Enqueue(bbm_id, bitblock, fs_->info_.abm_block + bitblock, 1);
+        fs_->BlockFree(txn, inode_.dnum[bno]);
         inode_.dnum[bno] = 0;
         inode_.block_count--;
         doSync = true;
@@ -141,9 +133,7 @@ mx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, uint32_t start) {
                 continue;
             }
 
-            fs_->block_map_.Clear(entry[direct], entry[direct] + 1);
-            uint32_t bitblock = entry[direct] / kMinfsBlockBits;
-            txn->Enqueue(bbm_id, bitblock, fs_->info_.abm_block + bitblock, 1);
+            fs_->BlockFree(txn, entry[direct]);
             entry[direct] = 0;
             dirty = true;
             inode_.block_count--;
@@ -160,9 +150,7 @@ mx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, uint32_t start) {
 
         if (delete_indirect)  {
             // release the direct block itself
-            fs_->block_map_.Clear(inode_.inum[indirect], inode_.inum[indirect] + 1);
-            uint32_t bitblock = inode_.inum[indirect] / kMinfsBlockBits;
-            txn->Enqueue(bbm_id, bitblock, fs_->info_.abm_block + bitblock, 1);
+            fs_->BlockFree(txn, inode_.inum[indirect]);
             inode_.inum[indirect] = 0;
             inode_.block_count--;
             doSync = true;
@@ -187,8 +175,8 @@ mx_status_t VnodeMinfs::InitIndirectVmo() {
     if ((status = MappedVmo::Create(size, &vmo_indirect_)) != NO_ERROR) {
         return status;
     }
-    if ((status = fs_->bc_->AttachVmo(vmo_indirect_->GetVmo(),
-                                      &vmoid_indirect_)) != NO_ERROR) {
+    if ((status = fs_->bc_->AttachMetadataVmo(vmo_indirect_->GetVmo(),
+                                              &vmoid_indirect_)) != NO_ERROR) {
         vmo_indirect_ = nullptr;
         return status;
     }
@@ -223,7 +211,14 @@ mx_status_t VnodeMinfs::InitVmo() {
         return status;
     }
 
-    if ((status = fs_->bc_->AttachVmo(vmo_.get(), &vmoid_)) != NO_ERROR) {
+    // Directory contents are metadata, and are journaled with the inodes
+    // and bitmaps which refer to them; file contents are not.
+    if (IsDirectory()) {
+        status = fs_->bc_->AttachMetadataVmo(vmo_.get(), &vmoid_);
+    } else {
+        status = fs_->bc_->AttachVmo(vmo_.get(), &vmoid_);
+    }
+    if (status != NO_ERROR) {
         vmo_.reset();
         return status;
     }
@@ -763,6 +758,13 @@ VnodeMinfs::~VnodeMinfs() {
         request.opcode = BLOCKIO_CLOSE_VMO;
         fs_->bc_->Txn(&request, 1);
     }
+    if (vmo_indirect_ != nullptr) {
+        block_fifo_request_t request;
+        request.txnid = fs_->bc_->TxnId();
+        request.vmoid = vmoid_indirect_;
+        request.opcode = BLOCKIO_CLOSE_VMO;
+        fs_->bc_->Txn(&request, 1);
+    }
 #endif
 }
 
@@ -857,6 +859,9 @@ ssize_t VnodeMinfs::Write(const void* data, size_t len, size_t off) {
     if (actual != 0) {
         InodeSync(&txn, kMxFsSyncMtime);  // Successful writes updates mtime
     }
+    if ((status = txn.Flush()) != NO_ERROR) {
+        return status;
+    }
     return actual;
 }
 
@@ -1015,6 +1020,7 @@ mx_status_t VnodeMinfs::Setattr(vnattr_t* a) {
         // write to disk, but don't overwrite the time
         WriteTxn txn(fs_->bc_.get());
         InodeSync(&txn, kMxFsSyncDefault);
+        return txn.Flush();
     }
     return NO_ERROR;
 }
@@ -1178,6 +1184,9 @@ mx_status_t VnodeMinfs::Create(mxtl::RefPtr<fs::Vnode>* out, const char* name, s
     if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
         return status;
     }
+    if ((status = txn.Flush()) != NO_ERROR) {
+        return status;
+    }
 
     *out = mxtl::move(vn);
     return NO_ERROR;
@@ -1228,7 +1237,11 @@ mx_status_t VnodeMinfs::Unlink(const char* name, size_t len, bool must_be_dir) {
     args.len = len;
     args.type = must_be_dir ? kMinfsTypeDir : 0;
     args.txn = &txn;
-    return ForEachDirent(&args, cb_dir_unlink);
+    mx_status_t status = ForEachDirent(&args, cb_dir_unlink);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    return txn.Flush();
 }
 
 mx_status_t VnodeMinfs::Truncate(size_t len) {
@@ -1241,6 +1254,7 @@ mx_status_t VnodeMinfs::Truncate(size_t len) {
     if (status == NO_ERROR) {
         // Successful truncates update inode
         InodeSync(&txn, kMxFsSyncMtime);
+        status = txn.Flush();
     }
     return status;
 }
@@ -1430,7 +1444,10 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
     // finally, remove oldname from its original position
     args.name = oldname;
     args.len = oldlen;
-    return ForEachDirent(&args, cb_dir_force_unlink);
+    if ((status = ForEachDirent(&args, cb_dir_force_unlink)) != NO_ERROR) {
+        return status;
+    }
+    return txn.Flush();
 }
 
 mx_status_t VnodeMinfs::Link(const char* name, size_t len, mxtl::RefPtr<fs::Vnode> _target) {
@@ -1477,7 +1494,7 @@ mx_status_t VnodeMinfs::Link(const char* name, size_t len, mxtl::RefPtr<fs::Vnod
     target->inode_.link_count++;
     target->InodeSync(&txn, kMxFsSyncDefault);
 
-    return NO_ERROR;
+    return txn.Flush();
 }
 
 mx_status_t VnodeMinfs::Sync() {
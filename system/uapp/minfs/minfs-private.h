@@ -7,6 +7,8 @@
 #ifdef __Fuchsia__
 #include <fs/dispatcher.h>
 #include <mx/vmo.h>
+#include <mxtl/auto_lock.h>
+#include <mxtl/mutex.h>
 #endif
 
 #include <mxtl/algorithm.h>
@@ -41,8 +43,6 @@ constexpr uint32_t kMxFsSyncDefault = 0; // default: no implicit time update
 constexpr uint32_t kMxFsSyncMtime = (1 << 0);
 constexpr uint32_t kMxFsSyncCtime = (1 << 1);
 
-constexpr uint32_t kMinfsBlockCacheSize = 64;
-
 // Used by fsck
 class MinfsChecker;
 
@@ -70,6 +70,9 @@ public:
     // Allocate a new data block.
     mx_status_t BlockNew(WriteTxn* txn, uint32_t hint, uint32_t* out_bno);
 
+    // Release a data block in the block bitmap.
+    void BlockFree(WriteTxn* txn, uint32_t bno);
+
     // free ino in inode bitmap, release all blocks held by inode
     mx_status_t InoFree(
 #ifdef __Fuchsia__
@@ -108,6 +111,12 @@ private:
 
 #ifdef __Fuchsia__
     mxtl::unique_ptr<fs::Dispatcher> dispatcher_;
+
+    // Requests for different vnodes are served concurrently, so the state
+    // they share is guarded here: |alloc_lock_| covers both allocation
+    // bitmaps, |hash_lock_| covers |vnode_hash_|.
+    mxtl::Mutex alloc_lock_;
+    mxtl::Mutex hash_lock_;
 #endif
     uint32_t abmblks_;
     uint32_t ibmblks_;
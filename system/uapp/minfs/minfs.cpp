@@ -29,6 +29,7 @@ void minfs_dump_info(const minfs_info_t* info) {
     trace(MINFS, "minfs: inode bitmap @ %10u\n", info->ibm_block);
     trace(MINFS, "minfs: alloc bitmap @ %10u\n", info->abm_block);
     trace(MINFS, "minfs: inode table  @ %10u\n", info->ino_block);
+    trace(MINFS, "minfs: journal      @ %10u (size %u)\n", info->jnl_block, info->jnl_count);
     trace(MINFS, "minfs: data blocks  @ %10u\n", info->dat_block);
 }
 
@@ -59,6 +60,11 @@ mx_status_t minfs_check_info(const minfs_info_t* info, uint32_t max) {
         error("minfs: too large for device\n");
         return ERR_INVALID_ARGS;
     }
+    if ((info->jnl_block < info->ino_block) || (info->jnl_count < 2) ||
+        (info->dat_block - info->jnl_block < info->jnl_count)) {
+        error("minfs: bad journal region %u (size %u)\n", info->jnl_block, info->jnl_count);
+        return ERR_INVALID_ARGS;
+    }
     //TODO: validate layout
     return 0;
 }
@@ -102,14 +108,17 @@ mx_status_t Minfs::InoFree(
     WriteTxn txn(bc_.get());
 #ifdef __Fuchsia__
     auto ibm_id = inode_map_vmoid_;
-    auto bbm_id = block_map_vmoid_;
 #else
     auto ibm_id = inode_map_.StorageUnsafe()->GetData();
-    auto bbm_id = block_map_.StorageUnsafe()->GetData();
 #endif
 
     // Free the inode bit itself
-    inode_map_.Clear(ino, ino + 1);
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&alloc_lock_);
+#endif
+        inode_map_.Clear(ino, ino + 1);
+    }
     uint32_t bitblock = ino / kMinfsBlockBits;
     txn.Enqueue(ibm_id, bitblock, info_.ibm_block + bitblock, 1);
     uint32_t block_count = inode.block_count;
@@ -121,9 +130,7 @@ mx_status_t Minfs::InoFree(
         }
         ValidateBno(inode.dnum[n]);
         block_count--;
-        block_map_.Clear(inode.dnum[n], inode.dnum[n] + 1);
-        uint32_t bitblock = inode.dnum[n] / kMinfsBlockBits;
-        txn.Enqueue(bbm_id, bitblock, info_.abm_block + bitblock, 1);
+        BlockFree(&txn, inode.dnum[n]);
     }
 
     // release all indirect blocks
@@ -145,29 +152,30 @@ mx_status_t Minfs::InoFree(
                 continue;
             }
             block_count--;
-            block_map_.Clear(entry[m], entry[m] + 1);
-            uint32_t bitblock = entry[m] / kMinfsBlockBits;
-            txn.Enqueue(bbm_id, bitblock, info_.abm_block + bitblock, 1);
+            BlockFree(&txn, entry[m]);
         }
         // release the direct block itself
         block_count--;
-        block_map_.Clear(inode.inum[n], inode.inum[n] + 1);
-        uint32_t bitblock = inode.inum[n] / kMinfsBlockBits;
-        txn.Enqueue(bbm_id, bitblock, info_.abm_block + bitblock, 1);
+        BlockFree(&txn, inode.inum[n]);
     }
 
     MX_DEBUG_ASSERT(block_count == 0);
-    return NO_ERROR;
+    return txn.Flush();
 }
 
 mx_status_t Minfs::InoNew(WriteTxn* txn, const minfs_inode_t* inode, uint32_t* ino_out) {
     size_t bitoff_start;
-    mx_status_t status = inode_map_.Find(false, 0, inode_map_.size(), 1, &bitoff_start);
-    if (status != NO_ERROR) {
-        return status;
+    mx_status_t status;
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&alloc_lock_);
+#endif
+        if ((status = inode_map_.Find(false, 0, inode_map_.size(), 1, &bitoff_start)) != NO_ERROR) {
+            return status;
+        }
+        status = inode_map_.Set(bitoff_start, bitoff_start + 1);
+        assert(status == NO_ERROR);
     }
-    status = inode_map_.Set(bitoff_start, bitoff_start + 1);
-    assert(status == NO_ERROR);
     uint32_t ino = static_cast<uint32_t>(bitoff_start);
 
     // locate data and block offset of bitmap
@@ -182,6 +190,9 @@ mx_status_t Minfs::InoNew(WriteTxn* txn, const minfs_inode_t* inode, uint32_t* i
 
     // Write the inode back
     if ((status = InodeSync(txn, ino, inode)) != NO_ERROR) {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&alloc_lock_);
+#endif
         inode_map_.Clear(ino, ino + 1);
         return status;
     }
@@ -216,13 +227,21 @@ mx_status_t Minfs::VnodeNew(WriteTxn* txn, mxtl::RefPtr<VnodeMinfs>* out, uint32
         return status;
     }
 
-    vnode_hash_.insert(vn.get());
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&hash_lock_);
+#endif
+        vnode_hash_.insert(vn.get());
+    }
 
     *out = mxtl::move(vn);
     return 0;
 }
 
 void Minfs::VnodeRelease(VnodeMinfs* vn) {
+#ifdef __Fuchsia__
+    mxtl::AutoLock lock(&hash_lock_);
+#endif
     vnode_hash_.erase(*vn);
 }
 
@@ -230,7 +249,16 @@ mx_status_t Minfs::VnodeGet(mxtl::RefPtr<VnodeMinfs>* out, uint32_t ino) {
     if ((ino < 1) || (ino >= info_.inode_count)) {
         return ERR_OUT_OF_RANGE;
     }
-    mxtl::RefPtr<VnodeMinfs> vn = mxtl::RefPtr<VnodeMinfs>(vnode_hash_.find(ino).CopyPointer());
+    // Lookups only happen while the VFS holds the namespace lock exclusively,
+    // and the last reference to a vnode is only ever dropped under that same
+    // lock, so a vnode found here is never in the middle of being destroyed.
+    mxtl::RefPtr<VnodeMinfs> vn;
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&hash_lock_);
+#endif
+        vn = mxtl::RefPtr<VnodeMinfs>(vnode_hash_.find(ino).CopyPointer());
+    }
     if (vn != nullptr) {
         *out = mxtl::move(vn);
         return NO_ERROR;
@@ -251,7 +279,12 @@ mx_status_t Minfs::VnodeGet(mxtl::RefPtr<VnodeMinfs>* out, uint32_t ino) {
 #endif
     memcpy(&vn->inode_, (void*)((uintptr_t)inodata + off_of_ino), kMinfsInodeSize);
     vn->ino_ = ino;
-    vnode_hash_.insert(vn.get());
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&hash_lock_);
+#endif
+        vnode_hash_.insert(vn.get());
+    }
 
     *out = mxtl::move(vn);
     return NO_ERROR;
@@ -264,14 +297,20 @@ mx_status_t Minfs::VnodeGet(mxtl::RefPtr<VnodeMinfs>* out, uint32_t ino) {
 mx_status_t Minfs::BlockNew(WriteTxn* txn, uint32_t hint, uint32_t* out_bno) {
     size_t bitoff_start;
     mx_status_t status;
-    if ((status = block_map_.Find(false, hint, block_map_.size(), 1, &bitoff_start)) != NO_ERROR) {
-        if ((status = block_map_.Find(false, 0, hint, 1, &bitoff_start)) != NO_ERROR) {
-            return ERR_NO_SPACE;
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&alloc_lock_);
+#endif
+        if ((status = block_map_.Find(false, hint, block_map_.size(), 1,
+                                      &bitoff_start)) != NO_ERROR) {
+            if ((status = block_map_.Find(false, 0, hint, 1, &bitoff_start)) != NO_ERROR) {
+                return ERR_NO_SPACE;
+            }
         }
-    }
 
-    status = block_map_.Set(bitoff_start, bitoff_start + 1);
-    assert(status == NO_ERROR);
+        status = block_map_.Set(bitoff_start, bitoff_start + 1);
+        assert(status == NO_ERROR);
+    }
     uint32_t bno = static_cast<uint32_t>(bitoff_start);
     ValidateBno(bno);
 
@@ -291,6 +330,22 @@ mx_status_t Minfs::BlockNew(WriteTxn* txn, uint32_t hint, uint32_t* out_bno) {
     return NO_ERROR;
 }
 
+void Minfs::BlockFree(WriteTxn* txn, uint32_t bno) {
+    {
+#ifdef __Fuchsia__
+        mxtl::AutoLock lock(&alloc_lock_);
+#endif
+        block_map_.Clear(bno, bno + 1);
+    }
+    uint32_t bitblock = bno / kMinfsBlockBits;
+#ifdef __Fuchsia__
+    txn->Enqueue(block_map_vmoid_, bitblock, info_.abm_block + bitblock, 1);
+#else
+    txn->Enqueue(block_map_.StorageUnsafe()->GetData(), bitblock,
+                 info_.abm_block + bitblock, 1);
+#endif
+}
+
 void minfs_dir_init(void* bdata, uint32_t ino_self, uint32_t ino_parent) {
 #define DE0_SIZE DirentSize(1)
 
@@ -356,13 +411,19 @@ mx_status_t Minfs::Create(Minfs** out, mxtl::unique_ptr<Bcache> bc, const minfs_
         return status;
     }
 
+    // Bring metadata up to date before anything reads it.
+    if ((status = fs->bc_->ReplayJournal(fs->info_.jnl_block, fs->info_.jnl_count)) != NO_ERROR) {
+        error("minfs: cannot replay journal\n");
+        return status;
+    }
+
 #ifdef __Fuchsia__
-    if ((status = fs->bc_->AttachVmo(fs->block_map_.StorageUnsafe()->GetVmo(),
-                                     &fs->block_map_vmoid_)) != NO_ERROR) {
+    if ((status = fs->bc_->AttachMetadataVmo(fs->block_map_.StorageUnsafe()->GetVmo(),
+                                             &fs->block_map_vmoid_)) != NO_ERROR) {
         return status;
     }
-    if ((status = fs->bc_->AttachVmo(fs->inode_map_.StorageUnsafe()->GetVmo(),
-                                     &fs->inode_map_vmoid_)) != NO_ERROR) {
+    if ((status = fs->bc_->AttachMetadataVmo(fs->inode_map_.StorageUnsafe()->GetVmo(),
+                                             &fs->inode_map_vmoid_)) != NO_ERROR) {
         return status;
     }
 
@@ -373,8 +434,8 @@ mx_status_t Minfs::Create(Minfs** out, mxtl::unique_ptr<Bcache> bc, const minfs_
         return status;
     }
 
-    if ((status = fs->bc_->AttachVmo(fs->inode_table_->GetVmo(),
-                                     &fs->inode_table_vmoid_)) != NO_ERROR) {
+    if ((status = fs->bc_->AttachMetadataVmo(fs->inode_table_->GetVmo(),
+                                             &fs->inode_table_vmoid_)) != NO_ERROR) {
         return status;
     }
 
@@ -386,6 +447,9 @@ mx_status_t Minfs::Create(Minfs** out, mxtl::unique_ptr<Bcache> bc, const minfs_
         return status;
     }
 
+    if ((status = fs->bc_->EnableJournal(fs->info_.jnl_block, fs->info_.jnl_count)) != NO_ERROR) {
+        return status;
+    }
 #else
     for (uint32_t n = 0; n < fs->abmblks_; n++) {
         void* bmdata = GetBlock<const RawBitmap&>(fs->block_map_, n);
@@ -476,11 +540,14 @@ int minfs_mkfs(mxtl::unique_ptr<Bcache> bc) {
     //  - Inode bitmap
     //  - Block bitmap
     //  - Inode table
+    //  - Journal
     // To an 8-block boundary on disk, allowing for future expansion.
     info.ibm_block = 8;
     info.abm_block = info.ibm_block + mxtl::roundup(ibmblks, 8u);
     info.ino_block = info.abm_block + mxtl::roundup(abmblks, 8u);
-    info.dat_block = info.ino_block + inoblks;
+    info.jnl_block = info.ino_block + mxtl::roundup(inoblks, 8u);
+    info.jnl_count = kMinfsJournalBlocks;
+    info.dat_block = info.jnl_block + info.jnl_count;
     minfs_dump_info(&info);
 
     RawBitmap abm;
@@ -552,6 +619,15 @@ int minfs_mkfs(mxtl::unique_ptr<Bcache> bc) {
     ino[kMinfsRootIno].dnum[0] = info.dat_block;
     bc->Writeblk(info.ino_block, blk);
 
+    // setup an empty journal; the first header slot is zeroed so a
+    // stale transaction from an earlier filesystem cannot be replayed
+    memset(blk, 0, sizeof(blk));
+    bc->Writeblk(info.jnl_block + 1, blk);
+    minfs_journal_info_t* jinfo = reinterpret_cast<minfs_journal_info_t*>(&blk[0]);
+    jinfo->magic = kMinfsJournalMagic;
+    jinfo->seq = 0;
+    bc->Writeblk(info.jnl_block, blk);
+
     memset(blk, 0, sizeof(blk));
     memcpy(blk, &info, sizeof(info));
     bc->Writeblk(0, blk);
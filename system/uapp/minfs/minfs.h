@@ -13,6 +13,7 @@
 #include <mxtl/ref_ptr.h>
 #include <mxtl/type_support.h>
 #include <mxtl/unique_free_ptr.h>
+#include <mxtl/unique_ptr.h>
 
 #include <magenta/types.h>
 
@@ -25,6 +26,10 @@
 
 #ifdef __Fuchsia__
 #include <block-client/client.h>
+#include <fs/mapped-vmo.h>
+#include <mxtl/auto_lock.h>
+#include <mxtl/mutex.h>
+#include <threads.h>
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::VmoStorage>;
 #else
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::DefaultStorage>;
@@ -36,7 +41,7 @@ namespace minfs {
 
 constexpr uint64_t kMinfsMagic0 = (0x002153466e694d21ULL);
 constexpr uint64_t kMinfsMagic1 = (0x385000d3d3d3d304ULL);
-constexpr uint32_t kMinfsVersion = 0x00000002;
+constexpr uint32_t kMinfsVersion = 0x00000003;
 
 constexpr uint32_t kMinfsRootIno        = 1;
 constexpr uint32_t kMinfsFlagClean      = 1;
@@ -74,10 +79,12 @@ typedef struct {
     uint32_t abm_block;     // first blockno of block allocation bitmap
     uint32_t ino_block;     // first blockno of inode table
     uint32_t dat_block;     // first blockno available for file data
+    uint32_t jnl_block;     // first blockno of metadata journal
+    uint32_t jnl_count;     // number of blocks in metadata journal
 } minfs_info_t;
 
 // Notes:
-// - the ibm, abm, ino, and dat regions must be in that order
+// - the ibm, abm, ino, jnl, and dat regions must be in that order
 //   and may not overlap
 // - the abm has an entry for every block on the volume, including
 //   the info block (0), the bitmaps, etc
@@ -108,6 +115,40 @@ typedef struct {
 static_assert(sizeof(minfs_inode_t) == kMinfsInodeSize,
               "minfs inode size is wrong");
 
+// Metadata journal
+//
+// The first block of the journal region holds a minfs_journal_info_t. It is
+// followed by a sequence of transactions, each one header block naming the
+// home locations of the |count| metadata blocks copied right after it.
+
+constexpr uint64_t kMinfsJournalMagic = (0x6c6e724a73666e4dULL);
+constexpr uint32_t kMinfsJournalBlocks = 256;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;           // sequence number of the first live transaction
+} minfs_journal_info_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;
+    uint32_t count;         // number of blocks in the transaction
+    uint32_t checksum;      // fnv1a over the transaction's blocks
+    uint32_t bno[];         // home block numbers
+} minfs_journal_header_t;
+
+constexpr uint32_t kMinfsJournalMaxBlocks =
+    (kMinfsBlockSize - sizeof(minfs_journal_header_t)) / sizeof(uint32_t);
+
+// Notes:
+// - a transaction is live if its header immediately follows the previous
+//   live transaction (or the info block), its seq is one more than the
+//   previous one (or equal to the info block's seq), and its checksum
+//   matches; replay stops at the first transaction which is not
+// - once every live transaction has been written to its home location,
+//   the info block's seq is advanced past them and the journal restarts
+//   just after the info block
+
 typedef struct {
     uint32_t ino;                   // inode number
     uint32_t reclen;                // Low 28 bits: Length of record
@@ -159,9 +200,36 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 //  4GB ->  512K blocks ->  64K bitmap (8K qword)
 // 32GB -> 4096K blocks -> 512K bitmap (64K qwords)
 
-// Block Cache (bcache.c)
+// Block Cache (bcache.cpp)
 constexpr uint32_t kMinfsHashBits = (8);
 
+// Number of blocks held by the block cache, and the most blocks a single
+// sequential readahead will pull in.
+constexpr uint32_t kMinfsBlockCacheSize = 256;
+constexpr uint32_t kMinfsReadaheadMax   = 32;
+
+// Dirty blocks are written back once this many have accumulated.
+constexpr uint32_t kMinfsDirtyMax = kMinfsBlockCacheSize / 2;
+
+// Journaled blocks are committed once this many are pending, or once the
+// oldest has waited kMinfsCommitInterval. Commits only happen between
+// operations, so a transaction may grow past the batch while the operations
+// already under way finish, but never past kMinfsJournalTxnMax blocks: each
+// operation reserves room for kMinfsJournalOpMax blocks when it begins.
+constexpr uint32_t kMinfsJournalBatch = 64;
+constexpr uint32_t kMinfsJournalTxnMax = kMinfsJournalBatch + kMinfsJournalBatch / 2;
+constexpr uint32_t kMinfsJournalOpMax = 32;
+constexpr mx_duration_t kMinfsCommitInterval = MX_MSEC(100);
+
+static_assert(kMinfsJournalTxnMax <= kMinfsJournalMaxBlocks,
+              "Journal transaction does not fit in a transaction header");
+static_assert(kMinfsJournalBlocks >= 2 * (kMinfsJournalTxnMax + 1) + 1,
+              "Journal cannot hold two full transactions");
+static_assert(kMinfsJournalTxnMax < kMinfsDirtyMax,
+              "Pending blocks could fill the block cache");
+static_assert(kMinfsJournalOpMax <= kMinfsJournalTxnMax,
+              "An operation does not fit in a journal transaction");
+
 class Bcache {
 public:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Bcache);
@@ -169,34 +237,182 @@ public:
 
     static mx_status_t Create(mxtl::unique_ptr<Bcache>* out, int fd, uint32_t blockmax);
 
-    // Raw block read functions.
-    // These do not track blocks (or attempt to access the block cache)
+    // Cached block access.
+    // Reads are served from the block cache when possible, and a run of
+    // sequential misses grows a readahead window. Writes are held in the
+    // cache until Sync(), eviction, or too many blocks become dirty.
     mx_status_t Readblk(uint32_t bno, void* data);
     mx_status_t Writeblk(uint32_t bno, const void* data);
 
     uint32_t Maxblk() const { return blockmax_; };
 
+    // Writes every live transaction in the journal occupying |count| blocks
+    // at |start| to its home location, then empties the journal.
+    mx_status_t ReplayJournal(uint32_t start, uint32_t count);
+
 #ifdef __Fuchsia__
     mx_status_t AttachVmo(mx_handle_t vmo, vmoid_t* out);
-    mx_status_t Txn(block_fifo_request_t* requests, size_t count) {
-        return block_fifo_txn(fifo_client_, requests, count);
-    }
+    // Like AttachVmo, but writes from |vmo| hold metadata and are
+    // journaled once EnableJournal has been called.
+    mx_status_t AttachMetadataVmo(mx_handle_t vmo, vmoid_t* out);
+
+    // Starts journaling metadata writes into the (replayed) journal
+    // occupying |count| blocks at |start|.
+    mx_status_t EnableJournal(uint32_t start, uint32_t count);
+
+    // Issues FIFO requests against the block device. Requests which do not
+    // target the cache's own VMO are kept coherent with the block cache:
+    // cached copies of written blocks are dropped, and committed copies of
+    // read blocks are written back first. Writes from metadata VMOs are
+    // copied into the cache and journaled instead, and reads into metadata
+    // VMOs see the copies which have not been committed yet.
+    mx_status_t Txn(block_fifo_request_t* requests, size_t count);
     txnid_t TxnId() const { return txnid_; }
+
+    // Bracket an operation which updates metadata. Journal transactions
+    // only close between operations: once a commit is due, BeginOp waits
+    // until it has happened, and the last EndOp of the operations already
+    // under way performs it. BeginOp also makes a commit due when the
+    // transaction lacks room for another kMinfsJournalOpMax blocks.
+    // Operations on the same thread nest.
+    void BeginOp();
+    mx_status_t EndOp();
 #endif
 
+    // Makes all writes durable: commits the journal if there is one, or
+    // writes back every dirty block if not, then flushes the device. Waits
+    // for the operations under way to finish, so it must not be called
+    // from within one.
     int Sync();
 
     ~Bcache();
 
 private:
+    struct BlockEntry : public mxtl::SinglyLinkedListable<BlockEntry*>,
+                        public mxtl::DoublyLinkedListable<BlockEntry*> {
+        uint32_t GetKey() const { return bno; }
+        static size_t GetHash(uint32_t key) { return fnv1a_tiny(key, kMinfsHashBits); }
+
+        uint32_t bno;   // Block number, valid only while in the hash table
+        uint32_t slot;  // Index of this entry's buffer within the cache
+        bool cached;    // Present in the hash table
+        bool dirty;     // Modified since it was last written back
+        bool pending;   // Modified since it was last committed to the journal
+    };
+
+    using BlockHash = mxtl::HashTable<uint32_t, BlockEntry*,
+                                      mxtl::SinglyLinkedList<BlockEntry*>,
+                                      size_t, 1 << kMinfsHashBits>;
+
+#ifdef __Fuchsia__
+    struct MetadataVmo : public mxtl::SinglyLinkedListable<mxtl::unique_ptr<MetadataVmo>> {
+        MetadataVmo(vmoid_t id, mx_handle_t vmo) : vmoid(id), vmo(vmo) {}
+        ~MetadataVmo() { mx_handle_close(vmo); }
+
+        vmoid_t GetKey() const { return vmoid; }
+        static size_t GetHash(vmoid_t key) { return key; }
+
+        vmoid_t vmoid;
+        mx_handle_t vmo;
+    };
+
+    using MetadataVmoHash = mxtl::HashTable<vmoid_t, mxtl::unique_ptr<MetadataVmo>>;
+#endif
+
+    // The slot past the last cache entry holds journal info and header
+    // blocks while they are being read or written.
+    static constexpr uint32_t kScratchSlot = kMinfsBlockCacheSize;
+
     Bcache(int fd, uint32_t blockmax);
 
+    mx_status_t ReadblkLocked(uint32_t bno, void* data);
+    mx_status_t WriteblkLocked(uint32_t bno, const void* data);
+
+    void* SlotData(uint32_t slot) const;
+    BlockEntry* Lookup(uint32_t bno);
+    bool HasDirty(uint32_t bno, uint32_t count);
+    // Marks |entry| dirty and, if |journaled|, pending for the next commit.
+    void MarkDirty(BlockEntry* entry, bool journaled);
+
+    // Takes the least recently used entry which is not pending for |bno|,
+    // writing back committed blocks first if that entry holds one.
+    mx_status_t Allocate(uint32_t bno, BlockEntry** out);
+    // Removes |bno| .. |bno + count| from the cache, discarding dirty data.
+    void Invalidate(uint32_t bno, uint32_t count);
+    // Reads up to |count| uncached blocks starting at |bno| into the cache.
+    mx_status_t Fill(uint32_t bno, uint32_t count);
+    // Transfers cache slot |slots[i]| to or from block |bnos[i]|, combining
+    // adjacent blocks into as few device requests as possible.
+    mx_status_t DeviceIo(bool write, const uint32_t* slots, const uint32_t* bnos,
+                         uint32_t count);
+
+    // Commits pending blocks to the journal, then writes every dirty block
+    // back to its home location. Only safe between operations.
+    mx_status_t WriteBack();
+    // Journal internals (journal.cpp).
+    // Commit must only be called between operations; Checkpoint writes
+    // back committed blocks only, and may be called at any time.
+    mx_status_t Commit();
+    mx_status_t Checkpoint();
+    mx_status_t WriteJournalInfo(uint64_t seq);
+
 #ifdef __Fuchsia__
+    mx_status_t DeviceTxn(block_fifo_request_t* requests, size_t count) {
+        return block_fifo_txn(fifo_client_, requests, count);
+    }
+    mx_status_t Capture(mx_handle_t vmo, uint64_t vmo_offset, uint32_t bno,
+                        uint32_t count);
+    // Copies the pending blocks among |count| at |bno| into |vmo|.
+    mx_status_t Overlay(mx_handle_t vmo, uint64_t vmo_offset, uint32_t bno,
+                        uint32_t count);
+    // Commits once no operation is under way, holding new ones out until then.
+    mx_status_t CommitBetweenOps();
+    static int CommitThread(void* arg);
+
+    mxtl::Mutex lock_;
     fifo_client_t* fifo_client_; // Fast path to interact with block device
     txnid_t txnid_; // TODO(smklein): One per thread
+    mxtl::unique_ptr<MappedVmo> cache_vmo_;
+    vmoid_t cache_vmoid_;
+    MetadataVmoHash metadata_vmos_;
+
+    thrd_t commit_thread_;
+    bool commit_thread_running_;
+    mx_handle_t commit_stop_;   // Event signaled to stop the commit thread
+    mx_time_t commit_deadline_;
+
+    cnd_t op_cond_;             // Signaled when |commit_due_| is cleared
+    uint32_t active_ops_;       // Outermost operations under way
+    bool commit_due_;           // Hold new operations out until a commit
+#else
+    mxtl::unique_ptr<uint8_t[]> cache_data_;
 #endif
     int fd_;
     uint32_t blockmax_;
+
+    mxtl::unique_ptr<BlockEntry[]> entries_;
+    BlockHash hash_;
+    // Most recently used entries are at the front. Unused entries sit at the
+    // back, so they are handed out before any cached block is evicted.
+    mxtl::DoublyLinkedList<BlockEntry*> lru_;
+    uint32_t dirty_count_;
+    uint32_t pending_count_;
+
+    // Sequential readahead state: the block a sequential reader would ask for
+    // next, and the number of blocks to fetch when it misses.
+    uint32_t ra_next_;
+    uint32_t ra_window_;
+
+    // Journal state. While |journal_| is false, dirty blocks are written
+    // straight back to their home locations.
+    bool journal_;
+    uint32_t jnl_start_;
+    uint32_t jnl_count_;
+    uint32_t jnl_head_;     // Next free block, relative to |jnl_start_|
+    uint64_t jnl_seq_;      // Sequence number of the next transaction
+    // Set once an operation outgrew the transaction. The pending blocks then
+    // hold part of an operation, so nothing is committed from then on.
+    bool jnl_broken_;
 };
 
 
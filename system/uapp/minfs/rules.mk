@@ -15,6 +15,7 @@ MODULE_SRCS := \
 # "libfs"
 MODULE_SRCS += \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/journal.cpp \
 
 # minfs implementation
 MODULE_SRCS += \
@@ -54,6 +55,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test.cpp \
     $(LOCAL_DIR)/host.cpp \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/journal.cpp \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/minfs-ops.cpp \
     system/ulib/fs/vfs.cpp \
@@ -0,0 +1,252 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <magenta/compiler.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/port.h>
+#include <mxtl/unique_ptr.h>
+
+namespace {
+
+// The kernel returns at most this many packets per mx_port_wait_many().
+constexpr uint32_t kMaxBatch = 16;
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+struct TestArgs {
+    bool signals;    // signal packets from events instead of user packets
+    bool coalesce;   // create the port with MX_PORT_OPT_COALESCE
+    uint32_t batch;  // packets per wait; 1 uses mx_port_wait()
+    uint32_t queue;  // packets (or events) made ready per round
+};
+
+// Dequeues until |expected| packets have arrived, returning how many waits it took.
+uint64_t drain(mx_handle_t port, uint32_t batch, uint64_t expected, uint64_t* received) {
+    mx_port_packet_t packets[kMaxBatch];
+    uint64_t waits = 0;
+    *received = 0;
+    while (*received < expected) {
+        __UNUSED mx_status_t status;
+        uint32_t actual = 1u;
+        if (batch == 1u) {
+            status = mx_port_wait(port, 0ull, &packets[0], 0u);
+        } else {
+            status = mx_port_wait_many(port, 0ull, packets, batch, &actual);
+        }
+        if (status == ERR_TIMED_OUT)
+            break;
+        assert(status == NO_ERROR);
+        *received += actual;
+        waits++;
+    }
+    return waits;
+}
+
+void do_test(uint32_t duration, const TestArgs& test_args) {
+    __UNUSED mx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    mx_handle_t port;
+    uint32_t options = MX_PORT_OPT_V2 | (test_args.coalesce ? MX_PORT_OPT_COALESCE : 0u);
+    status = mx_port_create(options, &port);
+    assert(status == NO_ERROR);
+
+    // In signal mode every event is watched with its own key, and is
+    // toggled twice per round so that coalescing has something to merge.
+    mxtl::unique_ptr<mx_handle_t[]> events;
+    if (test_args.signals) {
+        events.reset(new mx_handle_t[test_args.queue]);
+        for (uint32_t i = 0; i < test_args.queue; i++) {
+            status = mx_event_create(0u, &events[i]);
+            assert(status == NO_ERROR);
+            status = mx_object_wait_async(events[i], port, i, MX_EVENT_SIGNALED,
+                                          MX_WAIT_ASYNC_REPEATING);
+            assert(status == NO_ERROR);
+        }
+    }
+
+    mx_port_packet_t user = {};
+    user.type = MX_PKT_TYPE_USER;
+
+    uint64_t packets = 0;
+    uint64_t waits = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        for (uint32_t round = 0; round < 1000; round++) {
+            uint64_t expected = test_args.queue;
+            if (test_args.signals) {
+                // A repeating wait queues once until its packet is read, so the
+                // second toggle is dropped on a plain port and folded into the
+                // queued packet's count on a coalescing one.
+                for (uint32_t i = 0; i < test_args.queue; i++) {
+                    for (int toggle = 0; toggle < 2; toggle++) {
+                        status = mx_object_signal(events[i], 0u, MX_EVENT_SIGNALED);
+                        assert(status == NO_ERROR);
+                        status = mx_object_signal(events[i], MX_EVENT_SIGNALED, 0u);
+                        assert(status == NO_ERROR);
+                    }
+                }
+            } else {
+                for (uint32_t i = 0; i < test_args.queue; i++) {
+                    user.key = i;
+                    status = mx_port_queue(port, &user, 0u);
+                    assert(status == NO_ERROR);
+                }
+            }
+
+            uint64_t received;
+            waits += drain(port, test_args.batch, expected, &received);
+            assert(received == expected);
+            packets += received;
+        }
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    if (test_args.signals) {
+        for (uint32_t i = 0; i < test_args.queue; i++) {
+            status = mx_handle_close(events[i]);
+            assert(status == NO_ERROR);
+        }
+    }
+    status = mx_handle_close(port);
+    assert(status == NO_ERROR);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    printf("%s packets, batch %" PRIu32 ", %" PRIu32 " per round%s: "
+               "%.0f packets/second, %.0f waits/second (one core)\n",
+           test_args.signals ? "signal" : "user", test_args.batch, test_args.queue,
+           test_args.coalesce ? ", coalescing" : "",
+           static_cast<double>(packets) / real_duration,
+           static_cast<double>(waits) / real_duration);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -o    run single test (default)\n"
+        "  -s    run suite (ignores -e/-c/-B/-Q)\n"
+        "  -e    use signal packets from events (default: user packets)\n"
+        "  -c    create the port with MX_PORT_OPT_COALESCE\n"
+        "  -n N  set test repetition count to N (default: 1)\n"
+        "  -d N  set test duration to N seconds (default: 5)\n"
+        "  -B N  set packets per wait to N, at most 16 (default: 16)\n"
+        "  -Q N  set packets made ready per round to N (default: 64)\n";
+
+    bool run_suite = false;  // -o/-s
+    uint32_t duration = 5;   // -d
+    uint32_t repeats = 1;    // -n
+    // Ignored when running a suite:
+    TestArgs test_args = {
+        false,               // -e (signals)
+        false,               // -c (coalesce)
+        kMaxBatch,           // -B (batch)
+        64                   // -Q (queue)
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hosecn:d:B:Q:")) != -1) {
+        // Our option values are always unsigned numbers.
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'o':
+                run_suite = false;
+                break;
+            case 's':
+                run_suite = true;
+                break;
+            case 'e':
+                test_args.signals = true;
+                break;
+            case 'c':
+                test_args.coalesce = true;
+                break;
+            case 'n':
+                assert(optarg);
+                repeats = value;
+                break;
+            case 'd':
+                assert(optarg);
+                duration = value;
+                break;
+            case 'B':
+                assert(optarg);
+                if (value == 0u || value > kMaxBatch)
+                    argument_error(argv[0], "batch must be between 1 and 16");
+                test_args.batch = value;
+                break;
+            case 'Q':
+                assert(optarg);
+                if (value == 0u)
+                    argument_error(argv[0], "queue must not be zero");
+                test_args.queue = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (repeats > 1u) {
+            if (i > 0u)
+                printf("\n");
+            printf("Test iteration #%" PRIu32 " (of %" PRIu32 "):\n", i + 1,
+                   repeats);
+        }
+
+        if (run_suite) {
+            static constexpr TestArgs suite[] = {
+                {false, false, 1, 64},
+                {false, false, 4, 64},
+                {false, false, 16, 64},
+                {true, false, 1, 64},
+                {true, false, 16, 64},
+                {true, true, 1, 64},
+                {true, true, 16, 64},
+            };
+            for (size_t i = 0; i < countof(suite); i++)
+                do_test(duration, suite[i]);
+        } else {
+            do_test(duration, test_args);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
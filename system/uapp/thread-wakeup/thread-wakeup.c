@@ -0,0 +1,155 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+#include <stdatomic.h>
+
+// Measures how long it takes for a thread blocked on an event to start running
+// after another thread signals it. The test is repeated with an increasing number
+// of ping-pong pairs of threads, up to one pair per cpu by default, to show how
+// wakeup latency changes as more cpus are busy doing the same thing.
+
+#define ITERATIONS 2000
+
+typedef struct {
+    mx_handle_t ping;
+    mx_handle_t pong;
+    // Timestamp of the last signal from the waker, read by the sleeper.
+    atomic_uint_fast64_t signal_time;
+    uint64_t* samples;
+} pair_t;
+
+static int sleeper_func(void* arg) {
+    pair_t* pair = arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        mx_status_t status = mx_object_wait_one(pair->ping, MX_USER_SIGNAL_0,
+                                                MX_TIME_INFINITE, NULL);
+        uint64_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        if (status != NO_ERROR) {
+            printf("Unexpected wait return: %d\n", status);
+            return 1;
+        }
+        pair->samples[i] = now - atomic_load(&pair->signal_time);
+
+        mx_object_signal(pair->ping, MX_USER_SIGNAL_0, 0);
+        mx_object_signal(pair->pong, 0, MX_USER_SIGNAL_0);
+    }
+    return 0;
+}
+
+static int waker_func(void* arg) {
+    pair_t* pair = arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        atomic_store(&pair->signal_time, mx_time_get(MX_CLOCK_MONOTONIC));
+        mx_object_signal(pair->ping, 0, MX_USER_SIGNAL_0);
+
+        mx_status_t status = mx_object_wait_one(pair->pong, MX_USER_SIGNAL_0,
+                                                MX_TIME_INFINITE, NULL);
+        if (status != NO_ERROR) {
+            printf("Unexpected wait return: %d\n", status);
+            return 1;
+        }
+        mx_object_signal(pair->pong, MX_USER_SIGNAL_0, 0);
+    }
+    return 0;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t* sorted, size_t count, uint32_t pct) {
+    size_t index = (count * pct) / 100;
+    if (index >= count)
+        index = count - 1;
+    return sorted[index];
+}
+
+static int run_test(uint32_t num_pairs) {
+    pair_t* pairs = calloc(num_pairs, sizeof(pair_t));
+    thrd_t* threads = calloc(num_pairs * 2, sizeof(thrd_t));
+    uint64_t* samples = calloc((size_t)num_pairs * ITERATIONS, sizeof(uint64_t));
+    if (!pairs || !threads || !samples) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num_pairs; i++) {
+        if (mx_event_create(0u, &pairs[i].ping) != NO_ERROR ||
+            mx_event_create(0u, &pairs[i].pong) != NO_ERROR) {
+            printf("Failed to create events\n");
+            return 1;
+        }
+        atomic_init(&pairs[i].signal_time, 0);
+        pairs[i].samples = &samples[(size_t)i * ITERATIONS];
+    }
+
+    for (uint32_t i = 0; i < num_pairs; i++) {
+        if (thrd_create_with_name(&threads[i * 2], sleeper_func, &pairs[i], "sleeper") != thrd_success ||
+            thrd_create_with_name(&threads[i * 2 + 1], waker_func, &pairs[i], "waker") != thrd_success) {
+            printf("Failed to create thread\n");
+            return 1;
+        }
+    }
+
+    int ret = 0;
+    for (uint32_t i = 0; i < num_pairs * 2; i++) {
+        int thread_ret;
+        if (thrd_join(threads[i], &thread_ret) != thrd_success || thread_ret != 0)
+            ret = 1;
+    }
+
+    if (ret == 0) {
+        size_t count = (size_t)num_pairs * ITERATIONS;
+        qsort(samples, count, sizeof(uint64_t), compare_u64);
+        printf("%5u %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+               num_pairs,
+               percentile(samples, count, 50),
+               percentile(samples, count, 90),
+               percentile(samples, count, 99),
+               percentile(samples, count, 100),
+               samples[0]);
+    }
+
+    for (uint32_t i = 0; i < num_pairs; i++) {
+        mx_handle_close(pairs[i].ping);
+        mx_handle_close(pairs[i].pong);
+    }
+    free(samples);
+    free(threads);
+    free(pairs);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    uint32_t num_cpus = mx_system_get_num_cpus();
+    uint32_t max_pairs = num_cpus;
+    if (argc > 1)
+        max_pairs = (uint32_t)strtoul(argv[1], NULL, 10);
+    if (max_pairs == 0)
+        max_pairs = 1;
+
+    printf("Running thread wakeup latency test on %u cpus...\n", num_cpus);
+    printf("pairs    p50(ns)    p90(ns)    p99(ns)    max(ns)    min(ns)\n");
+
+    // Double the number of busy pairs each step, always finishing at |max_pairs|.
+    for (uint32_t pairs = 1; ; pairs *= 2) {
+        if (pairs > max_pairs)
+            pairs = max_pairs;
+        if (run_test(pairs) != 0) {
+            printf("Test failed with %u pairs\n", pairs);
+            return 1;
+        }
+        if (pairs == max_pairs)
+            break;
+    }
+    return 0;
+}
@@ -7,6 +7,7 @@
 #include <ddk/binding.h>
 #include <ddk/protocol/ethernet.h>
 
+#include <magenta/compiler.h>
 #include <magenta/device/ethernet.h>
 #include <magenta/listnode.h>
 #include <magenta/process.h>
@@ -21,6 +22,9 @@
 #define FIFO_DEPTH 256
 #define FIFO_ESIZE sizeof(eth_fifo_entry_t)
 
+// rx completions held back before writing them to the rx fifo at once
+#define RX_FLUSH_COUNT (FIFO_DEPTH / 4)
+
 #define TRACE 0
 
 #if TRACE
@@ -49,6 +53,10 @@ typedef struct ethdev0 {
     ethmac_info_t info;
 
     mx_device_t* mxdev;
+
+    // protects the rx caches and completions of every instance;
+    // taken after lock, if both are needed
+    mtx_t rx_lock;
 } ethdev0_t;
 
 // transmit thread has been created
@@ -90,6 +98,21 @@ typedef struct ethdev {
     // fifo thread
     thrd_t tx_thr;
 
+    // asks the fifo thread to write back rx completions
+    mx_handle_t rx_event;
+
+    // rx completions are waiting for space in the rx fifo, which the
+    // fifo thread retries once it is writable (under edev0->rx_lock)
+    bool rx_blocked;
+
+    // rx buffers read from the rx fifo but not used yet, and
+    // completed ones not written back yet (under edev0->rx_lock)
+    eth_fifo_entry_t rx_cache[FIFO_DEPTH];
+    uint32_t rx_cache_next;
+    uint32_t rx_cache_count;
+    eth_fifo_entry_t rx_done[FIFO_DEPTH];
+    uint32_t rx_done_count;
+
     mx_device_t* mxdev;
 
     uint32_t fail_rx_read;
@@ -99,13 +122,91 @@ typedef struct ethdev {
 
 #define FAIL_REPORT_RATE 50
 
-static void eth_handle_rx(ethdev_t* edev, const void* data, size_t len, uint32_t extra) {
-    eth_fifo_entry_t e;
+// Takes the next rx buffer the client has posted, reading the rx fifo
+// in batches.
+static mx_status_t eth_rx_take_locked(ethdev_t* edev, eth_fifo_entry_t* e) {
+    if (edev->rx_cache_next == edev->rx_cache_count) {
+        mx_status_t status;
+        uint32_t count;
+        edev->rx_cache_next = 0;
+        edev->rx_cache_count = 0;
+        if ((status = mx_fifo_read(edev->rx_fifo, edev->rx_cache,
+                                   sizeof(edev->rx_cache), &count)) < 0) {
+            return status;
+        }
+        edev->rx_cache_count = count;
+    }
+    *e = edev->rx_cache[edev->rx_cache_next++];
+    return NO_ERROR;
+}
+
+// Writes back as many rx completions as the rx fifo has room for.  The
+// rest stay queued, in order, until the fifo thread sees it writable.
+static void eth_rx_flush_locked(ethdev_t* edev) {
+    if (edev->rx_done_count == 0) {
+        edev->rx_blocked = false;
+        return;
+    }
+
     mx_status_t status;
     uint32_t count;
+    if ((status = mx_fifo_write(edev->rx_fifo, edev->rx_done,
+                                FIFO_ESIZE * edev->rx_done_count, &count)) < 0) {
+        if (status != ERR_SHOULD_WAIT) {
+            // Fatal, should force teardown
+            printf("eth: rx_fifo write failed %d\n", status);
+            edev->rx_done_count = 0;
+            edev->rx_blocked = false;
+            return;
+        }
+        count = 0;
+    }
+
+    edev->rx_done_count -= count;
+    if (edev->rx_done_count == 0) {
+        edev->rx_blocked = false;
+        return;
+    }
+    memmove(edev->rx_done, edev->rx_done + count, FIFO_ESIZE * edev->rx_done_count);
+    if ((edev->fail_rx_write++ % FAIL_REPORT_RATE) == 0) {
+        printf("eth: no rx_fifo space available (%u times)\n", edev->fail_rx_write);
+    }
+    if (!edev->rx_blocked) {
+        edev->rx_blocked = true;
+        mx_object_signal(edev->rx_event, 0, MX_EVENT_SIGNALED);
+    }
+}
+
+// Completions are written back in batches: once enough have built up,
+// or else by the fifo thread as soon as it gets around to it.  While the
+// rx fifo is full, only the fifo thread tries again.  There must be room
+// for |e|; see eth_handle_rx_locked().
+static void eth_rx_complete_locked(ethdev_t* edev, const eth_fifo_entry_t* e) {
+    edev->rx_done[edev->rx_done_count++] = *e;
+    if (edev->rx_blocked) {
+        return;
+    }
+    if (edev->rx_done_count >= RX_FLUSH_COUNT) {
+        eth_rx_flush_locked(edev);
+    } else if (edev->rx_done_count == 1) {
+        mx_object_signal(edev->rx_event, 0, MX_EVENT_SIGNALED);
+    }
+}
 
-    // TODO: read multiple and cache locally to reduce syscalls
-    if ((status = mx_fifo_read(edev->rx_fifo, &e, sizeof(e), &count)) < 0) {
+static void eth_handle_rx_locked(ethdev_t* edev, const void* data, size_t len, uint32_t extra) {
+    eth_fifo_entry_t e;
+    mx_status_t status;
+
+    // Without room to complete a buffer, leave it with the client and
+    // drop the packet.
+    if (edev->rx_done_count == countof(edev->rx_done)) {
+        eth_rx_flush_locked(edev);
+        if (edev->rx_done_count == countof(edev->rx_done)) {
+            return;
+        }
+    }
+
+    if ((status = eth_rx_take_locked(edev, &e)) < 0) {
         if (status == ERR_SHOULD_WAIT) {
             if ((edev->fail_rx_read++ % FAIL_REPORT_RATE) == 0) {
                 printf("eth: no rx buffers available (%u times)\n",
@@ -132,18 +233,7 @@ static void eth_handle_rx(ethdev_t* edev, const void* data, size_t len, uint32_t
         e.flags = ETH_FIFO_RX_OK | extra;
     }
 
-    if ((status = mx_fifo_write(edev->rx_fifo, &e, sizeof(e), &count)) < 0) {
-        if (status == ERR_SHOULD_WAIT) {
-            if ((edev->fail_rx_write++ % FAIL_REPORT_RATE) == 0) {
-                printf("eth: no rx_fifo space available (%u times)\n",
-                       edev->fail_rx_write);
-            }
-        } else {
-            // Fatal, should force teardown
-            printf("eth: rx_fifo write failed %d\n", status);
-        }
-        return;
-    }
+    eth_rx_complete_locked(edev, &e);
 }
 
 static void eth0_status(void* cookie, uint32_t status) {
@@ -157,9 +247,11 @@ static void eth0_recv(void* cookie, void* data, size_t len, uint32_t flags) {
 
     ethdev_t* edev;
     mtx_lock(&edev0->lock);
+    mtx_lock(&edev0->rx_lock);
     list_for_every_entry(&edev0->list_active, edev, ethdev_t, node) {
-        eth_handle_rx(edev, data, len, 0);
+        eth_handle_rx_locked(edev, data, len, 0);
     }
+    mtx_unlock(&edev0->rx_lock);
     mtx_unlock(&edev0->lock);
 }
 
@@ -171,11 +263,13 @@ static ethmac_ifc_t ethmac_ifc = {
 static void eth_tx_echo(ethdev0_t* edev0, const void* data, size_t len) {
     ethdev_t* edev;
     mtx_lock(&edev0->lock);
+    mtx_lock(&edev0->rx_lock);
     list_for_every_entry(&edev0->list_active, edev, ethdev_t, node) {
         if (edev->state & ETHDEV_TX_LISTEN) {
-            eth_handle_rx(edev, data, len, ETH_FIFO_RX_TX);
+            eth_handle_rx_locked(edev, data, len, ETH_FIFO_RX_TX);
         }
     }
+    mtx_unlock(&edev0->rx_lock);
     mtx_unlock(&edev0->lock);
 }
 
@@ -217,16 +311,38 @@ static int eth_tx_thread(void* arg) {
     uint32_t count;
 
     for (;;) {
+        // the rx fifo is only of interest while completions wait for it
+        mtx_lock(&edev0->rx_lock);
+        bool rx_blocked = edev->rx_blocked;
+        mtx_unlock(&edev0->rx_lock);
+        mx_wait_item_t items[3] = {
+            { .handle = edev->tx_fifo, .waitfor = MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED },
+            { .handle = edev->rx_event, .waitfor = MX_EVENT_SIGNALED },
+            { .handle = edev->rx_fifo, .waitfor = MX_FIFO_WRITABLE },
+        };
+        uint32_t nitems = rx_blocked ? 3 : 2;
+        if ((status = mx_object_wait_many(items, nitems, MX_TIME_INFINITE)) < 0) {
+            if (status != ERR_CANCELED) {
+                printf("eth: tx_fifo: error waiting: %d\n", status);
+            }
+            break;
+        }
+
+        // write back rx completions that have not made a full batch,
+        // or that did not fit in the rx fifo
+        if ((items[1].pending & MX_EVENT_SIGNALED) ||
+            ((nitems == 3) && (items[2].pending & MX_FIFO_WRITABLE))) {
+            mx_object_signal(edev->rx_event, MX_EVENT_SIGNALED, 0);
+            mtx_lock(&edev0->rx_lock);
+            eth_rx_flush_locked(edev);
+            mtx_unlock(&edev0->rx_lock);
+        }
+
+        if (!(items[0].pending & (MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED))) {
+            continue;
+        }
         if ((status = mx_fifo_read(edev->tx_fifo, entries, sizeof(entries), &count)) < 0) {
             if (status == ERR_SHOULD_WAIT) {
-                if ((status = mx_object_wait_one(edev->tx_fifo,
-                                                 MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED,
-                                                 MX_TIME_INFINITE, NULL)) < 0) {
-                    if (status != ERR_CANCELED) {
-                        printf("eth: tx_fifo: error waiting: %d\n", status);
-                    }
-                    break;
-                }
                 continue;
             } else {
                 printf("eth: tx_fifo: cannot read: %d\n", status);
@@ -349,6 +465,14 @@ static mx_status_t eth_start_locked(ethdev_t* edev) {
         return NO_ERROR;
     }
 
+    if (edev->rx_event == MX_HANDLE_INVALID) {
+        mx_status_t status;
+        if ((status = mx_event_create(0, &edev->rx_event)) < 0) {
+            printf("eth: failed to create rx event: %d\n", status);
+            return status;
+        }
+    }
+
     if (!(edev->state & ETHDEV_TX_THREAD)) {
         int r = thrd_create_with_name(&edev->tx_thr, eth_tx_thread,
                                       edev, "eth-tx-thread");
@@ -466,10 +590,14 @@ static void eth_kill_locked(ethdev_t* edev) {
     // make sure any future ioctls or other ops will fail
     edev->state |= ETHDEV_DEAD;
 
+    ethdev0_t* edev0 = edev->edev0;
+
     // try to convince clients to close us
     if (edev->rx_fifo) {
+        mtx_lock(&edev0->rx_lock);
         mx_handle_close(edev->rx_fifo);
         edev->rx_fifo = MX_HANDLE_INVALID;
+        mtx_unlock(&edev0->rx_lock);
     }
     if (edev->tx_fifo) {
         mx_handle_close(edev->tx_fifo);
@@ -488,6 +616,13 @@ static void eth_kill_locked(ethdev_t* edev) {
         xprintf("eth: kill: tx thread exited\n");
     }
 
+    if (edev->rx_event) {
+        mtx_lock(&edev0->rx_lock);
+        mx_handle_close(edev->rx_event);
+        edev->rx_event = MX_HANDLE_INVALID;
+        mtx_unlock(&edev0->rx_lock);
+    }
+
     if (edev->io_buf) {
         mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t) edev->io_buf, 0);
         edev->io_buf = NULL;
@@ -612,6 +747,7 @@ static mx_status_t eth_bind(void* ctx, mx_device_t* dev, void** cookie) {
     }
 
     mtx_init(&edev0->lock, mtx_plain);
+    mtx_init(&edev0->rx_lock, mtx_plain);
     list_initialize(&edev0->list_active);
     list_initialize(&edev0->list_idle);
 
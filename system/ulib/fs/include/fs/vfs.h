@@ -243,6 +243,12 @@ public:
 
 #ifdef __Fuchsia__
     virtual Dispatcher* GetDispatcher() = 0;
+
+    // Held by the VFS layer while it dispatches an operation which touches
+    // only this vnode (read, write, truncate, ...). Such operations on
+    // different vnodes may run concurrently; operations which walk or modify
+    // the namespace are serialized against everything else.
+    mxtl::Mutex* IoLock() __TA_RETURN_CAPABILITY(io_lock_) { return &io_lock_; }
 #endif
 
     // Attaches a handle to the vnode, if possible. Otherwise, returns an error.
@@ -275,6 +281,11 @@ protected:
     Vnode() : flags_(0) {};
 
     uint32_t flags_;
+
+#ifdef __Fuchsia__
+private:
+    mxtl::Mutex io_lock_;
+#endif
 };
 
 struct Vfs {
@@ -4,6 +4,7 @@
 
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -32,6 +33,9 @@ typedef struct vfs_iostate {
     vdircookie_t dircookie;
     size_t io_off;
     uint32_t io_flags;
+    // Client's vmo for bulk reads and writes (see MXRIO_SETBUF), or
+    // MX_HANDLE_INVALID.
+    mx_handle_t bulk_vmo;
 } vfs_iostate_t;
 
 namespace fs {
@@ -174,6 +178,16 @@ static mx_status_t iostate_get_token(uint64_t vnode_cookie, vfs_iostate* ios, mx
     return sizeof(mx_handle_t);
 }
 
+// Bulk transfers are staged in a per-thread buffer rather than by mapping the
+// client's vmo, which the client could shrink underneath us at any time.
+static uint8_t* bulk_buffer() {
+    static thread_local uint8_t* buffer = nullptr;
+    if (buffer == nullptr) {
+        buffer = static_cast<uint8_t*>(malloc(MXIO_BULK_SIZE));
+    }
+    return buffer;
+}
+
 mx_status_t vfs_handler_vn(mxrio_msg_t* msg, mxtl::RefPtr<Vnode> vn, vfs_iostate* ios) {
     uint32_t len = msg->datalen;
     int32_t arg = msg->arg;
@@ -218,6 +232,9 @@ mx_status_t vfs_handler_vn(mxrio_msg_t* msg, mxtl::RefPtr<Vnode> vn, vfs_iostate
                 ios->token = MX_HANDLE_INVALID;
             }
         }
+        if (ios->bulk_vmo != MX_HANDLE_INVALID) {
+            mx_handle_close(ios->bulk_vmo);
+        }
 
         // this will drop the ref on the vn
         mx_status_t status = vn->Close();
@@ -271,6 +288,72 @@ mx_status_t vfs_handler_vn(mxrio_msg_t* msg, mxtl::RefPtr<Vnode> vn, vfs_iostate
         ssize_t r = vn->Write(msg->data, len, msg->arg2.off);
         return static_cast<mx_status_t>(r);
     }
+    case MXRIO_SETBUF: {
+        if (ios->bulk_vmo != MX_HANDLE_INVALID) {
+            mx_handle_close(ios->bulk_vmo);
+        }
+        ios->bulk_vmo = msg->handle[0];
+        return NO_ERROR;
+    }
+    case MXRIO_READ_BULK:
+    case MXRIO_READ_AT_BULK: {
+        if ((ios->bulk_vmo == MX_HANDLE_INVALID) || (arg < 0) || (arg > MXIO_BULK_SIZE)) {
+            return ERR_INVALID_ARGS;
+        }
+        uint8_t* buffer = bulk_buffer();
+        if (buffer == nullptr) {
+            return ERR_NO_MEMORY;
+        }
+        bool at = MXRIO_OP(msg->op) == MXRIO_READ_AT_BULK;
+        ssize_t r = vn->Read(buffer, arg, at ? msg->arg2.off : ios->io_off);
+        if (r > 0) {
+            size_t actual;
+            mx_status_t status = mx_vmo_write(ios->bulk_vmo, buffer, 0, r, &actual);
+            if (status != NO_ERROR) {
+                return status;
+            } else if (actual != static_cast<size_t>(r)) {
+                return ERR_IO;
+            }
+        }
+        if ((r >= 0) && !at) {
+            ios->io_off += r;
+            msg->arg2.off = ios->io_off;
+        }
+        return static_cast<mx_status_t>(r);
+    }
+    case MXRIO_WRITE_BULK:
+    case MXRIO_WRITE_AT_BULK: {
+        if ((ios->bulk_vmo == MX_HANDLE_INVALID) || (arg < 0) || (arg > MXIO_BULK_SIZE)) {
+            return ERR_INVALID_ARGS;
+        }
+        uint8_t* buffer = bulk_buffer();
+        if (buffer == nullptr) {
+            return ERR_NO_MEMORY;
+        }
+        size_t actual;
+        mx_status_t status = mx_vmo_read(ios->bulk_vmo, buffer, 0, arg, &actual);
+        if (status != NO_ERROR) {
+            return status;
+        } else if (actual != static_cast<size_t>(arg)) {
+            return ERR_IO;
+        }
+        if (MXRIO_OP(msg->op) == MXRIO_WRITE_AT_BULK) {
+            return static_cast<mx_status_t>(vn->Write(buffer, arg, msg->arg2.off));
+        }
+        if (ios->io_flags & O_APPEND) {
+            vnattr_t attr;
+            if ((status = vn->Getattr(&attr)) < 0) {
+                return status;
+            }
+            ios->io_off = attr.size;
+        }
+        ssize_t r = vn->Write(buffer, arg, ios->io_off);
+        if (r >= 0) {
+            ios->io_off += r;
+            msg->arg2.off = ios->io_off;
+        }
+        return static_cast<mx_status_t>(r);
+    }
     case MXRIO_SEEK: {
         vnattr_t attr;
         mx_status_t r;
@@ -510,17 +593,65 @@ mx_status_t vfs_handler_vn(mxrio_msg_t* msg, mxtl::RefPtr<Vnode> vn, vfs_iostate
     }
 }
 
-// TODO(orr): temporary; prevent multithread weirdness while we
-// make locking more fine grained
-static mtx_t vfs_big_lock = MTX_INIT;
+// Operations which touch only the vnode they are sent to hold this lock
+// shared (and the vnode's IoLock), so independent files can be served in
+// parallel. Everything else -- opening, linking, renaming, ioctls -- may walk
+// or modify the namespace, and holds it exclusively.
+static pthread_rwlock_t vfs_namespace_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+class NamespaceLock {
+public:
+    explicit NamespaceLock(bool exclusive) {
+        if (exclusive) {
+            pthread_rwlock_wrlock(&vfs_namespace_lock);
+        } else {
+            pthread_rwlock_rdlock(&vfs_namespace_lock);
+        }
+    }
+    ~NamespaceLock() { pthread_rwlock_unlock(&vfs_namespace_lock); }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(NamespaceLock);
+};
+
+static bool vfs_op_is_vnode_local(uint32_t op) {
+    switch (MXRIO_OP(op)) {
+    case MXRIO_CLOSE:
+    case MXRIO_CLONE:
+    case MXRIO_READ:
+    case MXRIO_READ_AT:
+    case MXRIO_WRITE:
+    case MXRIO_WRITE_AT:
+    case MXRIO_SEEK:
+    case MXRIO_STAT:
+    case MXRIO_SETATTR:
+    case MXRIO_TRUNCATE:
+    case MXRIO_MMAP:
+    case MXRIO_SYNC:
+    case MXRIO_SETBUF:
+    case MXRIO_READ_BULK:
+    case MXRIO_READ_AT_BULK:
+    case MXRIO_WRITE_BULK:
+    case MXRIO_WRITE_AT_BULK:
+        return true;
+    default:
+        return false;
+    }
+}
 
 mx_status_t vfs_handler(mxrio_msg_t* msg, void* cookie) {
     vfs_iostate_t* ios = static_cast<vfs_iostate_t*>(cookie);
 
-    mxtl::AutoLock lock(&vfs_big_lock);
+    bool local = vfs_op_is_vnode_local(msg->op);
+    NamespaceLock ns_lock(!local);
+    // Hold our own reference so that, if this operation drops the last one
+    // elsewhere, the vnode is destroyed only after its IoLock is released
+    // (and still under the namespace lock).
     mxtl::RefPtr<Vnode> vn = ios->vn;
-    mx_status_t status = vfs_handler_vn(msg, mxtl::move(vn), ios);
-    return status;
+    if (!local) {
+        return vfs_handler_vn(msg, vn, ios);
+    }
+    mxtl::AutoLock io_lock(vn->IoLock());
+    return vfs_handler_vn(msg, vn, ios);
 }
 
 mx_handle_t vfs_rpc_server(mx_handle_t h, mxtl::RefPtr<Vnode> vn) {
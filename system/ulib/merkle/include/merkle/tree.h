@@ -119,6 +119,21 @@ public:
                        size_t tree_len, uint64_t offset, size_t length,
                        const Digest& digest);
 
+    // The maximum number of threads |CreateParallel| and |VerifyParallel|
+    // will use.
+    static constexpr size_t kMaxThreads = 32;
+
+    // Like |Create| and |Verify|, but the nodes of each level of the tree are
+    // hashed by up to |num_threads| threads.  The tree, root digest and
+    // failures produced are identical to those of the single threaded calls.
+    mx_status_t CreateParallel(const void* data, size_t data_len, void* tree,
+                               size_t tree_len, Digest* digest,
+                               size_t num_threads);
+    mx_status_t VerifyParallel(const void* data, size_t data_len,
+                               const void* tree, size_t tree_len,
+                               uint64_t offset, size_t length,
+                               const Digest& digest, size_t num_threads);
+
 private:
     // Sets the length of the data that this Merkle tree references.  This
     // method has the side effect of setting the geometry of the Merkle tree;
@@ -135,6 +150,17 @@ private:
     // tree and writes the digests to |tree|.
     mx_status_t HashData(const void* data, size_t length, void* tree);
 
+    // Common implementation of |Verify| and |VerifyParallel|.
+    mx_status_t VerifyInternal(const void* data, size_t data_len,
+                               const void* tree, size_t tree_len,
+                               uint64_t offset, size_t length,
+                               const Digest& digest, size_t num_threads);
+
+    // Checks the leaves in [|offset_|, |finish|) against the digests at
+    // |hashes| using up to |num_threads| threads, recording any failures.
+    mx_status_t VerifyLeavesParallel(const void* data, const uint8_t* hashes,
+                                     uint64_t finish, size_t num_threads);
+
     // This method adds the given offset |off| to the appropriate list of
     // failures.
     void AddFailure();
@@ -4,6 +4,7 @@
 
 #include <merkle/tree.h>
 
+#include <pthread.h>
 #include <string.h>
 
 #include <magenta/errors.h>
@@ -26,9 +27,95 @@ uint32_t GetNodeLength(uint64_t offset, uint64_t data_len) {
     return 0;
 }
 
+// A level of the tree, or the data, being hashed by several threads at once.
+// Each thread takes a contiguous share of the nodes.
+struct LevelWork {
+    // The nodes being hashed, their offset within the data or tree, and the
+    // offset of the level they belong to.  Node digests depend on the node's
+    // offset from the start of its level.
+    const uint8_t* nodes;
+    uint64_t start;
+    uint64_t level_start;
+    uint64_t level;
+    size_t data_len;
+    size_t num_nodes;
+    size_t num_threads;
+
+    // When creating, each node's digest is written to |digests|.  When
+    // verifying, it is compared against |digests| and mismatches are flagged.
+    uint8_t* digests;
+    const uint8_t* expected;
+    uint8_t* mismatches;
+};
+
+struct LevelThread {
+    LevelWork* work;
+    size_t index;
+};
+
+// Hashes the nodes making up the |index|th share of |work|.  Each node is
+// hashed exactly as |Tree::HashData| and |Tree::HashNode| would.
+void HashLevelShare(LevelWork* work, size_t index) {
+    size_t first = work->num_nodes * index / work->num_threads;
+    size_t last = work->num_nodes * (index + 1) / work->num_threads;
+    Digest digest;
+    for (size_t i = first; i < last; ++i) {
+        uint64_t offset = i * Tree::kNodeSize;
+        digest.Init();
+        uint64_t locality = (work->start - work->level_start + offset) | work->level;
+        digest.Update(&locality, sizeof(locality));
+        uint32_t length = GetNodeLength(work->start + offset, work->data_len);
+        digest.Update(&length, sizeof(length));
+        digest.Update(work->nodes + offset, length);
+        if (work->level == 0 && length != 0 && length < Tree::kNodeSize) {
+            uint8_t pad[Tree::kNodeSize - length];
+            memset(pad, 0, Tree::kNodeSize - length);
+            digest.Update(pad, Tree::kNodeSize - length);
+        }
+        digest.Final();
+        if (work->digests) {
+            digest.CopyTo(work->digests + i * Digest::kLength, Digest::kLength);
+        } else if (digest != work->expected + i * Digest::kLength) {
+            work->mismatches[i] = 1;
+        }
+    }
+}
+
+void* HashLevelThread(void* arg) {
+    LevelThread* thread = static_cast<LevelThread*>(arg);
+    HashLevelShare(thread->work, thread->index);
+    return nullptr;
+}
+
+// Hashes all the nodes in |work|, using the calling thread and up to
+// |work->num_threads - 1| others.
+void HashLevel(LevelWork* work) {
+    work->num_threads = mxtl::min(work->num_threads, work->num_nodes);
+    work->num_threads = mxtl::max(work->num_threads, static_cast<size_t>(1));
+
+    pthread_t threads[Tree::kMaxThreads];
+    LevelThread args[Tree::kMaxThreads];
+    bool started[Tree::kMaxThreads] = {false};
+    for (size_t i = 1; i < work->num_threads; ++i) {
+        args[i].work = work;
+        args[i].index = i;
+        started[i] = pthread_create(&threads[i], nullptr, HashLevelThread, &args[i]) == 0;
+    }
+    HashLevelShare(work, 0);
+    for (size_t i = 1; i < work->num_threads; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], nullptr);
+        } else {
+            // Couldn't get another thread; do its share here instead.
+            HashLevelShare(work, i);
+        }
+    }
+}
+
 } // namespace
 
 constexpr size_t Tree::kNodeSize;
+constexpr size_t Tree::kMaxThreads;
 const size_t kDigestsPerNode = Tree::kNodeSize / Digest::kLength;
 const size_t kMaxFailures = kDigestsPerNode;
 
@@ -118,6 +205,10 @@ mx_status_t Tree::CreateFinal(void* tree, Digest* digest) {
 
         if (offset_ == offsets_[level_]) {
             ++level_;
+            // Each level's digests start a new region of the tree.
+            if (level_ < offsets_.size()) {
+                hash = static_cast<uint8_t*>(tree) + offsets_[level_];
+            }
         }
     }
     HashNode(tree);
@@ -142,6 +233,52 @@ mx_status_t Tree::Create(const void* data, size_t data_len, void* tree,
     return NO_ERROR;
 }
 
+mx_status_t Tree::CreateParallel(const void* data, size_t data_len, void* tree,
+                                 size_t tree_len, Digest* digest,
+                                 size_t num_threads) {
+    num_threads = mxtl::min(num_threads, kMaxThreads);
+    if (num_threads <= 1 || data_len <= kNodeSize) {
+        return Create(data, data_len, tree, tree_len, digest);
+    }
+    if (!data || !digest) {
+        return ERR_INVALID_ARGS;
+    }
+    mx_status_t rc = CreateInit(data_len, tree, tree_len);
+    if (rc != NO_ERROR) {
+        return rc;
+    }
+
+    // Hash the leaves into the first region of the tree.
+    uint8_t* nodes = static_cast<uint8_t*>(tree);
+    LevelWork work = {};
+    work.nodes = static_cast<const uint8_t*>(data);
+    work.level = 0;
+    work.data_len = data_len_;
+    work.num_nodes = mxtl::roundup(data_len_, kNodeSize) / kNodeSize;
+    work.num_threads = num_threads;
+    work.digests = nodes;
+    HashLevel(&work);
+
+    // Each region of the tree is hashed into the next.  Each region depends
+    // on the one before it, but the nodes within a region are independent.
+    for (level_ = 1; level_ < offsets_.size(); ++level_) {
+        work.nodes = nodes + offsets_[level_ - 1];
+        work.start = offsets_[level_ - 1];
+        work.level_start = offsets_[level_ - 1];
+        work.level = level_;
+        work.num_nodes = (offsets_[level_] - offsets_[level_ - 1]) / kNodeSize;
+        work.num_threads = num_threads;
+        work.digests = nodes + offsets_[level_];
+        HashLevel(&work);
+    }
+
+    // The last region is a single node whose digest is the root.
+    offset_ = offsets_[level_ - 1];
+    HashNode(tree);
+    *digest = digest_;
+    return NO_ERROR;
+}
+
 mx_status_t Tree::SetRanges(size_t data_len, uint64_t offset, size_t length) {
     uint64_t finish = offset + length;
     if (finish < offset || finish > data_len) {
@@ -176,6 +313,22 @@ mx_status_t Tree::SetRanges(size_t data_len, uint64_t offset, size_t length) {
 mx_status_t Tree::Verify(const void* data, size_t data_len, const void* tree,
                          size_t tree_len, uint64_t offset, size_t length,
                          const Digest& digest) {
+    return VerifyInternal(data, data_len, tree, tree_len, offset, length,
+                          digest, 1);
+}
+
+mx_status_t Tree::VerifyParallel(const void* data, size_t data_len,
+                                 const void* tree, size_t tree_len,
+                                 uint64_t offset, size_t length,
+                                 const Digest& digest, size_t num_threads) {
+    return VerifyInternal(data, data_len, tree, tree_len, offset, length,
+                          digest, mxtl::min(num_threads, kMaxThreads));
+}
+
+mx_status_t Tree::VerifyInternal(const void* data, size_t data_len,
+                                 const void* tree, size_t tree_len,
+                                 uint64_t offset, size_t length,
+                                 const Digest& digest, size_t num_threads) {
     num_failures_ = 0;
     data_failures_.reset();
     tree_failures_.reset();
@@ -208,6 +361,14 @@ mx_status_t Tree::Verify(const void* data, size_t data_len, const void* tree,
             finish = mxtl::min(mxtl::roundup(offset + length, kNodeSize),
                                static_cast<uint64_t>(data_len));
             hash_offset = (offset_ / kDigestsPerNode);
+            if (num_threads > 1) {
+                rc = VerifyLeavesParallel(data, hashes + hash_offset, finish,
+                                          num_threads);
+                if (rc != NO_ERROR) {
+                    return rc;
+                }
+                continue;
+            }
         } else {
             offset_ = ranges_[level_ - 1].offset;
             finish = offset_ + ranges_[level_ - 1].length;
@@ -227,6 +388,36 @@ mx_status_t Tree::Verify(const void* data, size_t data_len, const void* tree,
 
 // Private methods
 
+mx_status_t Tree::VerifyLeavesParallel(const void* data, const uint8_t* hashes,
+                                       uint64_t finish, size_t num_threads) {
+    LevelWork work = {};
+    work.nodes = static_cast<const uint8_t*>(data) + offset_;
+    work.start = offset_;
+    work.level = 0;
+    work.data_len = data_len_;
+    work.num_nodes = mxtl::roundup(finish - offset_, kNodeSize) / kNodeSize;
+    work.num_threads = num_threads;
+    work.expected = hashes;
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> mismatches(new (&ac) uint8_t[work.num_nodes]());
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    work.mismatches = mismatches.get();
+    HashLevel(&work);
+
+    // Record failures in order, just as the serial walk would.
+    uint64_t start = offset_;
+    for (size_t i = 0; i < work.num_nodes; ++i) {
+        offset_ = start + (i + 1) * kNodeSize;
+        if (mismatches[i]) {
+            AddFailure();
+        }
+    }
+    offset_ = finish;
+    return NO_ERROR;
+}
+
 static_assert(sizeof(size_t) <= sizeof(uint64_t), ">64-bit is unsupported");
 mx_status_t Tree::SetLengths(size_t data_len, size_t tree_len) {
     if (tree_len < GetTreeLength(data_len)) {
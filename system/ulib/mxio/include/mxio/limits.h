@@ -16,6 +16,10 @@
 // at least this size.
 #define MXIO_CHUNK_SIZE 8192
 
+// Larger remoteio reads and writes move through a vmo shared
+// with the server, up to this many bytes per round trip.
+#define MXIO_BULK_SIZE (256 * 1024)
+
 // Maximum size for an ioctl input.
 #define MXIO_IOCTL_MAX_INPUT 1024
 
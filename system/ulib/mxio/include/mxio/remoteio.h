@@ -50,7 +50,12 @@ __BEGIN_CDECLS
 #define MXRIO_SYNC         0x00000019
 #define MXRIO_LINK        (0x0000001a | MXRIO_ONE_HANDLE)
 #define MXRIO_MMAP         0x0000001b
-#define MXRIO_NUM_OPS      28
+#define MXRIO_SETBUF      (0x0000001c | MXRIO_ONE_HANDLE)
+#define MXRIO_READ_BULK    0x0000001d
+#define MXRIO_READ_AT_BULK 0x0000001e
+#define MXRIO_WRITE_BULK   0x0000001f
+#define MXRIO_WRITE_AT_BULK 0x00000020
+#define MXRIO_NUM_OPS      33
 
 #define MXRIO_OP(n)        ((n) & 0x3FF) // opcode
 #define MXRIO_HC(n)        (((n) >> 8) & 3) // handle count
@@ -63,7 +68,9 @@ __BEGIN_CDECLS
     "read_at", "write_at", "truncate", "rename", \
     "connect", "bind", "listen", "getsockname", \
     "getpeername", "getsockopt", "setsockopt", "getaddrinfo", \
-    "setattr", "sync", "link", "mmap" }
+    "setattr", "sync", "link", "mmap", \
+    "setbuf", "read_bulk", "read_at_bulk", "write_bulk", \
+    "write_at_bulk" }
 
 const char* mxio_opname(uint32_t op);
 
@@ -197,6 +204,16 @@ static_assert(MXIO_CHUNK_SIZE >= PATH_MAX, "MXIO_CHUNK_SIZE must be large enough
 // SYNC        0          0        0                 0           -               -
 // LINK        0          0        <name1>0<name2>0  0           -               -
 // MMAP        maxreply   0        mmap_data_msg     0           mmap_data_msg   vmohandle
+// SETBUF      0          0        -                 0           -               -
+// READ_BULK   maxread    0        -                 newoffset   -               -
+// READ_AT_BULK maxread   offset   -                 0           -               -
+// WRITE_BULK  len        0        -                 newoffset   -               -
+// WRITE_AT_BULK len      offset   -                 0           -               -
+//
+// SETBUF hands the server a vmo (in handle[0]) of up to MXIO_BULK_SIZE bytes,
+// which the *_BULK ops then read from or write to at offset 0, in place of
+// the message payload.  Servers which do not support SETBUF reply
+// ERR_NOT_SUPPORTED, and the client keeps using READ and WRITE.
 //
 // proposed:
 //
@@ -6,6 +6,42 @@
 
 #include "private.h"
 
+// Number of requests kept in flight for sequential reads or writes
+// of a remote file.
+#define MXRIO_PIPELINE_DEPTH 4
+
+typedef struct mxrio_pipeline {
+    // MXRIO_READ or MXRIO_WRITE while requests are pipelined, else 0
+    uint32_t op;
+
+    // op of the previous synchronous read or write, if it was small
+    // and complete, else 0
+    uint32_t last_op;
+
+    // 0 until known, then 1 if the object is a regular file, else -1
+    int regular;
+
+    // requests in flight, oldest first
+    mx_txid_t txid[MXRIO_PIPELINE_DEPTH];
+    uint32_t len[MXRIO_PIPELINE_DEPTH];
+    unsigned head;
+    unsigned count;
+
+    // read-ahead data received but not read yet is buf[start, end)
+    uint8_t* buf;
+    size_t start;
+    size_t end;
+
+    // the server's seek offset as of the last read-ahead reply
+    int64_t server_off;
+
+    // a read-ahead came up short, so no more are sent
+    bool eof;
+
+    // a write-behind failed; reported by the next read, write, sync or close
+    mx_status_t error;
+} mxrio_pipeline_t;
+
 typedef struct mxrio mxrio_t;
 struct mxrio {
     // base mxio io object
@@ -19,6 +55,18 @@ struct mxrio {
 
     // transaction id used for synchronous remoteio calls
     _Atomic mx_txid_t txid;
+
+    // vmo shared with the server for bulk reads and writes, created
+    // on the first large one; bulk_lock serializes its users
+    mtx_t bulk_lock;
+    mx_handle_t bulk_vmo;
+
+    // set once the server has refused a bulk vmo
+    bool bulk_unsupported;
+
+    // read-ahead and write-behind state, under pipe_lock
+    mtx_t pipe_lock;
+    mxrio_pipeline_t pipe;
 };
 
 // These are for the benefit of namespace.c
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <threads.h>
@@ -25,6 +26,7 @@
 #include <mxio/namespace.h>
 #include <mxio/remoteio.h>
 #include <mxio/util.h>
+#include <mxio/vfs.h>
 
 #include "private-remoteio.h"
 
@@ -244,6 +246,262 @@ fail_discard_handles:
     return r;
 }
 
+// Sequential access to remote files is pipelined.  Once two small reads (or
+// writes) in a row at the seek offset of a regular file have completed, up to
+// MXRIO_PIPELINE_DEPTH further requests are kept in flight, written to the
+// channel without waiting for their replies.  Reads are then served from the
+// replies to read-ahead requests.  Writes return once sent, and a failure is
+// reported by the next read, write, sync or close.  Any other operation first
+// drains the pipeline and, after reading ahead, moves the server's seek offset
+// back to where the reader got to.
+//
+// Read-ahead data may predate writes made through other file descriptors
+// while it was in flight.
+
+#define MXRIO_PIPELINE_BUF_SIZE ((MXRIO_PIPELINE_DEPTH + 1) * MXIO_CHUNK_SIZE)
+
+static mx_status_t misc_common(mxrio_t* rio, uint32_t op, int64_t off,
+                               uint32_t maxreply, void* ptr, size_t len);
+
+static mx_status_t pipeline_send(mxrio_t* rio, uint32_t op, const void* data, uint32_t len) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    mxrio_msg_t msg;
+
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.txid = atomic_fetch_add(&rio->txid, 1);
+    msg.op = op;
+    if (op == MXRIO_READ) {
+        msg.arg = len;
+    } else {
+        msg.datalen = len;
+        memcpy(msg.data, data, len);
+    }
+
+    mx_status_t r;
+    if ((r = mx_channel_write(rio->h, 0, &msg, MXRIO_HDR_SZ + msg.datalen, NULL, 0)) < 0) {
+        return r;
+    }
+    unsigned n = (p->head + p->count++) % MXRIO_PIPELINE_DEPTH;
+    p->txid[n] = msg.txid;
+    p->len[n] = len;
+    return NO_ERROR;
+}
+
+// Receives the reply to the oldest request in flight, appending any data read
+// ahead to the buffer.
+static mx_status_t pipeline_recv(mxrio_t* rio) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    mx_txid_t txid = p->txid[p->head];
+    uint32_t len = p->len[p->head];
+    p->head = (p->head + 1) % MXRIO_PIPELINE_DEPTH;
+    p->count--;
+
+    mx_status_t r;
+    if ((r = mx_object_wait_one(rio->h, MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                MX_TIME_INFINITE, NULL)) < 0) {
+        return r;
+    }
+    mxrio_msg_t msg;
+    uint32_t dsize;
+    if ((r = mx_channel_read(rio->h, 0, &msg, msg.handle, sizeof(msg), MXIO_MAX_HANDLES,
+                             &dsize, &msg.hcount)) < 0) {
+        return r;
+    }
+    discard_handles(msg.handle, msg.hcount);
+    msg.hcount = 0;
+    if (!is_message_reply_valid(&msg, dsize) ||
+        (MXRIO_OP(msg.op) != MXRIO_STATUS) || (msg.txid != txid)) {
+        return ERR_IO;
+    }
+    if ((r = msg.arg) < 0) {
+        return r;
+    }
+
+    if (p->op == MXRIO_READ) {
+        if ((r > (int)msg.datalen) || ((uint32_t)r > len)) {
+            return ERR_IO;
+        }
+        memcpy(p->buf + p->end, msg.data, r);
+        p->end += r;
+        p->server_off = msg.arg2.off;
+        if ((uint32_t)r < len) {
+            p->eof = true;
+        }
+    } else if ((uint32_t)r < len) {
+        return ERR_IO;
+    }
+    return NO_ERROR;
+}
+
+// Sends read-ahead requests for as much as the buffer can take.
+static mx_status_t pipeline_fill_locked(mxrio_t* rio) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    while (!p->eof && (p->count < MXRIO_PIPELINE_DEPTH)) {
+        if (p->end + (p->count + 1) * MXIO_CHUNK_SIZE > MXRIO_PIPELINE_BUF_SIZE) {
+            if (p->start == 0) {
+                break;
+            }
+            memmove(p->buf, p->buf + p->start, p->end - p->start);
+            p->end -= p->start;
+            p->start = 0;
+            continue;
+        }
+        mx_status_t r;
+        if ((r = pipeline_send(rio, MXRIO_READ, NULL, MXIO_CHUNK_SIZE)) < 0) {
+            p->eof = true;
+            return r;
+        }
+    }
+    return NO_ERROR;
+}
+
+// Waits for every request in flight and, if reading ahead, moves the server's
+// seek offset back to the first byte not read yet.
+static mx_status_t pipeline_drain_locked(mxrio_t* rio) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    mx_status_t r = NO_ERROR;
+
+    while (p->count > 0) {
+        mx_status_t status = pipeline_recv(rio);
+        if ((status < 0) && (p->op == MXRIO_WRITE) && (p->error == NO_ERROR)) {
+            p->error = status;
+        }
+    }
+    if ((p->op == MXRIO_READ) && (p->end > p->start)) {
+        mxrio_msg_t msg;
+        memset(&msg, 0, MXRIO_HDR_SZ);
+        msg.op = MXRIO_SEEK;
+        msg.arg = SEEK_SET;
+        msg.arg2.off = p->server_off - (p->end - p->start);
+        if ((r = mxrio_txn(rio, &msg)) >= 0) {
+            discard_handles(msg.handle, msg.hcount);
+            r = NO_ERROR;
+        }
+    }
+    p->op = 0;
+    p->start = 0;
+    p->end = 0;
+    p->eof = false;
+    return r;
+}
+
+// Called before a read or write of |len| bytes at the seek offset.  Returns an
+// error left by write-behind, or else whether to pipeline the operation.
+static mx_status_t pipeline_begin_locked(mxrio_t* rio, uint32_t op, size_t len) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    mx_status_t r;
+
+    if ((p->op != 0) && ((p->op != op) || (len > MXIO_CHUNK_SIZE))) {
+        if ((r = pipeline_drain_locked(rio)) < 0) {
+            return r;
+        }
+    }
+    if ((r = p->error) < 0) {
+        p->error = NO_ERROR;
+        return r;
+    }
+    if (p->op == op) {
+        return 1;
+    }
+    if ((p->last_op != op) || (len > MXIO_CHUNK_SIZE) || (p->regular <= 0)) {
+        return 0;
+    }
+    if ((op == MXRIO_READ) && (p->buf == NULL) &&
+        ((p->buf = malloc(MXRIO_PIPELINE_BUF_SIZE)) == NULL)) {
+        return 0;
+    }
+    p->op = op;
+    return 1;
+}
+
+// Called after a synchronous read or write at the seek offset.
+static void pipeline_end(mxrio_t* rio, uint32_t op, size_t len, ssize_t r) {
+    bool complete = (r > 0) && ((size_t)r == len) && (len <= MXIO_CHUNK_SIZE);
+    int regular = rio->pipe.regular;
+    if (complete && (regular == 0)) {
+        vnattr_t attr;
+        mx_status_t status = misc_common(rio, MXRIO_STAT, 0, sizeof(attr), &attr, 0);
+        regular = ((status >= (mx_status_t)sizeof(attr)) &&
+                   ((attr.mode & V_TYPE_MASK) == V_TYPE_FILE)) ? 1 : -1;
+    }
+
+    mtx_lock(&rio->pipe_lock);
+    rio->pipe.last_op = complete ? op : 0;
+    rio->pipe.regular = regular;
+    mtx_unlock(&rio->pipe_lock);
+}
+
+// Called before any other operation.  If |report| is set, a write-behind error
+// is returned (once) as well.
+static mx_status_t pipeline_sync(mxrio_t* rio, bool report) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    mx_status_t r = NO_ERROR;
+
+    mtx_lock(&rio->pipe_lock);
+    if (p->op != 0) {
+        r = pipeline_drain_locked(rio);
+    }
+    p->last_op = 0;
+    if ((r == NO_ERROR) && report && (p->error < 0)) {
+        r = p->error;
+        p->error = NO_ERROR;
+    }
+    mtx_unlock(&rio->pipe_lock);
+    return r;
+}
+
+static ssize_t pipeline_read_locked(mxrio_t* rio, uint8_t* data, size_t len) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    ssize_t count = 0;
+    mx_status_t r = NO_ERROR;
+
+    while (len > 0) {
+        if (p->end > p->start) {
+            size_t n = (len > p->end - p->start) ? p->end - p->start : len;
+            memcpy(data, p->buf + p->start, n);
+            p->start += n;
+            data += n;
+            len -= n;
+            count += n;
+            continue;
+        }
+        p->start = 0;
+        p->end = 0;
+        if (((r = pipeline_fill_locked(rio)) < 0) && (p->count == 0)) {
+            break;
+        }
+        if (p->count == 0) {
+            // Everything up to the end of the file has been read; later
+            // reads go to the server again, in case the file grows.
+            p->op = 0;
+            p->eof = false;
+            p->last_op = 0;
+            break;
+        }
+        if ((r = pipeline_recv(rio)) < 0) {
+            p->eof = true;
+            break;
+        }
+    }
+    pipeline_fill_locked(rio);
+    return count ? count : r;
+}
+
+static ssize_t pipeline_write_locked(mxrio_t* rio, const void* data, size_t len) {
+    mxrio_pipeline_t* p = &rio->pipe;
+    mx_status_t r;
+
+    if (p->count == MXRIO_PIPELINE_DEPTH) {
+        if ((r = pipeline_recv(rio)) < 0) {
+            return r;
+        }
+    }
+    if ((r = pipeline_send(rio, MXRIO_WRITE, data, len)) < 0) {
+        return r;
+    }
+    return len;
+}
+
 ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
                     size_t in_len, void* out_buf, size_t out_len) {
     mxrio_t* rio = (mxrio_t*)io;
@@ -254,6 +512,9 @@ ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     if (in_len > MXIO_IOCTL_MAX_INPUT || out_len > MXIO_CHUNK_SIZE) {
         return ERR_INVALID_ARGS;
     }
+    if ((r = pipeline_sync(rio, false)) < 0) {
+        return r;
+    }
 
     memset(&msg, 0, MXRIO_HDR_SZ);
     msg.op = MXRIO_IOCTL;
@@ -334,6 +595,92 @@ ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     return r;
 }
 
+// Hands the server a vmo for bulk transfers, unless it already has one.
+// Returns ERR_NOT_SUPPORTED if the caller should use plain messages instead:
+// always, once the server has said it does not do bulk transfers, and for
+// this call only if handing over the vmo failed for any other reason.
+static mx_status_t bulk_setup_locked(mxrio_t* rio) {
+    if (rio->bulk_vmo != MX_HANDLE_INVALID) {
+        return NO_ERROR;
+    }
+    if (rio->bulk_unsupported) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    mx_handle_t vmo;
+    mx_status_t r;
+    if ((r = mx_vmo_create(MXIO_BULK_SIZE, 0, &vmo)) < 0) {
+        return r;
+    }
+    mxrio_msg_t msg;
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = MXRIO_SETBUF;
+    msg.hcount = 1;
+    if ((r = mx_handle_duplicate(vmo, MX_RIGHT_READ | MX_RIGHT_WRITE | MX_RIGHT_TRANSFER,
+                                 &msg.handle[0])) < 0) {
+        mx_handle_close(vmo);
+        return r;
+    }
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        mx_handle_close(vmo);
+        if (r == ERR_NOT_SUPPORTED) {
+            rio->bulk_unsupported = true;
+        }
+        return ERR_NOT_SUPPORTED;
+    }
+    discard_handles(msg.handle, msg.hcount);
+    rio->bulk_vmo = vmo;
+    return NO_ERROR;
+}
+
+static ssize_t write_bulk(uint32_t op, mxrio_t* rio, const uint8_t* data, size_t len, off_t offset) {
+    ssize_t count = 0;
+    mx_status_t r = 0;
+    mxrio_msg_t msg;
+    size_t xfer;
+
+    mtx_lock(&rio->bulk_lock);
+    if ((r = bulk_setup_locked(rio)) < 0) {
+        mtx_unlock(&rio->bulk_lock);
+        return r;
+    }
+    while (len > 0) {
+        xfer = (len > MXIO_BULK_SIZE) ? MXIO_BULK_SIZE : len;
+
+        size_t actual;
+        if ((r = mx_vmo_write(rio->bulk_vmo, data, 0, xfer, &actual)) < 0) {
+            break;
+        }
+
+        memset(&msg, 0, MXRIO_HDR_SZ);
+        msg.op = op;
+        msg.arg = xfer;
+        if (op == MXRIO_WRITE_AT_BULK)
+            msg.arg2.off = offset;
+
+        if ((r = mxrio_txn(rio, &msg)) < 0) {
+            break;
+        }
+        discard_handles(msg.handle, msg.hcount);
+
+        if ((size_t)r > xfer) {
+            r = ERR_IO;
+            break;
+        }
+        count += r;
+        data += r;
+        len -= r;
+        if (op == MXRIO_WRITE_AT_BULK)
+            offset += r;
+        // stop at short write
+        if ((size_t)r < xfer) {
+            break;
+        }
+    }
+    mtx_unlock(&rio->bulk_lock);
+    return count ? count : r;
+}
+
 static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t len, off_t offset) {
     mxrio_t* rio = (mxrio_t*)io;
     const uint8_t* data = _data;
@@ -342,6 +689,14 @@ static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t l
     mxrio_msg_t msg;
     ssize_t xfer;
 
+    if (len > MXIO_CHUNK_SIZE) {
+        uint32_t bulk_op = (op == MXRIO_WRITE_AT) ? MXRIO_WRITE_AT_BULK : MXRIO_WRITE_BULK;
+        if ((count = write_bulk(bulk_op, rio, data, len, offset)) != ERR_NOT_SUPPORTED) {
+            return count;
+        }
+        count = 0;
+    }
+
     while (len > 0) {
         xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
 
@@ -375,13 +730,82 @@ static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t l
 }
 
 static ssize_t mxrio_write(mxio_t* io, const void* _data, size_t len) {
-    return write_common(MXRIO_WRITE, io, _data, len, 0);
+    mxrio_t* rio = (mxrio_t*)io;
+
+    mtx_lock(&rio->pipe_lock);
+    mx_status_t status = pipeline_begin_locked(rio, MXRIO_WRITE, len);
+    ssize_t r = status;
+    if (status > 0) {
+        r = pipeline_write_locked(rio, _data, len);
+    }
+    mtx_unlock(&rio->pipe_lock);
+    if (status != 0) {
+        return r;
+    }
+
+    r = write_common(MXRIO_WRITE, io, _data, len, 0);
+    pipeline_end(rio, MXRIO_WRITE, len, r);
+    return r;
 }
 
 static ssize_t mxrio_write_at(mxio_t* io, const void* _data, size_t len, mx_off_t offset) {
+    mx_status_t r;
+    if ((r = pipeline_sync((mxrio_t*)io, true)) < 0) {
+        return r;
+    }
     return write_common(MXRIO_WRITE_AT, io, _data, len, offset);
 }
 
+static ssize_t read_bulk(uint32_t op, mxrio_t* rio, uint8_t* data, size_t len, off_t offset) {
+    ssize_t count = 0;
+    mx_status_t r = 0;
+    mxrio_msg_t msg;
+    size_t xfer;
+
+    mtx_lock(&rio->bulk_lock);
+    if ((r = bulk_setup_locked(rio)) < 0) {
+        mtx_unlock(&rio->bulk_lock);
+        return r;
+    }
+    while (len > 0) {
+        xfer = (len > MXIO_BULK_SIZE) ? MXIO_BULK_SIZE : len;
+
+        memset(&msg, 0, MXRIO_HDR_SZ);
+        msg.op = op;
+        msg.arg = xfer;
+        if (op == MXRIO_READ_AT_BULK)
+            msg.arg2.off = offset;
+
+        if ((r = mxrio_txn(rio, &msg)) < 0) {
+            break;
+        }
+        discard_handles(msg.handle, msg.hcount);
+
+        if ((size_t)r > xfer) {
+            r = ERR_IO;
+            break;
+        }
+        size_t actual;
+        mx_status_t status;
+        if ((status = mx_vmo_read(rio->bulk_vmo, data, 0, r, &actual)) < 0) {
+            r = status;
+            break;
+        }
+        count += r;
+        data += r;
+        len -= r;
+        if (op == MXRIO_READ_AT_BULK)
+            offset += r;
+
+        // stop at short read
+        if ((size_t)r < xfer) {
+            break;
+        }
+    }
+    mtx_unlock(&rio->bulk_lock);
+    return count ? count : r;
+}
+
 static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off_t offset) {
     mxrio_t* rio = (mxrio_t*)io;
     uint8_t* data = _data;
@@ -390,6 +814,14 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
     mxrio_msg_t msg;
     ssize_t xfer;
 
+    if (len > MXIO_CHUNK_SIZE) {
+        uint32_t bulk_op = (op == MXRIO_READ_AT) ? MXRIO_READ_AT_BULK : MXRIO_READ_BULK;
+        if ((count = read_bulk(bulk_op, rio, data, len, offset)) != ERR_NOT_SUPPORTED) {
+            return count;
+        }
+        count = 0;
+    }
+
     while (len > 0) {
         xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
 
@@ -424,10 +856,29 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
 }
 
 static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
-    return read_common(MXRIO_READ, io, _data, len, 0);
+    mxrio_t* rio = (mxrio_t*)io;
+
+    mtx_lock(&rio->pipe_lock);
+    mx_status_t status = pipeline_begin_locked(rio, MXRIO_READ, len);
+    ssize_t r = status;
+    if (status > 0) {
+        r = pipeline_read_locked(rio, _data, len);
+    }
+    mtx_unlock(&rio->pipe_lock);
+    if (status != 0) {
+        return r;
+    }
+
+    r = read_common(MXRIO_READ, io, _data, len, 0);
+    pipeline_end(rio, MXRIO_READ, len, r);
+    return r;
 }
 
 static ssize_t mxrio_read_at(mxio_t* io, void* _data, size_t len, mx_off_t offset) {
+    mx_status_t r;
+    if ((r = pipeline_sync((mxrio_t*)io, true)) < 0) {
+        return r;
+    }
     return read_common(MXRIO_READ_AT, io, _data, len, offset);
 }
 
@@ -436,6 +887,10 @@ static off_t mxrio_seek(mxio_t* io, off_t offset, int whence) {
     mxrio_msg_t msg;
     mx_status_t r;
 
+    if ((r = pipeline_sync(rio, false)) < 0) {
+        return r;
+    }
+
     memset(&msg, 0, MXRIO_HDR_SZ);
     msg.op = MXRIO_SEEK;
     msg.arg2.off = offset;
@@ -454,16 +909,27 @@ mx_status_t mxrio_close(mxio_t* io) {
     mxrio_msg_t msg;
     mx_status_t r;
 
+    mx_status_t pipe_status = pipeline_sync(rio, true);
+    free(rio->pipe.buf);
+    rio->pipe.buf = NULL;
+
     memset(&msg, 0, MXRIO_HDR_SZ);
     msg.op = MXRIO_CLOSE;
 
     if ((r = mxrio_txn(rio, &msg)) >= 0) {
         discard_handles(msg.handle, msg.hcount);
+        if (pipe_status < 0) {
+            r = pipe_status;
+        }
     }
 
     mx_handle_t h = rio->h;
     rio->h = 0;
     mx_handle_close(h);
+    if (rio->bulk_vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(rio->bulk_vmo);
+        rio->bulk_vmo = MX_HANDLE_INVALID;
+    }
     if (rio->h2 > 0) {
         h = rio->h2;
         rio->h2 = 0;
@@ -619,6 +1085,15 @@ mx_status_t mxio_clone_svcroot(mx_handle_t* handles, uint32_t* types) {
 mx_status_t mxrio_misc(mxio_t* io, uint32_t op, int64_t off,
                        uint32_t maxreply, void* ptr, size_t len) {
     mxrio_t* rio = (mxrio_t*)io;
+    mx_status_t r;
+    if ((r = pipeline_sync(rio, op == MXRIO_SYNC)) < 0) {
+        return r;
+    }
+    return misc_common(rio, op, off, maxreply, ptr, len);
+}
+
+static mx_status_t misc_common(mxrio_t* rio, uint32_t op, int64_t off,
+                               uint32_t maxreply, void* ptr, size_t len) {
     mxrio_msg_t msg;
     mx_status_t r;
 
@@ -849,6 +1324,9 @@ mx_status_t __mxrio_clone(mx_handle_t h, mx_handle_t* handles, uint32_t* types)
 static mx_status_t mxrio_unwrap(mxio_t* io, mx_handle_t* handles, uint32_t* types) {
     mxrio_t* rio = (void*)io;
     mx_status_t r;
+    // replies to requests in flight must not reach the handle's new owner
+    pipeline_sync(rio, false);
+    free(rio->pipe.buf);
     handles[0] = rio->h;
     types[0] = PA_MXIO_REMOTE;
     if (rio->h2 != 0) {
@@ -858,6 +1336,9 @@ static mx_status_t mxrio_unwrap(mxio_t* io, mx_handle_t* handles, uint32_t* type
     } else {
         r = 1;
     }
+    if (rio->bulk_vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(rio->bulk_vmo);
+    }
     free(io);
     return r;
 }
@@ -917,5 +1398,7 @@ mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
     atomic_init(&rio->io.refcount, 1);
     rio->h = h;
     rio->h2 = e;
+    mtx_init(&rio->bulk_lock, mtx_plain);
+    mtx_init(&rio->pipe_lock, mtx_plain);
     return &rio->io;
 }
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <magenta/compiler.h>
+#include <magenta/syscalls/port.h>
 #include <magenta/types.h>
 
 __BEGIN_CDECLS
@@ -17,13 +18,25 @@ struct port_handler {
     mx_status_t (*func)(port_handler_t* ph, mx_signals_t signals, uint32_t evt);
 };
 
+#define PORT_BATCH_MAX 16
+
 typedef struct {
     mx_handle_t handle;
+
+    // Packets received by the last mx_port_wait_many() that
+    // port_dispatch() has not handled yet.
+    uint32_t next;
+    uint32_t count;
+    mx_port_packet_t pkts[PORT_BATCH_MAX];
 } port_t;
 
 // Initialize a port
 mx_status_t port_init(port_t* port);
 
+// Initialize a port with extra mx_port_create() options,
+// such as MX_PORT_OPT_COALESCE.
+mx_status_t port_init_etc(port_t* port, uint32_t options);
+
 // Wait for an event on a handle, as specified by
 // the provided port handler.
 mx_status_t port_wait(port_t* port, port_handler_t* ph);
@@ -35,9 +48,13 @@ mx_status_t port_wait(port_t* port, port_handler_t* ph);
 // If a packet is received, the callback for the port handler
 // is invoked.  If that callback returns NO_ERROR, port_wait()
 // is invoked on that port handler again.
+//
+// Packets are received up to PORT_BATCH_MAX at a time; the ones
+// left over when returning early are handled by the next call.
 mx_status_t port_dispatch(port_t* port, mx_time_t timeout, bool once);
 
-// Cancel pending waits for the handler on this port
+// Cancel pending waits for the handler on this port, including
+// signal packets already received but not yet dispatched.
 mx_status_t port_cancel(port_t* port, port_handler_t* ph);
 
 // Queue an event for the handler on this port
@@ -21,7 +21,13 @@
 #endif
 
 mx_status_t port_init(port_t* port) {
-    mx_status_t r = mx_port_create(MX_PORT_OPT_V2, &port->handle);
+    return port_init_etc(port, 0);
+}
+
+mx_status_t port_init_etc(port_t* port, uint32_t options) {
+    port->next = 0;
+    port->count = 0;
+    mx_status_t r = mx_port_create(MX_PORT_OPT_V2 | options, &port->handle);
     zprintf("port_init(%p) port=%x\n", port, port->handle);
     return r;
 }
@@ -39,6 +45,14 @@ mx_status_t port_cancel(port_t* port, port_handler_t* ph) {
                                    (uint64_t)(uintptr_t)ph);
     zprintf("port_cancel(%p, %p) obj=%x port=%x: r = %d\n",
             port, ph, ph->handle, port->handle, r);
+    // The kernel drops the queued signal packets; drop the ones
+    // already received too. A zero key is never a handler.
+    for (uint32_t n = port->next; n < port->count; n++) {
+        mx_port_packet_t* pkt = &port->pkts[n];
+        if ((pkt->key == (uintptr_t)ph) && (pkt->type != MX_PKT_TYPE_USER)) {
+            pkt->key = 0;
+        }
+    }
     return r;
 }
 
@@ -54,23 +68,34 @@ mx_status_t port_queue(port_t* port, port_handler_t* ph, uint32_t evt) {
 
 mx_status_t port_dispatch(port_t* port, mx_time_t deadline, bool once) {
     for (;;) {
-        mx_port_packet_t pkt;
-        mx_status_t r;
-        if ((r = mx_port_wait(port->handle, deadline, &pkt, 0)) != NO_ERROR) {
-            if (r != ERR_TIMED_OUT) {
-                printf("port_dispatch: port wait failed %d\n", r);
+        if (port->next == port->count) {
+            uint32_t count;
+            mx_status_t r;
+            port->next = 0;
+            port->count = 0;
+            if ((r = mx_port_wait_many(port->handle, deadline, port->pkts,
+                                       PORT_BATCH_MAX, &count)) != NO_ERROR) {
+                if (r != ERR_TIMED_OUT) {
+                    printf("port_dispatch: port wait failed %d\n", r);
+                }
+                return r;
             }
-            return r;
+            port->count = count;
+        }
+        mx_port_packet_t* pkt = &port->pkts[port->next++];
+        if (pkt->key == 0) {
+            // canceled after it was received
+            continue;
         }
-        port_handler_t* ph = (void*) (uintptr_t) pkt.key;
-        if (pkt.type == MX_PKT_TYPE_USER) {
+        port_handler_t* ph = (void*) (uintptr_t) pkt->key;
+        if (pkt->type == MX_PKT_TYPE_USER) {
             zprintf("port_dispatch(%p) port=%x ph=%p func=%p: evt=%x\n",
-                    port, port->handle, ph, ph->func, pkt.user.u32[0]);
-            ph->func(ph, 0, pkt.user.u32[0]);
+                    port, port->handle, ph, ph->func, pkt->user.u32[0]);
+            ph->func(ph, 0, pkt->user.u32[0]);
         } else {
             zprintf("port_dispatch(%p) port=%x ph=%p func=%p: signals=%x\n",
-                    port, port->handle, ph, ph->func, pkt.signal.observed);
-            if (ph->func(ph, pkt.signal.observed, 0) == NO_ERROR) {
+                    port, port->handle, ph, ph->func, pkt->signal.observed);
+            if (ph->func(ph, pkt->signal.observed, 0) == NO_ERROR) {
                 port_wait(port, ph);
             }
         }
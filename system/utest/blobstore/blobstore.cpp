@@ -5,6 +5,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <poll.h>
 #include <stdbool.h>
@@ -1143,6 +1144,64 @@ static bool RootDirectory(void) {
     END_TEST;
 }
 
+static bool LookupBenchmark(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest(512, 1 << 20, ramdisk_path), 0, "Mounting Blobstore");
+
+    constexpr size_t kMaxBlobs = 8192;
+    constexpr size_t kTargets[] = {64, 256, 1024, 4096, kMaxBlobs};
+    constexpr size_t kBlobSize = 64;
+    constexpr size_t kPathLen = sizeof(MOUNT_PATH "/") + merkle::Digest::kLength * 2;
+
+    AllocChecker ac;
+    mxtl::unique_ptr<char[]> paths(new (&ac) char[kMaxBlobs * kPathLen]);
+    ASSERT_TRUE(ac.check(), "");
+
+    // A digest which is never written, to time unsuccessful lookups
+    mxtl::unique_ptr<blob_info_t> missing;
+    ASSERT_TRUE(GenerateBlob(kBlobSize, &missing), "");
+
+    size_t count = 0;
+    for (size_t target : kTargets) {
+        // Grow the store to the target size. Closed blobs are not cached in
+        // memory, so opening them again goes through the on-disk index.
+        for (; count < target; count++) {
+            mxtl::unique_ptr<blob_info_t> info;
+            ASSERT_TRUE(GenerateBlob(kBlobSize, &info), "");
+            int fd;
+            ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                                 info->data.get(), info->size_data, &fd), "");
+            ASSERT_EQ(close(fd), 0, "");
+            strcpy(&paths[count * kPathLen], info->path);
+        }
+
+        mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+        for (size_t i = 0; i < count; i++) {
+            int fd = open(&paths[i * kPathLen], O_RDONLY);
+            ASSERT_GT(fd, 0, "Failed to re-open blob");
+            ASSERT_EQ(close(fd), 0, "");
+        }
+        mx_time_t hit = (mx_time_get(MX_CLOCK_MONOTONIC) - start) / count;
+
+        constexpr size_t kMissIterations = 64;
+        start = mx_time_get(MX_CLOCK_MONOTONIC);
+        for (size_t i = 0; i < kMissIterations; i++) {
+            ASSERT_LT(open(missing->path, O_RDONLY), 0, "Opened a blob which does not exist");
+        }
+        mx_time_t miss = (mx_time_get(MX_CLOCK_MONOTONIC) - start) / kMissIterations;
+
+        unittest_printf("%6zu blobs: open+close %" PRIu64 " ns, missing lookup %" PRIu64 " ns\n",
+                        count, hit, miss);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(unlink(&paths[i * kPathLen]), 0, "");
+    }
+    ASSERT_EQ(EndBlobstoreTest(ramdisk_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(blobstore_tests)
 RUN_TEST_MEDIUM(TestBasic)
 RUN_TEST_MEDIUM(TestMmap)
@@ -1164,6 +1223,7 @@ RUN_TEST_MEDIUM(RootDirectory)
 RUN_TEST_LARGE(CreateUmountRemountLargeMultithreaded)
 RUN_TEST_LARGE(CreateUmountRemountLarge)
 RUN_TEST_LARGE(NoSpace)
+RUN_TEST_LARGE(LookupBenchmark)
 END_TEST_CASE(blobstore_tests)
 
 int main(int argc, char** argv) {
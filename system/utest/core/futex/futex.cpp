@@ -452,6 +452,56 @@ static bool test_futex_misaligned() {
     END_TEST;
 }
 
+static bool test_futex_wait_pi_bad_owner() {
+    BEGIN_TEST;
+    int futex_value = 1;
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+    ASSERT_EQ(mx_futex_wait_pi(&futex_value, futex_value, self, MX_TIME_INFINITE),
+              ERR_INVALID_ARGS, "waiting on a futex we own should fail");
+    ASSERT_EQ(mx_futex_wait_pi(&futex_value, futex_value, MX_HANDLE_INVALID, MX_TIME_INFINITE),
+              ERR_BAD_HANDLE, "waiting with no owner should fail");
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "");
+    ASSERT_EQ(mx_futex_wait_pi(&futex_value, futex_value, event, MX_TIME_INFINITE),
+              ERR_WRONG_TYPE, "the owner must be a thread");
+    ASSERT_EQ(mx_handle_close(event), NO_ERROR, "");
+    END_TEST;
+}
+
+struct PiWaiter {
+    volatile int* futex;
+    mx_handle_t owner;
+};
+
+static int pi_waiter_thread(void* arg) {
+    auto waiter = static_cast<PiWaiter*>(arg);
+    return mx_futex_wait_pi(const_cast<int*>(waiter->futex), 1, waiter->owner,
+                            MX_TIME_INFINITE);
+}
+
+// Test that a futex_wait_pi() waiter is woken by futex_wake_pi() from the
+// owner it lent its priority to.
+static bool test_futex_pi_wakeup() {
+    BEGIN_TEST;
+    volatile int futex_value = 1;
+    PiWaiter waiter = {&futex_value, thrd_get_mx_handle(thrd_current())};
+    thrd_t thread;
+    ASSERT_EQ(thrd_create_with_name(&thread, pi_waiter_thread, &waiter, "pi waiter"),
+              thrd_success, "");
+
+    mx_nanosleep(mx_deadline_after(MX_MSEC(100)));
+
+    // Release the futex.  If the waiter has not blocked yet, it sees the
+    // new value and returns ERR_BAD_STATE instead of waiting forever.
+    futex_value = 0;
+    ASSERT_EQ(mx_futex_wake_pi(const_cast<int*>(&futex_value), 1), NO_ERROR, "");
+
+    int result;
+    ASSERT_EQ(thrd_join(thread, &result), thrd_success, "");
+    ASSERT_TRUE(result == NO_ERROR || result == ERR_BAD_STATE, "unexpected futex_wait_pi status");
+    END_TEST;
+}
+
 static void log(const char* str) {
     uint64_t now = mx_time_get(MX_CLOCK_MONOTONIC);
     unittest_printf("[%08" PRIu64 ".%08" PRIu64 "]: %s",
@@ -544,6 +594,8 @@ RUN_TEST(test_futex_requeue_unqueued_on_timeout);
 RUN_TEST(test_futex_thread_killed);
 RUN_TEST(test_futex_thread_suspended);
 RUN_TEST(test_futex_misaligned);
+RUN_TEST(test_futex_wait_pi_bad_owner);
+RUN_TEST(test_futex_pi_wakeup);
 RUN_TEST(test_event_signaling);
 END_TEST_CASE(futex_tests)
 
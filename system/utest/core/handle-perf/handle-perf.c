@@ -0,0 +1,164 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+#include <unittest/unittest.h>
+
+// These tests measure the throughput of the kernel handle table when many
+// threads create, close and transfer handles at the same time. They check
+// that every operation succeeds and report the achieved rate; they do not
+// fail on slow results.
+
+#define ITERATIONS 10000
+#define MAX_THREADS 16
+
+typedef struct {
+    mx_handle_t event;
+    mx_handle_t channel[2];
+    bool ok;
+} worker_t;
+
+static int create_close_worker(void* arg) {
+    worker_t* worker = arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        mx_handle_t event;
+        if (mx_event_create(0u, &event) != NO_ERROR)
+            return 0;
+        if (mx_handle_close(event) != NO_ERROR)
+            return 0;
+    }
+    worker->ok = true;
+    return 0;
+}
+
+static int duplicate_close_worker(void* arg) {
+    worker_t* worker = arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        mx_handle_t dup;
+        if (mx_handle_duplicate(worker->event, MX_RIGHT_SAME_RIGHTS, &dup) != NO_ERROR)
+            return 0;
+        if (mx_handle_close(dup) != NO_ERROR)
+            return 0;
+    }
+    worker->ok = true;
+    return 0;
+}
+
+// The event's handle value changes on every round trip; |worker->event|
+// tracks it so that it can be closed however the loop ends. If a read
+// fails, the event is left in the channel and goes away with it.
+static int transfer_worker(void* arg) {
+    worker_t* worker = arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (mx_channel_write(worker->channel[0], 0u, NULL, 0u, &worker->event, 1u) != NO_ERROR)
+            return 0;
+        worker->event = MX_HANDLE_INVALID;
+        uint32_t num_bytes = 0u;
+        uint32_t num_handles = 1u;
+        if (mx_channel_read(worker->channel[1], 0u, NULL, &worker->event, 0u, num_handles,
+                            &num_bytes, &num_handles) != NO_ERROR || num_handles != 1u)
+            return 0;
+    }
+    worker->ok = true;
+    return 0;
+}
+
+// Runs |func| on |num_threads| threads and returns the number of operations
+// per second across all of them, or 0 on failure.
+static uint64_t run_workers(thrd_start_t func, uint32_t num_threads) {
+    worker_t workers[MAX_THREADS];
+    thrd_t threads[MAX_THREADS];
+    bool ok = true;
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers[i].event = MX_HANDLE_INVALID;
+        workers[i].channel[0] = MX_HANDLE_INVALID;
+        workers[i].channel[1] = MX_HANDLE_INVALID;
+        workers[i].ok = false;
+    }
+    for (uint32_t i = 0; ok && i < num_threads; i++) {
+        ok = mx_event_create(0u, &workers[i].event) == NO_ERROR &&
+             mx_channel_create(0u, &workers[i].channel[0], &workers[i].channel[1]) == NO_ERROR;
+    }
+
+    // Every thread that was started is joined, even if a later one could
+    // not be, so that no worker outlives the handles it uses.
+    uint32_t started = 0;
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    while (ok && started < num_threads) {
+        ok = thrd_create_with_name(&threads[started], func, &workers[started],
+                                   "handle-perf") == thrd_success;
+        if (ok)
+            started++;
+    }
+    for (uint32_t i = 0; i < started; i++)
+        thrd_join(threads[i], NULL);
+    mx_time_t duration = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        ok = ok && workers[i].ok;
+        if (workers[i].event != MX_HANDLE_INVALID)
+            mx_handle_close(workers[i].event);
+        if (workers[i].channel[0] != MX_HANDLE_INVALID)
+            mx_handle_close(workers[i].channel[0]);
+        if (workers[i].channel[1] != MX_HANDLE_INVALID)
+            mx_handle_close(workers[i].channel[1]);
+    }
+    if (!ok || duration == 0)
+        return 0;
+
+    return ((uint64_t)num_threads * ITERATIONS * MX_SEC(1)) / duration;
+}
+
+static bool run_scaling(const char* name, thrd_start_t func) {
+    uint32_t max_threads = mx_system_get_num_cpus();
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    for (uint32_t n = 1; ; n *= 2) {
+        if (n > max_threads)
+            n = max_threads;
+        uint64_t rate = run_workers(func, n);
+        ASSERT_NEQ(rate, 0u, "worker failed");
+        unittest_printf("%s: %2u threads: %" PRIu64 " ops/sec\n", name, n, rate);
+        if (n == max_threads)
+            break;
+    }
+    return true;
+}
+
+static bool handle_create_close_perf_test(void) {
+    BEGIN_TEST;
+    EXPECT_TRUE(run_scaling("create/close", create_close_worker), "");
+    END_TEST;
+}
+
+static bool handle_duplicate_close_perf_test(void) {
+    BEGIN_TEST;
+    EXPECT_TRUE(run_scaling("duplicate/close", duplicate_close_worker), "");
+    END_TEST;
+}
+
+static bool handle_transfer_perf_test(void) {
+    BEGIN_TEST;
+    EXPECT_TRUE(run_scaling("channel transfer", transfer_worker), "");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(handle_perf_tests)
+RUN_TEST(handle_create_close_perf_test)
+RUN_TEST(handle_duplicate_close_perf_test)
+RUN_TEST(handle_transfer_perf_test)
+END_TEST_CASE(handle_perf_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -542,6 +542,92 @@ static bool threads_event_repeat() {
     return threads_event(MX_WAIT_ASYNC_REPEATING);
 }
 
+static bool wait_many_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t port;
+    EXPECT_EQ(mx_port_create(MX_PORT_OPT_V2, &port), NO_ERROR, "");
+
+    for (uint64_t ix = 0; ix != 5; ++ix) {
+        const mx_port_packet_t in = { ix, MX_PKT_TYPE_USER, 0, { {} } };
+        EXPECT_EQ(mx_port_queue(port, &in, 0u), NO_ERROR, "");
+    }
+
+    mx_port_packet_t out[8] = {};
+    uint32_t actual = 0u;
+
+    EXPECT_EQ(mx_port_wait_many(port, 0ull, out, 0u, &actual), ERR_INVALID_ARGS, "");
+
+    EXPECT_EQ(mx_port_wait_many(port, 0ull, out, 3u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 3u, "");
+    for (uint32_t ix = 0; ix != actual; ++ix) {
+        EXPECT_EQ(out[ix].key, ix, "");
+        EXPECT_EQ(out[ix].type, MX_PKT_TYPE_USER, "");
+    }
+
+    EXPECT_EQ(mx_port_wait_many(port, 0ull, out, countof(out), &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 2u, "");
+    EXPECT_EQ(out[0].key, 3u, "");
+    EXPECT_EQ(out[1].key, 4u, "");
+
+    EXPECT_EQ(mx_port_wait_many(port, mx_deadline_after(MX_USEC(200)),
+                                out, countof(out), &actual), ERR_TIMED_OUT, "");
+
+    EXPECT_EQ(mx_handle_close(port), NO_ERROR, "");
+    END_TEST;
+}
+
+static bool coalesce_event(uint32_t wait_mode) {
+    BEGIN_TEST;
+
+    mx_handle_t port;
+    EXPECT_EQ(mx_port_create(MX_PORT_OPT_COALESCE, &port), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_port_create(MX_PORT_OPT_V2 | MX_PORT_OPT_COALESCE, &port), NO_ERROR, "");
+
+    const uint64_t key0 = 77u;
+    const uint32_t kNumSignals = 3u;
+
+    // One-shot waits coalesce across objects sharing a key, repeating
+    // waits across state changes of the same object.
+    mx_handle_t ev[kNumSignals];
+    for (uint32_t ix = 0; ix != kNumSignals; ++ix) {
+        EXPECT_EQ(mx_event_create(0u, &ev[ix]), NO_ERROR, "");
+        if ((wait_mode == MX_WAIT_ASYNC_ONCE) || (ix == 0)) {
+            EXPECT_EQ(mx_object_wait_async(
+                ev[ix], port, key0, MX_EVENT_SIGNALED, wait_mode), NO_ERROR, "");
+        }
+    }
+
+    for (uint32_t ix = 0; ix != kNumSignals; ++ix) {
+        mx_handle_t target = (wait_mode == MX_WAIT_ASYNC_ONCE) ? ev[ix] : ev[0];
+        EXPECT_EQ(mx_object_signal(target, 0u, MX_EVENT_SIGNALED), NO_ERROR, "");
+        EXPECT_EQ(mx_object_signal(target, MX_EVENT_SIGNALED, 0u), NO_ERROR, "");
+    }
+
+    mx_port_packet_t out[4] = {};
+    uint32_t actual = 0u;
+    EXPECT_EQ(mx_port_wait_many(port, 0ull, out, countof(out), &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(out[0].key, key0, "");
+    EXPECT_EQ(out[0].signal.count, kNumSignals, "");
+    EXPECT_EQ(out[0].signal.observed, MX_EVENT_SIGNALED | MX_SIGNAL_LAST_HANDLE, "");
+
+    EXPECT_EQ(mx_port_wait(port, 0ull, &out[0], 0u), ERR_TIMED_OUT, "");
+
+    EXPECT_EQ(mx_handle_close(port), NO_ERROR, "");
+    for (uint32_t ix = 0; ix != kNumSignals; ++ix)
+        EXPECT_EQ(mx_handle_close(ev[ix]), NO_ERROR, "");
+    END_TEST;
+}
+
+static bool coalesce_event_once() {
+    return coalesce_event(MX_WAIT_ASYNC_ONCE);
+}
+
+static bool coalesce_event_repeat() {
+    return coalesce_event(MX_WAIT_ASYNC_REPEATING);
+}
+
 BEGIN_TEST_CASE(port_tests)
 RUN_TEST(basic_test)
 RUN_TEST(queue_and_close_test)
@@ -562,6 +648,9 @@ RUN_TEST(cancel_event_key_once_after)
 RUN_TEST(cancel_event_key_repeat_after)
 RUN_TEST(threads_event_once)
 RUN_TEST(threads_event_repeat)
+RUN_TEST(wait_many_test)
+RUN_TEST(coalesce_event_once)
+RUN_TEST(coalesce_event_repeat)
 END_TEST_CASE(port_tests)
 
 #ifndef BUILD_COMBINED_TESTS
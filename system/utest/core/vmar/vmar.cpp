@@ -1593,6 +1593,51 @@ bool protect_over_demand_paged_test() {
     END_TEST;
 }
 
+// Verify that committed mappings of large-page size can be placed at a
+// specific address that is not large-page aligned, and are mapped up front.
+bool map_commit_specific_test() {
+    BEGIN_TEST;
+
+    mx_handle_t process;
+    mx_handle_t vmar;
+    mx_handle_t vmo;
+    uintptr_t mapping_addr;
+
+    ASSERT_EQ(mx_process_create(mx_job_default(), kProcessName, sizeof(kProcessName) - 1,
+                                0, &process, &vmar), NO_ERROR, "");
+    mx_info_vmar_t info;
+    ASSERT_EQ(mx_object_get_info(vmar, MX_INFO_VMAR, &info, sizeof(info), NULL, NULL),
+              NO_ERROR, "");
+
+    const size_t mapping_size = 4 * 1024 * 1024;
+    ASSERT_EQ(mx_vmo_create(mapping_size, 0, &vmo), NO_ERROR, "");
+
+    ASSERT_EQ(mx_vmar_map(vmar, PAGE_SIZE, vmo, 0, mapping_size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE |
+                          MX_VM_FLAG_SPECIFIC | MX_VM_FLAG_COMMIT,
+                          &mapping_addr),
+              NO_ERROR, "");
+    EXPECT_EQ(mapping_addr, info.base + PAGE_SIZE, "");
+    EXPECT_TRUE(check_pages_mapped(process, mapping_addr, UINT64_MAX, 64), "");
+    EXPECT_TRUE(check_pages_mapped(process, mapping_addr + mapping_size - 64 * PAGE_SIZE,
+                                   UINT64_MAX, 64), "");
+    EXPECT_EQ(mx_vmar_unmap(vmar, mapping_addr, mapping_size), NO_ERROR, "");
+
+    // Without SPECIFIC the mapping goes wherever it fits.
+    ASSERT_EQ(mx_vmar_map(vmar, 0, vmo, 0, mapping_size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE | MX_VM_FLAG_COMMIT,
+                          &mapping_addr),
+              NO_ERROR, "");
+    EXPECT_TRUE(check_pages_mapped(process, mapping_addr, UINT64_MAX, 64), "");
+    EXPECT_EQ(mx_vmar_unmap(vmar, mapping_addr, mapping_size), NO_ERROR, "");
+
+    EXPECT_EQ(mx_handle_close(vmar), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(process), NO_ERROR, "");
+
+    END_TEST;
+}
+
 }
 
 BEGIN_TEST_CASE(vmar_tests)
@@ -1616,6 +1661,7 @@ RUN_TEST(map_specific_overwrite_test);
 RUN_TEST(protect_split_test);
 RUN_TEST(protect_multiple_test);
 RUN_TEST(protect_over_demand_paged_test);
+RUN_TEST(map_commit_specific_test);
 END_TEST_CASE(vmar_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -190,6 +190,8 @@ bool benchmark_path_walk(void) {
 }
 
 BEGIN_TEST_CASE(basic_benchmarks)
+RUN_TEST_PERFORMANCE((benchmark_write_read<4 * KB, 8192>))
+RUN_TEST_PERFORMANCE((benchmark_write_read<8 * KB, 4096>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 1024>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 2048>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 4096>))
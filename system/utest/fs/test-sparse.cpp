@@ -97,4 +97,6 @@ RUN_FOR_ALL_FILESYSTEMS(sparse_tests,
     RUN_TEST_MEDIUM((test_sparse<kBlockSize * kDirectBlocks + kBlockSize,
                                  kBlockSize * kDirectBlocks + 2 * kBlockSize,
                                  kBlockSize * 32>))
+    // Larger than a single bulk transfer
+    RUN_TEST_MEDIUM((test_sparse<kBlockSize / 2, kBlockSize / 2, kBlockSize * 40 + 100>))
 )
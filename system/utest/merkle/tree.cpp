@@ -47,6 +47,7 @@ size_t gDataLen;
 uint8_t gData[1 << 24];
 size_t gTreeLen;
 uint8_t gTree[1 << 24];
+uint8_t gSerialTree[1 << 20];
 Digest gDigest;
 uint64_t gOffset;
 size_t gLength;
@@ -974,6 +975,116 @@ bool CreateAndVerifyHugePRNGData(void) {
     END_TEST;
 }
 
+bool CreateParallel(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    Digest expected;
+    mx_status_t rc;
+    size_t lengths[] = {0, 1, kNodeSize, kSmall, kLarge, kUnaligned, 1 << 24};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        InitData(lengths[i]);
+        for (size_t j = 0; j < gDataLen; ++j) {
+            gData[j] = static_cast<uint8_t>(rand());
+        }
+        gTreeLen = merkleTree.GetTreeLength(gDataLen);
+        rc = merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &expected);
+        ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        ASSERT_LE(gTreeLen, sizeof(gSerialTree), "Tree too large");
+        memcpy(gSerialTree, gTree, gTreeLen);
+        for (size_t n = 1; n <= Tree::kMaxThreads; n <<= 1) {
+            memset(gTree, 0, gTreeLen);
+            rc = merkleTree.CreateParallel(gData, gDataLen, gTree, gTreeLen,
+                                           &gDigest, n);
+            ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+            ASSERT_TRUE(gDigest == expected, "Incorrect root digest");
+            ASSERT_EQ(memcmp(gTree, gSerialTree, gTreeLen), 0,
+                      "Parallel tree differs from serial tree");
+        }
+    }
+    END_TEST;
+}
+
+bool VerifyParallel(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    auto& data_failures = merkleTree.data_failures();
+    auto& tree_failures = merkleTree.tree_failures();
+    InitData(kUnaligned * 4);
+    for (size_t i = 0; i < gDataLen; ++i) {
+        gData[i] = static_cast<uint8_t>(rand());
+    }
+    gTreeLen = merkleTree.GetTreeLength(gDataLen);
+    mx_status_t rc =
+        merkleTree.CreateParallel(gData, gDataLen, gTree, gTreeLen, &gDigest, 4);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    rc = merkleTree.VerifyParallel(gData, gDataLen, gTree, gTreeLen, 0,
+                                   gDataLen, gDigest, 4);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    // Corrupt several leaves; the parallel pass must report the same failures,
+    // in the same order, as the serial one.
+    gData[kNodeSize] ^= 1;
+    gData[kLarge + 3] ^= 1;
+    gData[gDataLen - 1] ^= 1;
+    rc = merkleTree.Verify(gData, gDataLen, gTree, gTreeLen, 0, gDataLen,
+                           gDigest);
+    ASSERT_EQ(rc, ERR_IO_DATA_INTEGRITY, mx_status_get_string(rc));
+    size_t num_failures = data_failures.size();
+    uint64_t failures[3];
+    ASSERT_EQ(num_failures, 3, "Wrong number of data_failures");
+    for (size_t i = 0; i < num_failures; ++i) {
+        failures[i] = data_failures[i];
+    }
+    for (size_t n = 2; n <= Tree::kMaxThreads; n <<= 1) {
+        rc = merkleTree.VerifyParallel(gData, gDataLen, gTree, gTreeLen, 0,
+                                       gDataLen, gDigest, n);
+        ASSERT_EQ(rc, ERR_IO_DATA_INTEGRITY, mx_status_get_string(rc));
+        ASSERT_EQ(data_failures.size(), num_failures,
+                  "Wrong number of data_failures");
+        for (size_t i = 0; i < num_failures; ++i) {
+            ASSERT_EQ(data_failures[i], failures[i],
+                      "Wrong offset for data_failure");
+        }
+        ASSERT_EQ(tree_failures.size(), 0, "Wrong number of tree_failures");
+    }
+    END_TEST;
+}
+
+bool VerifyParallelOffset(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    auto& data_failures = merkleTree.data_failures();
+    InitData(kUnaligned * 4);
+    for (size_t i = 0; i < gDataLen; ++i) {
+        gData[i] = static_cast<uint8_t>(rand());
+    }
+    gTreeLen = merkleTree.GetTreeLength(gDataLen);
+    mx_status_t rc =
+        merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    // Verify a range which starts partway into the data, aligned or not.
+    uint64_t offsets[] = {kNodeSize * 3, kNodeSize * 3 + 1};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        for (size_t n = 2; n <= Tree::kMaxThreads; n <<= 1) {
+            rc = merkleTree.VerifyParallel(gData, gDataLen, gTree, gTreeLen,
+                                           offsets[i], kNodeSize * 4, gDigest,
+                                           n);
+            ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        }
+    }
+    // A corrupted leaf within the range is reported at its own offset.
+    gData[kNodeSize * 5] ^= 1;
+    for (size_t n = 2; n <= Tree::kMaxThreads; n <<= 1) {
+        rc = merkleTree.VerifyParallel(gData, gDataLen, gTree, gTreeLen,
+                                       kNodeSize * 3, kNodeSize * 4, gDigest,
+                                       n);
+        ASSERT_EQ(rc, ERR_IO_DATA_INTEGRITY, mx_status_get_string(rc));
+        ASSERT_EQ(data_failures.size(), 1, "Wrong number of data_failures");
+        ASSERT_EQ(data_failures[0], kNodeSize * 5,
+                  "Wrong offset for data_failure");
+    }
+    END_TEST;
+}
+
 } // namespace
 
 BEGIN_TEST_CASE(MerkleTreeTests)
@@ -1032,4 +1143,7 @@ RUN_TEST(VerifyBadTree)
 RUN_TEST(VerifyGoodPartOfBadLeaves)
 RUN_TEST(VerifyBadLeaves)
 RUN_TEST(CreateAndVerifyHugePRNGData)
+RUN_TEST(CreateParallel)
+RUN_TEST(VerifyParallel)
+RUN_TEST(VerifyParallelOffset)
 END_TEST_CASE(MerkleTreeTests)
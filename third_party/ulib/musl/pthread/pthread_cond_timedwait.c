@@ -56,7 +56,7 @@ int pthread_cond_timedwait(pthread_cond_t* restrict c, pthread_mutex_t* restrict
                            const struct timespec* restrict ts) {
     int e, clock = c->_c_clock, oldstate, tmp;
 
-    if ((m->_m_type != PTHREAD_MUTEX_NORMAL) &&
+    if (!__pthread_mutex_is_normal(m) &&
         (m->_m_lock & PTHREAD_MUTEX_OWNED_LOCK_MASK) != __thread_get_tid())
         return EPERM;
 
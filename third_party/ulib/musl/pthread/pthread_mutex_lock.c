@@ -1,7 +1,7 @@
 #include "pthread_impl.h"
 
 int pthread_mutex_lock(pthread_mutex_t* m) {
-    if ((m->_m_type & PTHREAD_MUTEX_MASK) == PTHREAD_MUTEX_NORMAL &&
+    if (__pthread_mutex_is_normal(m) &&
         !a_cas_shim(&m->_m_lock, 0, EBUSY))
         return 0;
 
@@ -7,14 +7,20 @@ int pthread_mutex_unlock(pthread_mutex_t* m) {
     int cont;
     int type = m->_m_type & PTHREAD_MUTEX_MASK;
 
-    if (type != PTHREAD_MUTEX_NORMAL) {
+    if (!__pthread_mutex_is_normal(m)) {
         if ((atomic_load(&m->_m_lock) & PTHREAD_MUTEX_OWNED_LOCK_MASK) != __thread_get_tid())
             return EPERM;
         if ((type & PTHREAD_MUTEX_MASK) == PTHREAD_MUTEX_RECURSIVE && m->_m_count)
             return m->_m_count--, 0;
     }
     cont = atomic_exchange(&m->_m_lock, 0);
-    if (waiters || cont < 0)
-        __wake(&m->_m_lock, 1);
+    if (waiters || cont < 0) {
+        // A waiter that lent us its priority set the contended bit before
+        // blocking, so uncontended unlocks have nothing to give back.
+        if (m->_m_type & PTHREAD_MUTEX_PRIO_INHERIT_BIT)
+            _mx_futex_wake_pi(&m->_m_lock, 1);
+        else
+            __wake(&m->_m_lock, 1);
+    }
     return 0;
 }
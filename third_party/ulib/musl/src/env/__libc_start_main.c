@@ -75,6 +75,10 @@ __NO_SAFESTACK _Noreturn void __libc_start_main(
     // out the zeroing as dead stores.
     __asm__("# keepalive %0" :: "m"(randoms));
 
+#ifdef __x86_64__
+    __x86_64_memops_init();
+#endif
+
     // extract process startup information from channel in arg
     mx_handle_t bootstrap = (uintptr_t)arg;
 
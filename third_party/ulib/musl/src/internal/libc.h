@@ -44,6 +44,11 @@ extern char *__progname, *__progname_full;
 
 void __libc_start_init(void) ATTR_LIBC_VISIBILITY;
 
+#ifdef __x86_64__
+// Picks the memcpy and memset strategies for this cpu.
+void __x86_64_memops_init(void) ATTR_LIBC_VISIBILITY;
+#endif
+
 void __funcs_on_exit(void) ATTR_LIBC_VISIBILITY;
 void __funcs_on_quick_exit(void) ATTR_LIBC_VISIBILITY;
 void __libc_exit_fini(void) ATTR_LIBC_VISIBILITY;
@@ -122,10 +122,20 @@ static inline struct pthread* tp_to_pthread(void* tp) {
 #define SIGTIMER_SET ((sigset_t*)(const unsigned long[_NSIG / 8 / sizeof(long)]){0x80000000})
 
 #define PTHREAD_MUTEX_MASK (PTHREAD_MUTEX_RECURSIVE | PTHREAD_MUTEX_ERRORCHECK)
-// The bit used in the recursive and errorchecking cases, which track thread owners.
+// Set in the mutex type for PTHREAD_PRIO_INHERIT mutexes, which always track
+// their owner, so that waiters can lend it their priority.
+#define PTHREAD_MUTEX_PRIO_INHERIT_BIT 4
+// The bit used in the recursive, errorchecking and priority inheriting cases,
+// which track thread owners.
 #define PTHREAD_MUTEX_OWNED_LOCK_BIT 0x80000000
 #define PTHREAD_MUTEX_OWNED_LOCK_MASK 0x7fffffff
 
+// Whether the mutex lock word is the anonymous EBUSY rather than an owner.
+static inline int __pthread_mutex_is_normal(const pthread_mutex_t* m) {
+    return (m->_m_type & (PTHREAD_MUTEX_MASK | PTHREAD_MUTEX_PRIO_INHERIT_BIT)) ==
+           PTHREAD_MUTEX_NORMAL;
+}
+
 extern void* __pthread_tsd_main[];
 extern volatile size_t __pthread_tsd_size;
 
@@ -153,6 +163,9 @@ int __libc_sigprocmask(int, const sigset_t*, sigset_t*);
 // This is guaranteed to only return 0, EINVAL, or ETIMEDOUT.
 int __timedwait(atomic_int*, int, clockid_t, const struct timespec*)
     ATTR_LIBC_VISIBILITY;
+// As __timedwait, lending the caller's priority to the thread |owner|.
+int __timedwait_pi(atomic_int*, int, mx_handle_t owner, clockid_t, const struct timespec*)
+    ATTR_LIBC_VISIBILITY;
 
 // Loading a library can introduce more thread_local variables. Thread
 // allocation bases bookkeeping decisions based on the current state
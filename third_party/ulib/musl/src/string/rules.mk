@@ -78,6 +78,7 @@ else ifeq ($(SUBARCH),x86-64)
 LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/x86_64/memcpy.S \
     $(GET_LOCAL_DIR)/x86_64/memmove.S \
+    $(GET_LOCAL_DIR)/x86_64/memops.c \
     $(GET_LOCAL_DIR)/x86_64/mempcpy.S \
     $(GET_LOCAL_DIR)/x86_64/memset.S \
 
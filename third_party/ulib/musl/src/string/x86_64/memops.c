@@ -0,0 +1,24 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "memops.h"
+#include "libc.h"
+
+#include <cpuid.h>
+#include <stdint.h>
+
+bool __x86_64_memops_erms;
+size_t __x86_64_memops_nt_threshold = SIZE_MAX;
+
+void __x86_64_memops_init(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    // rep movsb is only the fastest medium sized copy when the cpu
+    // advertises enhanced rep movsb/stosb (leaf 7, ebx bit 9).
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        __x86_64_memops_erms = (ebx >> 9) & 1;
+    }
+    __x86_64_memops_nt_threshold = X86_64_MEMOPS_NT_THRESHOLD;
+}
@@ -0,0 +1,34 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <magenta/x86_64_memops.h>
+
+#ifndef __ASSEMBLER__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Tuning for memcpy, mempcpy and memset, chosen from cpuid by
+// __x86_64_memops_init() at startup.  Until then (for instance, while the
+// dynamic linker relocates itself) the copies use only baseline instructions.
+extern bool __x86_64_memops_erms __attribute__((visibility("hidden")));
+extern size_t __x86_64_memops_nt_threshold __attribute__((visibility("hidden")));
+
+#else // __ASSEMBLER__
+
+.hidden __x86_64_memops_erms
+.hidden __x86_64_memops_nt_threshold
+
+// See <magenta/x86_64_memops.h>.
+.macro memcpy_body
+    x86_64_memcpy_body __x86_64_memops_erms, __x86_64_memops_nt_threshold
+.endm
+
+.macro memset_body
+    x86_64_memset_body __x86_64_memops_erms, __x86_64_memops_nt_threshold
+.endm
+
+#endif // __ASSEMBLER__